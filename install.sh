@@ -1,10 +1,11 @@
 # TODO: Allow for local install.sh rather than just a root one.
 
 name="pipit"
-flags="-march=native -g"
+flags="-march=native -g -pthread"
 
 src=$([[ $(echo $(basename $(pwd))) == $name ]] && echo "src" || echo "src/$name")
 
 cd $src
 # I would like for this to not use ripgrep, but it's very convenient here.
-clang $flags -o ../bin/$name $(find -name "*.c" | rg -o "[\w\d_-]+\.c$")
+# Test harnesses have their own main and are built separately, see the top of each test_*.c.
+clang $flags -o ../bin/$name $(find -name "*.c" | rg -o "[\w\d_-]+\.c$" | rg -v "^test_")
@@ -0,0 +1,53 @@
+#include <sys/mman.h>
+#include "arena.h"
+
+int arena_init(struct Arena* arena)
+{
+    arena->base = mmap(NULL, ARENA_RESERVE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    arena->used = 0;
+    arena->peak = 0;
+    if (arena->base == MAP_FAILED)
+    {
+        arena->base = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+void* arena_alloc(struct Arena* arena, size_t size)
+{
+    size_t at = (arena->used + 15) & ~(size_t)15;
+    if (arena->base == NULL || size > ARENA_RESERVE - at)
+        return NULL;
+
+    arena->used = at + size;
+    arena->peak = arena->used > arena->peak ? arena->used : arena->peak;
+    return arena->base + at;
+}
+
+void arena_rewind(struct Arena* arena, size_t mark)
+{
+    if (mark < arena->used)
+        arena->used = mark;
+}
+
+void arena_reset(struct Arena* arena)
+{
+    // A frame which needed far more than usual shouldn't keep its pages forever, the rest stay warm for the next one.
+    if (arena->peak > ARENA_KEEP)
+        madvise(arena->base + ARENA_KEEP, arena->peak - ARENA_KEEP, MADV_DONTNEED);
+
+    arena->used = 0;
+    arena->peak = 0;
+}
+
+void arena_free(struct Arena* arena)
+{
+    if (arena->base != NULL)
+        munmap(arena->base, ARENA_RESERVE);
+
+    arena->base = NULL;
+    arena->used = 0;
+    arena->peak = 0;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+// Address space reserved for an arena, pages are only backed once they're touched.
+#define ARENA_RESERVE ((size_t)64 << 20)
+// Bytes kept backed across resets, anything a frame touched past this is given back to the OS.
+#define ARENA_KEEP ((size_t)1 << 20)
+
+/// @brief A bump allocator over a single reserved mapping, everything allocated from it is released at once by
+/// arena_reset. Meant for temporaries which don't outlive a frame.
+struct Arena
+{
+    char* base;
+    size_t used;
+    /// @brief Highest used since the last reset.
+    size_t peak;
+};
+
+/// @brief Reserves the address space of an arena.
+/// @param arena The arena to be initialized.
+/// @return 0 if successful, otherwise -1.
+int arena_init(struct Arena* arena);
+
+/// @brief Allocates from an arena, never touching the heap.
+/// @param arena The arena.
+/// @param size The number of bytes to allocate.
+/// @return Pointer to the block, 16 byte aligned and valid until the next reset, or NULL if the arena is exhausted.
+void* arena_alloc(struct Arena* arena, size_t size);
+
+/// @brief Releases everything allocated from an arena since used was mark, for temporaries of a single step of a frame.
+/// @param arena The arena.
+/// @param mark The arena's used before the allocations to be released.
+void arena_rewind(struct Arena* arena, size_t mark);
+
+/// @brief Releases everything allocated from an arena.
+void arena_reset(struct Arena* arena);
+
+/// @brief Unmaps an arena.
+void arena_free(struct Arena* arena);
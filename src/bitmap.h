@@ -1,65 +1,142 @@
+#pragma once
+
 #include <emmintrin.h>
 #include <immintrin.h>
 #include <smmintrin.h>
+#include <stdint.h>
 #include <stdio.h>
 
-// TODO: Refactor & documentation.
-// TODO: Bulk processing & utility functions.
+// Bit n of a cluster is bit n % 64 of 64-bit lane n / 64, so shard n of a cluster is simply bit n.
+// A set bit means the shard is free, runs of set bits are therefore runs of free shards.
+//
 // TODO: I have a hunch AVX-512 lzcnt should be substantially faster.
 
-static inline __m256i bmp_shr1(__m256i bmp)
-{
-    __m256i carry = _mm256_set1_epi16(0b0000000100000001);
-    carry = _mm256_and_si256(carry, bmp);
-    carry = _mm256_slli_epi16(carry, 7);
-    __m128i hi = _mm256_extracti128_si256(carry, 1);
-    hi = _mm_slli_si128(hi, 1);
-    __m128i lo = _mm256_castsi256_si128(carry);
-    hi = _mm_insert_epi8(hi, _mm_extract_epi8(lo, 15), 0);
-    lo = _mm_slli_si128(lo, 1);
-    carry = _mm256_set_m128i(hi, lo);
-    // TODO: I have no idea how this works or if it does, frankly.
-    __m256i shifted = _mm256_srli_epi16(bmp, 1);                  // shift each 16-bit lane
-    __m256i mask    = _mm256_set1_epi16(0x7F7F);                  // 0x7F per byte
-    bmp = _mm256_and_si256(shifted, mask);                        // keep only the 7 LSB of each byte
-    bmp = _mm256_or_si256(bmp, carry);
-    return bmp;
+/// @brief Generates a 256-bit bitmap with only the first n bits set.
+/// @param n The number of bits to set, clamped to 0..256.
+/// @return The generated 256-bit bitmap.
+static inline __m256i _bmp_prefix(int n)
+{
+    // Each 64-bit lane gets clamp(n - base, 0, 64) bits, the high dwords stay zero throughout
+    // so it's safe to do the clamping with 32-bit arithmetic.
+    __m256i cnt = _mm256_sub_epi32(_mm256_set1_epi64x(n < 0 ? 0 : n), _mm256_setr_epi64x(0, 64, 128, 192));
+    cnt = _mm256_max_epi32(cnt, _mm256_setzero_si256());
+    cnt = _mm256_min_epi32(cnt, _mm256_set1_epi64x(64));
+    // Shifting by 64 or more zeroes the lane, which is exactly what an empty lane should be.
+    return _mm256_srlv_epi64(_mm256_set1_epi64x(-1), _mm256_sub_epi64(_mm256_set1_epi64x(64), cnt));
 }
 
-// TODO: I think it could possibly be more efficient to do something else?
-static inline __m256i bmp_shl1(__m256i bmp)
-{
-    __m256i carry = _mm256_set1_epi16(0b1000000010000000);
-    carry = _mm256_and_si256(carry, bmp);
-    carry = _mm256_srli_epi16(carry, 7);
-    __m128i lo = _mm256_castsi256_si128(carry);
-    lo = _mm_srli_si128(lo, 1);
-    __m128i hi = _mm256_extracti128_si256(carry, 1);
-    lo = _mm_insert_epi8(lo, _mm_extract_epi8(hi, 0), 15);
-    hi = _mm_srli_si128(hi, 1);
-    carry = _mm256_set_m128i(hi, lo);
-    // Shift each bit by 1 left per byte and then OR the 2 for the carry.
-    bmp = _mm256_add_epi8(bmp, bmp);
-    bmp = _mm256_or_si256(bmp, carry);
-    return bmp;
+/// @brief Shifts a 256-bit bitmap towards higher bit indices.
+/// @param bmp The 256-bit bitmap to be shifted.
+/// @param n The number of bits to shift by.
+/// @return The shifted 256-bit bitmap, vacated bits are zero.
+static inline __m256i bmp_shl(__m256i bmp, int n)
+{
+    if (n >= 256)
+        return _mm256_setzero_si256();
+
+    // Lanes are moved whole first, lane k takes lane k - q and the carry comes from lane k - q - 1.
+    __m256i idx = _mm256_sub_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((n >> 6) * 2));
+    __m256i lo = _mm256_permutevar8x32_epi32(bmp, idx);
+    lo = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), idx), lo);
+
+    idx = _mm256_sub_epi32(idx, _mm256_set1_epi32(2));
+    __m256i hi = _mm256_permutevar8x32_epi32(bmp, idx);
+    hi = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), idx), hi);
+
+    // When n is lane aligned the carry shift is 64, which zeroes it.
+    lo = _mm256_sll_epi64(lo, _mm_cvtsi32_si128(n & 63));
+    hi = _mm256_srl_epi64(hi, _mm_cvtsi32_si128(64 - (n & 63)));
+    return _mm256_or_si256(lo, hi);
+}
+
+/// @brief Shifts a 256-bit bitmap towards lower bit indices.
+/// @param bmp The 256-bit bitmap to be shifted.
+/// @param n The number of bits to shift by.
+/// @return The shifted 256-bit bitmap, vacated bits are zero.
+static inline __m256i bmp_shr(__m256i bmp, int n)
+{
+    if (n >= 256)
+        return _mm256_setzero_si256();
+
+    // Mirror of bmp_shl, lane k takes lane k + q and the carry comes from lane k + q + 1.
+    __m256i idx = _mm256_add_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32((n >> 6) * 2));
+    __m256i lo = _mm256_permutevar8x32_epi32(bmp, idx);
+    lo = _mm256_andnot_si256(_mm256_cmpgt_epi32(idx, _mm256_set1_epi32(7)), lo);
+
+    idx = _mm256_add_epi32(idx, _mm256_set1_epi32(2));
+    __m256i hi = _mm256_permutevar8x32_epi32(bmp, idx);
+    hi = _mm256_andnot_si256(_mm256_cmpgt_epi32(idx, _mm256_set1_epi32(7)), hi);
+
+    lo = _mm256_srl_epi64(lo, _mm_cvtsi32_si128(n & 63));
+    hi = _mm256_sll_epi64(hi, _mm_cvtsi32_si128(64 - (n & 63)));
+    return _mm256_or_si256(lo, hi);
+}
+
+/// @brief Finds the lowest set bit in a 256-bit bitmap.
+/// @param bmp The 256-bit bitmap to be searched.
+/// @return The index of the lowest set bit, or -1 if no bits are set.
+static inline int bmp_ffs(__m256i bmp)
+{
+    // 8 mask bits per 64-bit lane, inverted so that only lanes with something in them are set.
+    int mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi64(bmp, _mm256_setzero_si256()));
+    if (mask == 0)
+        return -1;
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, bmp);
+    int lane = __builtin_ctz(mask) >> 3;
+    return (lane << 6) + __builtin_ctzll(lanes[lane]);
+}
+
+/// @brief Finds the highest set bit in a 256-bit bitmap.
+/// @param bmp The 256-bit bitmap to be searched.
+/// @return The index of the highest set bit, or -1 if no bits are set.
+static inline int bmp_fls(__m256i bmp)
+{
+    int mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi64(bmp, _mm256_setzero_si256()));
+    if (mask == 0)
+        return -1;
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, bmp);
+    int lane = (31 - __builtin_clz(mask)) >> 3;
+    return (lane << 6) + 63 - __builtin_clzll(lanes[lane]);
+}
+
+/// @brief Counts the number of set bits in a 256-bit bitmap.
+/// @param bmp The 256-bit bitmap to be counted.
+/// @return The number of set bits.
+static inline int bmp_popcount(__m256i bmp)
+{
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, bmp);
+    return __builtin_popcountll(lanes[0]) + __builtin_popcountll(lanes[1])
+        + __builtin_popcountll(lanes[2]) + __builtin_popcountll(lanes[3]);
 }
 
 /// @brief Condenses a 256-bit bitmap to reduce to len number successive bit patterns.
-/// In effect, this means that the only bits set were preceded by len number bits.
+/// In effect, this means that the only bits set were followed by len - 1 more set bits.
 /// @param bmp The 256-bit bitmap to be condensed.
 /// @param len The length of the bit pattern.
 /// @return The provided 256-bit bitmap bmp condensed to len bit patterns.
 static inline __m256i bmp_condense(__m256i bmp, int len)
 {
-    // This is really quite simple but ends up being very convoluted,
-    // in theory this is:
+    // Naively this is:
     //
-    // for (int i = 0; i < len; i++)
-    //     x &= x << 1;
+    // for (int i = 1; i < len; i++)
+    //     x &= x >> 1;
     //
-    // Where bits are condensed bitwise into pairs of num.
-    while (--len > 0)
-        bmp = _mm256_and_si256(bmp, bmp_shl1(bmp));
+    // But after every step each set bit already vouches for span bits, so the shift can double
+    // every time and we only need log2(len) steps, with one last step to cover the remainder.
+    int span = 1;
+    while (span * 2 <= len)
+    {
+        bmp = _mm256_and_si256(bmp, bmp_shr(bmp, span));
+        span *= 2;
+    }
+
+    if (span < len)
+        bmp = _mm256_and_si256(bmp, bmp_shr(bmp, len - span));
     return bmp;
 }
 
@@ -69,19 +146,20 @@ static inline __m256i bmp_condense(__m256i bmp, int len)
 /// @return The newly generated 256-bit bitmap with len bits at pos.
 static inline __m256i bmp_expand(int pos, int len)
 {
-    __m256i bmp = _mm256_set_epi8(
-        1, 0, 0, 0, 0, 0, 0,
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-        0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
-        0, 0, 0, 0, 0
-    );
+    return _mm256_andnot_si256(_bmp_prefix(pos), _bmp_prefix(pos + len));
+}
 
-    while (--len > 0)
-        bmp = _mm256_or_si256(bmp, bmp_shr1(bmp));
+/// @brief Checks if every bit of a pattern is set in the given bitmap.
+/// @param bmp The 256-bit bitmap to be checked.
+/// @param pos The initial bit position.
+/// @param len The length of the bit pattern.
+/// @return Truthy if all len bits at pos are set, otherwise 0.
+static inline int bmp_test(__m256i bmp, int pos, int len)
+{
+    if (pos < 0 || pos + len > 256)
+        return 0;
 
-    while (--pos > 0)
-        bmp = bmp_shr1(bmp);
-    return bmp;
+    return _mm256_testc_si256(bmp, bmp_expand(pos, len));
 }
 
 /// @brief Searches for the first successive set bit pattern of len in the given bitmap.
@@ -90,44 +168,185 @@ static inline __m256i bmp_expand(int pos, int len)
 /// @return The index of the first set bit in the pattern, or -1 if not found.
 static inline int bmp_decode(__m256i bmp, int len)
 {
-    bmp = bmp_condense(bmp, len);
-
-    int mask = _mm256_cmpneq_epi8_mask(bmp, _mm256_setzero_si256());
-    if (mask == 0)
-        return -1;
-    else if (mask & 0b11110000)
-        bmp = _mm256_permute4x64_epi64(bmp, 0b01001110);
-
-    mask = __builtin_ctz(mask);
-    bmp = _mm256_shuffle_epi8(bmp, _mm256_set1_epi8(15 - (mask % 16)));
-    return __builtin_ctz(_mm256_extract_epi8(bmp, 0)) + (mask << 3);
+    return bmp_ffs(bmp_condense(bmp, len));
 }
 
-/// @brief Searches for the first successive set bit pattern of len in the given bitmap.
+/// @brief Searches for the smallest run of set bits which can fit a pattern of len.
 /// @param bmp The 256-bit bitmap to be searched.
 /// @param len The length of successive bits to match for.
-/// @return The index of the first set bit in the pattern, or -1 if not found.
-static inline int bmp_recode(__m256i* ptr, int len)
+/// @return The index of the first set bit in the best fitting run, or -1 if not found.
+static inline int bmp_best(__m256i bmp, int len)
 {
-    __m256i bmp = *ptr;
-    bmp = bmp_condense(bmp, len);
+    // Only run starts (set bits with an unset bit before them) which are long enough are candidates.
+    __m256i cand = _mm256_and_si256(bmp_condense(bmp, len), _mm256_andnot_si256(bmp_shl(bmp, 1), bmp));
+    int best = -1;
+    int bestLen = 257;
+    int pos;
 
-    int mask = _mm256_cmpneq_epi8_mask(bmp, _mm256_setzero_si256());
-    if (mask == 0)
-        return -1;
-    else if (mask & 0b11110000)
-        bmp = _mm256_permute4x64_epi64(bmp, 0b01001110);
+    while ((pos = bmp_ffs(cand)) != -1)
+    {
+        // The run ends at the first unset bit after its start, or at the end of the bitmap.
+        int end = bmp_ffs(_mm256_andnot_si256(_mm256_or_si256(bmp, _bmp_prefix(pos)), _mm256_set1_epi8(-1)));
+        end = end == -1 ? 256 : end;
+
+        if (end - pos < bestLen)
+        {
+            best = pos;
+            bestLen = end - pos;
+            if (bestLen == len)
+                break;
+        }
 
-    mask = __builtin_ctz(mask);
-    bmp = _mm256_shuffle_epi8(bmp, _mm256_set1_epi8(15 - (mask % 16)));
-    // This is the index of the first set bit in the pattern.
-    mask = __builtin_ctz(_mm256_extract_epi8(bmp, 0)) + (mask << 3);
+        cand = _mm256_andnot_si256(_bmp_prefix(end), cand);
+    }
 
-    *ptr = _mm256_andnot_si256(bmp_expand(mask, len), *ptr);
-    return mask;
+    return best;
 }
 
+/// @brief Finds the length of the longest run of set bits in the given bitmap.
+/// @param bmp The 256-bit bitmap to be searched.
+/// @param max The longest run worth telling apart, longer runs are reported as max, 256 for no limit.
+/// @return The length of the longest run clamped to max, 0 if no bits are set.
+static inline int bmp_longest(__m256i bmp, int max)
+{
+    // A run of len existing implies a run of every shorter length, so this can be binary searched.
+    int lo = 0;
+    int hi = max;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) >> 1;
+        if (_mm256_testz_si256(bmp_condense(bmp, mid), bmp_condense(bmp, mid)))
+            hi = mid - 1;
+        else
+            lo = mid;
+    }
+    return lo;
+}
+
+/// @brief Sets len bits at pos in the given bitmap.
+/// @param ptr Pointer to the 256-bit bitmap to be modified.
+/// @param pos The initial bit position.
+/// @param len The length of the bit pattern.
 static inline void bmp_set(__m256i* ptr, int pos, int len)
 {
     *ptr = _mm256_or_si256(*ptr, bmp_expand(pos, len));
 }
+
+/// @brief Clears len bits at pos in the given bitmap.
+/// @param ptr Pointer to the 256-bit bitmap to be modified.
+/// @param pos The initial bit position.
+/// @param len The length of the bit pattern.
+static inline void bmp_clear(__m256i* ptr, int pos, int len)
+{
+    *ptr = _mm256_andnot_si256(bmp_expand(pos, len), *ptr);
+}
+
+// Bulk processing over arrays of clusters.
+//
+// A summary is an array of (num + 255) / 256 bitmaps where bit i is set if cluster i has at least
+// one set bit, it lets searches jump straight over full clusters instead of condensing each of them.
+
+/// @brief Updates the summary bit of a single cluster, this should be called after any modification.
+/// @param summary The summary bitmaps of the cluster array.
+/// @param idx The index of the cluster which was modified.
+/// @param bmp The current state of the cluster.
+static inline void bmps_mark(__m256i* summary, int idx, __m256i bmp)
+{
+    if (_mm256_testz_si256(bmp, bmp))
+        bmp_clear(summary + (idx >> 8), idx & 255, 1);
+    else
+        bmp_set(summary + (idx >> 8), idx & 255, 1);
+}
+
+/// @brief Builds the summary of an array of clusters from scratch.
+/// @param bmps The cluster array to be summarized.
+/// @param num The number of clusters in bmps.
+/// @param summary The summary bitmaps to be written, must fit (num + 255) / 256 bitmaps.
+static inline void bmps_summarize(const __m256i* bmps, int num, __m256i* summary)
+{
+    for (int i = 0; i < (num + 255) >> 8; i++)
+        summary[i] = _mm256_setzero_si256();
+
+    for (int i = 0; i < num; i++)
+        bmps_mark(summary, i, bmps[i]);
+}
+
+/// @brief Counts the number of set bits across an array of clusters.
+/// @param bmps The cluster array to be counted.
+/// @param num The number of clusters in bmps.
+/// @return The number of set bits.
+static inline int bmps_popcount(const __m256i* bmps, int num)
+{
+    int count = 0;
+    for (int i = 0; i < num; i++)
+        count += bmp_popcount(bmps[i]);
+    return count;
+}
+
+/// @brief Searches an array of clusters for the first cluster which can fit a pattern of len.
+/// @param bmps The cluster array to be searched.
+/// @param summary The summary bitmaps of bmps.
+/// @param num The number of clusters in bmps.
+/// @param len The length of successive bits to match for.
+/// @return The bit index (cluster * 256 + bit) of the pattern, or -1 if not found.
+static inline int bmps_first(const __m256i* bmps, const __m256i* summary, int num, int len)
+{
+    for (int i = 0; i < (num + 255) >> 8; i++)
+    {
+        __m256i cand = summary[i];
+        int idx;
+
+        while ((idx = bmp_ffs(cand)) != -1)
+        {
+            int pos = bmp_decode(bmps[(i << 8) + idx], len);
+            if (pos != -1)
+                return (((i << 8) + idx) << 8) + pos;
+
+            bmp_clear(&cand, idx, 1);
+        }
+    }
+
+    return -1;
+}
+
+/// @brief Searches an array of clusters for the smallest run which can fit a pattern of len.
+/// @param bmps The cluster array to be searched.
+/// @param summary The summary bitmaps of bmps.
+/// @param num The number of clusters in bmps.
+/// @param len The length of successive bits to match for.
+/// @return The bit index (cluster * 256 + bit) of the pattern, or -1 if not found.
+static inline int bmps_best(const __m256i* bmps, const __m256i* summary, int num, int len)
+{
+    int best = -1;
+    int bestLen = 257;
+
+    for (int i = 0; i < (num + 255) >> 8; i++)
+    {
+        __m256i cand = summary[i];
+        int idx;
+
+        while ((idx = bmp_ffs(cand)) != -1)
+        {
+            __m256i bmp = bmps[(i << 8) + idx];
+            int pos = bmp_best(bmp, len);
+            bmp_clear(&cand, idx, 1);
+
+            if (pos == -1)
+                continue;
+
+            // Measure the run we were given so it can be compared against the other clusters.
+            int end = bmp_ffs(_mm256_andnot_si256(_mm256_or_si256(bmp, _bmp_prefix(pos)), _mm256_set1_epi8(-1)));
+            end = end == -1 ? 256 : end;
+
+            if (end - pos < bestLen)
+            {
+                best = (((i << 8) + idx) << 8) + pos;
+                bestLen = end - pos;
+                if (bestLen == len)
+                    return best;
+            }
+        }
+    }
+
+    return best;
+}
@@ -0,0 +1,637 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <dirent.h>
+#include <immintrin.h>
+#include "browser.h"
+#include "mzalloc.h"
+#include "rapidhash.h"
+#include "trace.h"
+#include "pool.h"
+
+// Changes which invalidate a listing, anything that adds, removes or renames an entry.
+#define WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF)
+// Entries scored by one filter task.
+#define FILTER_CHUNK 16384
+
+/// @brief Layout of what getdents64 fills its buffer with, glibc only declares it behind newer headers.
+struct Dirent64
+{
+    uint64_t ino;
+    int64_t off;
+    unsigned short reclen;
+    unsigned char type;
+    char name[];
+};
+
+struct Filter
+{
+    struct Listing* listing;
+    const char* query;
+    int qlen;
+    uint64_t mask;
+    size_t from;
+    size_t to;
+    /// @brief Only entries which matched before are scored, the query grew so nothing else can match.
+    int refine;
+};
+
+struct Sizes
+{
+    struct Listing* listing;
+    uint32_t* entries;
+};
+
+/// @brief Gets the character class bits of a path, the query bits have to be a subset of them for it to match.
+static uint64_t browser_mask(const char* path, size_t len)
+{
+    uint64_t mask = 0;
+    for (size_t i = 0; i < len; i++)
+        mask |= 1ull << ((path[i] | 0x20) & 63);
+
+    return mask;
+}
+
+/// @brief Finds the next byte of a path equal to either case of a lowercase character, 32 bytes at a time.
+static size_t browser_find(const char* path, size_t at, size_t len, char c)
+{
+    char u = c >= 'a' && c <= 'z' ? c - 32 : c;
+    const __m256i lower = _mm256_set1_epi8(c);
+    const __m256i upper = _mm256_set1_epi8(u);
+    for (; at + 32 <= len; at += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(path + at));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, lower), _mm256_cmpeq_epi8(v, upper)));
+        if (mask != 0)
+            return at + __builtin_ctz(mask);
+    }
+
+    for (; at < len; at++)
+    {
+        if (path[at] == c || path[at] == u)
+            return at;
+    }
+
+    return len;
+}
+
+int browser_score(const char* path, size_t len, size_t base, const char* query, int qlen)
+{
+    int score = 0;
+    size_t at = 0;
+    for (int q = 0; q < qlen; q++)
+    {
+        size_t hit = browser_find(path, at, len, query[q]);
+        if (hit >= len)
+            return 0;
+
+        int points = 1;
+        char prev = hit > 0 ? path[hit - 1] : '/';
+        if (prev == '/' || prev == '_' || prev == '-' || prev == '.' || prev == ' ')
+            points += 3;
+        else if (prev >= 'a' && prev <= 'z' && path[hit] >= 'A' && path[hit] <= 'Z')
+            points += 3;
+        if (hit >= base)
+            points += 1;
+        if (q > 0 && hit == at)
+            points += 2;
+
+        score += points;
+        at = hit + 1;
+    }
+
+    // Shorter paths win ties, they're closer to what was typed.
+    score += len < 64 ? (64 - len) / 16 : 0;
+    return score < 1 ? 1 : score > 255 ? 255 : score;
+}
+
+/// @brief Scores a chunk of entries, the class masks rule out most of them 4 at a time before any path is read.
+static void browser_filter_task(void* arg, int i)
+{
+    struct Filter* filter = arg;
+    struct Listing* listing = filter->listing;
+    size_t from = filter->from + (size_t)i * FILTER_CHUNK;
+    size_t to = from + FILTER_CHUNK < filter->to ? from + FILTER_CHUNK : filter->to;
+    uint8_t* scores = listing->scores;
+
+    if (filter->qlen == 0)
+    {
+        memset(scores + from, 1, to - from);
+        return;
+    }
+
+    const __m256i q = _mm256_set1_epi64x(filter->mask);
+    for (size_t j = from; j < to; j += 4)
+    {
+        int hits = 0xf;
+        if (j + 4 <= to)
+        {
+            __m256i m = _mm256_loadu_si256((const __m256i*)(listing->masks + j));
+            hits = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(m, q), q)));
+        }
+
+        for (size_t k = j; k < j + 4 && k < to; k++)
+        {
+            if (!(hits >> (k - j) & 1) || (filter->refine && scores[k] == 0) || (listing->masks[k] & filter->mask) != filter->mask)
+            {
+                scores[k] = 0;
+                continue;
+            }
+
+            struct Entry* entry = listing->entries + k;
+            scores[k] = browser_score(listing->names + entry->path, entry->len, entry->base, filter->query, filter->qlen);
+        }
+    }
+}
+
+/// @brief Scores a range of entries against the query across the pool.
+static void browser_filter(struct Browser* browser, size_t from, size_t to, int refine)
+{
+    if (from >= to)
+        return;
+
+    struct Filter filter = {
+        .listing = browser->current,
+        .query = browser->query,
+        .qlen = browser->queryLen,
+        .mask = browser_mask(browser->query, browser->queryLen),
+        .from = from,
+        .to = to,
+        .refine = refine,
+    };
+
+    pool_run((to - from + FILTER_CHUNK - 1) / FILTER_CHUNK, browser_filter_task, &filter);
+    browser->dirty = 1;
+}
+
+/// @brief Orders the matches best first with a counting sort on their scores, walk order breaks ties.
+static void browser_order(struct Browser* browser)
+{
+    if (!browser->dirty)
+        return;
+
+    struct Listing* listing = browser->current;
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < browser->filtered; i++)
+        counts[listing->scores[i]]++;
+
+    size_t matches = browser->filtered - counts[0];
+    if (matches > browser->capOrder)
+    {
+        size_t cap = browser->capOrder < 1024 ? 1024 : browser->capOrder;
+        while (cap < matches)
+            cap *= 2;
+
+        uint32_t* order = mzrealloc(browser->order, cap * sizeof(uint32_t));
+        if (order == NULL)
+            return;
+
+        browser->order = order;
+        browser->capOrder = cap;
+    }
+
+    size_t start[256];
+    size_t at = 0;
+    for (int s = 255; s > 0; s--)
+    {
+        start[s] = at;
+        at += counts[s];
+    }
+
+    for (size_t i = 0; i < browser->filtered; i++)
+    {
+        if (listing->scores[i] != 0)
+            browser->order[start[listing->scores[i]]++] = i;
+    }
+
+    browser->numOrder = matches;
+    browser->dirty = 0;
+    browser_move(browser, 0);
+}
+
+/// @brief Grows the per-entry arrays of a listing to hold one more entry, and its names to hold len more bytes.
+static int browser_reserve(struct Listing* listing, size_t len)
+{
+    if (listing->count == listing->cap)
+    {
+        size_t cap = listing->cap < 1024 ? 1024 : listing->cap * 2;
+        struct Entry* entries = mzrealloc(listing->entries, cap * sizeof(struct Entry));
+        if (entries == NULL)
+            return -1;
+        listing->entries = entries;
+
+        uint64_t* masks = mzrealloc(listing->masks, cap * sizeof(uint64_t));
+        if (masks == NULL)
+            return -1;
+        listing->masks = masks;
+
+        uint8_t* scores = mzrealloc(listing->scores, cap);
+        if (scores == NULL)
+            return -1;
+        listing->scores = scores;
+
+        listing->cap = cap;
+    }
+
+    if (listing->namesLen + len > listing->namesCap)
+    {
+        size_t cap = listing->namesCap < 65536 ? 65536 : listing->namesCap;
+        while (cap < listing->namesLen + len)
+            cap *= 2;
+
+        char* names = mzrealloc(listing->names, cap);
+        if (names == NULL)
+            return -1;
+
+        listing->names = names;
+        listing->namesCap = cap;
+    }
+
+    return 0;
+}
+
+/// @brief Queues a directory entry to be read.
+static int browser_enqueue(struct Listing* listing, uint32_t entry)
+{
+    if (listing->queueLen == listing->queueCap)
+    {
+        size_t cap = listing->queueCap < 256 ? 256 : listing->queueCap * 2;
+        uint32_t* queue = mzrealloc(listing->queue, cap * sizeof(uint32_t));
+        if (queue == NULL)
+            return -1;
+
+        listing->queue = queue;
+        listing->queueCap = cap;
+    }
+
+    listing->queue[listing->queueLen++] = entry;
+    return 0;
+}
+
+/// @brief Writes the absolute path of an entry, UINT32_MAX being the root.
+static int browser_path(struct Listing* listing, uint32_t entry, char* out)
+{
+    if (entry == UINT32_MAX)
+        return snprintf(out, PATH_MAX, "%s", listing->root) < PATH_MAX ? 0 : -1;
+
+    struct Entry* e = listing->entries + entry;
+    const char* sep = listing->root[1] == '\0' ? "" : "/";
+    return snprintf(out, PATH_MAX, "%s%s%.*s", listing->root, sep, e->len, listing->names + e->path) < PATH_MAX ? 0 : -1;
+}
+
+/// @brief Adds every entry of one getdents64 batch read from the directory being walked.
+static void browser_add(struct Listing* listing, const char* dents, long n)
+{
+    for (long at = 0; at < n;)
+    {
+        struct Dirent64* d = (struct Dirent64*)(dents + at);
+        at += d->reclen;
+        if (d->name[0] == '.' && (d->name[1] == '\0' || (d->name[1] == '.' && d->name[2] == '\0')))
+            continue;
+
+        int type = d->type == DT_DIR ? BROWSER_DIR : d->type == DT_REG ? BROWSER_FILE : BROWSER_OTHER;
+        if (d->type == DT_UNKNOWN)
+        {
+            // Some filesystems don't fill in the type, those entries are stat'd while walking.
+            struct stat st;
+            if (fstatat(listing->dir, d->name, &st, 0) == 0)
+                type = S_ISDIR(st.st_mode) ? BROWSER_DIR : S_ISREG(st.st_mode) ? BROWSER_FILE : BROWSER_OTHER;
+        }
+        else if (d->type == DT_LNK)
+        {
+            // So are symlinks, only those to regular files can be opened. Links to directories aren't followed, the walk
+            // could go round in circles.
+            struct stat st;
+            type = fstatat(listing->dir, d->name, &st, 0) == 0 && S_ISREG(st.st_mode) ? BROWSER_FILE : BROWSER_OTHER;
+        }
+
+        size_t nameLen = strlen(d->name);
+        size_t parentLen = listing->dirEntry == UINT32_MAX ? 0 : listing->entries[listing->dirEntry].len + 1;
+        if (parentLen + nameLen > UINT16_MAX || browser_reserve(listing, parentLen + nameLen) != 0)
+            continue;
+
+        char* path = listing->names + listing->namesLen;
+        if (parentLen > 0)
+        {
+            struct Entry* parent = listing->entries + listing->dirEntry;
+            memcpy(path, listing->names + parent->path, parent->len);
+            path[parent->len] = '/';
+        }
+        memcpy(path + parentLen, d->name, nameLen);
+
+        size_t i = listing->count++;
+        listing->entries[i] = (struct Entry){ listing->namesLen, parentLen + nameLen, parentLen, type, -1 };
+        listing->masks[i] = browser_mask(path, parentLen + nameLen);
+        listing->namesLen += parentLen + nameLen;
+
+        // Hidden directories are listed but not walked, they're mostly version control and caches.
+        if (type == BROWSER_DIR && d->name[0] != '.')
+            browser_enqueue(listing, i);
+    }
+}
+
+/// @brief Reads directories breadth first until the walk is complete or the deadline passes.
+static void browser_walk(struct Listing* listing, char* dents, uint64_t deadline)
+{
+    while (!listing->complete)
+    {
+        if (listing->dir < 0)
+        {
+            if (listing->queueHead == listing->queueLen)
+            {
+                listing->complete = 1;
+                break;
+            }
+
+            char path[PATH_MAX];
+            listing->dirEntry = listing->queue[listing->queueHead++];
+            if (browser_path(listing, listing->dirEntry, path) != 0)
+                continue;
+
+            listing->dir = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (listing->dir < 0)
+                continue;
+
+            // Running out of watches just means the listing is walked again every time it's opened.
+            if (listing->notify >= 0 && inotify_add_watch(listing->notify, path, WATCH_MASK) < 0)
+            {
+                close(listing->notify);
+                listing->notify = -1;
+            }
+        }
+
+        long n = syscall(SYS_getdents64, listing->dir, dents, BROWSER_DENTS);
+        if (n <= 0)
+        {
+            close(listing->dir);
+            listing->dir = -1;
+        }
+        else
+            browser_add(listing, dents, n);
+
+        if (trace_now() >= deadline)
+            break;
+    }
+}
+
+/// @brief Throws away everything walked, keeping the root, so the listing starts over.
+static void browser_restart(struct Listing* listing)
+{
+    if (listing->dir >= 0)
+        close(listing->dir);
+    if (listing->notify >= 0)
+        close(listing->notify);
+
+    listing->notify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    listing->stale = 0;
+    listing->count = 0;
+    listing->namesLen = 0;
+    listing->queueHead = 0;
+    listing->queueLen = 0;
+    listing->dir = -1;
+    listing->complete = 0;
+    browser_enqueue(listing, UINT32_MAX);
+}
+
+/// @brief Drains the change notifications of a listing, marking it stale if there were any.
+static void browser_poll(struct Listing* listing)
+{
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (listing->notify >= 0 && read(listing->notify, events, sizeof(events)) > 0)
+        listing->stale = 1;
+}
+
+/// @brief Shows the first matches of a listing from the top, scoring everything walked so far.
+static void browser_show(struct Browser* browser)
+{
+    browser->filtered = 0;
+    browser->numOrder = 0;
+    browser->selected = 0;
+    browser->top = 0;
+    browser->dirty = 1;
+}
+
+int browser_init(struct Browser* browser)
+{
+    memset(browser, 0, sizeof(struct Browser));
+    browser->dents = mzalloc(BROWSER_DENTS);
+    return browser->dents != NULL ? 0 : -1;
+}
+
+int browser_open(struct Browser* browser, const char* path)
+{
+    char root[PATH_MAX];
+    if (realpath(path, root) == NULL)
+        return -1;
+
+    uint64_t hash = rapidhash(root, strlen(root));
+    struct Listing* listing = NULL;
+    struct Listing* victim = browser->cache;
+    for (int i = 0; i < BROWSER_CACHE; i++)
+    {
+        struct Listing* slot = browser->cache + i;
+        if (slot->root != NULL && slot->hash == hash && strcmp(slot->root, root) == 0)
+        {
+            listing = slot;
+            break;
+        }
+
+        if (victim->root != NULL && (slot->root == NULL || slot->used < victim->used))
+            victim = slot;
+    }
+
+    if (listing == NULL)
+    {
+        listing = victim;
+        if (listing->root == NULL)
+        {
+            listing->dir = -1;
+            listing->notify = -1;
+        }
+
+        mzfree(listing->root);
+        listing->root = mzalloc(strlen(root) + 1);
+        if (listing->root == NULL)
+            return -1;
+
+        strcpy(listing->root, root);
+        listing->hash = hash;
+        browser_restart(listing);
+    }
+    else
+    {
+        browser_poll(listing);
+        // Without watches there's no telling what changed since, so a finished walk can't be trusted.
+        if (listing->stale || (listing->notify < 0 && listing->complete))
+            browser_restart(listing);
+    }
+
+    listing->used = trace_now();
+    browser->current = listing;
+    browser->queryLen = 0;
+    browser_show(browser);
+    browser_step(browser);
+    return 0;
+}
+
+int browser_step(struct Browser* browser)
+{
+    struct Listing* listing = browser->current;
+    if (listing == NULL)
+        return 0;
+
+    browser_poll(listing);
+    if (listing->stale)
+    {
+        browser_restart(listing);
+        browser_show(browser);
+    }
+
+    if (!listing->complete)
+        browser_walk(listing, browser->dents, trace_now() + BROWSER_STEP_NS);
+
+    browser_filter(browser, browser->filtered, listing->count, 0);
+    browser->filtered = listing->count;
+    return !listing->complete;
+}
+
+void browser_query(struct Browser* browser, const char* query, int len)
+{
+    if (browser->current == NULL)
+        return;
+
+    len = len < BROWSER_QUERY_MAX ? len : BROWSER_QUERY_MAX;
+    // A longer query starting with the old one can only match a subset of what the old one did.
+    int refine = len >= browser->queryLen && memcmp(browser->query, query, browser->queryLen) == 0;
+    for (int i = 0; i < len; i++)
+        browser->query[i] = query[i] >= 'A' && query[i] <= 'Z' ? query[i] + 32 : query[i];
+    browser->queryLen = len;
+
+    browser_filter(browser, 0, browser->filtered, refine);
+    browser->selected = 0;
+    browser->top = 0;
+}
+
+void browser_move(struct Browser* browser, long delta)
+{
+    long selected = (long)browser->selected + delta;
+    long last = (long)browser->numOrder - 1;
+    selected = selected > last ? last : selected;
+    browser->selected = selected < 0 ? 0 : selected;
+}
+
+int browser_selected(struct Browser* browser, char* out)
+{
+    if (browser->current == NULL)
+        return -1;
+
+    browser_order(browser);
+    if (browser->selected >= browser->numOrder)
+        return -1;
+
+    uint32_t entry = browser->order[browser->selected];
+    if (browser_path(browser->current, entry, out) != 0)
+        return -1;
+
+    return browser->current->entries[entry].type;
+}
+
+/// @brief Stats one visible entry for its size.
+static void browser_stat_task(void* arg, int i)
+{
+    struct Sizes* sizes = arg;
+    struct Entry* entry = sizes->listing->entries + sizes->entries[i];
+    char path[PATH_MAX];
+    struct stat st;
+    if (browser_path(sizes->listing, sizes->entries[i], path) == 0 && stat(path, &st) == 0)
+        entry->size = st.st_size;
+    else
+        entry->size = 0;
+}
+
+/// @brief Writes a size into 6 columns, right aligned.
+static void browser_size(char* dst, int64_t size)
+{
+    const char* units = "BKMGTP";
+    double value = size;
+    int unit = 0;
+    while (value >= 1000 && unit < 5)
+    {
+        value /= 1024;
+        unit++;
+    }
+
+    char text[16];
+    int len = unit == 0 || value >= 10
+        ? snprintf(text, sizeof(text), "%d%c", (int)value, units[unit])
+        : snprintf(text, sizeof(text), "%.1f%c", value, units[unit]);
+    len = len < 6 ? len : 6;
+    memcpy(dst + 6 - len, text, len);
+}
+
+int browser_render(struct Browser* browser, char* dst, int rows, int cols)
+{
+    memset(dst, ' ', (size_t)rows * cols);
+    struct Listing* listing = browser->current;
+    if (listing == NULL || rows <= 0 || cols <= 0)
+        return 0;
+
+    browser_order(browser);
+    size_t visible = rows - 1;
+    if (browser->selected < browser->top)
+        browser->top = browser->selected;
+    if (browser->selected >= browser->top + visible)
+        browser->top = browser->selected - visible + 1;
+
+    char status[64];
+    int statusLen = snprintf(status, sizeof(status), " %zu/%zu%s", browser->numOrder, browser->filtered, listing->complete ? "" : "...");
+    int shown = browser->queryLen + 2 < cols ? browser->queryLen + 2 : cols;
+    memcpy(dst, "> ", shown < 2 ? shown : 2);
+    if (shown > 2)
+        memcpy(dst + 2, browser->query, shown - 2);
+    if (statusLen < cols - shown)
+        memcpy(dst + cols - statusLen, status, statusLen);
+
+    // Sizes are only ever needed for what's on screen, so that's all that gets stat'd, in parallel.
+    uint32_t pending[visible + 1];
+    struct Sizes sizes = { listing, pending };
+    int numPending = 0;
+    for (size_t r = 0; r < visible && browser->top + r < browser->numOrder; r++)
+    {
+        uint32_t entry = browser->order[browser->top + r];
+        if (listing->entries[entry].type == BROWSER_FILE && listing->entries[entry].size < 0)
+            pending[numPending++] = entry;
+    }
+    pool_run(numPending, browser_stat_task, &sizes);
+
+    for (size_t r = 0; r < visible && browser->top + r < browser->numOrder; r++)
+    {
+        char* row = dst + (r + 1) * cols;
+        struct Entry* entry = listing->entries + browser->order[browser->top + r];
+        if (browser->top + r == browser->selected && cols >= 2)
+            row[0] = '>';
+
+        int room = cols - 2 - (cols >= 16 ? 7 : 0);
+        int len = entry->len < room ? entry->len : room;
+        if (len > 0)
+            memcpy(row + 2, listing->names + entry->path, len);
+        if (entry->type == BROWSER_DIR && len < room)
+            row[2 + len] = '/';
+        if (cols >= 16 && entry->type == BROWSER_FILE)
+            browser_size(row + cols - 6, entry->size);
+    }
+
+    return shown;
+}
+
+int browser_fd(struct Browser* browser)
+{
+    return browser->current != NULL ? browser->current->notify : -1;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Listings kept around with their inotify watches, reopening one of them is instant until something in it changes.
+#define BROWSER_CACHE 8
+// Size of the buffer handed to getdents64, large enough that most directories are read in one call.
+#define BROWSER_DENTS (256 * 1024)
+#define BROWSER_QUERY_MAX 256
+// How long a single step of walking may take, so that keys and frames keep flowing while a huge tree is listed.
+#define BROWSER_STEP_NS 8000000
+#define BROWSER_FILE 0
+#define BROWSER_DIR 1
+#define BROWSER_OTHER 2
+
+/// @brief A file or directory found while walking, its path is relative to the root of the listing.
+struct Entry
+{
+    /// @brief Offset of the path into the names of the listing, not terminated.
+    uint32_t path;
+    uint16_t len;
+    /// @brief Offset of the last component within the path.
+    uint16_t base;
+    uint8_t type;
+    /// @brief Size in bytes, -1 until the entry has been stat'd, which only happens once it's on screen.
+    int64_t size;
+};
+
+/// @brief Every entry beneath a directory, walked breadth first a batch at a time.
+struct Listing
+{
+    /// @brief Absolute path of the root, NULL if the slot is unused.
+    char* root;
+    uint64_t hash;
+    /// @brief inotify descriptor watching every directory walked, -1 if watching failed and the listing can't be cached.
+    int notify;
+    /// @brief Set once anything beneath the root has changed, the listing is walked again when next shown.
+    int stale;
+    /// @brief Last time the listing was opened, the least recently used slot is reused.
+    uint64_t used;
+    struct Entry* entries;
+    /// @brief Character classes of every path, one bit per byte value modulo 64, kept apart so they scan 4 at a time.
+    uint64_t* masks;
+    /// @brief Filter score of every entry, 0 if it doesn't match.
+    uint8_t* scores;
+    size_t count;
+    size_t cap;
+    char* names;
+    size_t namesLen;
+    size_t namesCap;
+    /// @brief Entries of directories still to be read, UINT32_MAX stands for the root.
+    uint32_t* queue;
+    size_t queueHead;
+    size_t queueLen;
+    size_t queueCap;
+    /// @brief Directory being read and its entry, reading resumes from it next step.
+    int dir;
+    uint32_t dirEntry;
+    int complete;
+};
+
+/// @brief A listing shown through a fuzzy filter.
+struct Browser
+{
+    struct Listing cache[BROWSER_CACHE];
+    struct Listing* current;
+    char query[BROWSER_QUERY_MAX];
+    int queryLen;
+    /// @brief Entries scored against the current query, later ones arrived since.
+    size_t filtered;
+    /// @brief Matching entries, best first, rebuilt when scores change.
+    uint32_t* order;
+    size_t numOrder;
+    size_t capOrder;
+    int dirty;
+    /// @brief Selected row of the order and the first one on screen.
+    size_t selected;
+    size_t top;
+    char* dents;
+};
+
+/// @brief Initializes a browser with nothing open.
+/// @param browser The browser to be initialized.
+/// @return 0 if successful, otherwise -1.
+int browser_init(struct Browser* browser);
+
+/// @brief Shows the listing of a directory, reusing its cached listing if nothing in it has changed.
+/// The first batch of entries is read before returning, the rest arrive through browser_step.
+/// @param browser The browser.
+/// @param path Path of the directory.
+/// @return 0 if successful, otherwise -1.
+int browser_open(struct Browser* browser, const char* path);
+
+/// @brief Walks the current listing for up to BROWSER_STEP_NS and filters what arrived, also picking up changes on disk.
+/// @param browser The browser.
+/// @return Non-zero if there is still work to do.
+int browser_step(struct Browser* browser);
+
+/// @brief Replaces the filter query, refining the previous matches when the query only grew.
+/// @param browser The browser.
+/// @param query The new query.
+/// @param len Length of the query.
+void browser_query(struct Browser* browser, const char* query, int len);
+
+/// @brief Moves the selection, keeping it within the matches.
+/// @param browser The browser.
+/// @param delta Rows to move by.
+void browser_move(struct Browser* browser, long delta);
+
+/// @brief Gets the absolute path of the selected entry.
+/// @param browser The browser.
+/// @param out Buffer of PATH_MAX bytes for the path.
+/// @return Type of the entry, or -1 if nothing is selected.
+int browser_selected(struct Browser* browser, char* out);
+
+/// @brief Renders the query line and as many matches as fit, stat'ing the visible entries which haven't been yet.
+/// @param browser The browser.
+/// @param dst rows * cols cells, no terminators.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+/// @return Column of the end of the query, where the cursor goes.
+int browser_render(struct Browser* browser, char* dst, int rows, int cols);
+
+/// @brief Gets the descriptor which becomes readable when something beneath the current listing changes.
+/// @param browser The browser.
+/// @return The descriptor, or -1 if changes can't be watched.
+int browser_fd(struct Browser* browser);
+
+/// @brief Scores a path against a lowercase query, matches have to contain the query in order.
+/// Matches at the start of components, in the last component and in runs score higher.
+/// @param path The path.
+/// @param len Length of the path.
+/// @param base Offset of the last component of the path.
+/// @param query The query, lowercase.
+/// @param qlen Length of the query.
+/// @return Score from 1 to 255, 0 if the path doesn't match.
+int browser_score(const char* path, size_t len, size_t base, const char* query, int qlen);
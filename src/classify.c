@@ -0,0 +1,224 @@
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+#include "classify.h"
+#include "pool.h"
+
+// Lookup tables of the UTF-8 check, each has a bit set for every error a pair of bytes could be. A pair is an error
+// when the bit survives all three lookups, as in Keiser and Lemire's validation.
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+// Both lanes of a shuffle need the same table.
+#define TABLE(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) \
+    _mm256_setr_epi8(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p, a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p)
+
+/// @brief Checks 32 bytes of UTF-8 given the 32 before them.
+/// @return Nonzero bytes where a sequence is broken.
+static inline __m256i classify_utf8(__m256i input, __m256i prev)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i shifted = _mm256_permute2x128_si256(prev, input, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+    __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+    __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+
+    __m256i byte1High = _mm256_shuffle_epi8(
+        TABLE(TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+              TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+              TOO_SHORT | OVERLONG_2,
+              TOO_SHORT,
+              TOO_SHORT | OVERLONG_3 | SURROGATE,
+              TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4),
+        _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i byte1Low = _mm256_shuffle_epi8(
+        TABLE(CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+              CARRY | OVERLONG_2,
+              CARRY,
+              CARRY,
+              CARRY | TOO_LARGE,
+              CARRY | TOO_LARGE | TOO_LARGE_1000,
+              CARRY | TOO_LARGE | TOO_LARGE_1000,
+              CARRY | TOO_LARGE | TOO_LARGE_1000,
+              CARRY | TOO_LARGE | TOO_LARGE_1000,
+              CARRY | TOO_LARGE | TOO_LARGE_1000,
+              CARRY | TOO_LARGE | TOO_LARGE_1000,
+              CARRY | TOO_LARGE | TOO_LARGE_1000,
+              CARRY | TOO_LARGE | TOO_LARGE_1000,
+              CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+              CARRY | TOO_LARGE | TOO_LARGE_1000,
+              CARRY | TOO_LARGE | TOO_LARGE_1000),
+        _mm256_and_si256(prev1, nibble));
+    __m256i byte2High = _mm256_shuffle_epi8(
+        TABLE(TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+              TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+              TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+              TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+              TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+              TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT),
+        _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+
+    // Two continuations in a row are only right as the third or fourth byte of a sequence, and there they're required.
+    __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xe0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xf0 - 0x80)));
+    __m256i must = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must, special);
+}
+
+/// @brief Checks whether 32 bytes end partway into a sequence.
+/// @return Nonzero bytes if they do.
+static inline __m256i classify_incomplete(__m256i input)
+{
+    const __m256i max = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                         -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                         (char)(0xf0 - 1), (char)(0xe0 - 1), (char)(0xc0 - 1));
+    return _mm256_subs_epu8(input, max);
+}
+
+/// @brief Classifies 32 bytes given the 32 before them, only the bytes in mask are counted.
+static inline void classify_block(struct Classify* kind, __m256i v, __m256i prev, uint32_t mask, uint32_t* cr,
+                                  __m256i* error)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    uint32_t nl = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'))) & mask;
+    uint32_t crs = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\r'))) & mask;
+    uint32_t tab = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+    uint32_t nul = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) & mask;
+    uint32_t del = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f))) & mask;
+    // Signed compares, bytes above 0x7f are negative so they're taken back out of the ones below a space.
+    __m256i high = _mm256_cmpgt_epi8(zero, v);
+    uint32_t low = _mm256_movemask_epi8(_mm256_andnot_si256(high, _mm256_cmpgt_epi8(_mm256_set1_epi8(' '), v))) & mask;
+
+    kind->lines += __builtin_popcount(nl);
+    kind->crlf += __builtin_popcount(nl & (crs << 1 | *cr));
+    kind->nuls += __builtin_popcount(nul);
+    kind->controls += __builtin_popcount((low & ~(nl | crs | tab | nul)) | del);
+    *cr = crs >> 31;
+
+    // ASCII can't break a sequence, but it can follow one which never finished.
+    if (_mm256_movemask_epi8(high) == 0)
+        *error = _mm256_or_si256(*error, classify_incomplete(prev));
+    else
+        *error = _mm256_or_si256(*error, classify_utf8(v, prev));
+}
+
+/// @brief Classifies up to a position, which is a multiple of 32 unless it's the end. Steps carry nothing over between
+/// them, the original never changes so the 32 bytes before a step are simply read again.
+static void classify_until(struct Classify* kind, size_t until)
+{
+    const char* data = kind->data;
+    size_t pos = kind->pos;
+    __m256i prev = pos >= 32 ? _mm256_loadu_si256((const __m256i*)(data + pos - 32)) : _mm256_setzero_si256();
+    __m256i error = _mm256_setzero_si256();
+    uint32_t cr = pos > 0 && data[pos - 1] == '\r';
+
+    for (; pos + 32 <= until; pos += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + pos));
+        classify_block(kind, v, prev, UINT32_MAX, &cr, &error);
+        prev = v;
+    }
+
+    if (pos < until)
+    {
+        // The tail is padded with NULs which aren't counted, a sequence cut short by the end breaks on them.
+        char tail[32] = { 0 };
+        memcpy(tail, data + pos, until - pos);
+        __m256i v = _mm256_loadu_si256((const __m256i*)tail);
+        classify_block(kind, v, prev, (1u << (until - pos)) - 1, &cr, &error);
+        pos = until;
+    }
+    else if (pos == kind->len && pos > 0)
+        error = _mm256_or_si256(error, classify_incomplete(prev));
+
+    kind->utf8 &= _mm256_testz_si256(error, error);
+    kind->pos = pos;
+    kind->complete = pos == kind->len;
+}
+
+void classify_open(struct Classify* kind, const char* data, size_t len)
+{
+    *kind = (struct Classify){ .data = data, .len = len, .utf8 = 1 };
+    classify_until(kind, len < CLASSIFY_HEAD ? len : CLASSIFY_HEAD);
+    kind->binary = kind->nuls > 0 || kind->controls * CLASSIFY_CONTROL_RATIO > kind->pos;
+}
+
+/// @brief Parts of a step, each classified on a thread of its own from where the one before it ends.
+struct ClassifySplit
+{
+    struct Classify parts[POOL_MAX];
+    size_t ends[POOL_MAX];
+};
+
+/// @brief Classifies one part of a step.
+static void classify_part(void* arg, int i)
+{
+    struct ClassifySplit* split = arg;
+    classify_until(split->parts + i, split->ends[i]);
+}
+
+int classify_step(struct Classify* kind)
+{
+    if (kind->complete)
+        return 0;
+
+    // Steps carry nothing over, so parts of one can be classified side by side and their counts added up.
+    struct ClassifySplit split;
+    int n = 0;
+    size_t pos = kind->pos;
+    for (int threads = pool_size(); n < threads && pos < kind->len; n++)
+    {
+        size_t end = kind->len - pos < CLASSIFY_STEP ? kind->len : pos + CLASSIFY_STEP;
+        split.parts[n] = (struct Classify){ .data = kind->data, .len = kind->len, .pos = pos, .utf8 = 1 };
+        split.ends[n] = end;
+        pos = end;
+    }
+
+    pool_run(n, classify_part, &split);
+    for (int i = 0; i < n; i++)
+    {
+        kind->lines += split.parts[i].lines;
+        kind->crlf += split.parts[i].crlf;
+        kind->nuls += split.parts[i].nuls;
+        kind->controls += split.parts[i].controls;
+        kind->utf8 &= split.parts[i].utf8;
+    }
+
+    kind->pos = pos;
+    kind->complete = pos == kind->len;
+    return !kind->complete;
+}
+
+int classify_crlf(const struct Classify* kind)
+{
+    return kind->crlf * 2 > kind->lines;
+}
+
+void classify_sanitize(char* dst, size_t len, int utf8)
+{
+    __m256i keepHigh = _mm256_set1_epi8(utf8 ? -1 : 0);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(dst + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), classify_clean(v, keepHigh));
+    }
+
+    if (i < len)
+    {
+        char tail[32] = { 0 };
+        memcpy(tail, dst + i, len - i);
+        __m256i v = _mm256_loadu_si256((const __m256i*)tail);
+        _mm256_storeu_si256((__m256i*)tail, classify_clean(v, keepHigh));
+        memcpy(dst + i, tail, len - i);
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <stddef.h>
+#include <immintrin.h>
+
+// Bytes at the start of a file classified before its first frame, a binary file nearly always gives itself away in them.
+#define CLASSIFY_HEAD (64 * 1024)
+// Bytes classified on each thread of the pool in every later step, a few milliseconds even unoptimized so a key never
+// waits long for one to finish. As many steps as fit run between keys.
+#define CLASSIFY_STEP (512 * 1024)
+// A head where more than one byte in this many is a control other than whitespace is binary, even without a NUL.
+#define CLASSIFY_CONTROL_RATIO 16
+// Shown in place of control bytes, and of bytes above 0x7f in documents which aren't UTF-8.
+#define CLASSIFY_PLACEHOLDER '?'
+
+/// @brief What an original turned out to be, worked out 32 bytes at a time a step at a time.
+struct Classify
+{
+    /// @brief The original, which never changes, and how far into it the scan has got.
+    const char* data;
+    size_t len;
+    size_t pos;
+    /// @brief Newlines, and those of them preceded by a carriage return.
+    size_t lines;
+    size_t crlf;
+    /// @brief NUL bytes, and other control bytes which aren't whitespace.
+    size_t nuls;
+    size_t controls;
+    /// @brief Whether everything scanned so far is valid UTF-8.
+    int utf8;
+    /// @brief Whether the head looked binary, decided once when the file is opened.
+    int binary;
+    int complete;
+};
+
+/// @brief Starts classifying an original and classifies its head straight away.
+/// @param kind The classification to be started.
+/// @param data The original.
+/// @param len The length of the original.
+void classify_open(struct Classify* kind, const char* data, size_t len);
+
+/// @brief Classifies the next CLASSIFY_STEP bytes on every thread of the pool.
+/// @param kind The classification.
+/// @return 1 if there is more to classify, otherwise 0.
+int classify_step(struct Classify* kind);
+
+/// @brief Gets whether most lines seen so far end in a carriage return and a newline.
+int classify_crlf(const struct Classify* kind);
+
+/// @brief Replaces everything which would upset the terminal with CLASSIFY_PLACEHOLDER, tabs become a single space.
+/// @param dst Bytes about to be rendered.
+/// @param len The number of bytes.
+/// @param utf8 Whether bytes above 0x7f are left alone as part of UTF-8 sequences.
+void classify_sanitize(char* dst, size_t len, int utf8);
+
+/// @brief Sanitizes 32 bytes the way classify_sanitize does, for renderers which copy and sanitize in one pass.
+/// @param v The bytes.
+/// @param keepHigh All ones to leave bytes above 0x7f alone, otherwise zero.
+static inline __m256i classify_clean(__m256i v, __m256i keepHigh)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    __m256i high = _mm256_cmpgt_epi8(_mm256_setzero_si256(), v);
+    __m256i bad = _mm256_andnot_si256(_mm256_and_si256(high, keepHigh), _mm256_cmpgt_epi8(space, v));
+    bad = _mm256_or_si256(bad, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(0x7f)));
+    __m256i tab = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t'));
+    v = _mm256_blendv_epi8(v, _mm256_set1_epi8(CLASSIFY_PLACEHOLDER), bad);
+    return _mm256_blendv_epi8(v, space, tab);
+}
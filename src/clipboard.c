@@ -0,0 +1,225 @@
+#include <string.h>
+#include "clipboard.h"
+#include "mzalloc.h"
+
+// Bytes read out of an entry per round of OSC 52 encoding, a multiple of 3 so only the last round pads.
+#define EXPORT_CHUNK 3072
+
+/// @brief Empties an entry.
+static void clipboard_clear(struct Clip* clip)
+{
+    mzfree(clip->pieces);
+    mzfree(clip->bytes);
+    *clip = (struct Clip){ 0 };
+}
+
+/// @brief Adds a piece to the end of an entry, merging it into the last one when they're contiguous.
+static int clipboard_piece(struct Clip* clip, int source, size_t start, size_t len)
+{
+    struct Piece* last = clip->count > 0 ? clip->pieces + clip->count - 1 : NULL;
+    if (last != NULL && last->source == source && last->start + last->len == start)
+    {
+        last->len += len;
+        clip->len += len;
+        return 0;
+    }
+
+    if (clip->count == clip->cap)
+    {
+        int cap = clip->cap < 8 ? 8 : clip->cap * 2;
+        struct Piece* pieces = mzrealloc(clip->pieces, cap * sizeof(struct Piece));
+        if (pieces == NULL)
+            return -1;
+
+        clip->pieces = pieces;
+        clip->cap = cap;
+    }
+
+    clip->pieces[clip->count++] = (struct Piece){ .pos = clip->len, .start = start, .len = len, .source = source };
+    clip->len += len;
+    return 0;
+}
+
+/// @brief Gives an entry its own copy of its bytes so it no longer needs its source.
+static int clipboard_materialize(struct Clip* clip)
+{
+    if (clip->source == NULL)
+        return 0;
+
+    char* bytes = mzalloc(clip->len > 0 ? clip->len : 1);
+    if (bytes == NULL)
+        return -1;
+
+    clipboard_read(clip, 0, bytes, clip->len);
+    mzfree(clip->pieces);
+    clip->pieces = NULL;
+    clip->count = 0;
+    clip->cap = 0;
+    clip->bytes = bytes;
+    clip->source = NULL;
+    return 0;
+}
+
+int clipboard_copy(struct Clipboard* clipboard, const struct Text* text, size_t pos, size_t len, int append)
+{
+    len = pos + len <= text->len ? len : text->len - pos;
+    struct Clip* clip = clipboard->ring + clipboard->newest;
+    if (!append || clipboard->count == 0)
+    {
+        clipboard->newest = (clipboard->newest + 1) % CLIPBOARD_RING;
+        clipboard->count += clipboard->count < CLIPBOARD_RING;
+        clip = clipboard->ring + clipboard->newest;
+        clipboard_clear(clip);
+        clip->source = text;
+    }
+    else if (clip->source != text)
+    {
+        // Appending from somewhere else, the entry has to hold on to the bytes of both.
+        if (clipboard_materialize(clip) != 0)
+            return -1;
+
+        char* bytes = mzrealloc(clip->bytes, clip->len + len + 1);
+        if (bytes == NULL)
+            return -1;
+
+        clip->bytes = bytes;
+        clip->len += text_read(text, pos, clip->bytes + clip->len, len);
+        return 0;
+    }
+
+    size_t copied = 0;
+    for (int i = text_find(text, pos); i < text->count && copied < len; i++)
+    {
+        const struct Piece* piece = text->pieces + i;
+        size_t off = pos + copied - piece->pos;
+        size_t take = piece->len - off < len - copied ? piece->len - off : len - copied;
+        if (clipboard_piece(clip, piece->source, piece->start + off, take) != 0)
+            return -1;
+
+        copied += take;
+    }
+
+    return 0;
+}
+
+const struct Clip* clipboard_get(const struct Clipboard* clipboard, int back)
+{
+    if (back < 0 || back >= clipboard->count)
+        return NULL;
+
+    return clipboard->ring + (clipboard->newest - back + CLIPBOARD_RING) % CLIPBOARD_RING;
+}
+
+void clipboard_rotate(struct Clipboard* clipboard)
+{
+    if (clipboard->count < 2)
+        return;
+
+    // The oldest entry sits just past the newest when the ring is full, otherwise the entries before the newest have
+    // to be shuffled round so the empty slots stay out of the cycle.
+    if (clipboard->count == CLIPBOARD_RING)
+    {
+        clipboard->newest = (clipboard->newest - 1 + CLIPBOARD_RING) % CLIPBOARD_RING;
+        return;
+    }
+
+    struct Clip newest = clipboard->ring[clipboard->newest];
+    int oldest = (clipboard->newest - clipboard->count + 1 + CLIPBOARD_RING) % CLIPBOARD_RING;
+    for (int i = clipboard->newest; i != oldest; i = (i - 1 + CLIPBOARD_RING) % CLIPBOARD_RING)
+        clipboard->ring[i] = clipboard->ring[(i - 1 + CLIPBOARD_RING) % CLIPBOARD_RING];
+    clipboard->ring[oldest] = newest;
+}
+
+void clipboard_detach(struct Clipboard* clipboard, const struct Text* text)
+{
+    for (int i = 0; i < CLIPBOARD_RING; i++)
+    {
+        // An entry which can't be materialized would dangle, losing it is the lesser evil.
+        if (clipboard->ring[i].source == text && clipboard_materialize(clipboard->ring + i) != 0)
+            clipboard_clear(clipboard->ring + i);
+    }
+}
+
+struct Edit clipboard_edit(const struct Clip* clip, size_t pos, size_t del)
+{
+    if (clip->source == NULL)
+        return (struct Edit){ .pos = pos, .del = del, .data = clip->bytes, .len = clip->len };
+
+    return (struct Edit){ pos, del, NULL, clip->len, clip->pieces, clip->count, clip->source };
+}
+
+size_t clipboard_read(const struct Clip* clip, size_t pos, char* dst, size_t len)
+{
+    if (pos >= clip->len)
+        return 0;
+
+    len = pos + len <= clip->len ? len : clip->len - pos;
+    if (clip->source == NULL)
+    {
+        memcpy(dst, clip->bytes + pos, len);
+        return len;
+    }
+
+    // Pieces of an entry are in order, so the first one is found with a binary search like the document's.
+    int lo = 0;
+    int hi = clip->count - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (clip->pieces[mid].pos <= pos)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    size_t copied = 0;
+    for (int i = lo; i < clip->count && copied < len; i++)
+    {
+        const struct Piece* piece = clip->pieces + i;
+        const char* bytes = piece->source == TEXT_ORIGINAL ? clip->source->original : clip->source->add;
+        size_t off = pos + copied - piece->pos;
+        size_t take = piece->len - off < len - copied ? piece->len - off : len - copied;
+        memcpy(dst + copied, bytes + piece->start + off, take);
+        copied += take;
+    }
+
+    return copied;
+}
+
+int clipboard_export(const struct Clip* clip, void (*out)(const char* data, int len))
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    if (clip->len > CLIPBOARD_EXPORT_MAX)
+        return -1;
+
+    out("\x1b]52;c;", 7);
+    unsigned char chunk[EXPORT_CHUNK];
+    char encoded[EXPORT_CHUNK / 3 * 4];
+    for (size_t pos = 0; pos < clip->len; pos += EXPORT_CHUNK)
+    {
+        size_t len = clipboard_read(clip, pos, (char*)chunk, EXPORT_CHUNK);
+        int n = 0;
+        for (size_t i = 0; i < len; i += 3)
+        {
+            uint32_t v = chunk[i] << 16 | (i + 1 < len ? chunk[i + 1] << 8 : 0) | (i + 2 < len ? chunk[i + 2] : 0);
+            encoded[n++] = digits[v >> 18 & 63];
+            encoded[n++] = digits[v >> 12 & 63];
+            encoded[n++] = i + 1 < len ? digits[v >> 6 & 63] : '=';
+            encoded[n++] = i + 2 < len ? digits[v & 63] : '=';
+        }
+
+        out(encoded, n);
+    }
+
+    out("\a", 1);
+    return 0;
+}
+
+void clipboard_free(struct Clipboard* clipboard)
+{
+    for (int i = 0; i < CLIPBOARD_RING; i++)
+        clipboard_clear(clipboard->ring + i);
+
+    clipboard->newest = 0;
+    clipboard->count = 0;
+}
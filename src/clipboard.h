@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stddef.h>
+#include "text.h"
+
+// Entries kept in the kill ring, the oldest is dropped past this.
+#define CLIPBOARD_RING 16
+// Largest entry handed to the terminal's clipboard. It's encoded and written on the key that copied it and has to go
+// out in one piece, a frame drawn halfway would land inside the sequence, so it's kept small enough to go unnoticed.
+// Larger entries stay in the ring for pasting inside the editor.
+#define CLIPBOARD_EXPORT_MAX (64 * 1024)
+
+/// @brief A clipboard entry, the pieces of a range of a document for as long as that document's sources are around,
+/// and its own copy of the bytes only once they aren't. Either way it never has to be copied to be pasted.
+struct Clip
+{
+    /// @brief Document whose sources the pieces point into, NULL once the bytes have been materialized.
+    const struct Text* source;
+    /// @brief Pieces of the entry, their positions are within the entry.
+    struct Piece* pieces;
+    int count;
+    int cap;
+    size_t len;
+    /// @brief The bytes, only once the source went away.
+    char* bytes;
+};
+
+/// @brief A ring of entries, newest first.
+struct Clipboard
+{
+    struct Clip ring[CLIPBOARD_RING];
+    /// @brief Slot of the newest entry.
+    int newest;
+    int count;
+};
+
+/// @brief Copies a range of a document by taking its pieces, no bytes are copied however large the range is. The cost is
+/// a step per piece the range spans, the piece array is edited in place so the entry can't share it.
+/// @param clipboard The clipboard.
+/// @param text The document, the entry references it until clipboard_detach is called for it.
+/// @param pos Start of the range.
+/// @param len Length of the range.
+/// @param append Whether to add the range to the end of the newest entry instead of making a new one.
+/// @return 0 if successful, otherwise -1.
+int clipboard_copy(struct Clipboard* clipboard, const struct Text* text, size_t pos, size_t len, int append);
+
+/// @brief Gets an entry.
+/// @param clipboard The clipboard.
+/// @param back How many entries back from the newest, 0 being the newest.
+/// @return The entry, or NULL if there aren't that many.
+const struct Clip* clipboard_get(const struct Clipboard* clipboard, int back);
+
+/// @brief Makes the second newest entry the newest and the newest the oldest, cycling through the ring.
+void clipboard_rotate(struct Clipboard* clipboard);
+
+/// @brief Materializes every entry referencing a document, which has to happen before it's released or its original
+/// changes underneath it.
+/// @param clipboard The clipboard.
+/// @param text The document going away.
+void clipboard_detach(struct Clipboard* clipboard, const struct Text* text);
+
+/// @brief Gets the edit which pastes an entry, pastes into the document it was taken from reference the same pieces.
+/// @param clip The entry.
+/// @param pos Where to paste.
+/// @param del Bytes replaced by the paste.
+/// @return The edit, valid for as long as the entry is.
+struct Edit clipboard_edit(const struct Clip* clip, size_t pos, size_t del);
+
+/// @brief Copies bytes out of an entry.
+/// @param clip The entry.
+/// @param pos Offset into the entry.
+/// @param dst The buffer to be written to.
+/// @param len The maximum number of bytes to be copied.
+/// @return The number of bytes copied.
+size_t clipboard_read(const struct Clip* clip, size_t pos, char* dst, size_t len);
+
+/// @brief Streams an entry to the terminal's clipboard as an OSC 52 sequence, straight from its pieces.
+/// @param clip The entry, nothing is sent if it's longer than CLIPBOARD_EXPORT_MAX.
+/// @param out Writes to the terminal.
+/// @return 0 if sent, otherwise -1.
+int clipboard_export(const struct Clip* clip, void (*out)(const char* data, int len));
+
+/// @brief Releases every entry.
+void clipboard_free(struct Clipboard* clipboard);
@@ -0,0 +1,780 @@
+#define _GNU_SOURCE
+#include <immintrin.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "diff.h"
+#include "lineindex.h"
+#include "pool.h"
+#include "rapidhash.h"
+
+// Hunks published between wakeups of the view, the first one and the end always wake it.
+#define WAKE_EVERY 1024
+// Lines hashed between checks for cancellation.
+#define CANCEL_EVERY 65536
+// Chunks of lines hashed per thread of the pool, and the fewest bytes worth a chunk of their own.
+#define HASH_SPLIT 4
+#define HASH_CHUNK_MIN (64 * 1024)
+// Most bytes of a chunk. A document is hashed a window of chunks at a time, so the pool is never held for longer than a
+// window and the editor's own jobs get in between them.
+#define HASH_CHUNK_MAX (1024 * 1024)
+// Stack of the thread, left halves recurse and an unlucky split sequence can go deep.
+#define DIFF_STACK ((size_t)64 << 20)
+
+size_t diff_prefix(const char* a, const char* b, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        uint32_t same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                                               _mm256_loadu_si256((const __m256i*)(b + i))));
+        if (same != UINT32_MAX)
+            return i + __builtin_ctz(~same);
+    }
+
+    for (; i < len && a[i] == b[i]; i++)
+        ;
+    return i;
+}
+
+size_t diff_suffix(const char* a, const char* b, size_t len)
+{
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        uint32_t same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + len - i - 32)),
+                                                               _mm256_loadu_si256((const __m256i*)(b + len - i - 32))));
+        // The last byte is the top bit, so the equal bytes at the end are the leading ones.
+        if (same != UINT32_MAX)
+            return i + __builtin_clz(~same);
+    }
+
+    for (; i < len && a[len - i - 1] == b[len - i - 1]; i++)
+        ;
+    return i;
+}
+
+/// @brief Maps zeroed memory, the thread can't use mzalloc.
+static void* diff_map(size_t len)
+{
+    void* ptr = mmap(NULL, len > 0 ? len : 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return ptr == MAP_FAILED ? NULL : ptr;
+}
+
+/// @brief Unmaps memory from diff_map.
+static void diff_unmap(void* ptr, size_t len)
+{
+    if (ptr != NULL)
+        munmap(ptr, len > 0 ? len : 1);
+}
+
+/// @brief Gets the contiguous bytes ending at a position, back to the start of its piece.
+static const char* diff_chunk_before(const struct Text* text, size_t pos, size_t* len)
+{
+    const struct Piece* piece = text->pieces + text_find(text, pos - 1);
+    *len = pos - piece->pos;
+    return (piece->source == TEXT_ORIGINAL ? text->original : text->add) + piece->start;
+}
+
+/// @brief Finds how many bytes two documents have in common from the start, a run of pieces at a time.
+static size_t diff_common_start(const struct Text* a, const struct Text* b)
+{
+    size_t end = a->len < b->len ? a->len : b->len;
+    size_t pos = 0;
+    while (pos < end)
+    {
+        size_t la, lb;
+        const char* x = text_chunk(a, pos, &la);
+        const char* y = text_chunk(b, pos, &lb);
+        size_t n = la < lb ? la : lb;
+        n = n < end - pos ? n : end - pos;
+        size_t same = diff_prefix(x, y, n);
+        pos += same;
+        if (same < n)
+            break;
+    }
+
+    return pos;
+}
+
+/// @brief Finds how many bytes two documents have in common from the end, up to a limit.
+static size_t diff_common_end(const struct Text* a, const struct Text* b, size_t limit)
+{
+    size_t n = 0;
+    while (n < limit)
+    {
+        size_t la, lb;
+        const char* x = diff_chunk_before(a, a->len - n, &la);
+        const char* y = diff_chunk_before(b, b->len - n, &lb);
+        size_t run = la < lb ? la : lb;
+        run = run < limit - n ? run : limit - n;
+        size_t same = diff_suffix(x + la - run, y + lb - run, run);
+        n += same;
+        if (same < run)
+            break;
+    }
+
+    return n;
+}
+
+/// @brief Counts the newlines of a range of a document.
+static size_t diff_newlines(const struct Text* text, size_t from, size_t to)
+{
+    size_t n = 0;
+    while (from < to)
+    {
+        size_t len;
+        const char* at = text_chunk(text, from, &len);
+        len = len < to - from ? len : to - from;
+        n += lineindex_count(at, len);
+        from += len;
+    }
+
+    return n;
+}
+
+/// @brief A run of bytes whose lines are hashed by one task, each task takes the lines starting in its run.
+struct HashChunk
+{
+    size_t start;
+    size_t end;
+    /// @brief Index of the first line starting in the chunk, from the prefix sum of the counts.
+    size_t first;
+    size_t lines;
+    /// @brief Lines crossing pieces are copied here to be hashed.
+    char* scratch;
+    size_t scratchLen;
+    int failed;
+};
+
+struct HashJob
+{
+    struct Diff* diff;
+    const struct Text* text;
+    size_t from;
+    size_t to;
+    uint64_t* hashes;
+    size_t* starts;
+    struct HashChunk chunks[POOL_MAX * HASH_SPLIT];
+};
+
+/// @brief First pass over a chunk, counting the lines starting in it.
+static void diff_count_task(void* arg, int i)
+{
+    struct HashJob* job = arg;
+    struct HashChunk* chunk = job->chunks + i;
+    if (chunk->start == job->from)
+        chunk->lines = 1 + diff_newlines(job->text, chunk->start, chunk->end - 1);
+    else
+        chunk->lines = diff_newlines(job->text, chunk->start - 1, chunk->end - 1);
+}
+
+/// @brief Second pass over a chunk, fingerprinting the lines starting in it. Lines within a piece are hashed in place,
+/// only those crossing pieces are copied.
+static void diff_hash_task(void* arg, int i)
+{
+    struct HashJob* job = arg;
+    struct HashChunk* chunk = job->chunks + i;
+    if (chunk->lines == 0)
+        return;
+
+    const struct Text* text = job->text;
+    uint64_t* hashes = job->hashes;
+    size_t* starts = job->starts;
+    size_t line = chunk->first;
+    size_t last = chunk->first + chunk->lines;
+    size_t pos = chunk->start == job->from ? chunk->start : text_chr(text, chunk->start - 1, '\n') + 1;
+    while (line < last)
+    {
+        size_t len;
+        const char* at = text_chunk(text, pos, &len);
+        const char* stop = at + (len < job->to - pos ? len : job->to - pos);
+        const char* nl;
+        while (line < last && (nl = memchr(at, '\n', stop - at)) != NULL)
+        {
+            if (line % CANCEL_EVERY == 0 && __atomic_load_n(&job->diff->cancel, __ATOMIC_RELAXED))
+            {
+                chunk->failed = 1;
+                return;
+            }
+
+            starts[line] = pos;
+            hashes[line++] = rapidhash(at, nl + 1 - at);
+            pos += nl + 1 - at;
+            at = nl + 1;
+        }
+
+        if (line == last || at == stop)
+            continue;
+
+        // The rest of the piece starts a line which carries on into the next ones.
+        size_t end = text_chr(text, pos, '\n');
+        end = end < job->to ? end + 1 : job->to;
+        if (end - pos > chunk->scratchLen)
+        {
+            diff_unmap(chunk->scratch, chunk->scratchLen);
+            chunk->scratchLen = end - pos > 2 * chunk->scratchLen ? end - pos : 2 * chunk->scratchLen;
+            chunk->scratch = diff_map(chunk->scratchLen);
+            if (chunk->scratch == NULL)
+            {
+                chunk->failed = 1;
+                return;
+            }
+        }
+
+        text_read(text, pos, chunk->scratch, end - pos);
+        starts[line] = pos;
+        hashes[line++] = rapidhash(chunk->scratch, end - pos);
+        pos = end;
+    }
+}
+
+/// @brief Shrinks memory from diff_map in place.
+static void diff_shrink(void* ptr, size_t len, size_t shrunk)
+{
+    mremap(ptr, len > 0 ? len : 1, shrunk > 0 ? shrunk : 1, 0);
+}
+
+/// @brief Fingerprints every line of a range of one side, the range starting at a line and ending after a newline or
+/// at the end of the document. A window of chunks at a time, the chunks are counted across the pool, a prefix sum
+/// gives each its first line, then each hashes its lines.
+static int diff_hash(struct Diff* diff, int s, size_t from, size_t to)
+{
+    struct HashJob job;
+    job.diff = diff;
+    job.text = diff->side + s;
+    job.from = from;
+    job.to = to;
+
+    // Room for as many lines as the range could have, only what's written is ever backed and the rest goes at the end.
+    size_t cap = to - from + 1;
+    diff->lines[s] = cap;
+    diff->hashes[s] = diff_map(cap * sizeof(uint64_t));
+    diff->starts[s] = diff_map((cap + 1) * sizeof(size_t));
+    if (diff->hashes[s] == NULL || diff->starts[s] == NULL)
+        return -1;
+
+    job.hashes = diff->hashes[s];
+    job.starts = diff->starts[s];
+    size_t split = (size_t)pool_size() * HASH_SPLIT;
+    size_t lines = 0;
+    int failed = 0;
+    for (size_t pos = from; pos < to && !failed;)
+    {
+        size_t window = to - pos < split * HASH_CHUNK_MAX ? to - pos : split * HASH_CHUNK_MAX;
+        size_t wanted = window / HASH_CHUNK_MIN + 1;
+        int numChunks = wanted < split ? wanted : split;
+        for (int i = 0; i < numChunks; i++)
+            job.chunks[i] = (struct HashChunk){ .start = pos + window * i / numChunks,
+                .end = pos + window * (i + 1) / numChunks };
+
+        pool_run(numChunks, diff_count_task, &job);
+        for (int i = 0; i < numChunks; i++)
+        {
+            job.chunks[i].first = lines;
+            lines += job.chunks[i].lines;
+        }
+
+        pool_run(numChunks, diff_hash_task, &job);
+        for (int i = 0; i < numChunks; i++)
+        {
+            failed |= job.chunks[i].failed;
+            diff_unmap(job.chunks[i].scratch, job.chunks[i].scratchLen);
+        }
+
+        pos += window;
+    }
+
+    if (failed)
+        return -1;
+
+    diff->starts[s][lines] = to;
+    diff_shrink(diff->hashes[s], cap * sizeof(uint64_t), lines * sizeof(uint64_t));
+    diff_shrink(diff->starts[s], (cap + 1) * sizeof(size_t), (lines + 1) * sizeof(size_t));
+    diff->lines[s] = lines;
+    return 0;
+}
+
+/// @brief Publishes the pending hunk, waking the view for the first one and every WAKE_EVERY after.
+static void diff_publish(struct Diff* diff)
+{
+    struct DiffHunk* hunk = &diff->pending;
+    diff->hasPending = 0;
+    if (diff->count == DIFF_HUNKS_MAX)
+        return;
+
+    for (int s = 0; s < 2; s++)
+    {
+        size_t first = hunk->line[s] - diff->skipped;
+        hunk->pos[s] = diff->starts[s][first];
+        hunk->len[s] = diff->starts[s][first + hunk->count[s]] - hunk->pos[s];
+    }
+
+    diff->hunks[diff->count] = *hunk;
+    __atomic_store_n(&diff->count, diff->count + 1, __ATOMIC_RELEASE);
+    if (diff->count % WAKE_EVERY == 1)
+    {
+        uint64_t one = 1;
+        write(diff->wake, &one, sizeof(one));
+    }
+}
+
+/// @brief Notes that lines a0..a1 of the old side became b0..b1 of the new one. Changes arrive in order, so one which
+/// doesn't continue the pending hunk means a line in common came between and the pending hunk is final.
+static void diff_change(struct Diff* diff, long a0, long a1, long b0, long b1)
+{
+    struct DiffHunk* hunk = &diff->pending;
+    if (diff->hasPending && hunk->line[0] + hunk->count[0] == diff->skipped + a0 &&
+        hunk->line[1] + hunk->count[1] == diff->skipped + b0)
+    {
+        hunk->count[0] += a1 - a0;
+        hunk->count[1] += b1 - b0;
+        return;
+    }
+
+    if (diff->hasPending)
+        diff_publish(diff);
+
+    *hunk = (struct DiffHunk){ .line = { diff->skipped + a0, diff->skipped + b0 }, .count = { a1 - a0, b1 - b0 } };
+    diff->hasPending = 1;
+}
+
+/// @brief Finds where to split two runs of lines, the middle snake of Myers' linear space refinement. Past maxCost it
+/// settles for the furthest reaching path found from either end, which keeps huge unrelated inputs from going quadratic.
+static void diff_split(struct Diff* diff, long off1, long lim1, long off2, long lim2, long* s1, long* s2)
+{
+    const uint64_t* ha = diff->hashes[0];
+    const uint64_t* hb = diff->hashes[1];
+    long* kvdf = diff->forward;
+    long* kvdb = diff->backward;
+    long dmin = off1 - lim2;
+    long dmax = lim1 - off2;
+    long fmid = off1 - off2;
+    long bmid = lim1 - lim2;
+    long odd = (fmid - bmid) & 1;
+    long fmin = fmid, fmax = fmid;
+    long bmin = bmid, bmax = bmid;
+    kvdf[fmid] = off1;
+    kvdb[bmid] = lim1;
+
+    for (long cost = 1;; cost++)
+    {
+        long d, i1, i2;
+        if (fmin > dmin)
+            kvdf[--fmin - 1] = -1;
+        else
+            ++fmin;
+        if (fmax < dmax)
+            kvdf[++fmax + 1] = -1;
+        else
+            --fmax;
+
+        for (d = fmax; d >= fmin; d -= 2)
+        {
+            i1 = kvdf[d - 1] >= kvdf[d + 1] ? kvdf[d - 1] + 1 : kvdf[d + 1];
+            i2 = i1 - d;
+            for (; i1 < lim1 && i2 < lim2 && ha[i1] == hb[i2]; i1++, i2++)
+                ;
+            kvdf[d] = i1;
+            if (odd && bmin <= d && d <= bmax && kvdb[d] <= i1)
+            {
+                *s1 = i1;
+                *s2 = i2;
+                return;
+            }
+        }
+
+        if (bmin > dmin)
+            kvdb[--bmin - 1] = LONG_MAX;
+        else
+            ++bmin;
+        if (bmax < dmax)
+            kvdb[++bmax + 1] = LONG_MAX;
+        else
+            --bmax;
+
+        for (d = bmax; d >= bmin; d -= 2)
+        {
+            i1 = kvdb[d - 1] < kvdb[d + 1] ? kvdb[d - 1] : kvdb[d + 1] - 1;
+            i2 = i1 - d;
+            for (; i1 > off1 && i2 > off2 && ha[i1 - 1] == hb[i2 - 1]; i1--, i2--)
+                ;
+            kvdb[d] = i1;
+            if (!odd && fmin <= d && d <= fmax && i1 <= kvdf[d])
+            {
+                *s1 = i1;
+                *s2 = i2;
+                return;
+            }
+        }
+
+        if (cost < diff->maxCost && !__atomic_load_n(&diff->cancel, __ATOMIC_RELAXED))
+            continue;
+
+        long fbest = -1, fbest1 = -1;
+        for (d = fmax; d >= fmin; d -= 2)
+        {
+            i1 = kvdf[d] < lim1 ? kvdf[d] : lim1;
+            i2 = i1 - d;
+            if (lim2 < i2)
+            {
+                i1 = lim2 + d;
+                i2 = lim2;
+            }
+            if (fbest < i1 + i2)
+            {
+                fbest = i1 + i2;
+                fbest1 = i1;
+            }
+        }
+
+        long bbest = LONG_MAX, bbest1 = LONG_MAX;
+        for (d = bmax; d >= bmin; d -= 2)
+        {
+            i1 = kvdb[d] > off1 ? kvdb[d] : off1;
+            i2 = i1 - d;
+            if (i2 < off2)
+            {
+                i1 = off2 + d;
+                i2 = off2;
+            }
+            if (i1 + i2 < bbest)
+            {
+                bbest = i1 + i2;
+                bbest1 = i1;
+            }
+        }
+
+        if ((lim1 + lim2) - bbest < fbest - (off1 + off2))
+        {
+            *s1 = fbest1;
+            *s2 = fbest - fbest1;
+        }
+        else
+        {
+            *s1 = bbest1;
+            *s2 = bbest - bbest1;
+        }
+        return;
+    }
+}
+
+/// @brief Diffs two runs of lines, left half first so changes come out in order. The right half is looped on rather
+/// than recursed into.
+static int diff_compare(struct Diff* diff, long off1, long lim1, long off2, long lim2)
+{
+    const uint64_t* ha = diff->hashes[0];
+    const uint64_t* hb = diff->hashes[1];
+    while (1)
+    {
+        if (__atomic_load_n(&diff->cancel, __ATOMIC_RELAXED))
+            return -1;
+
+        for (; off1 < lim1 && off2 < lim2 && ha[off1] == hb[off2]; off1++, off2++)
+            ;
+        for (; off1 < lim1 && off2 < lim2 && ha[lim1 - 1] == hb[lim2 - 1]; lim1--, lim2--)
+            ;
+
+        if (off1 == lim1 || off2 == lim2)
+        {
+            if (off1 < lim1 || off2 < lim2)
+                diff_change(diff, off1, lim1, off2, lim2);
+            return 0;
+        }
+
+        long s1, s2;
+        diff_split(diff, off1, lim1, off2, lim2, &s1, &s2);
+        // A split which doesn't cut anything off can only come from giving up, the rest is one change.
+        if ((s1 == off1 && s2 == off2) || (s1 == lim1 && s2 == lim2))
+        {
+            diff_change(diff, off1, lim1, off2, lim2);
+            return 0;
+        }
+
+        if (diff_compare(diff, off1, s1, off2, s2) != 0)
+            return -1;
+
+        off1 = s1;
+        off2 = s2;
+    }
+}
+
+/// @brief Body of the thread, skipping what both sides have in common at either end and diffing the lines between.
+static void* diff_run(void* arg)
+{
+    struct Diff* diff = arg;
+    const struct Text* a = diff->side;
+    const struct Text* b = diff->side + 1;
+    size_t prefix = diff_common_start(a, b);
+    if (prefix < a->len || prefix < b->len)
+    {
+        size_t limit = (a->len < b->len ? a->len : b->len) - prefix;
+        size_t suffix = diff_common_end(a, b, limit);
+
+        // Only whole lines are skipped, the prefix goes back to the start of its line and the suffix only starts after
+        // its first newline. Bytes before the prefix are the same on both sides, so its line starts at the same place.
+        size_t from = text_rchr(a, prefix, '\n') + 1;
+        size_t cut = 0;
+        if (suffix > 0)
+        {
+            size_t nl = text_chr(a, a->len - suffix, '\n');
+            cut = nl < a->len ? a->len - nl - 1 : 0;
+        }
+
+        diff->skipped = diff_newlines(a, 0, from);
+        if (diff_hash(diff, 0, from, a->len - cut) == 0 && diff_hash(diff, 1, from, b->len - cut) == 0)
+        {
+            long ndiags = diff->lines[0] + diff->lines[1] + 3;
+            long* paths = diff_map((2 * ndiags + 2) * sizeof(long));
+            if (paths != NULL)
+            {
+                diff->forward = paths + diff->lines[1] + 1;
+                diff->backward = diff->forward + ndiags;
+                diff->maxCost = DIFF_COST_MIN;
+                while (diff->maxCost * diff->maxCost < ndiags)
+                    diff->maxCost *= 2;
+
+                diff_compare(diff, 0, diff->lines[0], 0, diff->lines[1]);
+            }
+        }
+    }
+
+    if (diff->hasPending)
+        diff_publish(diff);
+
+    __atomic_store_n(&diff->complete, 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    write(diff->wake, &one, sizeof(one));
+    return NULL;
+}
+
+/// @brief Starts the thread once both sides are in place.
+static int diff_launch(struct Diff* diff, const char* names[2])
+{
+    for (int s = 0; s < 2; s++)
+        snprintf(diff->name[s], sizeof(diff->name[s]), "%s", names[s]);
+
+    diff->hunks = diff_map(DIFF_HUNKS_MAX * sizeof(struct DiffHunk));
+    diff->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, DIFF_STACK);
+    int failed = diff->hunks == NULL || diff->wake < 0 || pthread_create(&diff->thread, &attr, diff_run, diff) != 0;
+    pthread_attr_destroy(&attr);
+    if (failed)
+    {
+        diff_free(diff);
+        return -1;
+    }
+
+    diff->started = 1;
+    return 0;
+}
+
+int diff_start(struct Diff* diff, const struct Text* old, const struct Text* new, const char* names[2])
+{
+    *diff = (struct Diff){ .wake = -1 };
+    if (text_snapshot(diff->side, old) != 0 || text_snapshot(diff->side + 1, new) != 0)
+    {
+        diff_free(diff);
+        return -1;
+    }
+
+    return diff_launch(diff, names);
+}
+
+int diff_file(struct Diff* diff, const char* path, const struct Text* text, const char* name)
+{
+    *diff = (struct Diff){ .wake = -1 };
+    int handle = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (handle < 0 || fstat(handle, &st) != 0)
+    {
+        if (handle >= 0)
+            close(handle);
+        return -1;
+    }
+
+    diff->mappedLen = st.st_size;
+    diff->mapped = diff->mappedLen > 0 ? mmap(NULL, diff->mappedLen, PROT_READ, MAP_PRIVATE, handle, 0) : NULL;
+    close(handle);
+    if (diff->mapped == MAP_FAILED)
+    {
+        diff->mapped = NULL;
+        return -1;
+    }
+
+    if (text_init(diff->side, diff->mapped, diff->mappedLen) != 0 || text_snapshot(diff->side + 1, text) != 0)
+    {
+        diff_free(diff);
+        return -1;
+    }
+
+    const char* names[2] = { "disk", name };
+    return diff_launch(diff, names);
+}
+
+void diff_wait(struct Diff* diff)
+{
+    if (diff->started)
+        pthread_join(diff->thread, NULL);
+    diff->started = 0;
+}
+
+void diff_free(struct Diff* diff)
+{
+    __atomic_store_n(&diff->cancel, 1, __ATOMIC_RELAXED);
+    diff_wait(diff);
+
+    for (int s = 0; s < 2; s++)
+    {
+        diff_unmap(diff->hashes[s], diff->lines[s] * sizeof(uint64_t));
+        diff_unmap(diff->starts[s], (diff->lines[s] + 1) * sizeof(size_t));
+        text_free(diff->side + s);
+    }
+
+    if (diff->forward != NULL)
+    {
+        long ndiags = diff->lines[0] + diff->lines[1] + 3;
+        diff_unmap(diff->forward - diff->lines[1] - 1, (2 * ndiags + 2) * sizeof(long));
+    }
+
+    diff_unmap(diff->hunks, DIFF_HUNKS_MAX * sizeof(struct DiffHunk));
+    if (diff->mapped != NULL)
+        munmap(diff->mapped, diff->mappedLen);
+    if (diff->wake >= 0)
+        close(diff->wake);
+    *diff = (struct Diff){ .wake = -1 };
+}
+
+const struct DiffHunk* diff_hunk(const struct Diff* diff, size_t i)
+{
+    return diff->hunks + i;
+}
+
+size_t diff_count(const struct Diff* diff)
+{
+    return __atomic_load_n(&diff->count, __ATOMIC_ACQUIRE);
+}
+
+int diff_fd(const struct Diff* diff)
+{
+    return diff->wake;
+}
+
+void diff_move(struct Diff* diff, long delta)
+{
+    size_t count = diff_count(diff);
+    while (delta > 0 && diff->hunk < count)
+    {
+        const struct DiffHunk* hunk = diff->hunks + diff->hunk;
+        size_t last = hunk->count[0] + hunk->count[1];
+        if (diff->row < last)
+        {
+            size_t step = last - diff->row < (size_t)delta ? last - diff->row : (size_t)delta;
+            diff->row += step;
+            delta -= step;
+        }
+        else if (diff->hunk + 1 < count)
+        {
+            diff->hunk++;
+            diff->row = 0;
+            delta--;
+        }
+        else
+            break;
+    }
+
+    while (delta < 0)
+    {
+        if (diff->row > 0)
+        {
+            size_t step = diff->row < (size_t)-delta ? diff->row : (size_t)-delta;
+            diff->row -= step;
+            delta += step;
+        }
+        else if (diff->hunk > 0)
+        {
+            diff->hunk--;
+            diff->row = diff->hunks[diff->hunk].count[0] + diff->hunks[diff->hunk].count[1];
+            delta++;
+        }
+        else
+            break;
+    }
+}
+
+/// @brief Writes a row of text, cut off or padded to the width.
+static void diff_text(char* dst, int cols, const char* text, int len)
+{
+    len = len < cols ? len : cols;
+    memcpy(dst, text, len);
+    memset(dst + len, ' ', cols - len);
+}
+
+void diff_render(struct Diff* diff, char* dst, int rows, int cols)
+{
+    if (rows <= 0)
+        return;
+
+    size_t count = diff_count(diff);
+    int complete = __atomic_load_n(&diff->complete, __ATOMIC_ACQUIRE);
+    char line[256];
+    int len = snprintf(line, sizeof(line), "%s -> %s, %zu hunk%s%s", diff->name[0], diff->name[1], count,
+                       count == 1 ? "" : "s", complete ? "" : " so far");
+    diff_text(dst, cols, line, len < (int)sizeof(line) ? len : (int)sizeof(line) - 1);
+    dst += cols;
+
+    if (count == 0)
+    {
+        memset(dst, ' ', (size_t)(rows - 1) * cols);
+        if (rows > 1)
+            diff_text(dst, cols, complete ? "No differences." : "Diffing...", complete ? 15 : 10);
+        return;
+    }
+
+    size_t h = diff->hunk;
+    size_t r = diff->row;
+    for (int y = 1; y < rows; y++, dst += cols)
+    {
+        if (h >= count)
+        {
+            memset(dst, ' ', cols);
+            continue;
+        }
+
+        const struct DiffHunk* hunk = diff->hunks + h;
+        if (r == 0)
+        {
+            // Unified diff numbering, an empty side gives the line before it.
+            len = snprintf(line, sizeof(line), "@@ -%zu,%zu +%zu,%zu @@",
+                           hunk->line[0] + (hunk->count[0] > 0), hunk->count[0],
+                           hunk->line[1] + (hunk->count[1] > 0), hunk->count[1]);
+            diff_text(dst, cols, line, len);
+        }
+        else
+        {
+            int s = r <= hunk->count[0] ? 0 : 1;
+            size_t i = hunk->line[s] - diff->skipped + (s == 0 ? r - 1 : r - 1 - hunk->count[0]);
+            size_t pos = diff->starts[s][i];
+            size_t end = diff->starts[s][i + 1];
+            end -= end > pos && text_at(diff->side + s, end - 1) == '\n';
+
+            dst[0] = s == 0 ? '-' : '+';
+            size_t shown = end - pos < (size_t)cols - 1 ? end - pos : (size_t)cols - 1;
+            text_read(diff->side + s, pos, dst + 1, shown);
+            memset(dst + 1 + shown, ' ', cols - 1 - shown);
+        }
+
+        if (++r > hunk->count[0] + hunk->count[1])
+        {
+            h++;
+            r = 0;
+        }
+    }
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "text.h"
+
+// Hunks go into a reservation which never moves, so the view can read them while more are being found.
+#define DIFF_HUNKS_MAX ((size_t)1 << 26)
+// Edit cost past which a split settles for the furthest reaching path instead of the shortest, as xdiff does.
+#define DIFF_COST_MIN 256
+
+/// @brief A run of lines which differ, count lines from line of one side became count lines from line of the other.
+/// Side 0 is the old document and side 1 the new one.
+struct DiffHunk
+{
+    /// @brief First line, counting from 0.
+    size_t line[2];
+    size_t count[2];
+    /// @brief Byte range of the lines, newlines included.
+    size_t pos[2];
+    size_t len[2];
+};
+
+/// @brief A diff between snapshots of two documents, worked out on its own thread and read as it streams in.
+struct Diff
+{
+    /// @brief Snapshots of both sides, fixed for the life of the diff so the thread and the view can both read them.
+    struct Text side[2];
+    /// @brief Mapping owned by the diff, for a side read from disk.
+    char* mapped;
+    size_t mappedLen;
+    /// @brief Titles of both sides, shown in the view.
+    char name[2][64];
+    pthread_t thread;
+    int started;
+    /// @brief Set to stop the thread early.
+    int cancel;
+    /// @brief Hunks published so far, read with acquire, and whether no more are coming.
+    struct DiffHunk* hunks;
+    size_t count;
+    int complete;
+    /// @brief eventfd written whenever hunks are published.
+    int wake;
+    /// @brief Hunk and row within it at the top of the view, the header of a hunk being its row 0.
+    size_t hunk;
+    size_t row;
+    // Everything past here belongs to the thread, which maps what it needs itself since mzalloc is single threaded.
+    /// @brief Fingerprints of the lines between the common prefix and suffix of each side, and their starts with the
+    /// end of the last one after them. Starts are read by the view too, they're in place before any hunk is published.
+    uint64_t* hashes[2];
+    size_t* starts[2];
+    size_t lines[2];
+    /// @brief Lines in the common prefix, added to every line number.
+    size_t skipped;
+    /// @brief Myers' forward and backward furthest reaching paths, both indexed by diagonal.
+    long* forward;
+    long* backward;
+    long maxCost;
+    /// @brief Hunk being built, published once a line in common follows it.
+    struct DiffHunk pending;
+    int hasPending;
+};
+
+/// @brief Starts diffing two documents in the background, the snapshots are taken before returning so either may be
+/// edited straight away.
+/// @param diff The diff to be started.
+/// @param old The old side.
+/// @param new The new side.
+/// @param names Titles of the old and new side.
+/// @return 0 if successful, otherwise -1.
+int diff_start(struct Diff* diff, const struct Text* old, const struct Text* new, const char* names[2]);
+
+/// @brief Starts diffing a file as it is on disk against a document.
+/// @param diff The diff to be started.
+/// @param path Path of the file, the old side.
+/// @param text The document, the new side.
+/// @param name Title of the document.
+/// @return 0 if successful, otherwise -1.
+int diff_file(struct Diff* diff, const char* path, const struct Text* text, const char* name);
+
+/// @brief Stops the thread if it's still going and releases everything.
+void diff_free(struct Diff* diff);
+
+/// @brief Waits for the diff to finish, for replays which have to come out the same every time.
+void diff_wait(struct Diff* diff);
+
+/// @brief Gets a published hunk.
+/// @param diff The diff.
+/// @param i Index of the hunk, below the count read with diff_count.
+/// @return The hunk.
+const struct DiffHunk* diff_hunk(const struct Diff* diff, size_t i);
+
+/// @brief Gets the number of hunks published so far.
+size_t diff_count(const struct Diff* diff);
+
+/// @brief Gets the descriptor which becomes readable when hunks are published, reading it clears it.
+int diff_fd(const struct Diff* diff);
+
+/// @brief Scrolls the view, keeping it within the hunks published so far.
+/// @param diff The diff.
+/// @param delta Rows to scroll by.
+void diff_move(struct Diff* diff, long delta);
+
+/// @brief Renders the hunks from the top of the view inline, a header row per hunk then its old lines and its new ones.
+/// @param diff The diff.
+/// @param dst rows * cols cells, no terminators.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+void diff_render(struct Diff* diff, char* dst, int rows, int cols);
+
+/// @brief Finds how many bytes two runs have in common from the start, 32 at a time.
+/// @return Length of the common prefix.
+size_t diff_prefix(const char* a, const char* b, size_t len);
+
+/// @brief Finds how many bytes two runs have in common from the end, 32 at a time.
+/// @return Length of the common suffix.
+size_t diff_suffix(const char* a, const char* b, size_t len);
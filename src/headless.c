@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include "headless.h"
+#include "trace.h"
+
+// Screen parser states.
+#define SCREEN_TEXT 0
+#define SCREEN_ESCAPE 1
+#define SCREEN_CSI 2
+#define SCREEN_OSC 3
+
+struct KeyName
+{
+    const char* name;
+    const char* seq;
+};
+
+static const struct KeyName names[] = {
+    { "up", "\x1b[A" },
+    { "down", "\x1b[B" },
+    { "right", "\x1b[C" },
+    { "left", "\x1b[D" },
+    { "enter", "\r" },
+    { "tab", "\t" },
+    { "esc", "\x1b" },
+    { "backspace", "\x7f" },
+    { "space", " " },
+    { "f2", "\x1bOQ" },
+    { "pgup", "\x1b[5~" },
+    { "pgdn", "\x1b[6~" },
+};
+
+/// @brief Appends a key to a script, growing it as needed.
+static int script_push(struct Script* script, const char* seq, int len, int* cap)
+{
+    if (script->count == *cap)
+    {
+        int grow = *cap == 0 ? 256 : *cap * 2;
+        char (*keys)[KEY_MAX] = realloc(script->keys, grow * KEY_MAX);
+        if (keys == NULL)
+            return -1;
+
+        script->keys = keys;
+        *cap = grow;
+    }
+
+    memset(script->keys[script->count], 0, KEY_MAX);
+    memcpy(script->keys[script->count], seq, len);
+    script->count++;
+    return 0;
+}
+
+/// @brief Parses a single script line, without its repeat, into a run of keys.
+static int script_parse(const char* line, char (*keys)[KEY_MAX], int* lens, int max)
+{
+    int len = strlen(line);
+    if (len >= 2 && line[0] == '"' && line[len - 1] == '"')
+    {
+        int n = 0;
+        for (int i = 1; i < len - 1 && n < max; i++, n++)
+        {
+            keys[n][0] = line[i];
+            lens[n] = 1;
+        }
+
+        return n;
+    }
+
+    for (int i = 0; i < sizeof(names) / sizeof(*names); i++)
+    {
+        if (strcasecmp(line, names[i].name) == 0)
+        {
+            lens[0] = strlen(names[i].seq);
+            memcpy(keys[0], names[i].seq, lens[0]);
+            return 1;
+        }
+    }
+
+    if (len == 2 && line[0] == '^')
+    {
+        keys[0][0] = toupper(line[1]) & 0x1f;
+        lens[0] = 1;
+        return 1;
+    }
+
+    if (len == 5 && strncasecmp(line, "alt+", 4) == 0)
+    {
+        keys[0][0] = '\x1b';
+        keys[0][1] = line[4];
+        lens[0] = 2;
+        return 1;
+    }
+
+    if (len == 1)
+    {
+        keys[0][0] = line[0];
+        lens[0] = 1;
+        return 1;
+    }
+
+    return -1;
+}
+
+int script_load(struct Script* script, const char* path)
+{
+    FILE* in = fopen(path, "r");
+    if (in == NULL)
+    {
+        fprintf(stderr, "Failed to open script %s.\n", path);
+        return -1;
+    }
+
+    *script = (struct Script){ 0 };
+    int cap = 0;
+    int number = 0;
+    char line[1024];
+    char keys[1024][KEY_MAX];
+    int lens[1024];
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        number++;
+        line[strcspn(line, "\r\n")] = '\0';
+
+        // Comments only start a line or follow whitespace so that # can still be typed.
+        char* comment = line[0] == '#' ? line : strstr(line, " #");
+        if (comment != NULL)
+            *comment = '\0';
+
+        long repeat = 1;
+        char* star = strrchr(line, '*');
+        if (star != NULL && star != line && isspace(star[-1]))
+        {
+            repeat = strtol(star + 1, NULL, 10);
+            *star = '\0';
+        }
+
+        // Trim whitespace, but leave quoted text alone.
+        char* start = line;
+        while (isspace(*start))
+            start++;
+        char* end = start + strlen(start);
+        while (end > start && isspace(end[-1]))
+            end--;
+        *end = '\0';
+
+        if (*start == '\0')
+            continue;
+
+        memset(keys, 0, sizeof(keys));
+        int n = script_parse(start, keys, lens, 1024);
+        if (n < 0 || repeat < 0)
+        {
+            fprintf(stderr, "%s:%d: unknown key \"%s\".\n", path, number, start);
+            fclose(in);
+            free(script->keys);
+            *script = (struct Script){ 0 };
+            return -1;
+        }
+
+        for (long r = 0; r < repeat; r++)
+        {
+            for (int i = 0; i < n; i++)
+            {
+                if (script_push(script, keys[i], lens[i], &cap) != 0)
+                {
+                    fclose(in);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    fclose(in);
+    return 0;
+}
+
+int script_next(struct Script* script, char* seq)
+{
+    if (script->next >= script->count)
+        return 0;
+
+    memcpy(seq, script->keys[script->next++], KEY_MAX);
+    return strnlen(seq, KEY_MAX);
+}
+
+int screen_init(struct Screen* screen, int rows, int cols)
+{
+    *screen = (struct Screen){ .rows = rows, .cols = cols };
+    screen->cells = malloc((size_t)rows * cols);
+    if (screen->cells == NULL)
+        return -1;
+
+    memset(screen->cells, ' ', (size_t)rows * cols);
+    return 0;
+}
+
+/// @brief Runs a finished control sequence.
+static void screen_control(struct Screen* screen, char final)
+{
+    int* params = screen->params;
+    switch (final)
+    {
+    case 'H':
+    case 'f':
+        screen->row = (params[0] > 0 ? params[0] : 1) - 1;
+        screen->col = (params[1] > 0 ? params[1] : 1) - 1;
+        screen->row = screen->row < screen->rows ? screen->row : screen->rows - 1;
+        screen->col = screen->col < screen->cols ? screen->col : screen->cols - 1;
+        screen->wrap = 0;
+        break;
+    case 'J':
+        if (params[0] == 2)
+        {
+            memset(screen->cells, ' ', (size_t)screen->rows * screen->cols);
+            screen->frames++;
+        }
+        break;
+    // Attributes aren't kept, so SGR and anything else is swallowed.
+    default:
+        break;
+    }
+}
+
+void screen_feed(struct Screen* screen, const char* data, size_t len)
+{
+    screen->bytes += len;
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = data[i];
+        switch (screen->state)
+        {
+        case SCREEN_TEXT:
+            if (c == '\x1b')
+                screen->state = SCREEN_ESCAPE;
+            else if (c == '\r')
+            {
+                screen->col = 0;
+                screen->wrap = 0;
+            }
+            else if (c == '\n')
+            {
+                screen->row += screen->row + 1 < screen->rows;
+                screen->wrap = 0;
+            }
+            else if (c >= ' ' && c != 0x7f && screen->row < screen->rows)
+            {
+                // Wrap like a terminal with autowrap, which stays on the last cell of a row until the next character
+                // comes. The last cell of the screen just stays put.
+                if (screen->wrap && screen->row + 1 < screen->rows)
+                {
+                    screen->col = 0;
+                    screen->row++;
+                }
+
+                screen->wrap = 0;
+                screen->cells[screen->row * screen->cols + screen->col] = c;
+                if (screen->col + 1 < screen->cols)
+                    screen->col++;
+                else
+                    screen->wrap = 1;
+            }
+            break;
+        case SCREEN_ESCAPE:
+            if (c == '[')
+            {
+                screen->state = SCREEN_CSI;
+                screen->params[0] = screen->params[1] = 0;
+                screen->param = 0;
+            }
+            else if (c == ']')
+                screen->state = SCREEN_OSC;
+            else
+                screen->state = SCREEN_TEXT;
+            break;
+        case SCREEN_OSC:
+            // Operating system commands such as clipboard exports don't draw anything, they end at BEL or ESC \.
+            if (c == '\a')
+                screen->state = SCREEN_TEXT;
+            else if (c == '\x1b')
+                screen->state = SCREEN_ESCAPE;
+            break;
+        case SCREEN_CSI:
+            // Control characters inside a sequence are run by a terminal, none of them matter here.
+            if (c < ' ')
+                break;
+
+            if (isdigit(c))
+            {
+                if (screen->param < 2)
+                    screen->params[screen->param] = screen->params[screen->param] * 10 + c - '0';
+            }
+            else if (c == ';')
+                screen->param++;
+            else if (c >= '@' && c <= '~')
+            {
+                screen_control(screen, c);
+                screen->state = SCREEN_TEXT;
+            }
+            break;
+        }
+    }
+}
+
+void screen_dump(struct Screen* screen, FILE* out)
+{
+    for (int i = 0; i < screen->rows; i++)
+    {
+        char* row = screen->cells + i * screen->cols;
+        int len = screen->cols;
+        while (len > 0 && row[len - 1] == ' ')
+            len--;
+
+        fwrite(row, 1, len, out);
+        fputc('\n', out);
+    }
+}
+
+void headless_report(FILE* out, struct Script* script, struct Screen* screen, uint64_t elapsed)
+{
+    double secs = elapsed / 1e9;
+    fprintf(out, "keys %d/%d in %.3fms, %.0f keys/s\n", script->next, script->count, elapsed / 1e6,
+        secs > 0 ? script->next / secs : 0);
+    fprintf(out, "frames %llu, %.1f bytes/frame, %.2f MB/s rendered\n", (unsigned long long)screen->frames,
+        screen->frames > 0 ? (double)screen->bytes / screen->frames : 0, secs > 0 ? screen->bytes / secs / 1e6 : 0);
+
+    fprintf(out, "%-8s %10s %12s %12s %12s %12s\n", "stage", "count", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns");
+    for (int i = 0; i < NUM_TRACES; i++)
+    {
+        fprintf(out, "%-8s %10llu %12llu %12llu %12llu %12llu\n", trace_name(i), (unsigned long long)trace_count(i),
+            (unsigned long long)trace_percentile(i, 50), (unsigned long long)trace_percentile(i, 90),
+            (unsigned long long)trace_percentile(i, 99), (unsigned long long)trace_percentile(i, 99.9));
+    }
+}
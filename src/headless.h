@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Longest key sequence which can be replayed, matches what processKeys reads at once.
+#define KEY_MAX 4
+
+/// @brief A keystroke script, one key per line:
+///   up, down, left, right, enter, tab, esc, backspace, space, f2, pgup, pgdn - named keys.
+///   ^X - control key, alt+x - escape prefixed key.
+///   "text" - every byte of the text as its own key.
+///   x - any other single character is typed as is.
+/// Any line may be followed by *N to repeat it N times, # starts a comment.
+struct Script
+{
+    char (*keys)[KEY_MAX];
+    int count;
+    int next;
+};
+
+/// @brief An in-memory terminal, understands just enough of the escape sequences pipit emits to keep a screen.
+struct Screen
+{
+    int rows;
+    int cols;
+    /// @brief Cursor position, zero-based.
+    int row;
+    int col;
+    /// @brief Whether the last cell of a row was just written, the next character goes on the next row.
+    int wrap;
+    /// @brief rows * cols characters, no terminators.
+    char* cells;
+    /// @brief Number of screen clears seen, each frame starts with one.
+    uint64_t frames;
+    /// @brief Total bytes fed.
+    uint64_t bytes;
+    /// @brief Escape sequence parser state, sequences can be split between feeds.
+    int state;
+    int params[2];
+    int param;
+};
+
+/// @brief Loads a keystroke script.
+/// @param script The script to be filled out.
+/// @param path The path of the script file.
+/// @return 0 if successful, otherwise -1 and the line which failed is printed to stderr.
+int script_load(struct Script* script, const char* path);
+
+/// @brief Pops the next key of a script.
+/// @param script The script to be replayed.
+/// @param seq Receives the key, zero padded out to KEY_MAX.
+/// @return Length of the key, 0 if the script has finished.
+int script_next(struct Script* script, char* seq);
+
+/// @brief Initializes a blank screen.
+/// @param screen The screen to be initialized.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+/// @return 0 if successful, otherwise -1.
+int screen_init(struct Screen* screen, int rows, int cols);
+
+/// @brief Feeds terminal output to a screen, as if it were written to a terminal.
+/// @param screen The screen to be written to.
+/// @param data The bytes written.
+/// @param len Number of bytes written.
+void screen_feed(struct Screen* screen, const char* data, size_t len);
+
+/// @brief Prints the screen contents, one line per row with trailing spaces trimmed.
+/// @param screen The screen to be printed.
+/// @param out The stream to be printed to.
+void screen_dump(struct Screen* screen, FILE* out);
+
+/// @brief Prints the throughput of a replayed script and the per-frame timings traced while replaying it.
+/// @param out The stream to be printed to.
+/// @param script The replayed script.
+/// @param screen The screen which was rendered to.
+/// @param elapsed Wall time of the replay in nanoseconds.
+void headless_report(FILE* out, struct Script* script, struct Screen* screen, uint64_t elapsed);
@@ -0,0 +1,101 @@
+#include <string.h>
+#include <immintrin.h>
+#include "hex.h"
+
+// Columns between the offset and the hex, and from the start of the hex to the end of the row.
+#define HEX_GAP 2
+#define HEX_BODY (HEX_ROW * 3 + 1 + HEX_ROW + 1)
+#define HEX_WIDTH_MAX (16 + HEX_GAP + HEX_BODY)
+
+int hex_margin(size_t len)
+{
+    int digits = 8;
+    while (digits < 16 && len > ((size_t)1 << (digits * 4)) - 1)
+        digits++;
+
+    return digits;
+}
+
+int hex_column(int margin, size_t pos)
+{
+    return margin + HEX_GAP + pos % HEX_ROW * 3;
+}
+
+/// @brief Spreads the hex of 16 bytes out as "xx " 48 times over, a nibble a lane and a shuffle per 16 columns.
+static inline void hex_bytes(char* dst, __m128i v)
+{
+    const __m128i digits = _mm_setr_epi8('0', '1', '2', '3', '4', '5', '6', '7', '8', '9', 'a', 'b', 'c', 'd', 'e', 'f');
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i space = _mm_set1_epi8(' ');
+    // -1 lanes of a shuffle come out as 0, they're the spaces between bytes.
+    const __m128i spread[3] = {
+        _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10),
+        _mm_setr_epi8(3, -1, 4, 5, -1, 6, 7, -1, 8, 9, -1, 10, 11, -1, 12, 13),
+        _mm_setr_epi8(-1, 6, 7, -1, 8, 9, -1, 10, 11, -1, 12, 13, -1, 14, 15, -1),
+    };
+
+    __m128i high = _mm_shuffle_epi8(digits, _mm_and_si128(_mm_srli_epi16(v, 4), nibble));
+    __m128i low = _mm_shuffle_epi8(digits, _mm_and_si128(v, nibble));
+    // Digits of bytes 0 to 7, 4 to 11 and 8 to 15.
+    __m128i first = _mm_unpacklo_epi8(high, low);
+    __m128i last = _mm_unpackhi_epi8(high, low);
+    __m128i sources[3] = { first, _mm_alignr_epi8(last, first, 8), last };
+
+    for (int i = 0; i < 3; i++)
+    {
+        __m128i gaps = _mm_and_si128(_mm_cmplt_epi8(spread[i], _mm_setzero_si128()), space);
+        _mm_storeu_si128((__m128i*)(dst + i * 16), _mm_or_si128(_mm_shuffle_epi8(sources[i], spread[i]), gaps));
+    }
+}
+
+void hex_row(char* dst, int cols, size_t offset, int margin, const unsigned char* bytes, int count)
+{
+    static const char digits[] = "0123456789abcdef";
+    char row[HEX_WIDTH_MAX];
+    for (int i = margin - 1; i >= 0; i--, offset >>= 4)
+        row[i] = digits[offset & 15];
+    memset(row + margin, ' ', HEX_GAP);
+
+    unsigned char padded[HEX_ROW] = { 0 };
+    memcpy(padded, bytes, count);
+    __m128i v = _mm_loadu_si128((const __m128i*)padded);
+    char* body = row + margin + HEX_GAP;
+    hex_bytes(body, v);
+
+    // Printable is 0x20 to 0x7e, the compares are signed so everything above 0x7f falls out too.
+    __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1f)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7f)));
+    body[HEX_ROW * 3] = '|';
+    _mm_storeu_si128((__m128i*)(body + HEX_ROW * 3 + 1), _mm_blendv_epi8(_mm_set1_epi8('.'), v, printable));
+    body[HEX_ROW * 3 + 1 + HEX_ROW] = '|';
+
+    // A short last row keeps its columns lined up with the rows above it.
+    if (count < HEX_ROW)
+    {
+        memset(body + count * 3, ' ', (HEX_ROW - count) * 3);
+        body[HEX_ROW * 3 + 1 + count] = '|';
+        memset(body + HEX_ROW * 3 + 2 + count, ' ', HEX_ROW - count);
+    }
+
+    int width = margin + HEX_GAP + HEX_BODY;
+    int shown = width < cols ? width : cols;
+    memcpy(dst, row, shown);
+    memset(dst + shown, ' ', cols - shown);
+}
+
+void hex_render(const struct Text* text, size_t top, char* dst, int rows, int cols)
+{
+    int margin = hex_margin(text->len);
+    unsigned char bytes[HEX_ROW];
+    for (int i = 0; i < rows; i++, top += HEX_ROW, dst += cols)
+    {
+        // A document which fills its last row exactly gets an empty row after it, so there's somewhere for the cursor.
+        if (top > text->len)
+        {
+            memset(dst, ' ', (size_t)(rows - i) * cols);
+            return;
+        }
+
+        int count = text_read(text, top, (char*)bytes, HEX_ROW);
+        hex_row(dst, cols, top, margin, bytes, count);
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include "text.h"
+
+// Bytes shown per row, as hexdump -C does.
+#define HEX_ROW 16
+
+/// @brief Gets the width of the offset column for a document, enough digits for its last offset and never fewer than 8.
+/// @param len The length of the document.
+/// @return The width in columns.
+int hex_margin(size_t len);
+
+/// @brief Formats a row of the hex view: its offset, every byte in hex and the bytes themselves with anything
+/// unprintable shown as a dot. Rows are cut off or padded with spaces to fit.
+/// @param dst cols cells, no terminator.
+/// @param cols Number of columns.
+/// @param offset Offset of the first byte.
+/// @param margin Width of the offset column from hex_margin.
+/// @param bytes The bytes of the row.
+/// @param count Number of bytes, at most HEX_ROW.
+void hex_row(char* dst, int cols, size_t offset, int margin, const unsigned char* bytes, int count);
+
+/// @brief Renders a document as rows of hex, every row HEX_ROW bytes from a row aligned top.
+/// @param text The document.
+/// @param top Offset of the first row, a multiple of HEX_ROW.
+/// @param dst rows * cols cells, no terminators.
+/// @param rows Number of rows.
+/// @param cols Number of columns.
+void hex_render(const struct Text* text, size_t top, char* dst, int rows, int cols);
+
+/// @brief Gets the column the hex of a byte starts at.
+/// @param margin Width of the offset column from hex_margin.
+/// @param pos Offset of the byte.
+/// @return The column.
+int hex_column(int margin, size_t pos);
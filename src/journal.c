@@ -0,0 +1,625 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <linux/io_uring.h>
+#include "journal.h"
+#include "lineindex.h"
+#include "mzalloc.h"
+#include "rapidhash.h"
+
+// Completions carry the journal they're for, the low bit tells an fsync from a write.
+#define SYNC_BIT 1ull
+
+static int backend = 0;
+/// @brief Every open journal, walked when submitting and syncing.
+static struct Journal* journals[JOURNAL_MAX];
+
+/// @brief The ring and its mappings, set up once by journal_init. The kernel moves the heads of the submission
+/// queue and the tails of the completion queue, we move the other two.
+static int ring = -1;
+static unsigned* sqHead;
+static unsigned* sqTail;
+static unsigned* sqArray;
+static unsigned sqMask;
+static unsigned sqEntries;
+static struct io_uring_sqe* sqes;
+static unsigned* cqHead;
+static unsigned* cqTail;
+static unsigned cqMask;
+static struct io_uring_cqe* cqes;
+/// @brief Entries filled in but not yet published to the kernel.
+static unsigned sqFilled;
+/// @brief timerfd which fires when written journals are due an fsync.
+static int timer = -1;
+static int armed = 0;
+
+/// @brief The writer thread, which does the same as the ring when there isn't one. Journals, their pending records
+/// and their flags are only touched under the lock while it's running.
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake;
+static pthread_cond_t idle;
+
+/// @brief Gets the monotonic time in nanoseconds.
+static uint64_t journal_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// @brief Records are padded to 8 so every header is aligned.
+static inline size_t journal_pad(size_t len)
+{
+    return (len + 7) & ~(size_t)7;
+}
+
+/// @brief Writes all of a buffer, for the writer thread and the rare short write of the ring.
+static int journal_write(int fd, const char* data, size_t len, size_t off)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, data, len, off);
+        if (n <= 0)
+            return -1;
+
+        data += n;
+        len -= n;
+        off += n;
+    }
+
+    return 0;
+}
+
+/// @brief Hands the pending records over to be written, the old flight buffer takes new records from now on.
+static void journal_swap(struct Journal* journal)
+{
+    char* buffer = journal->flight;
+    size_t cap = journal->flightCap;
+    journal->flight = journal->pending;
+    journal->flightLen = journal->pendingLen;
+    journal->flightCap = journal->pendingCap;
+    journal->pending = buffer;
+    journal->pendingLen = 0;
+    journal->pendingCap = cap;
+    journal->writing = 1;
+}
+
+/// @brief Sets up the ring, its three mappings and the fsync timer.
+static int journal_ring()
+{
+    struct io_uring_params params = { 0 };
+    ring = syscall(__NR_io_uring_setup, JOURNAL_RING, &params);
+    if (ring < 0)
+        return -1;
+
+    size_t sqLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqLen = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    int single = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (single)
+        sqLen = cqLen = sqLen > cqLen ? sqLen : cqLen;
+
+    char* sq = mmap(NULL, sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_SQ_RING);
+    char* cq = single ? sq : mmap(NULL, cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring, IORING_OFF_CQ_RING);
+    sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                ring, IORING_OFF_SQES);
+    timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED || timer < 0)
+    {
+        // Leaking the odd mapping is fine, this only ever happens once and the thread takes over.
+        close(ring);
+        ring = -1;
+        return -1;
+    }
+
+    sqHead = (unsigned*)(sq + params.sq_off.head);
+    sqTail = (unsigned*)(sq + params.sq_off.tail);
+    sqArray = (unsigned*)(sq + params.sq_off.array);
+    sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    sqEntries = params.sq_entries;
+    sqFilled = *sqTail;
+    cqHead = (unsigned*)(cq + params.cq_off.head);
+    cqTail = (unsigned*)(cq + params.cq_off.tail);
+    cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+/// @brief Gets the next free submission queue entry, NULL if the queue is full.
+static struct io_uring_sqe* journal_sqe()
+{
+    if (sqFilled - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries)
+        return NULL;
+
+    unsigned index = sqFilled++ & sqMask;
+    sqArray[index] = index;
+    memset(sqes + index, 0, sizeof(struct io_uring_sqe));
+    return sqes + index;
+}
+
+/// @brief Publishes every entry filled in and submits them, waiting for at least wait completions.
+static void journal_enter(unsigned wait)
+{
+    __atomic_store_n(sqTail, sqFilled, __ATOMIC_RELEASE);
+    unsigned count = sqFilled - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE);
+    if (count > 0 || wait > 0)
+        syscall(__NR_io_uring_enter, ring, count, wait, wait > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+}
+
+/// @brief Picks up every completed write and fsync.
+static void journal_reap()
+{
+    unsigned head = *cqHead;
+    unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe* cqe = cqes + (head & cqMask);
+        struct Journal* journal = (struct Journal*)(uintptr_t)(cqe->user_data & ~SYNC_BIT);
+        if (cqe->user_data & SYNC_BIT)
+        {
+            journal->syncing = 0;
+            continue;
+        }
+
+        // Regular files don't write short unless something is badly wrong, the rest is finished by hand if they do.
+        size_t done = cqe->res > 0 ? cqe->res : 0;
+        if (done < journal->flightLen
+            && journal_write(journal->fd, journal->flight + done, journal->flightLen - done, journal->end + done) != 0)
+            journal->failed = 1;
+
+        journal->end += journal->flightLen;
+        journal->flightLen = 0;
+        journal->writing = 0;
+        journal->dirty = 1;
+    }
+
+    __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+}
+
+/// @brief Starts the fsync timer unless it's already running.
+static void journal_arm()
+{
+    if (armed)
+        return;
+
+    struct itimerspec spec = { .it_value = { JOURNAL_SYNC_NS / 1000000000, JOURNAL_SYNC_NS % 1000000000 } };
+    armed = timerfd_settime(timer, 0, &spec, NULL) == 0;
+}
+
+static void* journal_writer(void* unused)
+{
+    (void)unused;
+    uint64_t due = 0;
+    pthread_mutex_lock(&lock);
+    while (1)
+    {
+        int wrote = 0;
+        for (int i = 0; i < JOURNAL_MAX; i++)
+        {
+            struct Journal* journal = journals[i];
+            if (journal == NULL || journal->pendingLen == 0 || journal->failed)
+                continue;
+
+            // The flight buffer is ours until writing is cleared, records keep being appended to the other one.
+            journal_swap(journal);
+            pthread_mutex_unlock(&lock);
+            int failed = journal_write(journal->fd, journal->flight, journal->flightLen, journal->end);
+            pthread_mutex_lock(&lock);
+
+            journal->failed |= failed;
+            journal->end += journal->flightLen;
+            journal->flightLen = 0;
+            journal->writing = 0;
+            journal->dirty = 1;
+            due = due != 0 ? due : journal_now() + JOURNAL_SYNC_NS;
+            wrote = 1;
+        }
+
+        if (due != 0 && journal_now() >= due)
+        {
+            for (int i = 0; i < JOURNAL_MAX; i++)
+            {
+                struct Journal* journal = journals[i];
+                if (journal == NULL || !journal->dirty)
+                    continue;
+
+                journal->dirty = 0;
+                journal->syncing = 1;
+                pthread_mutex_unlock(&lock);
+                fdatasync(journal->fd);
+                pthread_mutex_lock(&lock);
+                journal->syncing = 0;
+            }
+
+            due = 0;
+        }
+
+        pthread_cond_broadcast(&idle);
+        if (wrote)
+            continue;
+
+        if (due == 0)
+            pthread_cond_wait(&wake, &lock);
+        else
+        {
+            struct timespec until = { due / 1000000000, due % 1000000000 };
+            pthread_cond_timedwait(&wake, &lock, &until);
+        }
+    }
+
+    return NULL;
+}
+
+int journal_init(int want)
+{
+    if (backend != 0)
+        return 0;
+
+    if (want != JOURNAL_THREAD && journal_ring() == 0)
+    {
+        backend = JOURNAL_URING;
+        return 0;
+    }
+
+    if (want == JOURNAL_URING)
+        return -1;
+
+    // The thread waits against the monotonic clock, like the timer of the ring.
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wake, &attr);
+    pthread_cond_init(&idle, &attr);
+    pthread_condattr_destroy(&attr);
+    if (pthread_create(&writer, NULL, journal_writer, NULL) != 0)
+        return -1;
+
+    pthread_detach(writer);
+    backend = JOURNAL_THREAD;
+    return 0;
+}
+
+size_t journal_replay(struct Text* text, const char* data, size_t len, size_t* applied)
+{
+    struct Edit* batch = NULL;
+    int count = 0;
+    int cap = 0;
+    // Edits of a batch are sorted and don't overlap, anything else can't have come from text_apply.
+    size_t floor = 0;
+    size_t off = 0;
+    size_t replayed = 0;
+    *applied = 0;
+
+    while (len - off >= sizeof(struct JournalRecord))
+    {
+        const struct JournalRecord* record = (const struct JournalRecord*)(data + off);
+        size_t left = len - off - sizeof(struct JournalRecord);
+        if (record->len > left || journal_pad(record->len) > left
+            || record->hash != rapidhash((const char*)record + sizeof(uint64_t),
+                                         sizeof(struct JournalRecord) - sizeof(uint64_t) + journal_pad(record->len)))
+            break;
+
+        // Every edit of a batch agrees on its version and size, and the batch moves the document on.
+        const struct JournalRecord* first = count > 0 ? (const struct JournalRecord*)batch[0].data - 1 : record;
+        if (record->version <= text->version || record->version != first->version || record->count != first->count
+            || record->count > INT_MAX || record->pos < floor || record->pos > text->len
+            || record->del > text->len - record->pos)
+            break;
+
+        if (count == cap)
+        {
+            int grown = cap == 0 ? 16 : cap * 2;
+            struct Edit* edits = mzrealloc(batch, grown * sizeof(struct Edit));
+            if (edits == NULL)
+                break;
+
+            batch = edits;
+            cap = grown;
+        }
+
+        floor = record->pos + record->del;
+        batch[count++] = (struct Edit){ .pos = record->pos, .del = record->del, .data = (const char*)(record + 1),
+            .len = record->len };
+        off += sizeof(struct JournalRecord) + journal_pad(record->len);
+        if ((uint64_t)count < record->count)
+            continue;
+
+        // A batch torn by a crash never gets this far, its edits are dropped with it.
+        if (text_apply(text, batch, count) != 0)
+            break;
+
+        *applied += count;
+        replayed = off;
+        count = 0;
+        floor = 0;
+    }
+
+    mzfree(batch);
+    return replayed;
+}
+
+int journal_open(struct Journal* journal, const char* path, int handle, struct Text* text)
+{
+    *journal = (struct Journal){ .fd = -1 };
+    char file[PATH_MAX];
+    struct JournalHeader header = { 0 };
+    struct stat st;
+    if (journal_init(JOURNAL_AUTO) != 0 || fstat(handle, &st) != 0
+        || lineindex_cache(path, ".journal", file, &header.pathHash) != 0)
+        return -1;
+
+    // Another session editing the same file owns its journal, this one goes without.
+    int fd = open(file, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0 || flock(fd, LOCK_EX | LOCK_NB) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    header.size = st.st_size;
+    header.mtime = st.st_mtim.tv_sec;
+    header.mtimeNsec = st.st_mtim.tv_nsec;
+
+    struct stat js;
+    size_t replayed = 0;
+    if (fstat(fd, &js) == 0 && (size_t)js.st_size > sizeof(header))
+    {
+        char* map = mmap(NULL, js.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            // Records only make sense against the very file they were made on.
+            if (memcmp(map, &header, sizeof(header)) == 0)
+                replayed = journal_replay(text, map + sizeof(header), js.st_size - sizeof(header), &journal->recovered);
+            munmap(map, js.st_size);
+        }
+    }
+
+    // Whatever didn't replay is cut off, new records carry on from the last whole batch.
+    if (ftruncate(fd, sizeof(header) + replayed) != 0 || journal_write(fd, (const char*)&header, sizeof(header), 0) != 0)
+    {
+        close(fd);
+        unlink(file);
+        return -1;
+    }
+
+    journal->path = mzalloc(strlen(file) + 1);
+    if (journal->path == NULL)
+    {
+        close(fd);
+        return -1;
+    }
+
+    strcpy(journal->path, file);
+    journal->fd = fd;
+    journal->end = sizeof(header) + replayed;
+
+    pthread_mutex_lock(&lock);
+    for (int i = 0; i < JOURNAL_MAX; i++)
+    {
+        if (journals[i] == NULL)
+        {
+            journals[i] = journal;
+            pthread_mutex_unlock(&lock);
+            return 0;
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+    close(fd);
+    mzfree(journal->path);
+    *journal = (struct Journal){ .fd = -1 };
+    return -1;
+}
+
+void journal_append(struct Journal* journal, const struct Text* text, const struct Edit* edits, int n)
+{
+    if (journal->fd < 0)
+        return;
+
+    size_t need = 0;
+    for (int i = 0; i < n; i++)
+        need += sizeof(struct JournalRecord) + journal_pad(edits[i].len);
+
+    // Uncontended unless the writer is swapping buffers, and it never holds the lock across a write.
+    if (backend == JOURNAL_THREAD)
+        pthread_mutex_lock(&lock);
+
+    if (journal->failed)
+    {
+        if (backend == JOURNAL_THREAD)
+            pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    if (journal->pendingLen + need > journal->pendingCap)
+    {
+        size_t cap = journal->pendingCap < 4096 ? 4096 : journal->pendingCap;
+        while (cap < journal->pendingLen + need)
+            cap *= 2;
+
+        char* grown = mzrealloc(journal->pending, cap);
+        if (grown == NULL)
+        {
+            // Missing a batch would replay everything after it wrongly, stopping here leaves a consistent journal.
+            journal->failed = 1;
+            if (backend == JOURNAL_THREAD)
+                pthread_mutex_unlock(&lock);
+            return;
+        }
+
+        journal->pending = grown;
+        journal->pendingCap = cap;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        const struct Edit* edit = edits + i;
+        struct JournalRecord* record = (struct JournalRecord*)(journal->pending + journal->pendingLen);
+        char* bytes = (char*)(record + 1);
+        *record = (struct JournalRecord){ 0, text->version, n, edit->pos, edit->del, edit->len };
+
+        // Pieces are read straight out of their source, both sources are append only so they're still there.
+        if (edit->pieces == NULL)
+            memcpy(bytes, edit->data, edit->len);
+        else
+        {
+            size_t copied = 0;
+            for (int p = 0; p < edit->count; p++)
+            {
+                const struct Piece* piece = edit->pieces + p;
+                const char* src = piece->source == TEXT_ORIGINAL ? edit->source->original : edit->source->add;
+                memcpy(bytes + copied, src + piece->start, piece->len);
+                copied += piece->len;
+            }
+        }
+
+        memset(bytes + edit->len, 0, journal_pad(edit->len) - edit->len);
+        record->hash = rapidhash((const char*)record + sizeof(uint64_t),
+                                 sizeof(struct JournalRecord) - sizeof(uint64_t) + journal_pad(edit->len));
+        journal->pendingLen += sizeof(struct JournalRecord) + journal_pad(edit->len);
+    }
+
+    if (backend == JOURNAL_THREAD)
+        pthread_mutex_unlock(&lock);
+}
+
+void journal_submit()
+{
+    if (backend == JOURNAL_THREAD)
+    {
+        pthread_mutex_lock(&lock);
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    if (backend != JOURNAL_URING)
+        return;
+
+    journal_reap();
+    int submitted = 0;
+    for (int i = 0; i < JOURNAL_MAX; i++)
+    {
+        struct Journal* journal = journals[i];
+        if (journal == NULL || journal->writing || journal->pendingLen == 0 || journal->failed)
+            continue;
+
+        struct io_uring_sqe* sqe = journal_sqe();
+        if (sqe == NULL)
+            break;
+
+        journal_swap(journal);
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->fd = journal->fd;
+        sqe->addr = (uintptr_t)journal->flight;
+        sqe->len = journal->flightLen;
+        sqe->off = journal->end;
+        sqe->user_data = (uintptr_t)journal;
+        submitted++;
+    }
+
+    if (submitted > 0)
+    {
+        journal_enter(0);
+        journal_arm();
+    }
+}
+
+int journal_fd()
+{
+    return backend == JOURNAL_URING ? timer : -1;
+}
+
+void journal_tick()
+{
+    uint64_t expirations;
+    read(timer, &expirations, sizeof(expirations));
+    armed = 0;
+
+    journal_reap();
+    int again = 0;
+    for (int i = 0; i < JOURNAL_MAX; i++)
+    {
+        struct Journal* journal = journals[i];
+        if (journal == NULL)
+            continue;
+
+        // Writes still in flight are synced next time round.
+        again |= journal->writing || journal->pendingLen > 0;
+        if (!journal->dirty || journal->syncing)
+            continue;
+
+        struct io_uring_sqe* sqe = journal_sqe();
+        if (sqe == NULL)
+        {
+            again = 1;
+            break;
+        }
+
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = journal->fd;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = (uintptr_t)journal | SYNC_BIT;
+        journal->dirty = 0;
+        journal->syncing = 1;
+    }
+
+    journal_enter(0);
+    if (again)
+        journal_arm();
+}
+
+void journal_close(struct Journal* journal, int keep)
+{
+    if (journal->fd < 0)
+        return;
+
+    if (backend == JOURNAL_URING)
+    {
+        while (journal->writing || journal->syncing)
+        {
+            journal_enter(1);
+            journal_reap();
+        }
+    }
+
+    pthread_mutex_lock(&lock);
+    while (backend == JOURNAL_THREAD && (journal->writing || journal->syncing))
+        pthread_cond_wait(&idle, &lock);
+
+    for (int i = 0; i < JOURNAL_MAX; i++)
+    {
+        if (journals[i] == journal)
+            journals[i] = NULL;
+    }
+    pthread_mutex_unlock(&lock);
+
+    // A journal being kept is left as a crash would leave it after its last fsync.
+    if (keep)
+    {
+        if (!journal->failed && journal_write(journal->fd, journal->pending, journal->pendingLen, journal->end) == 0)
+            journal->end += journal->pendingLen;
+        fdatasync(journal->fd);
+    }
+    else
+        unlink(journal->path);
+
+    close(journal->fd);
+    mzfree(journal->path);
+    mzfree(journal->pending);
+    mzfree(journal->flight);
+    *journal = (struct Journal){ .fd = -1 };
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "text.h"
+
+#define JOURNAL_MAGIC "PIPITJNL"
+#define JOURNAL_VERSION 1
+// Journals open at once, one per document.
+#define JOURNAL_MAX 1024
+// Submission queue entries of the ring, at most a write and an fsync per journal are ever in flight.
+#define JOURNAL_RING (2 * JOURNAL_MAX)
+// How long written records may go without an fsync.
+#define JOURNAL_SYNC_NS 1000000000
+// Backends, the ring unless io_uring is unavailable, in which case a writer thread does the same work.
+#define JOURNAL_AUTO 0
+#define JOURNAL_URING 1
+#define JOURNAL_THREAD 2
+
+/// @brief Start of a journal, records only replay onto the file it was started against.
+struct JournalHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t unused;
+    uint64_t pathHash;
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtimeNsec;
+};
+
+/// @brief One edit of a batch, followed by its inserted bytes padded to 8. Every edit of a batch has the version the
+/// document reached with it, and positions from before the batch, so a batch replays as a single text_apply.
+struct JournalRecord
+{
+    /// @brief rapidhash of the rest of the record, a record torn by a crash fails it and ends the replay.
+    uint64_t hash;
+    uint64_t version;
+    /// @brief Edits in the batch, a batch is only replayed once all of them have been read.
+    uint64_t count;
+    uint64_t pos;
+    uint64_t del;
+    uint64_t len;
+};
+
+/// @brief Recovery journal of a document, edits are appended to memory as they're made and written out in batches
+/// between keys, so the keystroke path only ever copies.
+struct Journal
+{
+    /// @brief The journal file, -1 if the document isn't journaled.
+    int fd;
+    char* path;
+    /// @brief Records appended since the last write was submitted.
+    char* pending;
+    size_t pendingLen;
+    size_t pendingCap;
+    /// @brief Records being written, untouched until the write completes.
+    char* flight;
+    size_t flightLen;
+    size_t flightCap;
+    /// @brief Offset of the end of the journal once the write in flight completes.
+    size_t end;
+    int writing;
+    int syncing;
+    /// @brief Written since the last fsync.
+    int dirty;
+    /// @brief Set once a record couldn't be kept or written, nothing more is appended so the journal stays consistent.
+    int failed;
+    /// @brief Edits replayed from an earlier session when the journal was opened.
+    size_t recovered;
+};
+
+/// @brief Picks the backend, before any journal is opened. Opening a journal picks JOURNAL_AUTO otherwise.
+/// @param backend JOURNAL_AUTO, JOURNAL_URING or JOURNAL_THREAD.
+/// @return 0 if successful, otherwise -1 if the backend can't be started.
+int journal_init(int backend);
+
+/// @brief Opens the journal of a file, replaying it onto the document first if it was left by an earlier session
+/// against the same file. A journal of a file which has since changed is thrown away.
+/// The journal lives next to the file's line index, see lineindex_open.
+/// @param journal The journal, which must stay at the same address until closed.
+/// @param path The path of the file.
+/// @param handle Open descriptor of the file, for its size and modification time.
+/// @param text The document, straight after text_init.
+/// @return 0 if successful, otherwise -1 and the document isn't journaled.
+int journal_open(struct Journal* journal, const char* path, int handle, struct Text* text);
+
+/// @brief Appends a batch which has just been applied. Only copies, nothing is written until journal_submit.
+/// @param journal The journal.
+/// @param text The document, already edited.
+/// @param edits The batch as it was applied.
+/// @param n Number of edits.
+void journal_append(struct Journal* journal, const struct Text* text, const struct Edit* edits, int n);
+
+/// @brief Starts writing everything appended to every journal, as one submission to the ring or a wakeup of the
+/// writer thread, and picks up completed writes. Never waits.
+void journal_submit();
+
+/// @brief Gets the descriptor which becomes readable when journals are due an fsync, -1 if the writer thread keeps
+/// time itself.
+int journal_fd();
+
+/// @brief Handles journal_fd becoming readable, fsyncing every journal written since the last one.
+void journal_tick();
+
+/// @brief Waits for a journal's writes and closes it.
+/// @param journal The journal.
+/// @param keep Whether the file is left for the next session to recover, otherwise it's removed.
+void journal_close(struct Journal* journal, int keep);
+
+/// @brief Replays records onto a document, stopping at the first torn or foreign one.
+/// @param text The document.
+/// @param data Records, straight after the header.
+/// @param len Length of the records.
+/// @param applied Receives the number of edits replayed.
+/// @return Length of the records which replayed, anything after it is garbage.
+size_t journal_replay(struct Text* text, const char* data, size_t len, size_t* applied);
@@ -0,0 +1,583 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "lineindex.h"
+#include "mzalloc.h"
+#include "rapidhash.h"
+#include "pool.h"
+#include <immintrin.h>
+
+#define CACHE_MAGIC "PIPITIDX"
+#define CACHE_VERSION 1
+// The sample is a hash over this many windows spread over the file plus its tail, catching changes which keep mtime.
+#define CACHE_SAMPLES 16
+#define CACHE_SAMPLE_LEN 4096
+// While counting, a chunk notes where every this many of its newlines ends, so placing checkpoints afterwards
+// only rescans a little of it instead of the whole chunk.
+#define SCAN_SAMPLE 64
+// Chunks per pool thread, more than one so that uneven chunks still balance.
+#define SCAN_SPLIT 4
+
+/// @brief Header of a sidecar cache, followed by the checkpoints then the fingerprints.
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t every;
+    uint64_t pathHash;
+    uint64_t size;
+    int64_t mtime;
+    int64_t mtimeNsec;
+    uint64_t sample;
+    uint64_t lines;
+    uint64_t count;
+    uint64_t blocks;
+};
+
+/// @brief A contiguous run of blocks counted by one task.
+struct ScanChunk
+{
+    /// @brief Bytes counted, the first chunk may start partway into its first block.
+    size_t start;
+    size_t end;
+    size_t firstBlock;
+    size_t lastBlock;
+    size_t lines;
+    /// @brief Lines counted before this chunk, from the prefix sum.
+    size_t before;
+    /// @brief Offset just past every SCAN_SAMPLEth newline of the chunk, room for a chunk made only of newlines.
+    uint64_t* samples;
+    size_t numSamples;
+};
+
+struct Scan
+{
+    struct LineIndex* index;
+    const char* data;
+    size_t len;
+    /// @brief First block which needs a fingerprint.
+    size_t hashFrom;
+    /// @brief Line number at the start of the first chunk.
+    size_t base;
+    struct ScanChunk* chunks;
+    uint64_t* checkpoints;
+};
+
+size_t lineindex_count(const char* data, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t n = 0;
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+        n += __builtin_popcount(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(data + i)), nl)));
+    for (; i < len; i++)
+        n += data[i] == '\n';
+
+    return n;
+}
+
+/// @brief Finds the end of the nth newline of a range, n being at least 1.
+/// @return Pointer just past the newline, or end if the range has fewer.
+static const char* lineindex_nth(const char* data, const char* end, size_t n)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    for (; data + 32 <= end; data += 32)
+    {
+        uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)data), nl));
+        size_t count = __builtin_popcount(mask);
+        if (count >= n)
+        {
+            while (--n > 0)
+                mask &= mask - 1;
+            return data + __builtin_ctz(mask) + 1;
+        }
+
+        n -= count;
+    }
+
+    for (; data < end; data++)
+    {
+        if (*data == '\n' && --n == 0)
+            return data + 1;
+    }
+
+    return end;
+}
+
+/// @brief Notes the end of a sampled newline, room for every sample was made before the chunk was handed out since
+/// mzalloc mustn't be called from the pool.
+static inline void lineindex_sample_at(struct ScanChunk* chunk, size_t pos)
+{
+    chunk->samples[chunk->numSamples++] = pos;
+}
+
+/// @brief First pass over a chunk, fingerprinting its blocks and counting and sampling its newlines one block at a time,
+/// so the count reads each block while hashing it has just brought it into cache.
+static void lineindex_count_task(void* arg, int i)
+{
+    struct Scan* scan = arg;
+    struct ScanChunk* chunk = scan->chunks + i;
+    const __m256i nl = _mm256_set1_epi8('\n');
+    uint64_t* fingerprints = (uint64_t*)scan->index->fingerprints;
+    size_t counted = 0;
+
+    for (size_t block = chunk->firstBlock; block <= chunk->lastBlock; block++)
+    {
+        size_t start = block << LINE_BLOCK_SHIFT;
+        size_t end = start + LINE_BLOCK < scan->len ? start + LINE_BLOCK : scan->len;
+        if (block >= scan->hashFrom)
+            fingerprints[block] = rapidhash(scan->data + start, end - start);
+
+        start = start > chunk->start ? start : chunk->start;
+        const char* at = scan->data + start;
+        const char* stop = scan->data + end;
+        for (; at + 32 <= stop; at += 32)
+        {
+            uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)at), nl));
+            size_t count = __builtin_popcount(mask);
+            // A vector holds fewer newlines than a sample interval, so it crosses at most one sample.
+            if (counted % SCAN_SAMPLE + count >= SCAN_SAMPLE)
+            {
+                for (size_t k = SCAN_SAMPLE - counted % SCAN_SAMPLE; k > 1; k--)
+                    mask &= mask - 1;
+                lineindex_sample_at(chunk, at - scan->data + __builtin_ctz(mask) + 1);
+            }
+
+            counted += count;
+        }
+
+        for (; at < stop; at++)
+        {
+            if (*at == '\n' && ++counted % SCAN_SAMPLE == 0)
+                lineindex_sample_at(chunk, at - scan->data + 1);
+        }
+    }
+
+    chunk->lines = counted;
+}
+
+/// @brief Second pass over a chunk, placing the checkpoints which land in it starting from the nearest sample.
+static void lineindex_place_task(void* arg, int i)
+{
+    struct Scan* scan = arg;
+    struct ScanChunk* chunk = scan->chunks + i;
+    size_t first = scan->base + chunk->before;
+
+    for (size_t line = (first / LINE_EVERY + 1) * LINE_EVERY; line <= first + chunk->lines; line += LINE_EVERY)
+    {
+        // The line starts just after the kth newline of the chunk.
+        size_t k = line - first;
+        size_t sample = k / SCAN_SAMPLE;
+        const char* at = scan->data + (sample == 0 ? chunk->start : chunk->samples[sample - 1]);
+        size_t rest = k - sample * SCAN_SAMPLE;
+        if (rest > 0)
+            at = lineindex_nth(at, scan->data + chunk->end, rest);
+
+        scan->checkpoints[line / LINE_EVERY] = at - scan->data;
+    }
+}
+
+/// @brief Indexes the original from its last checkpoint on and fingerprints every block from hashFrom on.
+/// Chunks of blocks are counted across the pool, a prefix sum gives each its first line, then each places its checkpoints.
+static int lineindex_scan(struct LineIndex* index, const char* data, size_t len, size_t hashFrom)
+{
+    size_t from = index->checkpoints[index->count - 1];
+    size_t base = (index->count - 1) * LINE_EVERY;
+    size_t firstBlock = from >> LINE_BLOCK_SHIFT;
+    index->lines = base;
+    if (firstBlock >= index->blocks)
+        return 0;
+
+    size_t blocks = index->blocks - firstBlock;
+    size_t split = (size_t)pool_size() * SCAN_SPLIT;
+    int numChunks = blocks < split ? blocks : split;
+    struct ScanChunk* chunks = mzalloc(numChunks * sizeof(struct ScanChunk));
+    if (chunks == NULL)
+        return -1;
+
+    int failed = 0;
+    for (int i = 0; i < numChunks; i++)
+    {
+        size_t first = firstBlock + blocks * i / numChunks;
+        size_t last = firstBlock + blocks * (i + 1) / numChunks - 1;
+        size_t start = first << LINE_BLOCK_SHIFT;
+        size_t end = (last + 1) << LINE_BLOCK_SHIFT;
+        chunks[i] = (struct ScanChunk){
+            .start = start > from ? start : from,
+            .end = end < len ? end : len,
+            .firstBlock = first,
+            .lastBlock = last,
+        };
+        // Only as much of this as the chunk has samples is ever touched.
+        chunks[i].samples = mzalloc(((chunks[i].end - chunks[i].start) / SCAN_SAMPLE + 1) * sizeof(uint64_t));
+        failed |= chunks[i].samples == NULL;
+    }
+
+    struct Scan scan = { index, data, len, hashFrom, base, chunks, NULL };
+    if (!failed)
+        pool_run(numChunks, lineindex_count_task, &scan);
+
+    size_t lines = 0;
+    for (int i = 0; i < numChunks; i++)
+    {
+        chunks[i].before = lines;
+        lines += chunks[i].lines;
+    }
+
+    size_t count = (base + lines) / LINE_EVERY + 1;
+    uint64_t* checkpoints = failed ? NULL : mzrealloc((uint64_t*)index->checkpoints, count * sizeof(uint64_t));
+    if (checkpoints != NULL)
+    {
+        index->checkpoints = checkpoints;
+        index->count = count;
+        index->lines = base + lines;
+        scan.checkpoints = checkpoints;
+        pool_run(numChunks, lineindex_place_task, &scan);
+    }
+
+    for (int i = 0; i < numChunks; i++)
+        mzfree(chunks[i].samples);
+    mzfree(chunks);
+    return checkpoints != NULL ? 0 : -1;
+}
+
+/// @brief Allocates the arrays of an index, keeping the first kept checkpoints and fingerprints of a previous one.
+static int lineindex_alloc(struct LineIndex* index, size_t len, const uint64_t* checkpoints, size_t kept,
+    const uint64_t* fingerprints, size_t reused)
+{
+    *index = (struct LineIndex){ 0 };
+    index->blocks = (len + LINE_BLOCK - 1) >> LINE_BLOCK_SHIFT;
+    uint64_t* _checkpoints = mzalloc((kept > 0 ? kept : 1) * sizeof(uint64_t));
+    uint64_t* _fingerprints = mzalloc((index->blocks > 0 ? index->blocks : 1) * sizeof(uint64_t));
+    if (_checkpoints == NULL || _fingerprints == NULL)
+    {
+        mzfree(_checkpoints);
+        mzfree(_fingerprints);
+        return -1;
+    }
+
+    _checkpoints[0] = 0;
+    if (kept > 0)
+        memcpy(_checkpoints, checkpoints, kept * sizeof(uint64_t));
+    if (reused > 0)
+        memcpy(_fingerprints, fingerprints, reused * sizeof(uint64_t));
+
+    index->checkpoints = _checkpoints;
+    index->count = kept > 0 ? kept : 1;
+    index->fingerprints = _fingerprints;
+    return 0;
+}
+
+int lineindex_build(struct LineIndex* index, const char* data, size_t len)
+{
+    if (lineindex_alloc(index, len, NULL, 0, NULL, 0) != 0)
+        return -1;
+
+    if (lineindex_scan(index, data, len, 0) != 0)
+    {
+        lineindex_free(index);
+        return -1;
+    }
+
+    return 0;
+}
+
+/// @brief Rebuilds an index from a cache of an older version of the file, keeping everything before the first changed block.
+static int lineindex_resume(struct LineIndex* index, const struct CacheHeader* header, const char* data, size_t len)
+{
+    const uint64_t* checkpoints = (const uint64_t*)(header + 1);
+    const uint64_t* fingerprints = checkpoints + header->count;
+    size_t blocks = (len + LINE_BLOCK - 1) >> LINE_BLOCK_SHIFT;
+    blocks = blocks < header->blocks ? blocks : header->blocks;
+
+    size_t same = 0;
+    for (; same < blocks; same++)
+    {
+        size_t start = same << LINE_BLOCK_SHIFT;
+        size_t n = len - start < LINE_BLOCK ? len - start : LINE_BLOCK;
+        if (rapidhash(data + start, n) != fingerprints[same])
+            break;
+    }
+
+    // A checkpoint only depends on the bytes before it, so anything up to the end of the unchanged blocks still holds.
+    size_t limit = same << LINE_BLOCK_SHIFT;
+    size_t kept = 1;
+    while (kept < header->count && checkpoints[kept] <= limit && checkpoints[kept] <= len)
+        kept++;
+
+    if (lineindex_alloc(index, len, checkpoints, kept, fingerprints, same) != 0)
+        return -1;
+
+    if (lineindex_scan(index, data, len, same) != 0)
+    {
+        lineindex_free(index);
+        return -1;
+    }
+
+    return 0;
+}
+
+/// @brief Hashes windows spread over the file, cheap enough for every open of a huge file.
+static uint64_t lineindex_sample(const char* data, size_t len)
+{
+    uint64_t hash = len;
+    for (int i = 0; i <= CACHE_SAMPLES; i++)
+    {
+        // The last window is always the tail, appends are the most common change.
+        size_t start = i < CACHE_SAMPLES ? len / CACHE_SAMPLES * i : (len > CACHE_SAMPLE_LEN ? len - CACHE_SAMPLE_LEN : 0);
+        size_t n = len - start < CACHE_SAMPLE_LEN ? len - start : CACHE_SAMPLE_LEN;
+        hash = rapidhash_withSeed(data + start, n, hash);
+    }
+
+    return hash;
+}
+
+int lineindex_cache(const char* path, const char* suffix, char* out, uint64_t* hash)
+{
+    char dir[PATH_MAX];
+    const char* env = getenv("PIPIT_CACHE");
+    if (env != NULL && strcmp(env, "0") == 0)
+        return -1;
+
+    // A path cut short would point somewhere else entirely, so a cache which doesn't fit isn't used at all.
+    if (env != NULL && *env != '\0')
+    {
+        if (snprintf(dir, sizeof(dir), "%s", env) >= (int)sizeof(dir))
+            return -1;
+    }
+    else
+    {
+        const char* base = getenv("XDG_CACHE_HOME");
+        const char* home = getenv("HOME");
+        int n;
+        if (base != NULL && *base != '\0')
+            n = snprintf(dir, sizeof(dir), "%s", base);
+        else if (home != NULL)
+            n = snprintf(dir, sizeof(dir), "%s/.cache", home);
+        else
+            return -1;
+
+        if (n >= (int)sizeof(dir) - 6)
+            return -1;
+
+        mkdir(dir, 0755);
+        strcat(dir, "/pipit");
+    }
+
+    mkdir(dir, 0755);
+
+    char real[PATH_MAX];
+    if (realpath(path, real) == NULL)
+        return -1;
+
+    *hash = rapidhash(real, strlen(real));
+    if (snprintf(out, PATH_MAX, "%s/%016llx%s", dir, (unsigned long long)*hash, suffix) >= PATH_MAX)
+        return -1;
+    return 0;
+}
+
+/// @brief Writes an index to its cache, through a temporary so readers never see half a cache.
+static void lineindex_save(const struct LineIndex* index, const char* cache, struct CacheHeader* header)
+{
+    char tmp[PATH_MAX];
+    if (snprintf(tmp, sizeof(tmp), "%s.%d", cache, (int)getpid()) >= (int)sizeof(tmp))
+        return;
+
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return;
+
+    header->lines = index->lines;
+    header->count = index->count;
+    header->blocks = index->blocks;
+
+    size_t sizes[3] = { sizeof(*header), index->count * sizeof(uint64_t), index->blocks * sizeof(uint64_t) };
+    const char* parts[3] = { (const char*)header, (const char*)index->checkpoints, (const char*)index->fingerprints };
+    int ok = 1;
+    for (int i = 0; i < 3 && ok; i++)
+    {
+        for (size_t done = 0; done < sizes[i];)
+        {
+            ssize_t n = write(fd, parts[i] + done, sizes[i] - done);
+            if (n <= 0)
+            {
+                ok = 0;
+                break;
+            }
+
+            done += n;
+        }
+    }
+
+    close(fd);
+    if (!ok || rename(tmp, cache) != 0)
+        unlink(tmp);
+}
+
+int lineindex_open(struct LineIndex* index, const char* path, int handle, const char* data, size_t len)
+{
+    *index = (struct LineIndex){ 0 };
+
+    char cache[PATH_MAX];
+    uint64_t pathHash;
+    struct stat st;
+    if (len < LINE_CACHE_MIN || fstat(handle, &st) != 0 || lineindex_cache(path, ".idx", cache, &pathHash) != 0)
+        return lineindex_build(index, data, len);
+
+    struct CacheHeader key = {
+        .magic = CACHE_MAGIC,
+        .version = CACHE_VERSION,
+        .every = LINE_EVERY,
+        .pathHash = pathHash,
+        .size = len,
+        .mtime = st.st_mtim.tv_sec,
+        .mtimeNsec = st.st_mtim.tv_nsec,
+        .sample = lineindex_sample(data, len),
+    };
+
+    int fd = open(cache, O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat cst;
+        void* map = MAP_FAILED;
+        if (fstat(fd, &cst) == 0 && cst.st_size >= sizeof(struct CacheHeader))
+            map = mmap(NULL, cst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (map != MAP_FAILED)
+        {
+            const struct CacheHeader* header = map;
+            int valid = memcmp(header->magic, CACHE_MAGIC, 8) == 0 && header->version == CACHE_VERSION &&
+                header->every == LINE_EVERY && header->pathHash == pathHash && header->count > 0 &&
+                cst.st_size == sizeof(struct CacheHeader) + (header->count + header->blocks) * sizeof(uint64_t);
+
+            if (valid && header->size == key.size && header->mtime == key.mtime &&
+                header->mtimeNsec == key.mtimeNsec && header->sample == key.sample)
+            {
+                index->checkpoints = (const uint64_t*)(header + 1);
+                index->count = header->count;
+                index->lines = header->lines;
+                index->fingerprints = index->checkpoints + header->count;
+                index->blocks = header->blocks;
+                index->map = map;
+                index->mapLen = cst.st_size;
+                return 0;
+            }
+
+            int resumed = valid && lineindex_resume(index, header, data, len) == 0;
+            munmap(map, cst.st_size);
+            if (resumed)
+            {
+                lineindex_save(index, cache, &key);
+                return 0;
+            }
+        }
+    }
+
+    if (lineindex_build(index, data, len) != 0)
+        return -1;
+
+    lineindex_save(index, cache, &key);
+    return 0;
+}
+
+void lineindex_free(struct LineIndex* index)
+{
+    if (index->map != NULL)
+        munmap(index->map, index->mapLen);
+    else
+    {
+        mzfree((void*)index->checkpoints);
+        mzfree((void*)index->fingerprints);
+    }
+
+    *index = (struct LineIndex){ 0 };
+}
+
+size_t lineindex_line(const struct LineIndex* index, const char* data, size_t pos)
+{
+    // The last checkpoint at or before pos.
+    size_t lo = 0;
+    size_t hi = index->count - 1;
+    while (lo < hi)
+    {
+        size_t mid = (lo + hi + 1) / 2;
+        if (index->checkpoints[mid] <= pos)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo * LINE_EVERY + lineindex_count(data + index->checkpoints[lo], pos - index->checkpoints[lo]);
+}
+
+size_t lineindex_offset(const struct LineIndex* index, const char* data, size_t len, size_t line)
+{
+    if (line > index->lines)
+        return len;
+
+    const char* at = data + index->checkpoints[line / LINE_EVERY];
+    if (line % LINE_EVERY != 0)
+        at = lineindex_nth(at, data + len, line % LINE_EVERY);
+
+    return at - data;
+}
+
+/// @brief Counts the newlines in the first len bytes of a piece, through the index when it's a long original piece.
+static size_t lineindex_piece(const struct LineIndex* index, const struct Text* text, const struct Piece* piece, size_t len)
+{
+    // Short pieces are cheaper to count than the up to two checkpoint scans the index needs.
+    if (piece->source == TEXT_ADDED || len < LINE_BLOCK / 16)
+        return lineindex_count((piece->source == TEXT_ORIGINAL ? text->original : text->add) + piece->start, len);
+
+    return lineindex_line(index, text->original, piece->start + len) - lineindex_line(index, text->original, piece->start);
+}
+
+size_t lineindex_seek(const struct LineIndex* index, const struct Text* text, size_t line)
+{
+    size_t seen = 0;
+    if (line == 0)
+        return 0;
+
+    for (int i = 0; i < text->count; i++)
+    {
+        const struct Piece* piece = text->pieces + i;
+        size_t n = lineindex_piece(index, text, piece, piece->len);
+        if (seen + n < line)
+        {
+            seen += n;
+            continue;
+        }
+
+        // The line starts just after the (line - seen)th newline of this piece.
+        if (piece->source == TEXT_ORIGINAL)
+        {
+            size_t first = lineindex_line(index, text->original, piece->start);
+            size_t at = lineindex_offset(index, text->original, text->originalLen, first + line - seen);
+            return piece->pos + (at - piece->start);
+        }
+
+        const char* src = text->add + piece->start;
+        return piece->pos + (lineindex_nth(src, src + piece->len, line - seen) - src);
+    }
+
+    return text->len;
+}
+
+size_t lineindex_number(const struct LineIndex* index, const struct Text* text, size_t pos)
+{
+    size_t seen = 0;
+    for (int i = 0; i < text->count && text->pieces[i].pos < pos; i++)
+    {
+        const struct Piece* piece = text->pieces + i;
+        seen += lineindex_piece(index, text, piece, pos - piece->pos < piece->len ? pos - piece->pos : piece->len);
+    }
+
+    return seen;
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "text.h"
+
+// A checkpoint is kept every LINE_EVERY lines, so finding any line scans at most this many lines from one.
+#define LINE_EVERY 1024
+// The original is fingerprinted in blocks, a changed file keeps every checkpoint before its first changed block.
+#define LINE_BLOCK_SHIFT 20
+#define LINE_BLOCK ((size_t)1 << LINE_BLOCK_SHIFT)
+// Files smaller than this are indexed faster than a cache could be opened, so they never get one.
+#define LINE_CACHE_MIN (1024 * 1024)
+
+/// @brief Line checkpoints over an immutable original, either built or mapped straight from a sidecar cache.
+struct LineIndex
+{
+    /// @brief Offset of line i * LINE_EVERY, the first checkpoint is always 0.
+    const uint64_t* checkpoints;
+    size_t count;
+    /// @brief Number of newlines in the original.
+    size_t lines;
+    /// @brief rapidhash of every LINE_BLOCK bytes of the original, the last block may be short.
+    const uint64_t* fingerprints;
+    size_t blocks;
+    /// @brief The cache mapping the arrays point into, or NULL if they were built and are owned.
+    void* map;
+    size_t mapLen;
+};
+
+/// @brief Builds the index of an original from scratch.
+/// @param index The index to be built.
+/// @param data The original.
+/// @param len The length of the original.
+/// @return 0 if successful, otherwise -1.
+int lineindex_build(struct LineIndex* index, const char* data, size_t len);
+
+/// @brief Opens the index of a file, mapping its sidecar cache if it's unchanged, otherwise building and caching it.
+/// A cache of a file which has since changed still provides every checkpoint before the first changed block.
+/// The cache lives in $PIPIT_CACHE, $XDG_CACHE_HOME/pipit or ~/.cache/pipit, PIPIT_CACHE=0 disables it.
+/// @param index The index to be opened.
+/// @param path The path of the file.
+/// @param handle Open descriptor of the file, used for its size and modification time.
+/// @param data The mapping of the file.
+/// @param len The length of the mapping.
+/// @return 0 if successful, otherwise -1.
+int lineindex_open(struct LineIndex* index, const char* path, int handle, const char* data, size_t len);
+
+/// @brief Gets the path of a sidecar cache of a file, creating the cache directory if needed. Other sidecars, such as
+/// journals, live alongside the index under a different suffix.
+/// @param path The path of the file.
+/// @param suffix Appended to the hash of the file's real path.
+/// @param out Receives the path, PATH_MAX bytes.
+/// @param hash Receives the hash of the file's real path.
+/// @return 0 if successful, otherwise -1 if the cache is disabled, unavailable or its path wouldn't fit.
+int lineindex_cache(const char* path, const char* suffix, char* out, uint64_t* hash);
+
+/// @brief Counts the newlines in a range, 32 bytes at a time.
+/// @param data The range.
+/// @param len The length of the range.
+/// @return The number of newlines.
+size_t lineindex_count(const char* data, size_t len);
+
+/// @brief Releases an index.
+/// @param index The index to be released.
+void lineindex_free(struct LineIndex* index);
+
+/// @brief Counts the newlines of the original before a position.
+/// @param index The index of the original.
+/// @param data The original.
+/// @param pos The position, at most the length of the original.
+/// @return The number of newlines before pos, which is also the zero-based line pos is on.
+size_t lineindex_line(const struct LineIndex* index, const char* data, size_t pos);
+
+/// @brief Finds the start of a line of the original.
+/// @param index The index of the original.
+/// @param data The original.
+/// @param len The length of the original.
+/// @param line The zero-based line.
+/// @return Offset of the line, or len if the original has fewer lines.
+size_t lineindex_offset(const struct LineIndex* index, const char* data, size_t len, size_t line);
+
+/// @brief Finds the start of a line of a document, original pieces go through the index and added ones are counted.
+/// @param index The index of the document's original.
+/// @param text The document.
+/// @param line The zero-based line.
+/// @return Position of the line, or the length of the document if it has fewer lines.
+size_t lineindex_seek(const struct LineIndex* index, const struct Text* text, size_t line);
+
+/// @brief Gets the zero-based line of a position in a document.
+/// @param index The index of the document's original.
+/// @param text The document.
+/// @param pos The position.
+/// @return The number of newlines before pos.
+size_t lineindex_number(const struct LineIndex* index, const struct Text* text, size_t pos);
@@ -6,38 +6,40 @@
 #include <ctype.h>
 #include <sys/ioctl.h>
 #include "map.h"
-#include "alloca.h"
 #include <limits.h>
+#include <signal.h>
 #include <pwd.h>
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
 #include "rapidhash.h"
 #include "mzalloc.h"
-
-#define NUM_TABS 12
-// Limit the size of virtual sequences to 1kB to prevent overstacking.
-#define SEQ_MAX 1024
-
-// TODO: Maybe lines structure should be in every buffer and alongside the sequences.
-struct Sequence
-{
-    // 0: addition
-    // 1: deletion
-    // 2: special
-    int kind : 2;
-    // 0: skipped when moving cursor.
-    // 1: registers as only a single character when moving cursor.
-    int value : 1;
-    // This need not be more than 11 bits, but it's 2 spare so why not.
-    int dlen : 13;
-    // Horizontal index of the sequence in the relative column.
-    short index;
-    // Size of text that this replaces, only applicable for addition or special sequences.
-    short slen;
-    // This may only contain SEQ_MAX number of chars.
-    char* data;
-};
-
+#include "trace.h"
+#include "headless.h"
+#include "text.h"
+#include "lineindex.h"
+#include "browser.h"
+#include "plugin.h"
+#include "clipboard.h"
+#include "arena.h"
+#include "diff.h"
+#include "classify.h"
+#include "hex.h"
+#include "journal.h"
+#include "search.h"
+#include "sequence.h"
+#include "words.h"
+#include "render.h"
+#include "sched.h"
+
+// Tabs kept warm, past this the least recently focused ones drop their caches.
+#define TABS_WARM 8
+// Stalls on memory which trim every tab but the focused one, 150ms within 2s. Unprivileged triggers need a window of a
+// multiple of 2s.
+#define PRESSURE_TRIGGER "some 150000 2000000"
+// Completions offered at once.
+#define COMPLETIONS_MAX 8
 struct Buffer
 {
     int handle;
@@ -48,242 +50,1775 @@ struct Buffer
     int isModified : 1;
     /// @brief Buffer is pending for new line update.
     int isPending : 1;
+    /// @brief Document of the buffer, pieces over the mapping in data and everything typed since it was opened.
+    struct Text text;
+    /// @brief Line checkpoints of the mapping, loaded from the sidecar cache when the file hasn't changed.
+    struct LineIndex index;
+    /// @brief Path the buffer was opened from and the file name shown in the tab bar.
+    char* path;
+    char* name;
+    /// @brief What the original turned out to be, classified a step at a time between keys.
+    struct Classify kind;
+    /// @brief Whether the document is shown as rows of hex, binary files open this way.
+    int hex;
+    /// @brief Every edit of the document, so a crash loses at most the last second of them.
+    struct Journal journal;
+    /// @brief Where the view and the primary cursor were when the tab lost focus.
+    size_t top;
+    size_t cursor;
+    /// @brief Focus changes counted up to when the tab last had focus, the least recent are trimmed first.
+    uint64_t focused;
+    /// @brief Whether the caches were dropped, they come back as the tab is used again.
+    int cold;
+    /// @brief Every word of the document, for completing words from any tab. Binary files aren't indexed.
+    struct Words words;
     // TODO: Consider raw buffers for each buffer?
     // TODO: Go over this structure and see how I can improve this.
-    // Virtual buffer containing all unwritten sequences.
-    struct Sequence seqs[];
 };
 
-struct Line
+struct Line
+{
+    size_t pos;
+    int length;
+};
+
+/// @brief An editing cursor, every cursor receives the same keys.
+struct Cursor
+{
+    /// @brief Position in the focused document.
+    size_t pos;
+    /// @brief Column which vertical movement tries to return to.
+    int goal;
+};
+
+static struct termios orig;
+static struct Map binds;
+/// @brief Open documents by tab number, closed tabs leave NULL so the numbers of the others don't change.
+static struct Buffer** tabs;
+static int numTabs = 0;
+static int capTabs = 0;
+/// @brief Focus changes so far.
+static uint64_t focusCount = 0;
+/// @brief PSI trigger on memory stalls, -1 if the kernel doesn't offer one.
+static int pressure = -1;
+
+/// @brief Index of the currently focused tab.
+static int focus = 0;
+/// @brief Cursor position.
+static int vx = 0, vy = 0;
+/// @brief Padding dimensions.
+static int px = 0, py = 1;
+/// @brief Cursor set, sorted by position without duplicates.
+static struct Cursor* cursors;
+static int numCursors = 0;
+static int capCursors = 0;
+/// @brief Index of the cursor shown on screen, vx and vy are its screen position.
+static int primary = 0;
+/// @brief Batch of edits gathered from every cursor each keystroke, sized alongside cursors.
+static struct Edit* edits;
+/// @brief Document position of the first visible line.
+static size_t top = 0;
+/// @brief Number of rows and columns present in the current window.
+static int rows, cols;
+/// @brief Line buffer, one per visible row, allocated from the frame arena.
+// TODO: Explain the buffers and write it all out to make sure it isn't redundant.
+static struct Line* lines;
+/// @brief Number of lines in line buffer.
+static int numLines;
+/// @brief Raw rendering buffer, a byte per cell.
+static char* raw;
+/// @brief Bytes allocated for the raw buffer, it only ever grows.
+static size_t capRaw;
+/// @brief Attributes of every cell of the raw buffer, see RENDER_* in render.h.
+static uint16_t* attrs;
+/// @brief What goes to the terminal each frame, the raw buffer written out row by row.
+static char* output;
+static size_t capOutput;
+/// @brief Temporaries of rendering and input, reset wholesale after every frame so keys never touch the heap.
+static struct Arena frame;
+/// @brief Set by SIGWINCH, the window size is read again before the next frame.
+static volatile sig_atomic_t resized = 0;
+/// @brief Length of the tab bar at the start of the raw buffer, the next tab is written after it.
+static int tabBar = 0;
+/// @brief Whether the latency overlay is drawn over the last row.
+static int overlay = 0;
+/// @brief Timestamp of the last key read which hasn't made it to the terminal yet, 0 if none.
+static uint64_t keyTime = 0;
+/// @brief Whether keys come from a script and frames go to a virtual screen instead of the terminal.
+static int headless = 0;
+/// @brief Script being replayed and screen being rendered to when headless.
+static struct Script script;
+static struct Screen screen;
+/// @brief Timestamp of when the headless replay began.
+static uint64_t replayStart;
+/// @brief File browser, shown in place of the focused document while browsing.
+static struct Browser browser;
+static int browsing = 0;
+/// @brief Diff shown in place of the focused document, hunks stream in while it's being worked out.
+static struct Diff diff;
+static int diffing = 0;
+/// @brief Out of process plugins, see plugin.h.
+static struct Plugin plugins[PLUGIN_MAX];
+static int numPlugins = 0;
+/// @brief Last status message sent by a plugin, drawn over the last row.
+static char status[256];
+/// @brief Kill ring, entries reference the pieces they were taken from.
+static struct Clipboard clipboard;
+/// @brief Other end of the range copied or cut from the primary cursor, SIZE_MAX if unset and the line is taken instead.
+static size_t mark = SIZE_MAX;
+/// @brief Command run by the last key, consecutive cuts build up a single entry.
+static void (*lastCommand)(void);
+/// @brief Words completing the one before the primary cursor, shown below it while completing.
+static struct Completion
+{
+    char word[WORDS_MAX];
+    size_t len;
+    int64_t count;
+} completions[COMPLETIONS_MAX];
+static int numCompletions = 0;
+static int completing = 0;
+/// @brief Selected completion and the length of the prefix it completes.
+static int completion = 0;
+static size_t completionPrefix = 0;
+
+#define BUFFER_SIZE cols * rows
+// Rows are read a vector at a time, the last one past the end of the buffer.
+#define RAW_BUFFER_SIZE cols * rows + RENDER_SLACK
+
+void disableRawMode()
+{
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig);
+}
+
+void enableRawMode()
+{
+    tcgetattr(STDIN_FILENO, &orig);
+    atexit(disableRawMode);
+    struct termios raw = orig;
+    raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
+    raw.c_iflag &= ~(IXON | ICRNL);
+    raw.c_oflag &= ~(OPOST);
+    raw.c_cflag |= (CS8);
+    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+}
+
+int getBounds(int* rows, int* cols)
+{
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1)
+        return -1;
+
+    *rows = ws.ws_row;
+    *cols = ws.ws_col;
+    return 0;
+}
+
+void onResize(int sig)
+{
+    (void)sig;
+    resized = 1;
+}
+
+/// @brief Writes the tab bar to the start of the raw buffer, the document starts on the row after it.
+void renderTabs()
+{
+    // The tab bar never takes the last row, however many tabs there are in however small a window.
+    char* ptr = raw;
+    char* limit = raw + (rows - 1) * cols;
+    for (int i = 0; i < numTabs && ptr + 3 < limit; i++)
+    {
+        if (tabs[i] == NULL)
+            continue;
+
+        if (ptr > raw)
+            *ptr++ = ' ';
+
+        char number[16];
+        for (int n = snprintf(number, sizeof(number), "%d ", i + 1), k = 0; k < n && ptr < limit; k++)
+            *ptr++ = number[k];
+
+        for (const char* name = tabs[i]->name; *name != '\0' && ptr < limit; name++)
+            *ptr++ = *name;
+
+        if (tabs[i]->isModified && ptr < limit)
+            *ptr++ = '*';
+    }
+
+    // The rest of the last row of the tab bar is blank.
+    tabBar = ptr - raw;
+    memset(ptr, ' ', cols - tabBar % cols);
+    py = tabBar / cols + 1;
+}
+
+/// @brief Sizes the raw buffer for the current window, it's only reallocated when it has to grow.
+/// @return 0 if successful, otherwise -1.
+int reserveFrame()
+{
+    if (RAW_BUFFER_SIZE > capRaw)
+    {
+        char* grown = realloc(raw, RAW_BUFFER_SIZE);
+        if (grown == NULL)
+            return -1;
+        raw = grown;
+
+        uint16_t* grownAttrs = realloc(attrs, (RAW_BUFFER_SIZE) * sizeof(uint16_t));
+        if (grownAttrs == NULL)
+            return -1;
+        attrs = grownAttrs;
+        capRaw = RAW_BUFFER_SIZE;
+    }
+
+    if (render_bound(rows, cols) > capOutput)
+    {
+        char* grown = realloc(output, render_bound(rows, cols));
+        if (grown == NULL)
+            return -1;
+
+        output = grown;
+        capOutput = render_bound(rows, cols);
+    }
+
+    memset(raw, ' ', RAW_BUFFER_SIZE);
+    memset(attrs, 0, (RAW_BUFFER_SIZE) * sizeof(uint16_t));
+    return 0;
+}
+
+/// @brief Picks up a new window size. Nothing cached depends on the geometry: the line index and the documents are
+/// untouched, the view keeps its first line and only the rows now visible are rendered on the next frame.
+void resize()
+{
+    resized = 0;
+    int oldRows = rows;
+    int oldCols = cols;
+    if (getBounds(&rows, &cols) == -1 || rows <= 0 || cols <= 0)
+    {
+        rows = oldRows;
+        cols = oldCols;
+        return;
+    }
+
+    if (rows == oldRows && cols == oldCols)
+        return;
+
+    if (reserveFrame() != 0)
+    {
+        rows = oldRows;
+        cols = oldCols;
+        return;
+    }
+
+    renderTabs();
+    tabs[focus]->isPending = -1;
+}
+
+/// @brief Writes to the terminal, or to the virtual screen when headless.
+void display(const char* data, int len)
+{
+    if (headless)
+        screen_feed(&screen, data, len);
+    else
+        write(STDOUT_FILENO, data, len);
+}
+
+/// @brief Closes the journal of every open document, nothing is left to recover after leaving normally.
+void closeJournals()
+{
+    for (int i = 0; i < numTabs; i++)
+    {
+        if (tabs[i] != NULL)
+            journal_close(&tabs[i]->journal, 0);
+    }
+}
+
+/// @brief Prints the final screen and the replay report, then exits.
+void finishHeadless()
+{
+    closeJournals();
+    screen_dump(&screen, stdout);
+    headless_report(stdout, &script, &screen, trace_now() - replayStart);
+    exit(0);
+}
+
+/// @brief Job classifying a step of a tab's file, repainting if what the focused one turned out to be changed.
+/// @return 1 if there is more to classify, otherwise 0.
+int classifyJob(void* arg)
+{
+    struct Buffer* buf = arg;
+    struct Classify* kind = &buf->kind;
+    int utf8 = kind->utf8;
+    int crlf = classify_crlf(kind);
+    int more = classify_step(kind);
+    if (buf == tabs[focus] && (kind->utf8 != utf8 || classify_crlf(kind) != crlf))
+        buf->isPending = -1;
+
+    return more;
+}
+
+/// @brief Job walking the browser's listing, dropped once the walk is done or the browser is closed.
+/// @return 1 if there is more to walk, otherwise 0.
+int walkJob(void* arg)
+{
+    return browsing && browser_step(arg);
+}
+
+/// @brief Drops what a tab can do without while it's out of focus. The mapping only loses its pages, which fault back in
+/// from the page cache. The line index is kept, it's a small fraction of the file and rebuilding it on focus would scan
+/// the whole original when there's no cache.
+void trimBuffer(struct Buffer* buf)
+{
+    if (buf->cold)
+        return;
+
+    text_trim(&buf->text);
+    if (buf->used > 0)
+        madvise(buf->data, buf->used, MADV_DONTNEED);
+    buf->cold = 1;
+}
+
+/// @brief Trims the least recently focused tabs until at most warm are left warm, the focused one always is.
+void trimTabs(int warm)
+{
+    while (1)
+    {
+        int count = 0;
+        int coldest = -1;
+        for (int i = 0; i < numTabs; i++)
+        {
+            if (tabs[i] == NULL || tabs[i]->cold)
+                continue;
+
+            count++;
+            if (i != focus && (coldest < 0 || tabs[i]->focused < tabs[coldest]->focused))
+                coldest = i;
+        }
+
+        if (count <= warm || coldest < 0)
+            return;
+
+        trimBuffer(tabs[coldest]);
+    }
+}
+
+/// @brief Reads a key from the terminal, or the next key of the script when headless.
+/// Changes on disk under the browser, hunks of a diff, word indexes being built and plugin replies are waited for
+/// alongside keys, and while jobs are queued they run in slices for up to a budget instead of a key being waited for,
+/// 0 means something other than a key woke it up.
+int readKey(char* seq)
+{
+    int indexing = 0;
+    for (int i = 0; i < numTabs; i++)
+    {
+        indexing |= tabs[i] != NULL && tabs[i]->words.started && !tabs[i]->words.ready;
+        // Classifying is queued again until it's done, in case there was no memory to queue it when the tab opened.
+        if (tabs[i] != NULL && !tabs[i]->kind.complete)
+            sched_add(classifyJob, tabs[i]);
+    }
+
+    // Opening a directory starts a walk, which is a job of its own until it's done.
+    if (browsing && browser.current != NULL && !browser.current->complete)
+        sched_add(walkJob, &browser);
+
+    int journaling = journal_fd() >= 0;
+    int waiting = browsing || diffing || sched_pending() || indexing || journaling || pressure >= 0 || numPlugins > 0;
+    if (!headless && waiting)
+    {
+        struct pollfd fds[6 + PLUGIN_MAX] = { { STDIN_FILENO, POLLIN, 0 } };
+        int n = 1;
+        if (journaling)
+            fds[n++] = (struct pollfd){ journal_fd(), POLLIN, 0 };
+        int indexed = n;
+        if (indexing)
+            fds[n++] = (struct pollfd){ words_fd(), POLLIN, 0 };
+        int watching = n;
+        if (pressure >= 0)
+            fds[n++] = (struct pollfd){ pressure, POLLPRI, 0 };
+        int browsed = n;
+        if (browsing)
+            fds[n++] = (struct pollfd){ browser_fd(&browser), POLLIN, 0 };
+        if (diffing)
+            fds[n++] = (struct pollfd){ diff_fd(&diff), POLLIN, 0 };
+        for (int i = 0; i < numPlugins; i++)
+            fds[n++] = (struct pollfd){ plugins[i].dead ? -1 : plugins[i].socket, POLLIN, 0 };
+
+        if (poll(fds, n, sched_pending() ? 0 : -1) > 0 && (fds[0].revents & POLLIN))
+            return read(STDIN_FILENO, seq, 4);
+
+        if (journaling && (fds[1].revents & POLLIN))
+            journal_tick();
+        if (indexing && (fds[indexed].revents & POLLIN))
+        {
+            uint64_t done;
+            read(words_fd(), &done, sizeof(done));
+            for (int i = 0; i < numTabs; i++)
+            {
+                if (tabs[i] != NULL)
+                    words_poll(&tabs[i]->words);
+            }
+        }
+        if (pressure >= 0 && (fds[watching].revents & (POLLPRI | POLLERR)))
+        {
+            // Under pressure only the focused tab stays warm, until enough others have been focused again.
+            if (fds[watching].revents & POLLERR)
+            {
+                close(pressure);
+                pressure = -1;
+            }
+            trimTabs(1);
+        }
+        // A change beneath a listing which was already walked restarts the walk.
+        if (browsing && (fds[browsed].revents & POLLIN) && browser_step(&browser))
+            sched_add(walkJob, &browser);
+        if (diffing)
+        {
+            uint64_t published;
+            read(diff_fd(&diff), &published, sizeof(published));
+        }
+
+        sched_run(SCHED_BUDGET_NS, STDIN_FILENO);
+        return 0;
+    }
+
+    if (!headless)
+        return read(STDIN_FILENO, seq, 4);
+
+    // Replays have to come out the same every time, so every job and the indexing finish before the next key.
+    if (browsing && browser_step(&browser))
+        sched_add(walkJob, &browser);
+    sched_finish();
+    for (int i = 0; i < numTabs && indexing; i++)
+    {
+        if (tabs[i] != NULL)
+            words_wait(&tabs[i]->words);
+    }
+
+    int len = script_next(&script, seq);
+    if (len == 0)
+        finishHeadless();
+
+    return len;
+}
+
+/// @brief Gets the start of the line containing pos.
+size_t lineStart(struct Text* text, size_t pos)
+{
+    // No newline before pos gives SIZE_MAX, which wraps around to the start of the document.
+    return text_rchr(text, pos, '\n') + 1;
+}
+
+/// @brief Gets what a scan of the focused document looks for, rows of hex are a byte a column.
+int sequenceFlags()
+{
+    struct Buffer* buf = tabs[focus];
+    if (buf->hex)
+        return 0;
+
+    return (buf->kind.utf8 ? SEQUENCE_UTF8 : 0) | (classify_crlf(&buf->kind) ? SEQUENCE_CRLF : 0);
+}
+
+/// @brief Maps the sequences of up to SEQUENCE_SPAN bytes of the focused document from pos into the frame arena, reading
+/// them in place if they're in one piece.
+void mapSequences(struct Sequences* seqs, size_t pos, size_t len, size_t lineEnd)
+{
+    struct Text* text = &tabs[focus]->text;
+    len = len < SEQUENCE_SPAN ? len : SEQUENCE_SPAN;
+    int flags = sequenceFlags() | (pos + len == lineEnd ? SEQUENCE_END : 0);
+    size_t avail;
+    const char* bytes = text_chunk(text, pos, &avail);
+    if (bytes == NULL || avail < len)
+    {
+        char* copy = arena_alloc(&frame, len + 1);
+        if (copy == NULL)
+        {
+            *seqs = (struct Sequences){ .len = len };
+            return;
+        }
+
+        text_read(text, pos, copy, len);
+        bytes = copy;
+    }
+
+    sequence_scan(seqs, bytes, len, flags, &frame);
+}
+
+/// @brief Gets the column of a position on its line, a multi-byte character takes one and a hidden carriage return none.
+int columnOf(size_t pos)
+{
+    struct Text* text = &tabs[focus]->text;
+    size_t start = lineStart(text, pos);
+    size_t mark = frame.used;
+    struct Sequences seqs;
+    mapSequences(&seqs, start, pos - start, SIZE_MAX);
+    size_t column = sequence_column(&seqs, pos - start);
+    arena_rewind(&frame, mark);
+    return column < INT_MAX ? column : INT_MAX;
+}
+
+/// @brief Moves the first visible line so that the primary cursor is on screen.
+void scroll()
+{
+    struct Text* text = &tabs[focus]->text;
+    size_t start = lineStart(text, cursors[primary].pos);
+    int visible = rows - py;
+
+    if (start < top)
+    {
+        top = start;
+        return;
+    }
+
+    size_t line = top;
+    for (int i = 0; i < visible && line <= text->len; i++)
+    {
+        if (line == start)
+            return;
+        line = text_chr(text, line, '\n') + 1;
+    }
+
+    // The cursor went below the screen, so its line becomes the last visible one.
+    top = start;
+    for (int i = 1; i < visible && top > 0; i++)
+        top = lineStart(text, top - 1);
+}
+
+/// @brief Renders the visible lines of the focused document below the tab bar and finds the primary cursor on screen.
+void renderText(char* dst)
+{
+    struct Text* text = &tabs[focus]->text;
+    const struct Classify* kind = &tabs[focus]->kind;
+    int crlf = classify_crlf(kind);
+    scroll();
+
+    size_t at = top;
+    numLines = 0;
+    lines = arena_alloc(&frame, (rows - py > 0 ? rows - py : 1) * sizeof(struct Line));
+
+    for (int i = 0; i < rows - py; i++)
+    {
+        size_t end = text_chr(text, at, '\n');
+        lines[i].pos = at;
+        lines[i].length = end - at;
+        numLines++;
+
+        // TODO: Long lines are cut off until there is horizontal scrolling or wrapping.
+        int shown = lines[i].length < cols ? lines[i].length : cols;
+        text_read(text, at, dst, shown);
+        // Carriage returns ending lines are hidden, other control bytes are replaced as the frame is written out.
+        if (crlf && shown == lines[i].length && shown > 0 && dst[shown - 1] == '\r')
+            dst[shown - 1] = ' ';
+        dst += shown;
+
+        memset(dst, ' ', cols - shown);
+        dst += cols - shown;
+
+        if (end >= text->len)
+            break;
+        at = end + 1;
+    }
+
+    // Rows past the end of the document are blanked, edits can leave fewer lines than the last frame.
+    memset(dst, ' ', (rows - py - numLines) * cols);
+
+    // A window too short for anything below the tab bar has nowhere to put the cursor.
+    vy = 0;
+    vx = 0;
+    if (numLines == 0)
+        return;
+
+    size_t cursor = cursors[primary].pos;
+    while (vy + 1 < numLines && lines[vy + 1].pos <= cursor)
+        vy++;
+    int column = columnOf(cursor);
+    vx = column < cols ? column : cols - 1;
+}
+
+/// @brief Gives the cells of a range of the focused document an attribute, flags add to those already there and a colour
+/// replaces the one there. Rows take a cell past the end of their line, for a cursor there or a range over the newline.
+void highlight(size_t from, size_t to, uint16_t attr)
+{
+    uint16_t* row = attrs + py * cols;
+    for (int i = 0; i < numLines && lines[i].pos < to; i++, row += cols)
+    {
+        size_t start = lines[i].pos;
+        size_t stop = start + (lines[i].length < cols ? lines[i].length + 1 : cols);
+        size_t a = from > start ? from : start;
+        size_t b = to < stop ? to : stop;
+        for (size_t k = a; k < b; k++)
+        {
+            uint16_t cell = row[k - start];
+            if (attr & RENDER_FOREGROUND)
+                cell &= ~(RENDER_FOREGROUND | RENDER_COLOR);
+            row[k - start] = cell | attr;
+        }
+    }
+}
+
+/// @brief Highlights the visible lines: decorations plugins asked for on the version shown, the marked range and every
+/// cursor but the primary one, which is the terminal's own.
+void highlightText()
+{
+    if (numLines == 0)
+        return;
+
+    struct Text* text = &tabs[focus]->text;
+    size_t first = lines[0].pos;
+    size_t last = lines[numLines - 1].pos + lines[numLines - 1].length + 1;
+    for (int p = 0; p < numPlugins; p++)
+    {
+        for (size_t i = 0; i < plugins[p].numDecorations; i++)
+        {
+            // Positions of any other version would land on the wrong bytes, the plugin decorates again once it's synced.
+            const struct PluginDecorate* decoration = plugins[p].decorations + i;
+            if (decoration->tab == (uint32_t)focus && decoration->version == text->version && decoration->pos < last
+                && decoration->pos + decoration->len > first)
+                highlight(decoration->pos, decoration->pos + decoration->len, decoration->style);
+        }
+    }
+
+    if (mark != SIZE_MAX)
+    {
+        size_t at = cursors[primary].pos;
+        size_t other = mark < text->len ? mark : text->len;
+        highlight(other < at ? other : at, other < at ? at : other, RENDER_UNDERLINE);
+    }
+
+    // Cursors are sorted, only those from the first line on are looked at.
+    int lo = 0;
+    int hi = numCursors;
+    while (lo < hi)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if (cursors[mid].pos < first)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (int i = lo; i < numCursors && cursors[i].pos < last; i++)
+    {
+        if (i != primary)
+            highlight(cursors[i].pos, cursors[i].pos + 1, RENDER_REVERSE);
+    }
+}
+
+/// @brief Renders the focused document as rows of hex below the tab bar, scrolled to keep the primary cursor on screen.
+void renderHex(char* dst)
+{
+    struct Text* text = &tabs[focus]->text;
+    size_t cursor = cursors[primary].pos;
+    size_t visible = rows - py > 0 ? rows - py : 1;
+    if (cursor < top)
+        top = cursor - cursor % HEX_ROW;
+    else if (cursor >= top + visible * HEX_ROW)
+        top = (cursor / HEX_ROW - visible + 1) * HEX_ROW;
+
+    hex_render(text, top, dst, rows - py, cols);
+    vy = (cursor - top) / HEX_ROW;
+    vx = hex_column(hex_margin(text->len), cursor);
+    vx = vx < cols ? vx : cols - 1;
+}
+
+/// @brief Draws the completions over the rows below the primary cursor, or above it if they don't fit below, lined up
+/// with the word they complete.
+void renderCompletions(char* dst, uint16_t* cellAttrs)
+{
+    int height = rows - py;
+    int width = 0;
+    for (int i = 0; i < numCompletions; i++)
+        width = (int)completions[i].len + 2 > width ? (int)completions[i].len + 2 : width;
+    width = width < cols ? width : cols;
+
+    int first = vy + 1 + numCompletions <= height || vy < numCompletions ? vy + 1 : vy - numCompletions;
+    int x = vx - (int)completionPrefix - 1;
+    x = x + width <= cols ? x : cols - width;
+    x = x > 0 ? x : 0;
+    for (int i = 0; i < numCompletions && first + i < height; i++)
+    {
+        char* at = dst + (first + i) * cols + x;
+        int len = (int)completions[i].len < width - 1 ? (int)completions[i].len : width - 1;
+        memset(at, ' ', width);
+        at[0] = i == completion ? '>' : ' ';
+        memcpy(at + 1, completions[i].word, len);
+        for (int k = 0; k < width; k++)
+            cellAttrs[(first + i) * cols + x + k] = i == completion ? RENDER_REVERSE : 0;
+    }
+}
+
+// TODO: Be able to check if the file has been externally modified, requires currently mapping to change.
+void updateLineBuffer()
+{
+    // TODO: Other tabs being created will fuck up the raw buffer.
+    // TODO: Do I need tab rendering buffers and a global rendering buffer or something?
+    // The browser and diffs repaint every frame, entries and hunks keep arriving without any key being pressed.
+    if (tabs[focus]->isPending == 0 && !browsing && !diffing)
+        return;
+
+    uint64_t start = trace_now();
+    // TODO: Tab selection and possibly make the rendering more compartmentalized?
+    memset(attrs + py * cols, 0, (rows - py) * cols * sizeof(uint16_t));
+    if (browsing)
+    {
+        vx = browser_render(&browser, raw + py * cols, rows - py, cols);
+        vy = 0;
+    }
+    else if (diffing)
+    {
+        diff_render(&diff, raw + py * cols, rows - py, cols);
+        vx = 0;
+        vy = 0;
+    }
+    else if (tabs[focus]->hex)
+        renderHex(raw + py * cols);
+    else
+    {
+        renderText(raw + py * cols);
+        highlightText();
+        if (completing)
+            renderCompletions(raw + py * cols, attrs + py * cols);
+    }
+
+    trace_record(TRACE_LINES, start, trace_now());
+}
+
+void clearScreen()
+{
+    uint64_t start = trace_now();
+    updateLineBuffer();
+    int overlaid = overlay || status[0] != '\0';
+    if (overlay)
+        trace_overlay(raw + (rows - 1) * cols, cols);
+    else if (status[0] != '\0')
+    {
+        int len = strnlen(status, cols);
+        memset(raw + (rows - 1) * cols, ' ', cols);
+        memcpy(raw + (rows - 1) * cols, status, len);
+    }
+    if (overlaid)
+        memset(attrs + (rows - 1) * cols, 0, cols * sizeof(uint16_t));
+
+    // Rows of a document which isn't UTF-8 show its high bytes as placeholders, anything else shown keeps them.
+    int plain = !browsing && !diffing && !tabs[focus]->hex && !tabs[focus]->kind.utf8;
+    size_t len = 0;
+    for (int row = 0; row < rows; row++)
+    {
+        int utf8 = !plain || row < py || (row == rows - 1 && overlaid);
+        len += render_row(output + len, raw + row * cols, attrs + row * cols, cols, utf8);
+        if (row + 1 < rows)
+        {
+            output[len++] = '\r';
+            output[len++] = '\n';
+        }
+    }
+    len += render_cursor(output + len, vy + py + 1, vx + px + 1);
+
+    uint64_t built = trace_now();
+    trace_record(TRACE_FRAME, start, built);
+
+    // Clear the screen and return the cursor to home position.
+    display("\x1b[2J", 4);
+    display("\x1b[H", 3);
+    display(output, len);
+
+    uint64_t end = trace_now();
+    trace_record(TRACE_WRITE, built, end);
+    if (keyTime != 0)
+        trace_record(TRACE_PHOTON, keyTime, end);
+    keyTime = 0;
+}
+
+int compareCursors(const void* a, const void* b)
+{
+    size_t x = ((const struct Cursor*)a)->pos;
+    size_t y = ((const struct Cursor*)b)->pos;
+    return (x > y) - (x < y);
+}
+
+/// @brief Grows the cursor set and the edit batch to hold at least n cursors.
+int reserveCursors(int n)
+{
+    if (n <= capCursors)
+        return 0;
+
+    int cap = capCursors == 0 ? 16 : capCursors;
+    while (cap < n)
+        cap *= 2;
+
+    struct Cursor* _cursors = mzrealloc(cursors, cap * sizeof(struct Cursor));
+    if (_cursors == NULL)
+        return -1;
+    cursors = _cursors;
+
+    struct Edit* _edits = mzrealloc(edits, cap * sizeof(struct Edit));
+    if (_edits == NULL)
+        return -1;
+    edits = _edits;
+
+    capCursors = cap;
+    return 0;
+}
+
+/// @brief Restores the cursor set to sorted order without duplicates, keeping track of the primary cursor.
+void mergeCursors()
+{
+    size_t at = cursors[primary].pos;
+    for (int i = 1; i < numCursors; i++)
+    {
+        if (cursors[i].pos < cursors[i - 1].pos)
+        {
+            qsort(cursors, numCursors, sizeof(struct Cursor), compareCursors);
+            break;
+        }
+    }
+
+    int n = 0;
+    for (int i = 0; i < numCursors; i++)
+    {
+        if (n == 0 || cursors[i].pos != cursors[n - 1].pos)
+            cursors[n++] = cursors[i];
+        if (cursors[i].pos == at)
+            primary = n - 1;
+    }
+
+    numCursors = n;
+}
+
+/// @brief Gets where a cursor lands one line up or down, or its own position if there is no such line.
+size_t verticalMove(struct Text* text, struct Cursor* cursor, int dir)
+{
+    // Rows of hex are a fixed number of bytes apart.
+    if (tabs[focus]->hex)
+    {
+        if (dir < 0)
+            return cursor->pos >= HEX_ROW ? cursor->pos - HEX_ROW : cursor->pos;
+        return text->len - cursor->pos >= HEX_ROW ? cursor->pos + HEX_ROW : cursor->pos;
+    }
+
+    size_t start = lineStart(text, cursor->pos);
+    size_t target;
+    if (dir < 0)
+    {
+        if (start == 0)
+            return cursor->pos;
+        target = lineStart(text, start - 1);
+    }
+    else
+    {
+        size_t end = text_chr(text, cursor->pos, '\n');
+        if (end >= text->len)
+            return cursor->pos;
+        target = end + 1;
+    }
+
+    // A column is at most 4 bytes along, so that far is all that has to be mapped.
+    size_t length = text_chr(text, target, '\n') - target;
+    size_t wanted = (size_t)cursor->goal * 4 + 4;
+    size_t mark = frame.used;
+    struct Sequences seqs;
+    mapSequences(&seqs, target, length < wanted ? length : wanted, target + length);
+    size_t offset = sequence_offset(&seqs, cursor->goal);
+    arena_rewind(&frame, mark);
+    return target + (offset < length ? offset : length);
+}
+
+void vertical(int dir)
+{
+    struct Text* text = &tabs[focus]->text;
+    for (int i = 0; i < numCursors; i++)
+        cursors[i].pos = verticalMove(text, cursors + i, dir);
+
+    mergeCursors();
+}
+
+/// @brief Moves a position a column along, over whole characters and past a hidden carriage return onto the next line.
+/// No character is longer than 4 bytes, so only the bytes either side of the position are mapped.
+size_t horizontalMove(struct Text* text, size_t pos, int dir)
+{
+    if (dir < 0 ? pos == 0 : pos >= text->len)
+        return pos;
+    if (tabs[focus]->hex)
+        return pos + dir;
+
+    char window[8];
+    size_t from = pos >= 4 ? pos - 4 : 0;
+    size_t got = text_read(text, from, window, pos + 4 - from);
+    size_t at = pos - from;
+    size_t first = at;
+    size_t last = at;
+    while (first > 0 && window[first - 1] != '\n')
+        first--;
+    while (last < got && window[last] != '\n')
+        last++;
+
+    // The start of the line moves onto the end of the one before, which ends before its carriage return if it's hidden.
+    if (dir < 0 && first == at)
+        return (sequenceFlags() & SEQUENCE_CRLF) && pos >= 2 && text_at(text, pos - 2) == '\r' ? pos - 2 : pos - 1;
+
+    int end = last < got || from + got == text->len;
+    size_t mark = frame.used;
+    struct Sequences seqs;
+    sequence_scan(&seqs, window + first, last - first, sequenceFlags() | (end ? SEQUENCE_END : 0), &frame);
+    size_t moved;
+    if (dir > 0 && end && at - first >= sequence_end(&seqs))
+        moved = from + last < text->len ? from + last + 1 : pos;
+    else
+        moved = from + first + sequence_step(&seqs, at - first, dir);
+    arena_rewind(&frame, mark);
+    return moved;
+}
+
+void horizontal(int dir)
+{
+    struct Text* text = &tabs[focus]->text;
+    for (int i = 0; i < numCursors; i++)
+    {
+        cursors[i].pos = horizontalMove(text, cursors[i].pos, dir);
+        // A binary file may not have a newline for gigabytes, and hex has no use for the goal anyway.
+        if (!tabs[focus]->hex)
+            cursors[i].goal = columnOf(cursors[i].pos);
+    }
+
+    mergeCursors();
+}
+
+void up()
+{
+    vertical(-1);
+}
+
+void down()
+{
+    vertical(1);
+}
+
+void left()
+{
+    horizontal(-1);
+}
+
+void right()
+{
+    horizontal(1);
+}
+
+/// @brief Moves the cursors a screen up or down.
+void page(int dir)
+{
+    for (int i = 1; i < rows - py; i++)
+        vertical(dir);
+}
+
+void pageUp()
+{
+    page(-1);
+}
+
+void pageDown()
+{
+    page(1);
+}
+
+/// @brief Applies a batch to a document, taking the words it touches out of the index before and putting the new ones in
+/// after, and journals it.
+/// @return 0 if successful, otherwise -1 and the document is untouched.
+int applyBatch(int tab, const struct Edit* batch, int n)
+{
+    struct Buffer* buf = tabs[tab];
+    words_edit(&buf->words, &buf->text, batch, n, -1);
+    if (text_apply(&buf->text, batch, n) != 0)
+    {
+        // The words taken out are still in the document, rather than putting them back the index starts over.
+        if (buf->words.started)
+        {
+            words_close(&buf->words);
+            words_open(&buf->words, &buf->text);
+        }
+        return -1;
+    }
+
+    words_edit(&buf->words, &buf->text, batch, n, 1);
+    journal_append(&buf->journal, &buf->text, batch, n);
+    return 0;
+}
+
+/// @brief Replaces the del bytes before every cursor with what insert inserts as a single batch, one pass over the document.
+void spliceCursors(size_t del, const struct Edit* insert)
+{
+    // The hex view only looks, typing into it would insert text rather than change bytes.
+    if (tabs[focus]->hex)
+        return;
+
+    struct Text* text = &tabs[focus]->text;
+    size_t len = insert->len;
+    for (int i = 0; i < numCursors; i++)
+    {
+        // A deletion can't reach back past the start of the document or into the previous cursor's edit.
+        size_t floor = i > 0 ? edits[i - 1].pos + edits[i - 1].del : 0;
+        size_t d = cursors[i].pos - floor < del ? cursors[i].pos - floor : del;
+        edits[i] = *insert;
+        edits[i].pos = cursors[i].pos - d;
+        edits[i].del = d;
+    }
+
+    if (applyBatch(focus, edits, numCursors) != 0)
+        return;
+
+    // Every cursor lands after its own insertion, shifted by everything the cursors before it did.
+    ptrdiff_t shift = 0;
+    ptrdiff_t topShift = 0;
+    for (int i = 0; i < numCursors; i++)
+    {
+        if (edits[i].pos < top)
+        {
+            if (edits[i].pos + edits[i].del <= top)
+                topShift = shift + len - edits[i].del;
+            else
+                topShift = shift + edits[i].pos - top;
+        }
+
+        cursors[i].pos = edits[i].pos + shift + len;
+        shift += len - edits[i].del;
+    }
+
+    top = lineStart(text, top + topShift);
+    for (int i = 0; i < numCursors; i++)
+        cursors[i].goal = columnOf(cursors[i].pos);
+
+    mergeCursors();
+    tabs[focus]->isModified = -1;
+}
+
+/// @brief Replaces the del bytes before every cursor with data as a single batch, one pass over the document.
+void editCursors(size_t del, const char* data, size_t len)
+{
+    struct Edit insert = { .data = data, .len = len };
+    spliceCursors(del, &insert);
+}
+
+/// @brief Applies a single edit to a document, moving the cursors and the view along with it if it's focused.
+void applyEdit(int tab, const struct Edit* edit)
+{
+    struct Text* text = &tabs[tab]->text;
+    if (applyBatch(tab, edit, 1) != 0)
+        return;
+
+    tabs[tab]->isModified = -1;
+    tabs[tab]->isPending = -1;
+    if (tab != focus)
+        return;
+
+    // Cursors past the edit shift with it, cursors inside it end up after the inserted text.
+    size_t end = edit->pos + edit->del;
+    for (int i = 0; i < numCursors; i++)
+    {
+        if (cursors[i].pos >= end)
+            cursors[i].pos = cursors[i].pos - edit->del + edit->len;
+        else if (cursors[i].pos > edit->pos)
+            cursors[i].pos = edit->pos + edit->len;
+    }
+
+    if (top >= end)
+        top = top - edit->del + edit->len;
+    else if (top > edit->pos)
+        top = lineStart(text, edit->pos);
+    if (tabs[tab]->hex)
+        top -= top % HEX_ROW;
+
+    mergeCursors();
+}
+
+void backspace()
+{
+    editCursors(1, NULL, 0);
+}
+
+void newline()
+{
+    // Files which mostly end their lines with CRLF keep doing so.
+    if (classify_crlf(&tabs[focus]->kind))
+        editCursors(0, "\r\n", 2);
+    else
+        editCursors(0, "\n", 1);
+}
+
+/// @brief Adds a cursor one line past the outermost cursor in a direction.
+void addCursor(int dir)
+{
+    if (reserveCursors(numCursors + 1) != 0)
+        return;
+
+    struct Cursor cursor = cursors[dir < 0 ? 0 : numCursors - 1];
+    cursor.goal = cursors[primary].goal;
+    cursor.pos = verticalMove(&tabs[focus]->text, &cursor, dir);
+    cursors[numCursors++] = cursor;
+    mergeCursors();
+}
+
+void addCursorAbove()
+{
+    addCursor(-1);
+}
+
+void addCursorBelow()
+{
+    addCursor(1);
+}
+
+int isWord(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/// @brief Gets the word under the primary cursor, at most TEXT_NEEDLE_MAX bytes of it.
+/// @return Length of the word, 0 if the cursor isn't on one.
+size_t wordAt(size_t* start)
+{
+    struct Text* text = &tabs[focus]->text;
+    size_t at = cursors[primary].pos;
+    size_t end = at;
+    *start = at;
+    while (*start > 0 && at - *start < TEXT_NEEDLE_MAX && isWord(text_at(text, *start - 1)))
+        (*start)--;
+    while (end < text->len && end - *start < TEXT_NEEDLE_MAX && isWord(text_at(text, end)))
+        end++;
+
+    return end - *start;
+}
+
+/// @brief Adds a cursor to every whole-word occurrence of the word under the primary cursor, at the same offset.
+void addCursorsAtWord()
+{
+    struct Text* text = &tabs[focus]->text;
+    size_t start;
+    size_t len = wordAt(&start);
+    if (len == 0)
+        return;
+
+    char word[TEXT_NEEDLE_MAX];
+    text_read(text, start, word, len);
+    size_t offset = cursors[primary].pos - start;
+
+    // Every occurrence is found in one pass rather than a search per cursor.
+    size_t* hits;
+    size_t count;
+    if (search_all(text, word, len, &hits, &count) != 0)
+        return;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t hit = hits[i];
+        if ((hit > 0 && isWord(text_at(text, hit - 1))) || isWord(text_at(text, hit + len)))
+            continue;
+
+        if (reserveCursors(numCursors + 1) != 0)
+            break;
+
+        cursors[numCursors++] = (struct Cursor){ hit + offset, offset };
+    }
+
+    mzfree(hits);
+    mergeCursors();
+}
+
+/// @brief Drops every cursor but the primary one.
+void collapseCursors()
+{
+    cursors[0] = cursors[primary];
+    numCursors = 1;
+    primary = 0;
+}
+
+/// @brief Sets the other end of the range to be copied or cut at the primary cursor, or unsets it.
+void setMark()
+{
+    mark = mark == SIZE_MAX ? cursors[primary].pos : SIZE_MAX;
+}
+
+/// @brief Gets the range between the mark and the primary cursor, or the primary cursor's line with its newline.
+void markedRange(size_t* pos, size_t* len)
+{
+    struct Text* text = &tabs[focus]->text;
+    size_t at = cursors[primary].pos;
+    if (mark != SIZE_MAX)
+    {
+        size_t other = mark < text->len ? mark : text->len;
+        *pos = other < at ? other : at;
+        *len = (other < at ? at : other) - *pos;
+        return;
+    }
+
+    *pos = lineStart(text, at);
+    size_t end = text_chr(text, at, '\n');
+    *len = (end < text->len ? end + 1 : end) - *pos;
+}
+
+/// @brief Copies the marked range or the line, which also goes to the terminal's clipboard if it isn't too large.
+void copy()
+{
+    size_t pos, len;
+    markedRange(&pos, &len);
+    mark = SIZE_MAX;
+    if (clipboard_copy(&clipboard, &tabs[focus]->text, pos, len, 0) == 0 && !headless)
+        clipboard_export(clipboard_get(&clipboard, 0), display);
+}
+
+/// @brief Cuts the marked range or the line, cuts in a row add to the same entry.
+void cut()
+{
+    size_t pos, len;
+    markedRange(&pos, &len);
+    mark = SIZE_MAX;
+    if (len == 0 || clipboard_copy(&clipboard, &tabs[focus]->text, pos, len, lastCommand == cut) != 0)
+        return;
+
+    struct Edit edit = { .pos = pos, .del = len };
+    applyEdit(focus, &edit);
+    for (int i = 0; i < numCursors; i++)
+        cursors[i].goal = columnOf(cursors[i].pos);
+}
+
+/// @brief Pastes the newest entry at every cursor, entries from the same document paste its pieces without copying.
+void paste()
 {
-    int pos;
-    int length;
-};
+    const struct Clip* clip = clipboard_get(&clipboard, 0);
+    if (clip == NULL || clip->len == 0)
+        return;
 
-static struct termios orig;
-static struct Map binds;
-static struct Buffer tabs[NUM_TABS];
+    struct Edit insert = clipboard_edit(clip, 0, 0);
+    spliceCursors(0, &insert);
+}
 
-/// @brief Index of the currently focused tab.
-static int focus = 0;
-/// @brief Cursor position.
-static int vx = 0, vy = 0;
-/// @brief Padding dimensions.
-static int px = 0, py = 1;
-/// @brief Current index into the rendering buffer.
-static int pos = 0;
-/// @brief Number of rows and columns present in the current window.
-static int rows, cols;
-/// @brief Line buffer.
-// TODO: Explain the buffers and write it all out to make sure it isn't redundant.
-static struct Line* lines;
-/// @brief Number of lines in line buffer.
-static int numLines;
-/// @brief Raw rendering buffer.
-static char* raw;
+/// @brief Replaces every occurrence of the marked range, or of the word under the primary cursor, with the newest entry.
+/// Matches are found in one pass and replaced as a single batch, every replacement referencing the same pieces.
+void replaceAll()
+{
+    struct Text* text = &tabs[focus]->text;
+    const struct Clip* clip = clipboard_get(&clipboard, 0);
+    size_t pos, len;
+    if (mark != SIZE_MAX)
+        markedRange(&pos, &len);
+    else
+        len = wordAt(&pos);
+    mark = SIZE_MAX;
 
-#define BUFFER_SIZE cols * rows
-// The extra 32 bytes here are to make room for the cursor sequence.
-#define RAW_BUFFER_SIZE cols * rows + 32
+    if (clip == NULL || len == 0 || len > TEXT_NEEDLE_MAX)
+    {
+        snprintf(status, sizeof(status), clip == NULL ? "Nothing to replace with, copy something first."
+                                                      : "Mark up to %d bytes or move onto a word to replace.",
+                 TEXT_NEEDLE_MAX);
+        return;
+    }
 
-void disableRawMode()
-{
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig);
+    char needle[TEXT_NEEDLE_MAX];
+    text_read(text, pos, needle, len);
+    size_t* hits;
+    size_t count;
+    struct Edit* batch = NULL;
+    if (search_all(text, needle, len, &hits, &count) != 0 || count > INT_MAX
+        || (batch = mzalloc(count * sizeof(struct Edit))) == NULL)
+    {
+        snprintf(status, sizeof(status), "Too many matches to replace.");
+        mzfree(hits);
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+        batch[i] = clipboard_edit(clip, hits[i], len);
+
+    if (count > 0 && applyBatch(focus, batch, count) == 0)
+    {
+        tabs[focus]->isModified = -1;
+
+        // Everything shifts by the matches before it, a cursor inside a match ends up after its replacement.
+        ptrdiff_t grow = (ptrdiff_t)clip->len - (ptrdiff_t)len;
+        size_t k = 0;
+        for (int i = 0; i < numCursors; i++)
+        {
+            while (k < count && hits[k] + len <= cursors[i].pos)
+                k++;
+            size_t at = cursors[i].pos;
+            cursors[i].pos = k < count && hits[k] < at ? hits[k] + clip->len + k * grow : at + k * grow;
+            cursors[i].goal = columnOf(cursors[i].pos);
+        }
+
+        size_t before = 0;
+        while (before < count && hits[before] + len <= top)
+            before++;
+        top = lineStart(text, (before < count && hits[before] < top ? hits[before] : top) + before * grow);
+        if (tabs[focus]->hex)
+            top -= top % HEX_ROW;
+        mergeCursors();
+    }
+
+    snprintf(status, sizeof(status), "Replaced %zu occurrences.", count);
+    mzfree(batch);
+    mzfree(hits);
 }
 
-void enableRawMode()
+/// @brief Offers a word as a completion. Counts of the same word from different tabs add up, and once there are
+/// COMPLETIONS_MAX the least frequent makes way.
+void offerCompletion(const char* word, size_t len, int64_t count)
 {
-    tcgetattr(STDIN_FILENO, &orig);
-    atexit(disableRawMode);
-    struct termios raw = orig;
-    raw.c_lflag &= ~(ECHO | ICANON | ISIG | IEXTEN);
-    raw.c_iflag &= ~(IXON | ICRNL);
-    raw.c_oflag &= ~(OPOST);
-    raw.c_cflag |= (CS8);
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    int least = 0;
+    for (int i = 0; i < numCompletions; i++)
+    {
+        if (completions[i].len == len && memcmp(completions[i].word, word, len) == 0)
+        {
+            completions[i].count += count;
+            return;
+        }
+
+        if (completions[i].count < completions[least].count)
+            least = i;
+    }
+
+    if (numCompletions < COMPLETIONS_MAX)
+        least = numCompletions++;
+    else if (completions[least].count >= count)
+        return;
+
+    memcpy(completions[least].word, word, len);
+    completions[least].len = len;
+    completions[least].count = count;
 }
 
-int getBounds(int* rows, int* cols)
+int compareCompletions(const void* a, const void* b)
 {
-    struct winsize ws;
-    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1)
-        return -1;
+    const struct Completion* x = a;
+    const struct Completion* y = b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
 
-    *rows = ws.ws_row;
-    *cols = ws.ws_col;
-    return 0;
+    int order = memcmp(x->word, y->word, x->len < y->len ? x->len : y->len);
+    return order != 0 ? order : (x->len > y->len) - (x->len < y->len);
 }
 
-// TODO: Be able to check if the file has been externally modified, requires currently mapping to change.
-void updateLineBuffer()
+/// @brief Types the rest of a completion at every cursor.
+void acceptCompletion(int i)
 {
-    // TODO: Other tabs being created will fuck up the raw buffer.
-    // TODO: Do I need tab rendering buffers and a global rendering buffer or something?
-    if (tabs[focus].isPending == 0)
+    completing = 0;
+    editCursors(0, completions[i].word + completionPrefix, completions[i].len - completionPrefix);
+}
+
+/// @brief Completes the word before the primary cursor from the words of every tab, typing the rest straight away if
+/// there's only one way to, otherwise offering the most frequent below the cursor.
+void complete()
+{
+    struct Text* text = &tabs[focus]->text;
+    size_t at = cursors[primary].pos;
+    size_t start = at;
+    while (start > 0 && at - start < WORDS_MAX && isWord(text_at(text, start - 1)))
+        start--;
+    size_t end = at;
+    while (end < text->len && end - start <= WORDS_MAX && isWord(text_at(text, end)))
+        end++;
+
+    completing = 0;
+    if (tabs[focus]->hex || start == at || at - start >= WORDS_MAX)
+    {
+        snprintf(status, sizeof(status), "Type the start of a word to complete it.");
         return;
+    }
 
-    char* tmp = raw;
-    // TODO: Tab selection and possibly make the rendering more compartmentalized?
-    raw += py * cols;
-    int _pos = -1;
-    numLines = rows - py;
+    char prefix[WORDS_MAX];
+    char self[WORDS_MAX];
+    completionPrefix = at - start;
+    text_read(text, start, prefix, completionPrefix);
+    size_t selfLen = end - start <= WORDS_MAX ? text_read(text, start, self, end - start) : 0;
 
-    for (int i = 0; i < rows - py; i++)
+    numCompletions = 0;
+    int indexing = 0;
+    for (int t = 0; t < numTabs; t++)
     {
-        int sentinel = ++_pos;
-        if (_pos >= tabs[focus].used || tabs[focus].data[_pos] == '\0')
-            break;
-
-        lines[i].pos = sentinel;
-        lines[i].length = 0;
+        if (tabs[t] == NULL || !tabs[t]->words.ready)
+        {
+            indexing |= tabs[t] != NULL && tabs[t]->words.started;
+            continue;
+        }
 
-        while (_pos < tabs[focus].used && tabs[focus].data[_pos] != '\n' && tabs[focus].data[_pos] != '\0')
+        // One more than is offered, in case one of them is the word being typed.
+        struct WordMatch matches[COMPLETIONS_MAX + 1];
+        size_t n = words_lookup(&tabs[t]->words.table, prefix, completionPrefix, matches, COMPLETIONS_MAX + 1);
+        for (size_t i = 0; i < n; i++)
         {
-            // if (tabs[focus].data[_pos] == '\t')
-            // {
-            //     memcpy(raw, tabs[focus].data + sentinel, _pos - sentinel);
-            //     raw += _pos - sentinel;
-            //     sentinel = _pos + 1;
-            //     // TODO: This doesn't work, these need to be more than just visual also visual stuff needs worked out.
-            // }
-
-            _pos++;
-            lines[i].length++;
+            // The word under the cursor doesn't complete itself.
+            int64_t count = matches[i].count;
+            if (t == focus && matches[i].len == selfLen && memcmp(matches[i].word, self, selfLen) == 0)
+                count--;
+            if (count > 0)
+                offerCompletion(matches[i].word, matches[i].len, count);
         }
+    }
+
+    if (numCompletions == 0)
+    {
+        snprintf(status, sizeof(status), indexing ? "Still indexing, nothing completes %.*s yet." : "Nothing completes %.*s.",
+                 (int)completionPrefix, prefix);
+        return;
+    }
 
-        if (_pos != sentinel)
-            memcpy(raw, tabs[focus].data + sentinel, _pos - sentinel);
-        raw += _pos - sentinel;
+    qsort(completions, numCompletions, sizeof(struct Completion), compareCompletions);
+    completion = 0;
+    if (numCompletions == 1)
+        acceptCompletion(0);
+    else
+        completing = 1;
+}
 
-        memset(raw, ' ', cols - lines[i].length);
-        raw += cols - lines[i].length;
+/// @brief Handles a key while completing, up and down pick, enter or tab accept and Esc cancels. Any other key cancels
+/// and is then handled as usual.
+/// @return 1 if the key was handled, otherwise 0.
+int completionKey(const char* seq)
+{
+    if (strncmp(seq, "\x1b[A", 4) == 0)
+        completion = (completion + numCompletions - 1) % numCompletions;
+    else if (strncmp(seq, "\x1b[B", 4) == 0)
+        completion = (completion + 1) % numCompletions;
+    else if (strncmp(seq, "\r", 4) == 0 || strncmp(seq, "\t", 4) == 0)
+        acceptCompletion(completion);
+    else
+    {
+        completing = 0;
+        return strncmp(seq, "\x1b", 4) == 0;
     }
 
-    // Alarm doesn't mess with the sequence so it's being used as a placeholder, viable digits replace the alarm characters.
-    strcpy(raw, "\x1b[\a\a\a\a;\a\a\a\aH");
-    raw += 5;
+    return 1;
+}
+
+/// @brief Cycles the kill ring so the next paste takes the entry before.
+void rotateClipboard()
+{
+    clipboard_rotate(&clipboard);
+}
 
-    int row = vy + py + 1;
-    int col = vx + px + 1;
-    int digits = 0;
-    while (row > 0)
+/// @brief Switches the focused document between text and hex, keeping the primary cursor where it is.
+void toggleHex()
+{
+    struct Text* text = &tabs[focus]->text;
+    tabs[focus]->hex = !tabs[focus]->hex;
+    if (tabs[focus]->hex)
+        top -= top % HEX_ROW;
+    else
     {
-        *raw-- = '0' + (row % 10);
-        row /= 10;
-        digits++;
+        // Goals were left alone while in hex, lines only mean something again now.
+        top = lineStart(text, top);
+        for (int i = 0; i < numCursors; i++)
+            cursors[i].goal = columnOf(cursors[i].pos);
+        if (!tabs[focus]->words.started)
+            words_open(&tabs[focus]->words, text);
     }
+}
+
+void toggleOverlay()
+{
+    overlay = !overlay;
+}
+
+void dumpTrace()
+{
+    char* path = getenv("PIPIT_TRACE");
+    trace_dump(path != NULL ? path : "pipit.trace");
+}
+
+void quit()
+{
+    if (headless)
+        finishHeadless();
+
+    closeJournals();
+    display("\x1b[2J", 4);
+    display("\x1b[H", 3);
+
+    exit(65);
+}
 
-    raw += digits + 5;
+int buffer_open(char* path);
 
-    digits = 0;
-    while (col > 0)
+/// @brief Moves focus to a tab, keeping the view of the one losing it for when it's back.
+void focusTab(int tab)
+{
+    if (tab != focus && tabs[focus] != NULL)
     {
-        *raw-- = '0' + (col % 10);
-        col /= 10;
-        digits++;
+        tabs[focus]->top = top;
+        tabs[focus]->cursor = cursors[primary].pos;
     }
 
-    raw = tmp;
+    focus = tab;
+    struct Buffer* buf = tabs[tab];
+    buf->focused = ++focusCount;
+    buf->cold = 0;
+
+    top = buf->top;
+    numCursors = 1;
+    primary = 0;
+    cursors[0] = (struct Cursor){ buf->cursor, columnOf(buf->cursor) };
+    mark = SIZE_MAX;
+    buf->isPending = -1;
+    trimTabs(TABS_WARM);
 }
 
-void clearScreen()
+/// @brief Focuses the next open tab in dir, wrapping around.
+void cycleTabs(int dir)
 {
-    // Clear the screen and return the cursor to home position.
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    for (int i = 1; i < numTabs; i++)
+    {
+        int tab = ((focus + i * dir) % numTabs + numTabs) % numTabs;
+        if (tabs[tab] != NULL)
+        {
+            focusTab(tab);
+            return;
+        }
+    }
+}
 
-    updateLineBuffer();
-    write(STDOUT_FILENO, raw, RAW_BUFFER_SIZE);
+void nextTab()
+{
+    cycleTabs(1);
 }
 
-void down()
+void previousTab()
+{
+    cycleTabs(-1);
+}
+
+/// @brief Closes the focused tab, plugins and the clipboard let go of its document first. Closing the last one quits.
+void closeTab()
 {
-    if (vy + 1 >= numLines)
+    struct Buffer* buf = tabs[focus];
+    int next = -1;
+    for (int i = 0; i < numTabs; i++)
+    {
+        if (tabs[i] != NULL && i != focus && (next < 0 || tabs[i]->focused > tabs[next]->focused))
+            next = i;
+    }
+
+    if (next < 0)
+    {
+        quit();
         return;
+    }
 
-    vy++;
-    if (vx < lines[vy].length)
-        pos = lines[vy].pos + vx;
-    else
+    for (int i = 0; i < numPlugins; i++)
+        plugin_close(plugins + i, focus);
+    clipboard_detach(&clipboard, &buf->text);
+    sched_cancel(buf);
+    journal_close(&buf->journal, 0);
+    words_close(&buf->words);
+    text_free(&buf->text);
+    lineindex_free(&buf->index);
+    if (buf->used > 0)
+        munmap(buf->data, buf->used);
+    close(buf->handle);
+    free(buf->path);
+    free(buf->name);
+    mzfree(buf);
+
+    tabs[focus] = NULL;
+    while (numTabs > 0 && tabs[numTabs - 1] == NULL)
+        numTabs--;
+    focusTab(next);
+    renderTabs();
+}
+
+/// @brief Opens the browser on the working directory, or closes it if it's open.
+void toggleBrowser()
+{
+    browsing = !browsing && browser_open(&browser, ".") == 0;
+    tabs[focus]->isPending = -1;
+}
+
+/// @brief Handles a key while browsing, the filter takes anything typed and enter opens the selection.
+void browserKey(const char* seq, int len)
+{
+    char path[PATH_MAX];
+    if (strncmp(seq, "\x1b[A", 4) == 0)
+        browser_move(&browser, -1);
+    else if (strncmp(seq, "\x1b[B", 4) == 0)
+        browser_move(&browser, 1);
+    else if (strncmp(seq, "\x1b", 4) == 0 || strncmp(seq, "\x0f", 4) == 0)
+        toggleBrowser();
+    else if (strncmp(seq, "\x18", 4) == 0 || strncmp(seq, "\x1bOQ", 4) == 0)
+        quit();
+    else if (seq[0] == '\x7f' || seq[0] == '\x08')
+    {
+        // Backspacing past the start of the query goes up a directory.
+        if (browser.queryLen > 0)
+            browser_query(&browser, browser.query, browser.queryLen - 1);
+        else
+        {
+            snprintf(path, sizeof(path), "%s/..", browser.current->root);
+            browser_open(&browser, path);
+        }
+    }
+    else if (seq[0] == '\r')
+    {
+        int type = browser_selected(&browser, path);
+        if (type == BROWSER_DIR)
+            browser_open(&browser, path);
+        else if (type == BROWSER_FILE)
+        {
+            int tab = buffer_open(path);
+            if (tab < 0)
+                return;
+
+            focusTab(tab);
+            browsing = 0;
+        }
+    }
+    else if ((unsigned char)seq[0] >= ' ' && browser.queryLen + len <= BROWSER_QUERY_MAX)
     {
-        vx = lines[vy].length > 0 ? lines[vy].length - 1 : 0;
-        pos = lines[vy].pos + lines[vy].length - 1;
+        char query[BROWSER_QUERY_MAX];
+        memcpy(query, browser.query, browser.queryLen);
+        memcpy(query + browser.queryLen, seq, len);
+        browser_query(&browser, query, browser.queryLen + len);
     }
 }
 
-void right()
+/// @brief Diffs the focused document against its file as it is on disk.
+void diffDisk()
+{
+    diffing = diff_file(&diff, tabs[focus]->path, &tabs[focus]->text, tabs[focus]->name) == 0;
+    // Replays have to come out the same every time, so the diff is finished before the frame showing it.
+    if (diffing && headless)
+        diff_wait(&diff);
+}
+
+/// @brief Diffs the closest tab before the focused one against the focused one.
+void diffTabs()
 {
-    if (vx + 1 >= lines[vy].length)
+    for (int i = 1; i < numTabs; i++)
     {
-        if (vy + 1 < numLines)
-            vx = lines[vy + 1].length;
-        down();
+        int other = (focus - i + numTabs) % numTabs;
+        if (tabs[other] == NULL)
+            continue;
+
+        const char* names[2] = { tabs[other]->name, tabs[focus]->name };
+        diffing = diff_start(&diff, &tabs[other]->text, &tabs[focus]->text, names) == 0;
+        if (diffing && headless)
+            diff_wait(&diff);
         return;
     }
 
-    vx++;
-    pos++;
+    snprintf(status, sizeof(status), "No other tab to diff against.");
 }
 
-void up()
+/// @brief Handles a key while a diff is shown, which only scrolls it.
+void diffKey(const char* seq)
 {
-    if (vy - 1 < 0)
-            return;
-
-    vy--;
-    if (vx < lines[vy].length)
-        pos = lines[vy].pos + vx;
-    else
+    if (strncmp(seq, "\x1b[A", 4) == 0)
+        diff_move(&diff, -1);
+    else if (strncmp(seq, "\x1b[B", 4) == 0)
+        diff_move(&diff, 1);
+    else if (strncmp(seq, "\x1b[5~", 4) == 0)
+        diff_move(&diff, -(rows - py - 1));
+    else if (strncmp(seq, "\x1b[6~", 4) == 0)
+        diff_move(&diff, rows - py - 1);
+    else if (strncmp(seq, "\x18", 4) == 0 || strncmp(seq, "\x1bOQ", 4) == 0)
+        quit();
+    else if (strncmp(seq, "\x1b", 4) == 0 || strncmp(seq, "\x1b" "d", 4) == 0 || strncmp(seq, "\x1b" "D", 4) == 0)
     {
-        vx = lines[vy].length > 0 ? lines[vy].length - 1 : 0;
-        pos = lines[vy].pos + lines[vy].length - 1;
+        diff_free(&diff);
+        diffing = 0;
     }
 }
 
-void left()
+/// @brief Handles a command from a plugin, a replacement only applies if the document is still at the version it saw.
+void pluginCommand(void* ctx, struct Plugin* plugin, uint32_t type, const void* data, uint32_t len)
 {
-    if (vx - 1 < 0)
+    (void)ctx;
+    (void)plugin;
+    if (type == PLUGIN_STATUS)
     {
-        if (vy - 1 < numLines)
-            vx = lines[vy - 1].length;
-        up();
+        len = len < sizeof(status) - 1 ? len : sizeof(status) - 1;
+        memcpy(status, data, len);
+        status[len] = '\0';
+        tabs[focus]->isPending = -1;
         return;
     }
 
-    vx--;
-    pos--;
+    // The plugin can still write to the record, so what gets checked is a copy.
+    struct PluginReplace replace;
+    if (type != PLUGIN_REPLACE || len < sizeof(struct PluginReplace))
+        return;
+
+    memcpy(&replace, data, sizeof(replace));
+    if (replace.tab >= (uint32_t)numTabs || tabs[replace.tab] == NULL)
+        return;
+
+    struct Text* text = &tabs[replace.tab]->text;
+    if (text->pieces == NULL || replace.version != text->version || replace.pos > text->len
+        || replace.del > text->len - replace.pos)
+        return;
+
+    struct Edit edit = { .pos = replace.pos, .del = replace.del, .data = (const char*)data + sizeof(replace),
+        .len = len - sizeof(replace) };
+    applyEdit(replace.tab, &edit);
 }
 
-void quit()
+/// @brief Brings every plugin up to date with the open documents and handles what they sent back, never waiting on them.
+void syncPlugins()
 {
-    write(STDOUT_FILENO, "\x1b[2J", 4);
-    write(STDOUT_FILENO, "\x1b[H", 3);
+    for (int i = 0; i < numPlugins; i++)
+    {
+        for (int t = 0; t < numTabs; t++)
+        {
+            if (tabs[t] != NULL)
+                plugin_sync(plugins + i, t, &tabs[t]->text, tabs[t]->handle);
+        }
 
-    exit(65);
+        plugin_poll(plugins + i, pluginCommand, NULL);
+        plugin_flush(plugins + i);
+    }
 }
 
 void processKeys()
 {
     char seq[4] = {0, 0, 0, 0};
-    int len = read(STDIN_FILENO, seq, 4);
+    int len = readKey(seq);
 
     if (len <= 0)
         return;
 
-    if (seq[0] == 'q')
-        quit();
+    keyTime = trace_now();
 
     // TODO: I feel like there MUST be something I'm missing. Review rendering stuff later.
-    tabs[focus].isPending = -1;
+    tabs[focus]->isPending = -1;
 
     void (*func)(void);
-    if ((func = map_get(&binds, rapidhash(seq, 4))))
+    if (browsing)
+        browserKey(seq, len);
+    else if (diffing)
+        diffKey(seq);
+    else if (completing && completionKey(seq))
+        lastCommand = complete;
+    else if ((func = map_get(&binds, rapidhash(seq, 4))))
+    {
         func();
-    else
+        lastCommand = func;
+    }
+    else if ((unsigned char)seq[0] >= ' ' && seq[0] != 0x7f)
+    {
+        // Anything unbound which isn't a control or escape sequence is typed, pastes can arrive several bytes at once.
+        editCursors(0, seq, len);
+    }
+
+    // Plugins hear about the key after it's been handled, the pieces they get next already include it.
+    struct PluginKey key = { .tab = focus };
+    memcpy(key.key, seq, 4);
+    struct PluginCursor cursor = { focus, 0, cursors[primary].pos };
+    for (int i = 0; i < numPlugins; i++)
     {
-        //tabs[focus].data[pos] = seq[0];
-        right();
+        plugin_event(plugins + i, PLUGIN_KEY, &key, sizeof(key));
+        plugin_event(plugins + i, PLUGIN_CURSOR, &cursor, sizeof(cursor));
     }
+
+    trace_record(TRACE_KEYS, keyTime, trace_now());
+}
+
+/// @brief Binds a key sequence of up to 4 bytes to func, padded the same way processKeys reads them.
+void bind(const char* seq, void (*func)(void))
+{
+    char key[4] = {0, 0, 0, 0};
+    memcpy(key, seq, strnlen(seq, 4));
+    map_set(&binds, rapidhash(key, 4), func);
 }
 
 char* expand_path(const char* path)
@@ -291,8 +1826,9 @@ char* expand_path(const char* path)
     if (!path || !*path)
         return NULL;
 
+    // Everything here comes from the frame arena, the result is only valid until the end of the frame.
     size_t buffer_size = PATH_MAX;
-    char* expanded = malloc(buffer_size);
+    char* expanded = arena_alloc(&frame, buffer_size);
 
     if (!expanded)
         return NULL;
@@ -320,13 +1856,10 @@ char* expand_path(const char* path)
             const char* user_end = strchr(user_start, '/');
             size_t user_len = user_end ? (size_t)(user_end - user_start) : strlen(user_start);
 
-            char* user = malloc(user_len + 1);
+            char* user = arena_alloc(&frame, user_len + 1);
 
             if (!user)
-            {
-                free(expanded);
                 return NULL;
-            }
 
             memcpy(user, user_start, user_len);
             user[user_len] = '\0';
@@ -334,24 +1867,16 @@ char* expand_path(const char* path)
             struct passwd* pw = getpwnam(user);
             home = pw ? pw->pw_dir : NULL;
 
-            free(user);
-
             src += user_len;
         }
 
         if (!home)
-        {
-            free(expanded);
             return NULL;
-        }
 
         size_t home_len = strlen(home);
 
         if (home_len >= buffer_size)
-        {
-            free(expanded);
             return NULL;
-        }
 
         memcpy(dst, home, home_len);
         dst += home_len;
@@ -375,30 +1900,22 @@ char* expand_path(const char* path)
             }
 
             size_t var_len = (size_t)(var_end - var_start);
-            char* var_name = malloc(var_len + 1);
+            char* var_name = arena_alloc(&frame, var_len + 1);
 
             if (!var_name)
-            {
-                free(expanded);
                 return NULL;
-            }
 
             memcpy(var_name, var_start, var_len);
             var_name[var_len] = '\0';
 
             const char* val = getenv(var_name);
 
-            free(var_name);
-
             if (val)
             {
                 size_t val_len = strlen(val);
 
                 if ((dst - expanded) + val_len >= buffer_size)
-                {
-                    free(expanded);
                     return NULL;
-                }
 
                 memcpy(dst, val, val_len);
                 dst += val_len;
@@ -409,10 +1926,7 @@ char* expand_path(const char* path)
         else
         {
             if ((dst - expanded) + 1 >= buffer_size)
-            {
-                free(expanded);
                 return NULL;
-            }
 
             *dst++ = *src++;
         }
@@ -433,121 +1947,232 @@ int validate_safe(char** path)
     return validate(*path);
 }
 
-void buffer_open(char* path)
+/// @brief Opens a file into the first free tab, the table grows once every tab is taken.
+/// @return Index of the tab, or -1 if there's no memory for another.
+int buffer_open(char* path)
 {
+    int tab = 0;
+    while (tab < numTabs && tabs[tab] != NULL)
+        tab++;
+
+    if (tab == capTabs)
+    {
+        int cap = capTabs < 16 ? 16 : capTabs * 2;
+        struct Buffer** grown = mzrealloc(tabs, cap * sizeof(struct Buffer*));
+        if (grown == NULL)
+            return -1;
+
+        tabs = grown;
+        capTabs = cap;
+    }
+
+    // Buffers never move, the journal is registered by address.
+    struct Buffer* slot = mzalloc(sizeof(struct Buffer));
+    if (slot == NULL)
+        return -1;
+
     struct Buffer buf = {
         .grow = 64,
         .free = 64,
         .isModified = 0,
         .isPending = -1
     };
-    // TODO: Error handling.
-    buf.handle = open(path, O_RDWR);
-    buf.used = lseek(buf.handle, 0, SEEK_END);
-    // TODO: This is a raw buffer and should be discarded if changes aren't saved.
-    // TODO: Ideally we shouldn't take exclusive access of the file but I haven't yet figured out an alternative.
-    buf.data = mmap(NULL, buf.used, PROT_READ | PROT_WRITE, MAP_SHARED, buf.handle, 0);
-
-    char* name = strrchr(path, '/');
-    if (name != path)
-        name++;
-
-    for (int i = 0; i < NUM_TABS; i++)
+    // The original is never written to, edits go to the document's add buffer and pieces reference both. Only regular
+    // files can be mapped, and opening without blocking keeps a FIFO from hanging the editor before it's turned away.
+    struct stat st;
+    buf.handle = open(path, O_RDONLY | O_NONBLOCK);
+    if (buf.handle < 0 || fstat(buf.handle, &st) != 0 || !S_ISREG(st.st_mode))
     {
-        if (tabs[i].data != NULL)
-            continue;
-
-        tabs[i] = buf;
-
-        char* ptr = strchr(raw, '\a');
-        ptr = ptr == NULL ? raw : ptr;
-        int len = ptr - raw;
+        if (buf.handle >= 0)
+            close(buf.handle);
+        mzfree(slot);
+        return -1;
+    }
 
-        if (len > 0)
-            *ptr++ = ' ';
+    buf.used = st.st_size;
+    buf.data = buf.used > 0 ? mmap(NULL, buf.used, PROT_READ, MAP_SHARED, buf.handle, 0) : NULL;
+    if (buf.data == MAP_FAILED)
+    {
+        close(buf.handle);
+        mzfree(slot);
+        return -1;
+    }
+    text_init(&buf.text, buf.data, buf.used);
+    lineindex_open(&buf.index, path, buf.handle, buf.data, buf.used);
+    // Only the head is classified before the first frame, the rest a step at a time between keys.
+    classify_open(&buf.kind, buf.data, buf.used);
+    buf.hex = buf.kind.binary;
 
-        len += 3;
-        *ptr++ = '1' + i;
-        *ptr++ = ' ';
+    char* name = strrchr(path, '/');
+    buf.path = strdup(path);
+    buf.name = strdup(name == NULL ? path : name + 1);
+
+    *slot = buf;
+    tabs[tab] = slot;
+    numTabs = tab < numTabs ? numTabs : tab + 1;
+    // Replays have to come out the same every time, so they neither journal nor recover.
+    slot->journal = (struct Journal){ .fd = -1 };
+    if (!headless && journal_open(&slot->journal, path, buf.handle, &slot->text) == 0 && slot->journal.recovered > 0)
+    {
+        slot->isModified = -1;
+        snprintf(status, sizeof(status), "Recovered %zu unsaved edits of %s", slot->journal.recovered, buf.name);
+    }
+    // Indexed from what was recovered, binary files only once they're shown as text.
+    if (!slot->hex)
+        words_open(&slot->words, &slot->text);
+    if (!slot->kind.complete)
+        sched_add(classifyJob, slot);
+
+    renderTabs();
+    return tab;
+}
 
-        while (*name != '\0')
+int main(int argc, char** argv)
+{
+    // pipit [--headless <script> [<rows>x<cols>]] [--plugin <executable>]... [+<line>] <path>
+    char* path = NULL;
+    size_t line = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
         {
-            *ptr++ = *name++;
-            len++;
+            if (script_load(&script, argv[++i]) != 0)
+                return 1;
+
+            headless = 1;
+            rows = 24;
+            cols = 80;
+            if (i + 1 < argc && sscanf(argv[i + 1], "%dx%d", &rows, &cols) == 2)
+                i++;
         }
-
-        if (tabs[i].isModified)
+        else if (strcmp(argv[i], "--plugin") == 0 && i + 1 < argc)
         {
-            *ptr++ = '*';
-            len++;
+            char* plugin[] = { argv[++i], NULL };
+            if (numPlugins < PLUGIN_MAX && plugin_start(plugins + numPlugins, plugin) == 0)
+                numPlugins++;
         }
-
-        *ptr = '\a';
-
-        int rem = cols - (len % cols) + 1;
-        memset(ptr, ' ', rem);
-
-        py += len / cols;
-        break;
+        else if (argv[i][0] == '+' && isdigit((unsigned char)argv[i][1]))
+            line = strtoull(argv[i] + 1, NULL, 10);
+        else
+            path = argv[i];
     }
-}
-
-int main(int argc, char** argv)
-{
-    printf("%Ix\n", mzalloc(32));
-    printf("%Ix\n", mzalloc(32));
-    //printf("%Ix\n", mzalloc(32));
-    return 1;
 
-    if (getBounds(&rows, &cols) == -1)
+    if (headless)
+    {
+        if (rows <= 0 || cols <= 0 || screen_init(&screen, rows, cols) != 0)
+        {
+            printf("Invalid headless window size.\n");
+            return 1;
+        }
+    }
+    else if (getBounds(&rows, &cols) == -1)
     {
         printf("Failed to get window size.");
         return 0;
     }
 
-    if (RAW_BUFFER_SIZE <= 1024 * 1024)
-    {
-        raw = alloca(RAW_BUFFER_SIZE);
-        // TODO: Technically this won't work and it needs to be 8 times bigger because every character could be a newline.
-        lines = alloca(RAW_BUFFER_SIZE);
-    }
-    else
+    // The raw buffer lives on the heap so it can follow the window around, everything else of a frame is in the arena.
+    if (reserveFrame() != 0 || arena_init(&frame) != 0)
     {
-        raw = malloc(RAW_BUFFER_SIZE);
-        lines = malloc(RAW_BUFFER_SIZE);
+        printf("Failed to allocate frame buffers.");
+        return 0;
     }
 
-    memset(raw, 0, RAW_BUFFER_SIZE);
-    // No need to zero line buffer because it should never be used before lines are updated at least once.
-
-    char* path = argc >= 2 ? argv[1] : NULL;
+    // Expanded paths are in the arena, which isn't reset until the file is open and the first frame is drawn.
+    static char fallback[PATH_MAX];
     while (validate_safe(&path) != 0)
     {
-        if (path != NULL)
-            free(path);
-
-        path = calloc(PATH_MAX, sizeof(char));
+        path = fallback;
         printf("Failed to comprehend path, enter fallback file or <^C>: ");
-        scanf("%s", path);
+        scanf("%4095s", path);
     }
 
     // TODO: This looks gross, I mix camelcase and snakecase and lowercase.
-    enableRawMode();
-    buffer_open(path);
-    map_init(&binds);
+    if (!headless)
+    {
+        enableRawMode();
+        // No SA_RESTART, a resize interrupts the wait for a key so the next frame is drawn at the new size straight away.
+        struct sigaction action = { .sa_handler = onResize };
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGWINCH, &action, NULL);
+    }
+    if (buffer_open(path) < 0)
+    {
+        printf("Failed to open %s.", path);
+        return 0;
+    }
 
-    map_set(&binds, rapidhash("\x1b[A", sizeof("\x1b[A")), &up);
-    map_set(&binds, rapidhash("\x1b[D", sizeof("\x1b[D")), &left);
-    map_set(&binds, rapidhash("\x1b[B", sizeof("\x1b[B")), &down);
-    map_set(&binds, rapidhash("\x1b[C", sizeof("\x1b[C")), &right);
-    map_set(&binds, rapidhash("\x18", sizeof("\x18")), &quit);
-    map_set(&binds, rapidhash("^[OQ", sizeof("^[OQ")), &quit);
+    // Without a trigger tabs are only trimmed past TABS_WARM.
+    pressure = headless ? -1 : open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (pressure >= 0 && write(pressure, PRESSURE_TRIGGER, sizeof(PRESSURE_TRIGGER)) < 0)
+    {
+        close(pressure);
+        pressure = -1;
+    }
+    map_init(&binds);
+    browser_init(&browser);
+    reserveCursors(1);
+    focusTab(0);
+    if (line > 0)
+        cursors[0].pos = lineindex_seek(&tabs[focus]->index, &tabs[focus]->text, line - 1);
+
+    bind("\x1b[A", &up);
+    bind("\x1b[D", &left);
+    bind("\x1b[B", &down);
+    bind("\x1b[C", &right);
+    bind("\x18", &quit);
+    bind("\x1bOQ", &quit);
+    // ^T toggles the latency overlay, Alt+T dumps the latency histograms to $PIPIT_TRACE or ./pipit.trace.
+    bind("\x14", &toggleOverlay);
+    bind("\x1bt", &dumpTrace);
+    bind("\x7f", &backspace);
+    bind("\x08", &backspace);
+    bind("\r", &newline);
+    // ^P and ^N add a cursor above the first or below the last, ^D adds one at every match of the word under the cursor,
+    // and Esc drops all but the primary cursor.
+    bind("\x10", &addCursorAbove);
+    bind("\x0e", &addCursorBelow);
+    bind("\x04", &addCursorsAtWord);
+    bind("\x1b", &collapseCursors);
+    // ^O opens the file browser on the working directory.
+    bind("\x0f", &toggleBrowser);
+    // Alt+A sets the mark, Alt+6 copies and ^K cuts from it to the cursor or the whole line, ^U pastes and Alt+Y
+    // cycles the kill ring.
+    bind("\x1b" "a", &setMark);
+    bind("\x1b" "6", &copy);
+    bind("\x0b", &cut);
+    bind("\x15", &paste);
+    bind("\x1b" "y", &rotateClipboard);
+    // Alt+R replaces every occurrence of the marked range, or of the word under the cursor, with the newest entry.
+    bind("\x1b" "r", &replaceAll);
+    // Alt+/ completes the word before the cursor from the words of every tab, up and down pick from several and enter
+    // or tab takes one.
+    bind("\x1b" "/", &complete);
+    // Alt+D diffs the focused document against its file on disk, Alt+Shift+D against the tab before it. Up, down and
+    // the page keys scroll the diff and Esc closes it.
+    bind("\x1b" "d", &diffDisk);
+    bind("\x1b" "D", &diffTabs);
+    // Alt+H switches between text and hex, binary files open as hex. The page keys move a screen at a time.
+    bind("\x1b" "h", &toggleHex);
+    // Alt+. and Alt+, move to the next and previous tab, Alt+W closes the focused one.
+    bind("\x1b" ".", &nextTab);
+    bind("\x1b" ",", &previousTab);
+    bind("\x1b" "w", &closeTab);
+    bind("\x1b[5~", &pageUp);
+    bind("\x1b[6~", &pageDown);
     //return 0;
 
+    replayStart = trace_now();
     while (1)
     {
+        if (resized)
+            resize();
         clearScreen();
         processKeys();
+        syncPlugins();
+        // Everything typed this frame goes out as one write per document.
+        journal_submit();
+        arena_reset(&frame);
     }
 
     return 0;
@@ -79,7 +79,8 @@ static inline struct _Pair* _map_search(
 
     while (len >= 0)
     {
-        __m256i bmp;
+        // Every lane is overwritten below, but inserting into an uninitialized vector lets the optimizer drop lanes.
+        __m256i bmp = _mm256_setzero_si256();
         // Populate the first half of the vector with the first bucket we see.
         // To clarify, this is not intended to put all entries into a vector,
         // this merely indexes the pairs based on the keys we generated.
@@ -102,11 +103,15 @@ static inline struct _Pair* _map_search(
         int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi32(bmp, predicate));
         if (mask != 0)
         {
-            int idx = __builtin_ctz(mask);
+            // The mask has 4 bits per 32-bit key, so this is the index of the key that hit.
+            int idx = __builtin_ctz(mask) >> 2;
             struct _Pair* _cur = cur - BUCKET_SIZE;
             // Backtrack to bucket hit.
             _cur = idx <= 3 ? _cur : _cur - BUCKET_SIZE;
-            return _cur + ((uint32_t*)&keys)[idx];
+            // Reading the vector through a uint32_t pointer breaks strict aliasing, so spill it properly.
+            uint32_t slots[4];
+            _mm_storeu_si128((__m128i*)slots, keys);
+            return _cur + slots[idx & 3];
         }
 
         len -= 2;
@@ -1,152 +1,667 @@
+#define _GNU_SOURCE
 #include <immintrin.h>
 #include <stdint.h>
 #include <sys/mman.h>
+#include <unistd.h>
 #include "bitmap.h"
 #include <stdio.h>
 #include <string.h>
+#include "mzalloc.h"
 
-#define LARGE_SHARD_SIZE 256
-#define LARGE_SHARD_SEC (1024 * 1024)
-#define SMALL_SHARD_SIZE 48
-#define SMALL_SHARD_SEC (1024 * 1024 * 3)
-#define LARGE_CLUSTERS (LARGE_SHARD_SEC / (256 * LARGE_SHARD_SIZE))
-#define SMALL_CLUSTERS (SMALL_SHARD_SEC / (256 * SMALL_SHARD_SIZE))
-#define ARBITRAGE ((LARGE_CLUSTERS + SMALL_CLUSTERS) / 2)
-
-#define SLAB_SIZE (sizeof(struct Slab) + (size_t)SMALL_CLUSTERS * 256 * SMALL_SHARD_SIZE + (size_t)LARGE_CLUSTERS * 256 * LARGE_SHARD_SIZE)
-
-static struct Slab* slab;
+// Huge blocks are counted as the class after the last.
+#define CLASS_HUGE NUM_CLASSES
+// Slabs are reserved 4MB at a time and aligned to 4MB so that any pointer into one can find its header
+// by masking, huge blocks are aligned the same way. The smaller classes hit the cluster limit first
+// and just leave the tail of the reservation untouched.
+#define SLAB_SIZE (1024 * 1024 * 4)
+#define SLAB_CLUSTERS 256
+#define SLAB_BASE(ptr) ((struct Slab*)((uintptr_t)(ptr) & ~(uintptr_t)(SLAB_SIZE - 1)))
+// Huge blocks carry their header in front of them, 32 bytes to keep the block vector aligned.
+#define HUGE_HEADER 32
 
 struct Slab
 {
-    __m256i large[LARGE_CLUSTERS];
-    __m256i small[SMALL_CLUSTERS];
-    // This is going to be used to track the length/concurrency of shards.
-    // Every 2 bits of shard presence metadata is represented by 1 bit of arbitrage data.
-    __m256i arbitrage[ARBITRAGE];
+    // This must come first, huge headers share it to tell the two apart.
+    int class;
+    int clusters;
+    // Longest free run in any cluster, clamped to CLASS_RUN since nothing new asks for more.
+    int room;
+    // Number of shards currently allocated.
+    int used;
+    // Set while the data of an empty slab has been given back to the OS.
+    int decommitted;
+    // Slabs of a class are kept in lists by their room.
     struct Slab* next;
+    struct Slab* prev;
+    // Longest free run of each cluster, clamped like room.
+    unsigned char longest[SLAB_CLUSTERS];
+    __m256i presence[SLAB_CLUSTERS];
+    // Every shard has 1 bit of arbitrage, shards of the same allocation share the same value and
+    // neighbouring allocations never do, this is how the length of an allocation is recovered.
+    __m256i arbitrage[SLAB_CLUSTERS];
+};
+
+struct Huge
+{
+    int class;
+    size_t size;
+};
+
+struct Class
+{
+    // rooms[n] lists every slab with a room of n, bit n of mask is set while that list isn't empty.
+    // An allocation of len can take the first slab of any list past len without looking at the rest.
+    struct Slab* rooms[CLASS_RUN + 1];
+    unsigned mask;
+    // Number of empty slabs which are still committed.
+    int empty;
 };
 
-struct Slab* slab_init()
+static struct Class classes[NUM_CLASSES];
+// Counters which are cheap enough to always keep, everything else is gathered by mzstats.
+static struct MzStats census;
+// Keep a single empty slab per class warm so alloc/free at a slab boundary doesn't fault pages in and
+// out, and decommit the rest.
+static struct MzPolicy policy = { .decommit = MADV_DONTNEED, .retain = 1, .hugepages = 0 };
+
+static inline int size_class(size_t size)
+{
+    if (size <= MIN_SHARD_SIZE * CLASS_RUN)
+        return 0;
+
+    return 64 - __builtin_clzll((size - 1) / (MIN_SHARD_SIZE * CLASS_RUN));
+}
+
+/// @brief Maps len bytes aligned to SLAB_SIZE by over-reserving and trimming the excess.
+static void* map_aligned(size_t len)
 {
-    void* raw = mmap(NULL, SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    char* raw = mmap(NULL, len + SLAB_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (raw == MAP_FAILED)
         return NULL;
 
-    struct Slab* ptr = (struct Slab*)(((uintptr_t)raw + 31) & ~31);
-    size_t bitmapBytes = (LARGE_CLUSTERS + SMALL_CLUSTERS) * sizeof(__m256i);
-    memset(ptr, 255, bitmapBytes);
-    memset((char*)ptr + bitmapBytes, 0, sizeof(struct Slab) - bitmapBytes);
+    char* ptr = (char*)(((uintptr_t)raw + SLAB_SIZE - 1) & ~(uintptr_t)(SLAB_SIZE - 1));
+    if (ptr != raw)
+        munmap(raw, ptr - raw);
+    munmap(ptr + len, SLAB_SIZE - (ptr - raw));
+    return ptr;
+}
+
+static void slab_link(struct Slab* slab)
+{
+    struct Class* cls = classes + slab->class;
+    slab->prev = NULL;
+    slab->next = cls->rooms[slab->room];
+    if (slab->next != NULL)
+        slab->next->prev = slab;
+
+    cls->rooms[slab->room] = slab;
+    cls->mask |= 1u << slab->room;
+}
+
+static void slab_unlink(struct Slab* slab)
+{
+    struct Class* cls = classes + slab->class;
+    if (slab->prev != NULL)
+        slab->prev->next = slab->next;
+    else
+        cls->rooms[slab->room] = slab->next;
+
+    if (slab->next != NULL)
+        slab->next->prev = slab->prev;
+
+    if (cls->rooms[slab->room] == NULL)
+        cls->mask &= ~(1u << slab->room);
+}
+
+/// @brief Refreshes the longest run of a cluster after its presence changed and moves the slab
+/// between room lists if its room changed as a result.
+static void slab_update(struct Slab* slab, int idx)
+{
+    int longest = bmp_longest(slab->presence[idx], CLASS_RUN);
+    int prev = slab->longest[idx];
+    slab->longest[idx] = longest;
+
+    int room = slab->room;
+    if (longest > room)
+        room = longest;
+    else if (longest < prev && prev == room)
+    {
+        // The cluster that gave the slab its room shrank, so take the max over all of them again.
+        __m256i max = _mm256_setzero_si256();
+        for (int i = 0; i < SLAB_CLUSTERS; i += 32)
+            max = _mm256_max_epu8(max, _mm256_loadu_si256((__m256i*)(slab->longest + i)));
+
+        __m128i half = _mm_max_epu8(_mm256_castsi256_si128(max), _mm256_extracti128_si256(max, 1));
+        half = _mm_max_epu8(half, _mm_srli_si128(half, 8));
+        half = _mm_max_epu8(half, _mm_srli_si128(half, 4));
+        half = _mm_max_epu8(half, _mm_srli_si128(half, 2));
+        half = _mm_max_epu8(half, _mm_srli_si128(half, 1));
+        room = _mm_extract_epi8(half, 0);
+    }
+
+    if (room != slab->room)
+    {
+        slab_unlink(slab);
+        slab->room = room;
+        slab_link(slab);
+    }
+}
+
+struct Slab* slab_init(int class)
+{
+    size_t span = (size_t)256 * SHARD_SIZE(class);
+    int clusters = (SLAB_SIZE - sizeof(struct Slab)) / span;
+    clusters = clusters > SLAB_CLUSTERS ? SLAB_CLUSTERS : clusters;
+
+    struct Slab* ptr = map_aligned(SLAB_SIZE);
+    if (ptr == NULL)
+        return NULL;
+
+    // Anonymous mappings are already zeroed, so only the cluster metadata needs to be touched.
+    memset(ptr->presence, 255, clusters * sizeof(__m256i));
+    memset(ptr->longest, CLASS_RUN, clusters);
+    ptr->class = class;
+    ptr->clusters = clusters;
+    ptr->room = CLASS_RUN;
+    slab_link(ptr);
+    census.slabs[class]++;
+    classes[class].empty++;
+
+    // Slabs are 4MB aligned, so they can always be backed by 2MB pages.
+    if (policy.hugepages)
+        madvise(ptr, SLAB_SIZE, MADV_HUGEPAGE);
     return ptr;
 }
 
-int shard_lookup(void* ptr)
+/// @brief Gives the data of an empty slab back to the OS, the header stays so it can be reused
+/// and the pages are faulted back in as they're allocated again.
+static size_t slab_decommit(struct Slab* slab, int advice)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    char* data = (char*)slab + sizeof(struct Slab);
+    char* start = (char*)(((uintptr_t)data + page - 1) & ~(uintptr_t)(page - 1));
+    size_t len = data + ((size_t)slab->clusters << (8 + SHARD_SHIFT(slab->class))) - start;
+
+    madvise(start, len, advice);
+    slab->decommitted = 1;
+    census.decommits++;
+    return len;
+}
+
+/// @brief Called whenever a slab becomes empty, decommits it if there are more empty slabs than retained.
+static void slab_idle(struct Slab* slab)
 {
-    // TODO:
+    struct Class* cls = classes + slab->class;
+    if (++cls->empty > policy.retain && policy.decommit != 0)
+    {
+        slab_decommit(slab, policy.decommit);
+        cls->empty--;
+    }
+}
+
+int shard_lookup(struct Slab* slab, void* ptr)
+{
+    return ((char*)ptr - ((char*)slab + sizeof(struct Slab))) >> SHARD_SHIFT(slab->class);
+}
+
+void* shard_data(struct Slab* slab, int shard)
+{
+    return (char*)slab + sizeof(struct Slab) + ((size_t)shard << SHARD_SHIFT(slab->class));
+}
+
+/// @brief Picks the arbitrage value for a run of len at pos in a cluster.
+/// @return The value to be used, or -1 if both neighbours are allocated with different values.
+static int arbitrage_choose(struct Slab* slab, int idx, int pos, int len)
+{
+    // Runs never cross clusters, so the cluster edges behave like free neighbours.
+    int left = -1;
+    int right = -1;
+
+    if (pos > 0 && !bmp_test(slab->presence[idx], pos - 1, 1))
+        left = bmp_test(slab->arbitrage[idx], pos - 1, 1);
+
+    if (pos + len < 256 && !bmp_test(slab->presence[idx], pos + len, 1))
+        right = bmp_test(slab->arbitrage[idx], pos + len, 1);
+
+    if (left == -1)
+        return right == -1 ? 0 : right ^ 1;
+    else if (right == -1 || left == right)
+        return left ^ 1;
+
     return -1;
 }
 
-void* small_lookup(struct Slab* slab, int shard)
+static void arbitrage_paint(struct Slab* slab, int idx, int pos, int len, int value)
 {
-    return (char*)slab + sizeof(struct Slab) + ((size_t)shard * SMALL_SHARD_SIZE);
+    if (value)
+        bmp_set(slab->arbitrage + idx, pos, len);
+    else
+        bmp_clear(slab->arbitrage + idx, pos, len);
 }
 
-void* large_lookup(struct Slab* slab, int shard)
+/// @brief Finds the length of the allocation starting at pos in a cluster.
+static int arbitrage_span(struct Slab* slab, int idx, int pos)
 {
-    return (char*)slab + sizeof(struct Slab) + ((size_t)SMALL_CLUSTERS * 256 * SMALL_SHARD_SIZE) + ((size_t)shard * LARGE_SHARD_SIZE);
+    __m256i arb = slab->arbitrage[idx];
+    if (!bmp_test(arb, pos, 1))
+        arb = _mm256_xor_si256(arb, _mm256_set1_epi8(-1));
+
+    // Allocated shards with the same value as pos, the run ends at the first one past pos that isn't.
+    __m256i same = _mm256_andnot_si256(slab->presence[idx], arb);
+    int end = bmp_ffs(_mm256_andnot_si256(same, _mm256_andnot_si256(bmp_expand(0, pos), _mm256_set1_epi8(-1))));
+    return (end == -1 ? 256 : end) - pos;
 }
 
-void* mzalloc_small(size_t size)
+static int slab_claim(struct Slab* slab, int len)
 {
-    if (slab == NULL)
+    // Clusters whose longest run fits len make up the summary the search goes by, 32 of them at a time.
+    uint32_t words[SLAB_CLUSTERS / 32];
+    for (int i = 0; i < SLAB_CLUSTERS; i += 32)
     {
-        slab = slab_init();
-        if (slab == NULL)
-            return NULL;
+        __m256i longest = _mm256_loadu_si256((__m256i*)(slab->longest + i));
+        words[i >> 5] = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(longest, _mm256_set1_epi8(len)), longest));
     }
 
-    int len = (size + SMALL_SHARD_SIZE - 1) / SMALL_SHARD_SIZE;
-    struct Slab* cur = slab;
-    while (1)
+    // Clusters past the end of the slab have no room, so they're never in the summary.
+    __m256i fits = _mm256_loadu_si256((__m256i*)words);
+    int shard;
+
+    while ((shard = bmps_first(slab->presence, &fits, slab->clusters, len)) != -1)
     {
-        int shard = -1;
-        for (int i = 0; i < SMALL_CLUSTERS; i++)
+        int idx = shard >> 8;
+        int pos = shard & 255;
+        int value = arbitrage_choose(slab, idx, pos, len);
+
+        // Only runs exactly len long between two differing neighbours are rejected, so the rest of a cluster is
+        // rarely looked at.
+        if (value == -1)
         {
-            int res = bmp_recode(cur->small + i, len);
-            if (res != -1)
-            {
-                shard = i * 256 + res;
-                break;
-            }
+            __m256i starts = _mm256_andnot_si256(bmp_expand(0, pos + 1), bmp_condense(slab->presence[idx], len));
+            while ((pos = bmp_ffs(starts)) != -1 && (value = arbitrage_choose(slab, idx, pos, len)) == -1)
+                bmp_clear(&starts, pos, 1);
         }
 
-        if (shard == -1)
+        if (value != -1)
         {
-            if (cur->next == NULL)
+            if (slab->used == 0 && slab->decommitted)
+                slab->decommitted = 0;
+            else if (slab->used == 0)
+                classes[slab->class].empty--;
+
+            bmp_clear(slab->presence + idx, pos, len);
+            arbitrage_paint(slab, idx, pos, len, value);
+            slab->used += len;
+            slab_update(slab, idx);
+            return (idx << 8) + pos;
+        }
+
+        bmp_clear(&fits, idx, 1);
+    }
+
+    return -1;
+}
+
+void* mzalloc_class(int class, size_t size)
+{
+    int len = (size + SHARD_SIZE(class) - 1) >> SHARD_SHIFT(class);
+    struct Class* cls = classes + class;
+
+    // The tightest list that fits comes first, every slab in it can take len barring arbitrage conflicts.
+    for (unsigned avail = cls->mask >> len << len; avail != 0; avail &= avail - 1)
+    {
+        struct Slab* cur = cls->rooms[__builtin_ctz(avail)];
+        while (cur != NULL)
+        {
+            // Claiming may relink cur, so hold on to its successor first.
+            struct Slab* next = cur->next;
+            int shard = slab_claim(cur, len);
+            if (shard != -1)
             {
-                cur->next = slab_init();
-                if (cur->next == NULL)
-                    return NULL;
+                census.allocs[class]++;
+                return shard_data(cur, shard);
             }
 
-            cur = cur->next;
-            continue;
+            cur = next;
         }
+    }
+
+    struct Slab* slab = slab_init(class);
+    if (slab == NULL)
+        return NULL;
+
+    census.allocs[class]++;
+    return shard_data(slab, slab_claim(slab, len));
+}
+
+void* mzalloc_huge(size_t size)
+{
+    size_t len = (size + HUGE_HEADER + 4095) & ~(size_t)4095;
+    struct Huge* huge = map_aligned(len);
+    if (huge == NULL)
+        return NULL;
+
+    if (policy.hugepages && len >= 2 * 1024 * 1024)
+        madvise(huge, len, MADV_HUGEPAGE);
+
+    huge->class = CLASS_HUGE;
+    huge->size = len;
+    census.allocs[CLASS_HUGE]++;
+    census.huge += len;
+    return (char*)huge + HUGE_HEADER;
+}
+
+void* mzalloc(size_t size)
+{
+    size = size == 0 ? 1 : size;
+    if (size > HUGE_SIZE)
+        return mzalloc_huge(size);
+    else
+        return mzalloc_class(size_class(size), size);
+}
 
-        return small_lookup(cur, shard);
+void mzfree(void* ptr)
+{
+    if (ptr == NULL)
+        return;
+
+    struct Slab* slab = SLAB_BASE(ptr);
+    if (slab->class == CLASS_HUGE)
+    {
+        census.frees[CLASS_HUGE]++;
+        census.huge -= ((struct Huge*)slab)->size;
+        munmap(slab, ((struct Huge*)slab)->size);
+        return;
     }
+
+    int shard = shard_lookup(slab, ptr);
+    int len = arbitrage_span(slab, shard >> 8, shard & 255);
+    bmp_set(slab->presence + (shard >> 8), shard & 255, len);
+    slab->used -= len;
+    census.frees[slab->class]++;
+    slab_update(slab, shard >> 8);
+    if (slab->used == 0)
+        slab_idle(slab);
 }
 
-void* mzalloc_large(size_t size)
+void* mzrealloc(void* ptr, size_t size)
 {
-    if (slab == NULL)
+    if (ptr == NULL)
+        return mzalloc(size);
+
+    if (size == 0)
     {
-        slab = slab_init();
-        if (slab == NULL)
-            return NULL;
+        mzfree(ptr);
+        return NULL;
     }
 
-    int len = (size + LARGE_SHARD_SIZE - 1) / LARGE_SHARD_SIZE;
-    struct Slab* cur = slab;
-    while (1)
+    struct Slab* slab = SLAB_BASE(ptr);
+    size_t cap;
+
+    if (slab->class == CLASS_HUGE)
     {
-        int shard = -1;
-        for (int i = 0; i < LARGE_CLUSTERS; i++)
+        struct Huge* huge = (struct Huge*)slab;
+        cap = huge->size - HUGE_HEADER;
+
+        // Huge blocks stay huge and let the kernel move the pages instead of us copying them,
+        // in place if it can, otherwise into a fresh aligned reservation so masking still works.
+        if (size > HUGE_SIZE)
         {
-            int res = bmp_recode(cur->large + i, len);
-            if (res != -1)
+            size_t len = (size + HUGE_HEADER + 4095) & ~(size_t)4095;
+            void* raw = mremap(huge, huge->size, len, 0);
+            if (raw == MAP_FAILED)
             {
-                shard = i * 256 + res;
-                break;
+                void* target = map_aligned(len);
+                if (target == NULL)
+                    return NULL;
+
+                raw = mremap(huge, huge->size, len, MREMAP_MAYMOVE | MREMAP_FIXED, target);
+                if (raw == MAP_FAILED)
+                {
+                    munmap(target, len);
+                    return NULL;
+                }
             }
+
+            if (policy.hugepages && len >= 2 * 1024 * 1024)
+                madvise(raw, len, MADV_HUGEPAGE);
+
+            huge = raw;
+            census.huge += len - huge->size;
+            huge->size = len;
+            return (char*)huge + HUGE_HEADER;
         }
+    }
+    else
+    {
+        int shard = shard_lookup(slab, ptr);
+        int idx = shard >> 8;
+        int pos = shard & 255;
+        int len = arbitrage_span(slab, idx, pos);
+        int want = (size + SHARD_SIZE(slab->class) - 1) >> SHARD_SHIFT(slab->class);
+        cap = (size_t)len << SHARD_SHIFT(slab->class);
 
-        if (shard == -1)
+        // Shrinking just gives the tail back.
+        if (want <= len)
         {
-            if (cur->next == NULL)
+            if (want < len)
             {
-                cur->next = slab_init();
-                if (cur->next == NULL)
-                    return NULL;
+                bmp_set(slab->presence + idx, pos + want, len - want);
+                slab->used -= len - want;
+                slab_update(slab, idx);
             }
+            return ptr;
+        }
 
-            cur = cur->next;
-            continue;
+        // Growing extends the run if the shards after it are free and the shard after those
+        // isn't an allocation with the same arbitrage value, which would merge the two.
+        if (bmp_test(slab->presence[idx], pos + len, want - len))
+        {
+            int value = bmp_test(slab->arbitrage[idx], pos, 1);
+            if (pos + want == 256 || bmp_test(slab->presence[idx], pos + want, 1)
+                || bmp_test(slab->arbitrage[idx], pos + want, 1) != value)
+            {
+                bmp_clear(slab->presence + idx, pos + len, want - len);
+                arbitrage_paint(slab, idx, pos + len, want - len, value);
+                slab->used += want - len;
+                slab_update(slab, idx);
+                return ptr;
+            }
+        }
+    }
+
+    void* ret = mzalloc(size);
+    if (ret == NULL)
+        return NULL;
+
+    memcpy(ret, ptr, cap < size ? cap : size);
+    mzfree(ptr);
+    return ret;
+}
+
+/// @brief Counts the allocations in a cluster, which is every allocated shard that doesn't continue
+/// the run of the shard before it.
+static int cluster_allocs(struct Slab* slab, int idx)
+{
+    __m256i used = _mm256_xor_si256(slab->presence[idx], _mm256_set1_epi8(-1));
+    __m256i diff = _mm256_xor_si256(slab->arbitrage[idx], bmp_shl(slab->arbitrage[idx], 1));
+    __m256i cont = _mm256_andnot_si256(diff, bmp_shl(used, 1));
+    return bmp_popcount(_mm256_andnot_si256(cont, used));
+}
+
+void mzstats(struct MzStats* stats)
+{
+    *stats = census;
+    long page = sysconf(_SC_PAGESIZE);
+
+    for (int i = 0; i < NUM_CLASSES; i++)
+    {
+        for (int j = 0; j <= CLASS_RUN; j++)
+        {
+            for (struct Slab* cur = classes[i].rooms[j]; cur != NULL; cur = cur->next)
+            {
+                stats->shards[i] += cur->used;
+                stats->free[i] += cur->clusters * 256 - cur->used;
+                for (int k = 0; k < cur->clusters; k++)
+                    stats->runs[i] += bmp_longest(cur->presence[k], 256);
+
+                unsigned char vec[SLAB_SIZE / 4096];
+                if (mincore(cur, SLAB_SIZE, vec) == 0)
+                {
+                    for (int k = 0; k < SLAB_SIZE / page; k++)
+                        stats->resident += (size_t)(vec[k] & 1) * page;
+                }
+            }
         }
+    }
+
+    // Huge blocks aren't tracked individually, they're assumed to be fully resident.
+    stats->resident += census.huge;
 
-        return large_lookup(cur, shard);
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm != NULL)
+    {
+        size_t size;
+        if (fscanf(statm, "%zu %zu", &size, &stats->rss) == 2)
+            stats->rss *= page;
+        else
+            stats->rss = 0;
+        fclose(statm);
     }
 }
 
-void* mzalloc(size_t size)
+void mzpolicy(const struct MzPolicy* next)
 {
-    if (size >= 512)
-        return mzalloc_large(size);
-    else
-        return mzalloc_small(size);
+    policy = *next;
+    for (int i = 0; i < NUM_CLASSES; i++)
+    {
+        for (int j = 0; j <= CLASS_RUN; j++)
+        {
+            for (struct Slab* cur = classes[i].rooms[j]; cur != NULL; cur = cur->next)
+                madvise(cur, SLAB_SIZE, policy.hugepages ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+        }
+    }
+}
+
+size_t mztrim()
+{
+    size_t len = 0;
+    for (int i = 0; i < NUM_CLASSES; i++)
+    {
+        // Empty slabs always have the most room there is.
+        for (struct Slab* cur = classes[i].rooms[CLASS_RUN]; cur != NULL; cur = cur->next)
+        {
+            if (cur->used == 0 && !cur->decommitted)
+                len += slab_decommit(cur, policy.decommit != 0 ? policy.decommit : MADV_DONTNEED);
+        }
+
+        classes[i].empty = 0;
+    }
+
+    return len;
 }
 
-void free(void* ptr)
+int mzvalidate()
 {
-    // TODO:
+    int errors = 0;
+    for (int i = 0; i < NUM_CLASSES; i++)
+    {
+        size_t allocs = 0;
+        size_t slabs = 0;
+        int empty = 0;
+
+        for (int j = 0; j <= CLASS_RUN; j++)
+        {
+            if (((classes[i].mask >> j) & 1) != (classes[i].rooms[j] != NULL))
+                errors++;
+
+            for (struct Slab* cur = classes[i].rooms[j]; cur != NULL; cur = cur->next)
+            {
+                int used = cur->clusters * 256 - bmps_popcount(cur->presence, cur->clusters);
+                int room = 0;
+                slabs++;
+
+                if (cur->class != i || cur->room != j || SLAB_BASE(cur) != cur)
+                    errors++;
+
+                for (int k = 0; k < SLAB_CLUSTERS; k++)
+                {
+                    if (k >= cur->clusters)
+                    {
+                        // Clusters past the end of the slab must never look free.
+                        if (cur->longest[k] != 0 || !_mm256_testz_si256(cur->presence[k], cur->presence[k]))
+                            errors++;
+                        continue;
+                    }
+
+                    int longest = bmp_longest(cur->presence[k], CLASS_RUN);
+                    if (cur->longest[k] != longest)
+                        errors++;
+
+                    room = longest > room ? longest : room;
+                    allocs += cluster_allocs(cur, k);
+                }
+
+                if (cur->used != used || cur->room != room || (cur->decommitted && used != 0))
+                    errors++;
+
+                empty += used == 0 && !cur->decommitted;
+            }
+        }
+
+        if (empty != classes[i].empty)
+            errors++;
+
+        // Every live allocation must be recoverable from the arbitrage, otherwise two allocations merged.
+        if (allocs != census.allocs[i] - census.frees[i] || slabs != census.slabs[i])
+            errors++;
+    }
+
+    return errors;
+}
+
+void mzdump(FILE* out)
+{
+    struct MzStats stats;
+    mzstats(&stats);
+
+    fprintf(out, "myzomela: %zu bytes resident, %zu bytes rss, %zu bytes huge (%zu live), %zu decommits\n",
+        stats.resident, stats.rss, stats.huge, stats.allocs[CLASS_HUGE] - stats.frees[CLASS_HUGE], stats.decommits);
+
+    for (int i = 0; i < NUM_CLASSES; i++)
+    {
+        if (stats.slabs[i] == 0)
+            continue;
+
+        fprintf(out, "class %d (%zu byte shards): %zu slabs, %zu allocs, %zu frees, %zu shards used, %zu free, %.1f%% fragmented\n",
+            i, SHARD_SIZE(i), stats.slabs[i], stats.allocs[i], stats.frees[i], stats.shards[i], stats.free[i],
+            stats.free[i] == 0 ? 0.0 : 100.0 - 100.0 * stats.runs[i] / stats.free[i]);
+
+        for (int j = 0; j <= CLASS_RUN; j++)
+        {
+            for (struct Slab* cur = classes[i].rooms[j]; cur != NULL; cur = cur->next)
+            {
+                fprintf(out, "  slab %p: %d clusters, %d shards used, room %d%s\n", (void*)cur, cur->clusters, cur->used, cur->room,
+                    cur->decommitted ? ", decommitted" : "");
+
+                // Same layout as the arbitrage model's dump, entirely free clusters are skipped.
+                for (int k = 0; k < cur->clusters; k++)
+                {
+                    if (bmp_popcount(cur->presence[k]) == 256)
+                        continue;
+
+                    char p[257];
+                    char a[257];
+                    for (int l = 0; l < 256; l++)
+                    {
+                        int free = bmp_test(cur->presence[k], l, 1);
+                        p[l] = free ? '.' : '#';
+                        a[l] = free ? '.' : '0' + bmp_test(cur->arbitrage[k], l, 1);
+                    }
+                    p[256] = a[256] = '\0';
+
+                    fprintf(out, "  %4d longest %d\n    P: %s\n    A: %s\n", k, bmp_longest(cur->presence[k], 256), p, a);
+                }
+            }
+        }
+    }
 }
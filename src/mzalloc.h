@@ -1,4 +1,87 @@
+#pragma once
+
 #include "bitmap.h"
 #include <stddef.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+// Number of shard size classes, statistics for huge blocks come after them at index NUM_CLASSES.
+#define NUM_CLASSES 9
+// Shard sizes go 16, 32, 64 .. 4096 and an allocation goes to the smallest class which can fit it in
+// CLASS_RUN shards, so a run is always 9..16 shards long (except in the first class) and never wastes
+// more than a single shard. Anything past the last class is mapped directly.
+#define MIN_SHARD_SHIFT 4
+#define MIN_SHARD_SIZE (1 << MIN_SHARD_SHIFT)
+#define CLASS_RUN 16
+#define SHARD_SHIFT(class) (MIN_SHARD_SHIFT + (class))
+#define SHARD_SIZE(class) ((size_t)1 << SHARD_SHIFT(class))
+#define HUGE_SIZE (SHARD_SIZE(NUM_CLASSES - 1) * CLASS_RUN)
+
+struct MzStats
+{
+    size_t allocs[NUM_CLASSES + 1];
+    size_t frees[NUM_CLASSES + 1];
+    size_t slabs[NUM_CLASSES];
+    /// @brief Bytes mapped for huge blocks.
+    size_t huge;
+    /// @brief Number of times an empty slab was given back to the OS.
+    size_t decommits;
+    // Everything past here is only gathered by mzstats.
+    /// @brief Shards allocated in each class.
+    size_t shards[NUM_CLASSES];
+    /// @brief Shards free in each class.
+    size_t free[NUM_CLASSES];
+    /// @brief Sum of the longest free run of every cluster in each class,
+    /// 1 - runs / free gives how fragmented a class is.
+    size_t runs[NUM_CLASSES];
+    /// @brief Bytes of slabs and huge blocks actually resident.
+    size_t resident;
+    /// @brief Resident set size of the entire process.
+    size_t rss;
+};
+
+/// @brief Allocates a block of at least size bytes from Myzomela.
+/// @param size The number of bytes to allocate.
+/// @return Pointer to the block, or NULL if the allocation failed.
+void* mzalloc(size_t size);
+
+/// @brief Resizes a block, growing it in place when the shards after it are free.
+/// @param ptr The block to be resized, or NULL to allocate a new one.
+/// @param size The new size of the block in bytes, 0 frees the block.
+/// @return Pointer to the resized block, or NULL if it could not be resized and ptr is untouched.
+void* mzrealloc(void* ptr, size_t size);
+
+/// @brief Returns a block to Myzomela.
+/// @param ptr The block to be freed, may be NULL.
+void mzfree(void* ptr);
+
+struct MzPolicy
+{
+    /// @brief madvise advice used to give empty slabs back to the OS, MADV_DONTNEED drops them from
+    /// RSS immediately, MADV_FREE lets the kernel take them lazily, 0 never gives anything back.
+    int decommit;
+    /// @brief Number of empty slabs per class kept committed before any are decommitted.
+    int retain;
+    /// @brief Truthy to back slabs and huge blocks of 2MB or more with transparent huge pages.
+    int hugepages;
+};
+
+/// @brief Replaces the allocator policy, huge page backing is applied to existing slabs straight away.
+/// @param policy The policy to be used from now on.
+void mzpolicy(const struct MzPolicy* policy);
+
+/// @brief Decommits every empty slab regardless of how many the policy retains.
+/// @return The number of bytes given back to the OS.
+size_t mztrim();
+
+/// @brief Gathers statistics for the entire allocator, this walks every slab so it's not free.
+/// @param stats The statistics to be written.
+void mzstats(struct MzStats* stats);
+
+/// @brief Checks the presence, arbitrage and bookkeeping invariants of every slab.
+/// @return The number of violations found, 0 if everything is consistent.
+int mzvalidate();
 
-void* mzalloc(size_t size);
\ No newline at end of file
+/// @brief Writes statistics and the presence and arbitrage of every cluster in use to out.
+/// @param out The stream to be written to.
+void mzdump(FILE* out);
@@ -0,0 +1,562 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include "plugin.h"
+#include "mzalloc.h"
+
+#define RING_MASK (PLUGIN_RING_SIZE - 1)
+// Socket messages, a wakeup or the descriptors of a document.
+#define MESSAGE_WAKE 'w'
+#define MESSAGE_DOCUMENT 'd'
+
+/// @brief Gets the room a record of len bytes takes up in a ring.
+static inline uint64_t plugin_size(uint32_t len)
+{
+    return (sizeof(struct PluginRecord) + len + 7) & ~7ull;
+}
+
+int plugin_push(struct PluginRing* ring, uint32_t type, const void* head, uint32_t headLen, const void* body, uint32_t bodyLen)
+{
+    uint64_t size = plugin_size(headLen + bodyLen);
+    if (size > PLUGIN_RING_SIZE / 2)
+        return -1;
+
+    uint64_t at = ring->head;
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t offset = at & RING_MASK;
+    // A record which would wrap starts over at the beginning, the bytes before the end are padded out.
+    uint64_t pad = offset + size > PLUGIN_RING_SIZE ? PLUGIN_RING_SIZE - offset : 0;
+    if (at + pad + size - tail > PLUGIN_RING_SIZE)
+        return -1;
+
+    if (pad > 0)
+    {
+        *(struct PluginRecord*)(ring->data + offset) = (struct PluginRecord){ PLUGIN_PAD, pad - sizeof(struct PluginRecord) };
+        at += pad;
+        offset = 0;
+    }
+
+    struct PluginRecord* record = (struct PluginRecord*)(ring->data + offset);
+    *record = (struct PluginRecord){ type, headLen + bodyLen };
+    if (headLen > 0)
+        memcpy(record + 1, head, headLen);
+    if (bodyLen > 0)
+        memcpy((char*)(record + 1) + headLen, body, bodyLen);
+
+    __atomic_store_n(&ring->head, at + size, __ATOMIC_RELEASE);
+    return 0;
+}
+
+int plugin_peek(struct PluginRing* ring, uint32_t* type, const void** data, uint32_t* len)
+{
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head - tail > PLUGIN_RING_SIZE)
+        return -1;
+
+    // Every record moves tail towards head, so padding can't keep this going round.
+    while (tail != head)
+    {
+        // Records start 8 byte aligned, so one which does always has room for its header.
+        uint64_t offset = tail & RING_MASK;
+        if ((offset & 7) != 0)
+            return -1;
+
+        struct PluginRecord record;
+        memcpy(&record, ring->data + offset, sizeof(record));
+        uint64_t size = plugin_size(record.len);
+        if (size > PLUGIN_RING_SIZE - offset || size > head - tail)
+            return -1;
+
+        if (record.type == PLUGIN_PAD)
+        {
+            tail += size;
+            __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+            continue;
+        }
+
+        *type = record.type;
+        *len = record.len;
+        *data = ring->data + offset + sizeof(struct PluginRecord);
+        return 1;
+    }
+
+    return 0;
+}
+
+void plugin_pop(struct PluginRing* ring, uint32_t len)
+{
+    __atomic_store_n(&ring->tail, ring->tail + plugin_size(len), __ATOMIC_RELEASE);
+}
+
+int plugin_start(struct Plugin* plugin, char* const argv[])
+{
+    memset(plugin, 0, sizeof(struct Plugin));
+    plugin->socket = -1;
+    plugin->dead = 1;
+
+    int shared = memfd_create("pipit-plugin", MFD_CLOEXEC);
+    if (shared < 0)
+        return -1;
+
+    int pair[2];
+    void* map = ftruncate(shared, sizeof(struct PluginShared)) == 0
+        ? mmap(NULL, sizeof(struct PluginShared), PROT_READ | PROT_WRITE, MAP_SHARED, shared, 0)
+        : MAP_FAILED;
+    if (map == MAP_FAILED || socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) != 0)
+    {
+        if (map != MAP_FAILED)
+            munmap(map, sizeof(struct PluginShared));
+        close(shared);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Moved out of the way first, either might already sit on the other's number.
+        int rings = fcntl(shared, F_DUPFD_CLOEXEC, 16);
+        int socket = fcntl(pair[1], F_DUPFD_CLOEXEC, 16);
+        int null = open("/dev/null", O_RDWR);
+        dup2(null, STDIN_FILENO);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        dup2(rings, PLUGIN_FD_SHARED);
+        dup2(socket, PLUGIN_FD_SOCKET);
+        syscall(SYS_close_range, PLUGIN_FD_SOCKET + 1, ~0u, 0);
+
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    close(pair[1]);
+    close(shared);
+    if (pid < 0)
+    {
+        munmap(map, sizeof(struct PluginShared));
+        close(pair[0]);
+        return -1;
+    }
+
+    fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL) | O_NONBLOCK);
+    plugin->pid = pid;
+    plugin->socket = pair[0];
+    plugin->shared = map;
+    plugin->dead = 0;
+    return 0;
+}
+
+void plugin_stop(struct Plugin* plugin)
+{
+    if (plugin->pid > 0)
+    {
+        kill(plugin->pid, SIGKILL);
+        waitpid(plugin->pid, NULL, 0);
+    }
+
+    if (plugin->shared != NULL)
+        munmap(plugin->shared, sizeof(struct PluginShared));
+    if (plugin->socket >= 0)
+        close(plugin->socket);
+
+    mzfree(plugin->decorations);
+    memset(plugin, 0, sizeof(struct Plugin));
+    plugin->socket = -1;
+    plugin->dead = 1;
+}
+
+/// @brief Marks a plugin dead once its socket is gone, reaping it if it has exited.
+static void plugin_died(struct Plugin* plugin)
+{
+    plugin->dead = 1;
+    if (plugin->pid > 0 && waitpid(plugin->pid, NULL, WNOHANG) == plugin->pid)
+        plugin->pid = 0;
+}
+
+/// @brief Sends the descriptors of a document, reopened read-only so the plugin can map but never write them.
+/// @return 0 if sent, 1 if the socket is full, -1 if the plugin is gone or the descriptors can't be had.
+static int plugin_send_document(struct Plugin* plugin, int tab, struct Text* text, int handle)
+{
+    int fds[2];
+    int n = 0;
+    char proc[64];
+    if (text->originalLen > 0)
+    {
+        snprintf(proc, sizeof(proc), "/proc/self/fd/%d", handle);
+        fds[n++] = open(proc, O_RDONLY | O_CLOEXEC);
+    }
+
+    snprintf(proc, sizeof(proc), "/proc/self/fd/%d", text->addFd);
+    fds[n++] = open(proc, O_RDONLY | O_CLOEXEC);
+
+    int status = -1;
+    if (fds[0] >= 0 && fds[n - 1] >= 0)
+    {
+        char payload[2] = { MESSAGE_DOCUMENT, (char)tab };
+        struct iovec iov = { payload, sizeof(payload) };
+        char control[CMSG_SPACE(sizeof(fds))] = {0};
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = CMSG_SPACE(n * sizeof(int)) };
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(n * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, n * sizeof(int));
+
+        if (sendmsg(plugin->socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) >= 0)
+            status = 0;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            status = 1;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+
+    return status;
+}
+
+void plugin_sync(struct Plugin* plugin, int tab, struct Text* text, int handle)
+{
+    if (plugin->dead || tab < 0 || tab >= PLUGIN_DOCUMENTS)
+        return;
+
+    struct PluginSync* sync = plugin->sync + tab;
+    if (sync->opened == 0)
+    {
+        if (text_share(text) < 0)
+            return;
+
+        struct PluginDocument document = { tab, 0, text->originalLen };
+        if (plugin_push(&plugin->shared->events, PLUGIN_DOCUMENT, &document, sizeof(document), NULL, 0) != 0)
+            return;
+
+        plugin->pushed = 1;
+        sync->opened = 1;
+        sync->sent = 0;
+    }
+
+    if (sync->opened == 1)
+    {
+        int status = plugin_send_document(plugin, tab, text, handle);
+        if (status < 0)
+            plugin_died(plugin);
+        if (status != 0)
+            return;
+
+        sync->opened = 2;
+    }
+
+    if (sync->sent && sync->version == text->version)
+        return;
+
+    // A newer version starts over, the plugin throws away the partial list of the old one.
+    if (sync->sent || sync->version != text->version)
+    {
+        sync->version = text->version;
+        sync->next = 0;
+        sync->sent = 0;
+    }
+
+    do
+    {
+        uint32_t n = text->count - sync->next < PLUGIN_PIECES_MAX ? text->count - sync->next : PLUGIN_PIECES_MAX;
+        struct PluginPieces pieces = { tab, n, sync->next, text->count, text->version, text->len };
+        if (plugin_push(&plugin->shared->events, PLUGIN_PIECES, &pieces, sizeof(pieces), text->pieces + sync->next,
+                        n * sizeof(struct Piece)) != 0)
+            return;
+
+        plugin->pushed = 1;
+        sync->next += n;
+    } while (sync->next < (uint32_t)text->count);
+
+    sync->sent = 1;
+}
+
+int plugin_event(struct Plugin* plugin, uint32_t type, const void* data, uint32_t len)
+{
+    if (plugin->dead || plugin_push(&plugin->shared->events, type, data, len, NULL, 0) != 0)
+        return -1;
+
+    plugin->pushed = 1;
+    return 0;
+}
+
+/// @brief Keeps or drops decorations of a plugin.
+static void plugin_decorate(struct Plugin* plugin, uint32_t type, const void* data, uint32_t len)
+{
+    if (type == PLUGIN_CLEAR && len >= sizeof(struct PluginClear))
+    {
+        uint32_t tab = ((const struct PluginClear*)data)->tab;
+        size_t n = 0;
+        for (size_t i = 0; i < plugin->numDecorations; i++)
+        {
+            if (plugin->decorations[i].tab != tab)
+                plugin->decorations[n++] = plugin->decorations[i];
+        }
+
+        plugin->numDecorations = n;
+        return;
+    }
+
+    if (type != PLUGIN_DECORATE || len < sizeof(struct PluginDecorate))
+        return;
+
+    if (plugin->numDecorations == plugin->capDecorations)
+    {
+        size_t cap = plugin->capDecorations < 64 ? 64 : plugin->capDecorations * 2;
+        struct PluginDecorate* decorations = mzrealloc(plugin->decorations, cap * sizeof(struct PluginDecorate));
+        if (decorations == NULL)
+            return;
+
+        plugin->decorations = decorations;
+        plugin->capDecorations = cap;
+    }
+
+    plugin->decorations[plugin->numDecorations++] = *(const struct PluginDecorate*)data;
+}
+
+void plugin_close(struct Plugin* plugin, int tab)
+{
+    if (tab < 0 || tab >= PLUGIN_DOCUMENTS)
+        return;
+
+    struct PluginClear clear = { tab };
+    plugin_decorate(plugin, PLUGIN_CLEAR, &clear, sizeof(clear));
+    if (!plugin->dead && plugin->sync[tab].opened != 0)
+    {
+        struct PluginClose close = { tab };
+        plugin_event(plugin, PLUGIN_CLOSE, &close, sizeof(close));
+    }
+
+    plugin->sync[tab] = (struct PluginSync){ 0 };
+}
+
+int plugin_poll(struct Plugin* plugin, void (*fn)(void* ctx, struct Plugin* plugin, uint32_t type, const void* data, uint32_t len), void* ctx)
+{
+    if (plugin->dead)
+        return 0;
+
+    // Wakeups only need draining, the ring says what there is to do.
+    char message[16];
+    ssize_t got;
+    while ((got = recv(plugin->socket, message, sizeof(message), MSG_DONTWAIT)) > 0)
+        ;
+    if (got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        plugin_died(plugin);
+
+    int handled = 0;
+    uint32_t type;
+    uint32_t len;
+    const void* data;
+    int peeked = 0;
+    while (handled < PLUGIN_POLL_MAX && (peeked = plugin_peek(&plugin->shared->commands, &type, &data, &len)) > 0)
+    {
+        if (type == PLUGIN_DECORATE || type == PLUGIN_CLEAR)
+            plugin_decorate(plugin, type, data, len);
+        else
+            fn(ctx, plugin, type, data, len);
+
+        plugin_pop(&plugin->shared->commands, len);
+        handled++;
+    }
+
+    // A ring which doesn't add up was written over, nothing more the plugin sends can be trusted.
+    if (peeked < 0)
+        plugin_stop(plugin);
+
+    return handled;
+}
+
+void plugin_flush(struct Plugin* plugin)
+{
+    if (plugin->dead || !plugin->pushed)
+        return;
+
+    // A full socket already holds plenty of wakeups.
+    char wake = MESSAGE_WAKE;
+    if (send(plugin->socket, &wake, 1, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        plugin_died(plugin);
+
+    plugin->pushed = 0;
+}
+
+int plugin_connect(struct PluginClient* client)
+{
+    memset(client, 0, sizeof(struct PluginClient));
+    client->socket = PLUGIN_FD_SOCKET;
+    client->shared = mmap(NULL, sizeof(struct PluginShared), PROT_READ | PROT_WRITE, MAP_SHARED, PLUGIN_FD_SHARED, 0);
+    return client->shared != MAP_FAILED ? 0 : -1;
+}
+
+/// @brief Receives one socket message, keeping any descriptors it carries for their document.
+/// @return 1 if a message was received, 0 if there was none, -1 if the editor is gone.
+static int plugin_receive(struct PluginClient* client, int wait)
+{
+    char payload[2];
+    struct iovec iov = { payload, sizeof(payload) };
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control) };
+
+    ssize_t got = recvmsg(client->socket, &msg, wait ? MSG_CMSG_CLOEXEC : MSG_CMSG_CLOEXEC | MSG_DONTWAIT);
+    if (got < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    if (got == 0)
+        return -1;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (payload[0] == MESSAGE_DOCUMENT && got == 2 && cmsg != NULL && cmsg->cmsg_type == SCM_RIGHTS)
+    {
+        int n = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        struct PluginView* view = client->views + (unsigned char)payload[1] % PLUGIN_DOCUMENTS;
+        memcpy(view->fds, CMSG_DATA(cmsg), (n < 2 ? n : 2) * sizeof(int));
+        view->numFds = n < 2 ? n : 2;
+    }
+
+    return 1;
+}
+
+/// @brief Unmaps a document and forgets its pieces.
+static void plugin_unmap(struct PluginView* view)
+{
+    if (view->original != NULL)
+        munmap((void*)view->original, view->originalLen);
+    if (view->add != NULL)
+        munmap((void*)view->add, TEXT_SHARED_MAX);
+
+    mzfree(view->pieces);
+    mzfree(view->building);
+    memset(view, 0, sizeof(struct PluginView));
+}
+
+/// @brief Maps a newly opened document, its descriptors were sent before the record so they're waited for.
+static int plugin_map(struct PluginClient* client, const struct PluginDocument* document)
+{
+    if (document->tab >= PLUGIN_DOCUMENTS)
+        return 0;
+
+    struct PluginView* view = client->views + document->tab;
+    int want = document->originalLen > 0 ? 2 : 1;
+    while (view->numFds < want)
+    {
+        if (plugin_receive(client, 1) < 0)
+            return -1;
+    }
+
+    int fds[2];
+    memcpy(fds, view->fds, sizeof(fds));
+    plugin_unmap(view);
+
+    view->originalLen = document->originalLen;
+    if (want == 2)
+    {
+        void* original = mmap(NULL, document->originalLen, PROT_READ, MAP_SHARED, fds[0], 0);
+        view->original = original != MAP_FAILED ? original : NULL;
+    }
+
+    void* add = mmap(NULL, TEXT_SHARED_MAX, PROT_READ, MAP_SHARED | MAP_NORESERVE, fds[want - 1], 0);
+    view->add = add != MAP_FAILED ? add : NULL;
+    for (int i = 0; i < want; i++)
+        close(fds[i]);
+
+    return 0;
+}
+
+/// @brief Adds part of a piece list, the view switches over once the whole list of a version is in.
+static void plugin_assemble(struct PluginClient* client, const struct PluginPieces* pieces, uint32_t len)
+{
+    if (pieces->tab >= PLUGIN_DOCUMENTS || pieces->first + pieces->count > pieces->total
+        || len != sizeof(struct PluginPieces) + pieces->count * sizeof(struct Piece))
+        return;
+
+    struct PluginView* view = client->views + pieces->tab;
+    if (pieces->first == 0)
+    {
+        struct Piece* building = mzrealloc(view->building, (pieces->total + 1) * sizeof(struct Piece));
+        if (building == NULL)
+            return;
+
+        view->building = building;
+        view->buildVersion = pieces->version;
+        view->built = 0;
+    }
+
+    // Parts of a list whose start was missed are useless.
+    if (view->building == NULL || pieces->version != view->buildVersion || pieces->first != view->built)
+        return;
+
+    memcpy(view->building + pieces->first, pieces + 1, pieces->count * sizeof(struct Piece));
+    view->built += pieces->count;
+    if (view->built < pieces->total)
+        return;
+
+    mzfree(view->pieces);
+    view->pieces = view->building;
+    view->count = pieces->total;
+    view->version = pieces->version;
+    view->len = pieces->len;
+    view->building = NULL;
+    view->built = 0;
+}
+
+int plugin_next(struct PluginClient* client, int wait, uint32_t* type, const void** data, uint32_t* len)
+{
+    struct PluginRing* ring = &client->shared->events;
+    if (client->held)
+    {
+        plugin_pop(ring, client->heldLen);
+        client->held = 0;
+    }
+
+    while (1)
+    {
+        const void* record;
+        int peeked = plugin_peek(ring, type, &record, len);
+        if (peeked < 0)
+            return -1;
+        if (peeked > 0)
+        {
+            if (*type == PLUGIN_DOCUMENT && *len >= sizeof(struct PluginDocument) && plugin_map(client, record) != 0)
+                return -1;
+            if (*type == PLUGIN_PIECES && *len >= sizeof(struct PluginPieces))
+                plugin_assemble(client, record, *len);
+            if (*type == PLUGIN_CLOSE && *len >= sizeof(struct PluginClose))
+                plugin_unmap(client->views + ((const struct PluginClose*)record)->tab % PLUGIN_DOCUMENTS);
+
+            // The record is popped on the next call, so it stays valid until then.
+            client->held = 1;
+            client->heldLen = *len;
+            *data = record;
+            return 1;
+        }
+
+        int got = plugin_receive(client, wait);
+        if (got < 0)
+            return -1;
+        if (got == 0 && !wait)
+            return 0;
+    }
+}
+
+int plugin_send(struct PluginClient* client, uint32_t type, const void* head, uint32_t headLen, const void* body, uint32_t bodyLen)
+{
+    if (plugin_push(&client->shared->commands, type, head, headLen, body, bodyLen) != 0)
+        return -1;
+
+    char wake = MESSAGE_WAKE;
+    send(client->socket, &wake, 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    return 0;
+}
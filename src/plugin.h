@@ -0,0 +1,262 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "text.h"
+
+// Plugins run in their own process and talk to the editor through two single-producer single-consumer rings in shared
+// memory, events flow to the plugin and commands flow back. Documents are shared read-only, the plugin maps the
+// original and the add buffer itself and only piece lists cross the rings, so no document bytes are ever copied.
+// Neither side ever blocks on the other, a full ring drops events and delays piece lists until there's room.
+//
+// A plugin starts with the rings mapped from PLUGIN_FD_SHARED and a seqpacket socket on PLUGIN_FD_SOCKET, which carries
+// wakeups and the descriptors of each document. stdin, stdout and stderr go to /dev/null.
+
+// Bytes of each ring, a power of two.
+#define PLUGIN_RING_SIZE (1 << 20)
+#define PLUGIN_MAX 8
+// Highest tab number plus one which can be shared.
+#define PLUGIN_DOCUMENTS 64
+#define PLUGIN_FD_SHARED 3
+#define PLUGIN_FD_SOCKET 4
+// A piece list is split into records of at most this many, so long ones fit the ring in parts.
+#define PLUGIN_PIECES_MAX 4096
+// Commands handled per poll, a flooding plugin can't hold up a frame for longer than this.
+#define PLUGIN_POLL_MAX 256
+
+// Fills the rest of the ring when a record doesn't fit before it wraps, skipped by readers.
+#define PLUGIN_PAD 0
+// Editor to plugin.
+#define PLUGIN_DOCUMENT 1
+#define PLUGIN_PIECES 2
+#define PLUGIN_KEY 3
+#define PLUGIN_CURSOR 4
+#define PLUGIN_CLOSE 5
+// Plugin to editor.
+#define PLUGIN_DECORATE 16
+#define PLUGIN_CLEAR 17
+#define PLUGIN_REPLACE 18
+#define PLUGIN_STATUS 19
+
+/// @brief A ring of records, head is only written by the producer and tail only by the consumer.
+struct PluginRing
+{
+    _Alignas(64) uint64_t head;
+    _Alignas(64) uint64_t tail;
+    _Alignas(64) char data[PLUGIN_RING_SIZE];
+};
+
+struct PluginShared
+{
+    struct PluginRing events;
+    struct PluginRing commands;
+};
+
+/// @brief Precedes every record, records start 8 byte aligned and never wrap.
+struct PluginRecord
+{
+    uint32_t type;
+    uint32_t len;
+};
+
+/// @brief A document was opened, its original and add buffer descriptors were sent over the socket just before.
+struct PluginDocument
+{
+    uint32_t tab;
+    uint32_t reserved;
+    uint64_t originalLen;
+};
+
+/// @brief Part of the piece list of a version of a document, followed by count pieces starting at piece first of total.
+struct PluginPieces
+{
+    uint32_t tab;
+    uint32_t count;
+    uint32_t first;
+    uint32_t total;
+    uint64_t version;
+    uint64_t len;
+};
+
+struct PluginKey
+{
+    uint32_t tab;
+    char key[4];
+};
+
+struct PluginCursor
+{
+    uint32_t tab;
+    uint32_t reserved;
+    uint64_t pos;
+};
+
+struct PluginClose
+{
+    uint32_t tab;
+};
+
+/// @brief Asks for a range of a version of a document to be drawn in a style.
+struct PluginDecorate
+{
+    uint32_t tab;
+    /// @brief Attributes of the range, a colour and flags as in render.h.
+    uint32_t style;
+    uint64_t version;
+    uint64_t pos;
+    uint64_t len;
+};
+
+/// @brief Drops every decoration of a document.
+struct PluginClear
+{
+    uint32_t tab;
+};
+
+/// @brief Replaces del bytes at pos with the bytes following the record, only if the document is still at version.
+struct PluginReplace
+{
+    uint32_t tab;
+    uint32_t reserved;
+    uint64_t version;
+    uint64_t pos;
+    uint64_t del;
+};
+
+/// @brief How far a plugin has been told about a document.
+struct PluginSync
+{
+    /// @brief 1 once the document record is pushed, 2 once its descriptors made it over the socket too.
+    int opened;
+    /// @brief Version being sent and the next piece of it, or the version last sent in full.
+    uint64_t version;
+    uint32_t next;
+    int sent;
+};
+
+/// @brief Editor side of a plugin.
+struct Plugin
+{
+    pid_t pid;
+    int socket;
+    struct PluginShared* shared;
+    int dead;
+    /// @brief Whether anything was pushed since the plugin was last woken.
+    int pushed;
+    struct PluginSync sync[PLUGIN_DOCUMENTS];
+    /// @brief Decorations currently asked for, for every document.
+    struct PluginDecorate* decorations;
+    size_t numDecorations;
+    size_t capDecorations;
+};
+
+/// @brief What a plugin can see of a document.
+struct PluginView
+{
+    const char* original;
+    size_t originalLen;
+    const char* add;
+    /// @brief Latest complete piece list, in document order.
+    struct Piece* pieces;
+    uint32_t count;
+    uint64_t version;
+    size_t len;
+    /// @brief Piece list being received.
+    struct Piece* building;
+    uint64_t buildVersion;
+    uint32_t built;
+    /// @brief Descriptors received for the document and not yet mapped.
+    int fds[2];
+    int numFds;
+};
+
+/// @brief Plugin side of the connection.
+struct PluginClient
+{
+    struct PluginShared* shared;
+    int socket;
+    /// @brief Whether the event last returned is still in the ring, it's popped on the next call, and its length.
+    int held;
+    uint32_t heldLen;
+    struct PluginView views[PLUGIN_DOCUMENTS];
+};
+
+/// @brief Pushes a record made of a header and a body, either of which may be empty.
+/// @param ring The ring, only ever pushed to by one thread.
+/// @return 0 if successful, otherwise -1 if it doesn't fit right now.
+int plugin_push(struct PluginRing* ring, uint32_t type, const void* head, uint32_t headLen, const void* body, uint32_t bodyLen);
+
+/// @brief Gets the oldest record of a ring without removing it. The other side can write anywhere in the ring at any
+/// time, so the indices and every header are copied before they're checked and only the copies are used.
+/// @param ring The ring, only ever read by one thread.
+/// @param type Receives the type of the record.
+/// @param data Receives a pointer to the record, which stays within the ring until it's popped.
+/// @param len Receives the length of the record.
+/// @return 1 if there is a record, 0 if the ring is empty, -1 if the indices or a length don't fit the ring.
+int plugin_peek(struct PluginRing* ring, uint32_t* type, const void** data, uint32_t* len);
+
+/// @brief Removes the oldest record of a ring.
+/// @param ring The ring.
+/// @param len Length of the record as given by plugin_peek, the one in the ring may have changed since.
+void plugin_pop(struct PluginRing* ring, uint32_t len);
+
+/// @brief Starts a plugin, which gets the rings and the socket and nothing else of the editor.
+/// @param plugin The plugin to be started.
+/// @param argv Path of the executable and its arguments, NULL terminated.
+/// @return 0 if successful, otherwise -1.
+int plugin_start(struct Plugin* plugin, char* const argv[]);
+
+/// @brief Kills a plugin and releases everything it had.
+void plugin_stop(struct Plugin* plugin);
+
+/// @brief Brings a plugin up to date with a document, sharing it if it hasn't been and sending its pieces if they changed.
+/// Whatever doesn't fit right now is sent on a later call.
+/// @param plugin The plugin.
+/// @param tab Number of the document, below PLUGIN_DOCUMENTS.
+/// @param text The document, its add buffer is moved into shared memory the first time.
+/// @param handle Descriptor of the file the original is mapped from, reopened read-only for the plugin.
+void plugin_sync(struct Plugin* plugin, int tab, struct Text* text, int handle);
+
+/// @brief Tells a plugin a document was closed and forgets everything about it, so the tab number can be shared again.
+/// @param plugin The plugin.
+/// @param tab Number of the document.
+void plugin_close(struct Plugin* plugin, int tab);
+
+/// @brief Pushes an event, events which don't fit are dropped.
+/// @return 0 if successful, otherwise -1.
+int plugin_event(struct Plugin* plugin, uint32_t type, const void* data, uint32_t len);
+
+/// @brief Handles up to PLUGIN_POLL_MAX commands, keeping decorations itself and passing the rest to fn.
+/// @param plugin The plugin.
+/// @param fn Called for every other command with the plugin, the type and the record.
+/// @param ctx Passed to fn.
+/// @return Number of commands handled.
+int plugin_poll(struct Plugin* plugin, void (*fn)(void* ctx, struct Plugin* plugin, uint32_t type, const void* data, uint32_t len), void* ctx);
+
+/// @brief Wakes a plugin if anything was pushed since it was last woken, once per frame is enough.
+void plugin_flush(struct Plugin* plugin);
+
+/// @brief Connects a plugin to the editor which started it.
+/// @param client The client to be connected.
+/// @return 0 if successful, otherwise -1.
+int plugin_connect(struct PluginClient* client);
+
+/// @brief Gets the next event, mapping documents and assembling piece lists into their views on the way.
+/// @param client The client.
+/// @param wait Whether to sleep until an event arrives.
+/// @param type Receives the type of the event.
+/// @param data Receives the event, valid until the next call.
+/// @param len Receives the length of the event.
+/// @return 1 if there was an event, 0 if there wasn't, -1 if the editor is gone.
+int plugin_next(struct PluginClient* client, int wait, uint32_t* type, const void** data, uint32_t* len);
+
+/// @brief Sends a command made of a header and a body, waking the editor.
+/// @return 0 if successful, otherwise -1 if it doesn't fit right now.
+int plugin_send(struct PluginClient* client, uint32_t type, const void* head, uint32_t headLen, const void* body, uint32_t bodyLen);
+
+/// @brief Gets the bytes of a piece straight from the shared mappings.
+static inline const char* plugin_bytes(const struct PluginView* view, const struct Piece* piece)
+{
+    return (piece->source == TEXT_ORIGINAL ? view->original : view->add) + piece->start;
+}
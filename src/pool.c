@@ -0,0 +1,133 @@
+#include <pthread.h>
+#include <unistd.h>
+#include "pool.h"
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+// Only one job runs at a time, concurrent callers take a ticket and go in the order they came. A mutex would let a
+// thread running one job after another take it straight back, and the main thread could wait behind all of them.
+static pthread_cond_t turn = PTHREAD_COND_INITIALIZER;
+static unsigned tickets = 0;
+static unsigned serving = 0;
+static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+static int threads = 1;
+// Bumped for every job so that sleeping workers can tell a new one from a spurious wakeup.
+static unsigned generation = 0;
+static void (*job)(void* arg, int i);
+static void* jobArg;
+static int jobCount;
+static int next;
+static int remaining;
+// Workers inside pool_drain, a new job isn't set up until stragglers of the last one have left.
+static int active = 0;
+// Set on pool threads and while the caller is working, so nested calls run inline instead of deadlocking.
+static __thread int inPool = 0;
+
+/// @brief Claims and runs tasks of the current job until there are none left.
+static void pool_drain()
+{
+    int i;
+    while ((i = __atomic_fetch_add(&next, 1, __ATOMIC_RELAXED)) < jobCount)
+    {
+        job(jobArg, i);
+        if (__atomic_sub_fetch(&remaining, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            pthread_mutex_lock(&lock);
+            pthread_cond_signal(&done);
+            pthread_mutex_unlock(&lock);
+        }
+    }
+}
+
+static void* pool_worker(void* unused)
+{
+    (void)unused;
+    inPool = 1;
+    unsigned seen = 0;
+    while (1)
+    {
+        pthread_mutex_lock(&lock);
+        while (generation == seen)
+            pthread_cond_wait(&wake, &lock);
+        seen = generation;
+        active++;
+        pthread_mutex_unlock(&lock);
+
+        pool_drain();
+
+        pthread_mutex_lock(&lock);
+        if (--active == 0)
+            pthread_cond_signal(&done);
+        pthread_mutex_unlock(&lock);
+    }
+
+    return NULL;
+}
+
+static void pool_start()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int want = cpus < 1 ? 1 : cpus > POOL_MAX ? POOL_MAX : cpus;
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    for (int i = 1; i < want; i++)
+    {
+        pthread_t thread;
+        if (pthread_create(&thread, &attr, pool_worker, NULL) != 0)
+            break;
+        threads++;
+    }
+
+    pthread_attr_destroy(&attr);
+}
+
+void pool_run(int n, void (*fn)(void* arg, int i), void* arg)
+{
+    if (n <= 0)
+        return;
+
+    pthread_once(&once, pool_start);
+    if (inPool || n == 1 || threads == 1)
+    {
+        for (int i = 0; i < n; i++)
+            fn(arg, i);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    unsigned ticket = tickets++;
+    while (serving != ticket)
+        pthread_cond_wait(&turn, &lock);
+    while (active != 0)
+        pthread_cond_wait(&done, &lock);
+
+    job = fn;
+    jobArg = arg;
+    jobCount = n;
+    next = 0;
+    remaining = n;
+    generation++;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    inPool = 1;
+    pool_drain();
+    inPool = 0;
+
+    pthread_mutex_lock(&lock);
+    while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE) != 0 || active != 0)
+        pthread_cond_wait(&done, &lock);
+    serving++;
+    pthread_cond_broadcast(&turn);
+    pthread_mutex_unlock(&lock);
+}
+
+int pool_size()
+{
+    pthread_once(&once, pool_start);
+    return threads;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Upper bound on threads in the pool, the calling thread included.
+#define POOL_MAX 64
+
+/// @brief Runs fn(arg, i) for every i in 0..n across the worker pool and the calling thread, returning once all have run.
+/// Workers are started on first use, one per online CPU. Calls from inside a task run inline on that thread.
+/// @param n Number of tasks.
+/// @param fn The task, which must be safe to run concurrently with itself.
+/// @param arg Passed to every task.
+void pool_run(int n, void (*fn)(void* arg, int i), void* arg);
+
+/// @brief Gets the number of threads pool_run spreads tasks over, the calling thread included.
+/// @return The number of threads.
+int pool_size();
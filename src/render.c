@@ -0,0 +1,156 @@
+#include <string.h>
+#include <immintrin.h>
+#include "render.h"
+#include "classify.h"
+
+/// @brief Gets a mask of the cells of 16 which are blank, a space without attributes.
+static inline uint32_t render_blanks(const char* cells, const uint16_t* attrs)
+{
+    __m128i bytes = _mm_loadu_si128((const __m128i*)cells);
+    __m256i plain = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)attrs), _mm256_setzero_si256());
+    __m128i packed = _mm_packs_epi16(_mm256_castsi256_si128(plain), _mm256_extracti128_si256(plain, 1));
+    return _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(' ')), packed));
+}
+
+/// @brief Gets a mask of the cells of 16 where the attribute changes from cur, leaving out continuation bytes of UTF-8
+/// sequences so a character is never split between two.
+static inline uint32_t render_changes(const char* cells, const uint16_t* attrs, uint16_t cur, int utf8)
+{
+    __m256i same = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i*)attrs), _mm256_set1_epi16(cur));
+    __m128i packed = _mm_packs_epi16(_mm256_castsi256_si128(same), _mm256_extracti128_si256(same, 1));
+    uint32_t changes = ~_mm_movemask_epi8(packed) & 0xffff;
+    if (utf8)
+    {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)cells);
+        __m128i tail = _mm_cmpeq_epi8(_mm_and_si128(bytes, _mm_set1_epi8(0xc0)), _mm_set1_epi8(0x80));
+        changes &= ~_mm_movemask_epi8(tail);
+    }
+
+    return changes;
+}
+
+/// @brief Copies cells and sanitizes them on the way, whole vectors so up to RENDER_SLACK past len is read and written.
+static inline void render_copy(char* dst, const char* cells, size_t len, __m256i keepHigh)
+{
+    for (size_t i = 0; i < len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(cells + i));
+        _mm256_storeu_si256((__m256i*)(dst + i), classify_clean(v, keepHigh));
+    }
+}
+
+/// @brief Writes a number in decimal.
+static size_t render_number(char* dst, unsigned n)
+{
+    char digits[10];
+    size_t len = 0;
+    do
+    {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+
+    for (size_t i = 0; i < len; i++)
+        dst[i] = digits[len - 1 - i];
+    return len;
+}
+
+size_t render_row(char* dst, const char* cells, const uint16_t* attrs, int cols, int utf8)
+{
+    // The end is found a vector at a time from the back, most rows are short lines padded out with blanks.
+    int end = cols;
+    while (end > 0)
+    {
+        int from = end >= 16 ? end - 16 : 0;
+        uint32_t kept = ~render_blanks(cells + from, attrs + from) & ((1u << (end - from)) - 1);
+        if (kept != 0)
+        {
+            end = from + 32 - __builtin_clz(kept);
+            break;
+        }
+        end = from;
+    }
+
+    __m256i keepHigh = _mm256_set1_epi8(utf8 ? -1 : 0);
+    char* out = dst;
+    uint16_t cur = 0;
+    int pos = 0;
+    int search = 0;
+    while (pos < end)
+    {
+        int change = end;
+        for (; search < end; search += 16)
+        {
+            uint32_t changes = render_changes(cells + search, attrs + search, cur, utf8);
+            if (changes != 0)
+            {
+                change = search + __builtin_ctz(changes);
+                change = change < end ? change : end;
+                break;
+            }
+        }
+
+        render_copy(out, cells + pos, change - pos, keepHigh);
+        out += change - pos;
+        pos = change;
+        if (pos < end)
+        {
+            cur = attrs[pos];
+            out += render_sgr(out, cur);
+            search = pos + 1;
+        }
+    }
+
+    if (cur != 0)
+        out += render_sgr(out, 0);
+    return out - dst;
+}
+
+size_t render_sgr(char* dst, uint16_t attr)
+{
+    char* out = dst;
+    memcpy(out, "\x1b[0", 3);
+    out += 3;
+    if (attr & RENDER_BOLD)
+    {
+        memcpy(out, ";1", 2);
+        out += 2;
+    }
+    if (attr & RENDER_UNDERLINE)
+    {
+        memcpy(out, ";4", 2);
+        out += 2;
+    }
+    if (attr & RENDER_REVERSE)
+    {
+        memcpy(out, ";7", 2);
+        out += 2;
+    }
+    if (attr & RENDER_FOREGROUND)
+    {
+        memcpy(out, ";38;5;", 6);
+        out += 6;
+        out += render_number(out, attr & RENDER_COLOR);
+    }
+
+    *out++ = 'm';
+    return out - dst;
+}
+
+size_t render_cursor(char* dst, int row, int col)
+{
+    char* out = dst;
+    *out++ = '\x1b';
+    *out++ = '[';
+    out += render_number(out, row);
+    *out++ = ';';
+    out += render_number(out, col);
+    *out++ = 'H';
+    return out - dst;
+}
+
+size_t render_bound(int rows, int cols)
+{
+    // At worst every cell starts a run of its own.
+    return (size_t)rows * ((size_t)cols * (RENDER_SGR_MAX + 1) + RENDER_SGR_MAX + 2) + RENDER_CURSOR_MAX + RENDER_SLACK;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Attributes of a cell, a 256 colour foreground and flags on top of the terminal's defaults. Styles of plugin
+// decorations are the same.
+#define RENDER_COLOR 0x00ff
+#define RENDER_FOREGROUND 0x0100
+#define RENDER_BOLD 0x0200
+#define RENDER_UNDERLINE 0x0400
+#define RENDER_REVERSE 0x0800
+// Longest SGR sequence, every flag and a three digit colour.
+#define RENDER_SGR_MAX (sizeof("\x1b[0;1;4;7;38;5;255m") - 1)
+// Longest cursor position sequence.
+#define RENDER_CURSOR_MAX (sizeof("\x1b[2147483647;2147483647H") - 1)
+// Cells, attributes and output a row may be read or written past its end, a vector's worth.
+#define RENDER_SLACK 32
+
+/// @brief Writes a row of cells as terminal output: runs of cells with the same attributes are copied a vector at a
+/// time with everything which would upset the terminal replaced on the way, see classify_sanitize, and an SGR sequence
+/// goes between runs. Attributes only change at the start of a UTF-8 sequence, and trailing blanks without attributes
+/// are left out since every frame starts on a cleared screen. The row ends with the terminal's defaults.
+/// @param dst Room for the row, see render_bound.
+/// @param cells The row, readable for RENDER_SLACK bytes past cols.
+/// @param attrs Attributes of each cell, readable for RENDER_SLACK past cols.
+/// @param cols Number of cells.
+/// @param utf8 Whether bytes above 0x7f are left alone as part of UTF-8 sequences.
+/// @return Bytes written.
+size_t render_row(char* dst, const char* cells, const uint16_t* attrs, int cols, int utf8);
+
+/// @brief Writes the SGR sequence of an attribute, which resets everything the attribute doesn't set.
+/// @return Bytes written, at most RENDER_SGR_MAX.
+size_t render_sgr(char* dst, uint16_t attr);
+
+/// @brief Writes the sequence moving the terminal's cursor to a one-based row and column.
+/// @return Bytes written, at most RENDER_CURSOR_MAX.
+size_t render_cursor(char* dst, int row, int col);
+
+/// @brief Gets the most bytes a frame of rows written by render_row can take, with a line break after every row but
+/// the last, a cursor position and RENDER_SLACK.
+size_t render_bound(int rows, int cols);
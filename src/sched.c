@@ -0,0 +1,98 @@
+#include <poll.h>
+#include <string.h>
+#include "sched.h"
+#include "trace.h"
+#include "mzalloc.h"
+
+/// @brief A job waiting for its next step.
+struct SchedJob
+{
+    int (*step)(void* arg);
+    void* arg;
+};
+
+static struct SchedJob* jobs = NULL;
+static int numJobs = 0;
+static int capJobs = 0;
+// The job whose step comes next, so a long job can't keep the others from ever getting a turn.
+static int turn = 0;
+
+/// @brief Takes a job out of the queue, keeping the order of the others.
+static void sched_remove(int i)
+{
+    memmove(jobs + i, jobs + i + 1, (numJobs - i - 1) * sizeof(struct SchedJob));
+    numJobs--;
+    if (turn > i)
+        turn--;
+    if (turn >= numJobs)
+        turn = 0;
+}
+
+/// @brief Runs the step of the job whose turn it is, dropping it once it's done.
+static void sched_step()
+{
+    int i = turn;
+    if (jobs[i].step(jobs[i].arg))
+        turn = (i + 1) % numJobs;
+    else
+        sched_remove(i);
+}
+
+int sched_add(int (*step)(void* arg), void* arg)
+{
+    for (int i = 0; i < numJobs; i++)
+    {
+        if (jobs[i].step == step && jobs[i].arg == arg)
+            return 0;
+    }
+
+    if (numJobs == capJobs)
+    {
+        int cap = capJobs < 16 ? 16 : capJobs * 2;
+        struct SchedJob* grown = mzrealloc(jobs, cap * sizeof(struct SchedJob));
+        if (grown == NULL)
+            return -1;
+
+        jobs = grown;
+        capJobs = cap;
+    }
+
+    jobs[numJobs++] = (struct SchedJob){ step, arg };
+    return 0;
+}
+
+void sched_cancel(void* arg)
+{
+    for (int i = numJobs - 1; i >= 0; i--)
+    {
+        if (jobs[i].arg == arg)
+            sched_remove(i);
+    }
+}
+
+int sched_pending()
+{
+    return numJobs > 0;
+}
+
+int sched_run(uint64_t budget, int input)
+{
+    uint64_t start = trace_now();
+    while (numJobs > 0 && trace_now() - start < budget)
+    {
+        sched_step();
+
+        // Keys always come first, the rest of the budget is given up as soon as one is waiting.
+        struct pollfd fd = { input, POLLIN, 0 };
+        if (input >= 0 && poll(&fd, 1, 0) > 0)
+            break;
+    }
+
+    return numJobs > 0;
+}
+
+void sched_finish()
+{
+    while (numJobs > 0)
+        sched_step();
+}
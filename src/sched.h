@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+// How long jobs may run between keys before the frame is drawn, half a frame at 60Hz. A step only starts inside the
+// budget and never after a key has come in, so a key waits for one step at most.
+#define SCHED_BUDGET_NS 8000000
+
+/// @brief Queues a resumable job, its step is called between keys until it says it's done. A step does a slice of the
+/// work small enough to go unnoticed and keeps where it got to in arg, heavy pure work inside a step goes to the pool.
+/// A job already queued with the same step and argument isn't queued again, and the queue grows as jobs come in.
+/// @param step Does the next slice of the job, returning 1 if there is more to do, otherwise 0.
+/// @param arg Passed to every step.
+/// @return 0 if successful, otherwise -1 if there's no memory for another job.
+int sched_add(int (*step)(void* arg), void* arg);
+
+/// @brief Drops every job of an argument, for when what it works on goes away.
+/// @param arg The argument the jobs were queued with.
+void sched_cancel(void* arg);
+
+/// @brief Gets whether any job is queued.
+/// @return 1 if there is work waiting, otherwise 0.
+int sched_pending();
+
+/// @brief Runs steps of the queued jobs in turn until none are left, the budget is spent or a key comes in.
+/// @param budget Nanoseconds steps may start within.
+/// @param input Descriptor checked for keys between steps, -1 to not check.
+/// @return 1 if there is still work waiting, otherwise 0.
+int sched_run(uint64_t budget, int input);
+
+/// @brief Runs every queued job to the end, for replays which have to come out the same every time.
+void sched_finish();
@@ -0,0 +1,35 @@
+#include "search.h"
+#include "mzalloc.h"
+
+int search_all(const struct Text* text, const char* needle, size_t len, size_t** hits, size_t* count)
+{
+    *hits = NULL;
+    *count = 0;
+    if (len == 0 || len > TEXT_NEEDLE_MAX)
+        return -1;
+
+    size_t* out = NULL;
+    size_t n = 0;
+    size_t cap = 0;
+    for (size_t hit = text_search(text, 0, needle, len); hit < text->len; hit = text_search(text, hit + len, needle, len))
+    {
+        if (n == cap)
+        {
+            cap = cap == 0 ? 4096 : cap * 2;
+            size_t* grown = mzrealloc(out, cap * sizeof(size_t));
+            if (grown == NULL)
+            {
+                mzfree(out);
+                return -1;
+            }
+
+            out = grown;
+        }
+
+        out[n++] = hit;
+    }
+
+    *hits = out;
+    *count = n;
+    return 0;
+}
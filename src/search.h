@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+#include "text.h"
+
+/// @brief Finds every occurrence of a needle, the same matches as successive text_search calls each starting after the
+/// previous match, so none of them overlap. Everything a replace needs is gathered in one pass over the document.
+/// @param text The document to be searched.
+/// @param needle The bytes to be found.
+/// @param len The length of the needle, at most TEXT_NEEDLE_MAX.
+/// @param hits Receives the positions of the matches in order, allocated with mzalloc and NULL if there are none.
+/// @param count Receives the number of matches.
+/// @return 0 if successful, otherwise -1.
+int search_all(const struct Text* text, const char* needle, size_t len, size_t** hits, size_t* count);
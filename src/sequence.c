@@ -0,0 +1,153 @@
+#include <immintrin.h>
+#include "sequence.h"
+
+/// @brief Gets a bit for every lead byte of a multi-byte character among up to 32 bytes.
+static inline uint32_t sequence_leads(const char* at, size_t n)
+{
+    if (n >= 32)
+    {
+        // Leads are 0xc0 and up, -64 to -1 signed, continuation bytes below them and ASCII has no sign.
+        __m256i v = _mm256_loadu_si256((const __m256i*)at);
+        return _mm256_movemask_epi8(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(-65))) & _mm256_movemask_epi8(v);
+    }
+
+    uint32_t mask = 0;
+    for (size_t i = 0; i < n; i++)
+        mask |= (uint32_t)((unsigned char)at[i] >= 0xc0) << i;
+    return mask;
+}
+
+/// @brief Counts the sequences starting before an offset, a binary search over the offsets.
+static inline uint32_t sequence_before(const struct Sequences* seqs, size_t offset)
+{
+    uint32_t low = 0;
+    uint32_t high = seqs->count;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (seqs->offset[mid] < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+/// @brief Gets the column a sequence starts at.
+static inline size_t sequence_start(const struct Sequences* seqs, uint32_t i)
+{
+    return seqs->offset[i] - (i > 0 ? seqs->saved[i - 1] : 0);
+}
+
+int sequence_scan(struct Sequences* seqs, const char* line, size_t len, int flags, struct Arena* arena)
+{
+    *seqs = (struct Sequences){ .len = len < SEQUENCE_SPAN ? len : SEQUENCE_SPAN, .flags = flags };
+    len = seqs->len;
+    int crlf = (flags & SEQUENCE_CRLF) && (flags & SEQUENCE_END) && len > 0 && line[len - 1] == '\r';
+
+    // Counted first so the arrays are exactly as long as they need to be, an ASCII line takes nothing.
+    size_t count = crlf;
+    if (flags & SEQUENCE_UTF8)
+    {
+        for (size_t i = 0; i < len; i += 32)
+            count += __builtin_popcount(sequence_leads(line + i, len - i));
+    }
+
+    if (count == 0)
+        return 0;
+
+    char* block = arena_alloc(arena, count * (2 * sizeof(uint32_t) + 2));
+    if (block == NULL)
+    {
+        // An empty map makes every byte a column, which is still somewhere the cursor can be.
+        seqs->flags = 0;
+        return -1;
+    }
+
+    seqs->offset = (uint32_t*)block;
+    seqs->saved = seqs->offset + count;
+    seqs->bytes = (uint8_t*)(seqs->saved + count);
+    seqs->kind = seqs->bytes + count;
+
+    uint32_t n = 0;
+    uint32_t saved = 0;
+    for (size_t i = 0; (flags & SEQUENCE_UTF8) && i < len; i += 32)
+    {
+        for (uint32_t mask = sequence_leads(line + i, len - i); mask != 0; mask &= mask - 1)
+        {
+            size_t at = i + __builtin_ctz(mask);
+            unsigned char lead = line[at];
+            size_t bytes = 2 + (lead >= 0xe0) + (lead >= 0xf0);
+            // A character cut off by the end of the run is as much of it as there is.
+            bytes = bytes < len - at ? bytes : len - at;
+            saved += bytes - 1;
+            seqs->offset[n] = at;
+            seqs->bytes[n] = bytes;
+            seqs->kind[n] = SEQUENCE_SINGLE;
+            seqs->saved[n++] = saved;
+        }
+    }
+
+    if (crlf)
+    {
+        seqs->offset[n] = len - 1;
+        seqs->bytes[n] = 1;
+        seqs->kind[n] = SEQUENCE_SKIP;
+        seqs->saved[n++] = ++saved;
+    }
+
+    seqs->count = n;
+    return 0;
+}
+
+size_t sequence_column(const struct Sequences* seqs, size_t offset)
+{
+    uint32_t i = sequence_before(seqs, offset);
+    if (i > 0 && offset < seqs->offset[i - 1] + seqs->bytes[i - 1])
+        return sequence_start(seqs, i - 1);
+
+    return offset - (i > 0 ? seqs->saved[i - 1] : 0);
+}
+
+size_t sequence_offset(const struct Sequences* seqs, size_t column)
+{
+    // Sequences start at columns which never go down, so the first starting at or after column is a binary search too.
+    uint32_t low = 0;
+    uint32_t high = seqs->count;
+    while (low < high)
+    {
+        uint32_t mid = (low + high) / 2;
+        if (sequence_start(seqs, mid) < column)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    size_t offset = low < seqs->count && sequence_start(seqs, low) == column
+                        ? seqs->offset[low]
+                        : column + (low > 0 ? seqs->saved[low - 1] : 0);
+    size_t end = sequence_end(seqs);
+    return (seqs->flags & SEQUENCE_END) && offset > end ? end : offset;
+}
+
+size_t sequence_end(const struct Sequences* seqs)
+{
+    if (seqs->count > 0 && seqs->kind[seqs->count - 1] == SEQUENCE_SKIP)
+        return seqs->offset[seqs->count - 1];
+
+    return seqs->len;
+}
+
+size_t sequence_step(const struct Sequences* seqs, size_t offset, int dir)
+{
+    uint32_t i = sequence_before(seqs, offset);
+    if (dir > 0)
+        return i < seqs->count && seqs->offset[i] == offset ? offset + seqs->bytes[i] : offset + 1;
+
+    if (offset == 0)
+        return 0;
+    if (i > 0 && offset - 1 < seqs->offset[i - 1] + seqs->bytes[i - 1])
+        return seqs->offset[i - 1];
+    return offset - 1;
+}
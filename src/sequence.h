@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "arena.h"
+
+// Bytes of a line mapped at most, columns past it are counted a byte each. Nothing that far along fits on screen.
+#define SEQUENCE_SPAN (64 * 1024)
+
+// Kinds of sequence. A skipped one takes no column and the cursor never stops after its start, the carriage return
+// of a CRLF line ending. A single one takes one column and the cursor steps over it at once, a multi-byte character.
+#define SEQUENCE_SKIP 0
+#define SEQUENCE_SINGLE 1
+
+// What a scan looks for. Multi-byte characters only in valid UTF-8, a trailing carriage return only if the bytes
+// reach the end of a line of a CRLF document.
+#define SEQUENCE_UTF8 1
+#define SEQUENCE_CRLF 2
+#define SEQUENCE_END 4
+
+/// @brief Runs of a line's bytes which don't take a column each, structure of arrays in an arena and sorted by offset.
+/// Plain bytes aren't stored, so an ASCII line maps to nothing at all.
+struct Sequences
+{
+    /// @brief Offset of each sequence from the start of the bytes scanned.
+    uint32_t* offset;
+    uint8_t* bytes;
+    uint8_t* kind;
+    /// @brief Columns saved by the sequences up to and including each, bytes less columns.
+    uint32_t* saved;
+    uint32_t count;
+    /// @brief Bytes scanned.
+    uint32_t len;
+    int flags;
+};
+
+/// @brief Maps the sequences of a run of a line, a vector of bytes at a time. Runs are at most SEQUENCE_SPAN.
+/// @param seqs The map, valid until the arena is rewound or reset.
+/// @param line The bytes, continuation bytes before the first lead count a column each.
+/// @param len Number of bytes.
+/// @param flags SEQUENCE_UTF8, SEQUENCE_CRLF and SEQUENCE_END.
+/// @param arena Where the arrays go.
+/// @return 0 if successful, otherwise -1 and the map is empty so every byte is a column.
+int sequence_scan(struct Sequences* seqs, const char* line, size_t len, int flags, struct Arena* arena);
+
+/// @brief Gets the column of an offset, offsets inside a sequence give the column it starts at.
+size_t sequence_column(const struct Sequences* seqs, size_t offset);
+
+/// @brief Gets the offset a column starts at, columns past the end give the last place the cursor can stop.
+size_t sequence_offset(const struct Sequences* seqs, size_t column);
+
+/// @brief Gets the last place the cursor can stop, before a skipped carriage return or at the end of the bytes.
+size_t sequence_end(const struct Sequences* seqs);
+
+/// @brief Moves an offset over one column, stepping over whole sequences.
+/// @param seqs The map.
+/// @param offset Where the cursor is, at most sequence_end.
+/// @param dir 1 or -1.
+/// @return The offset one column along, which may be outside the bytes scanned.
+size_t sequence_step(const struct Sequences* seqs, size_t offset, int dir);
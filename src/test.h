@@ -0,0 +1,52 @@
+#pragma once
+
+// Shared by the test harnesses, each test_*.c is a program of its own and test.sh at the root builds and runs them all.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+// Run before a failed check exits, harnesses define it first to print state worth seeing.
+#ifndef TEST_DUMP
+#define TEST_DUMP()
+#endif
+
+#define check(cond, ...)                                            \
+    do                                                              \
+    {                                                               \
+        if (!(cond))                                                \
+        {                                                           \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__);             \
+            printf(__VA_ARGS__);                                    \
+            printf("\n");                                           \
+            TEST_DUMP();                                            \
+            exit(1);                                                \
+        }                                                           \
+    } while (0)
+
+/// @brief State of next, harnesses reseed it to replay a stream.
+static __attribute__((unused)) uint64_t seed = 42;
+
+/// @brief splitmix64, workloads have to be the same every run and between allocators so libc rand is out.
+static inline uint64_t next()
+{
+    uint64_t z = (seed += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+/// @brief Gets monotonic time in seconds for timing benches.
+static inline double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// @brief Gets the first argument of a harness as a number, usually rounds or operations, or a default without one.
+static inline int test_arg(int argc, char** argv, int fallback)
+{
+    return argc >= 2 ? atoi(argv[1]) : fallback;
+}
@@ -0,0 +1,265 @@
+// Harness for the bitmap helpers, every one is checked against the same thing done a bit at a time.
+//
+// ./test.sh test_bitmap
+// ../bin/test_bitmap [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "bitmap.h"
+#include "test.h"
+
+// Clusters in the bulk checks, more than one summary bitmap's worth so the summary crosses over too.
+#define NUM_BMPS 300
+
+/// @brief A bitmap spelled out a bit at a time.
+struct Bits
+{
+    unsigned char bit[256];
+};
+
+static struct Bits unpack(__m256i bmp)
+{
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, bmp);
+
+    struct Bits bits;
+    for (int i = 0; i < 256; i++)
+        bits.bit[i] = (lanes[i >> 6] >> (i & 63)) & 1;
+    return bits;
+}
+
+static __m256i pack(const struct Bits* bits)
+{
+    uint64_t lanes[4] = { 0 };
+    for (int i = 0; i < 256; i++)
+        lanes[i >> 6] |= (uint64_t)bits->bit[i] << (i & 63);
+    return _mm256_loadu_si256((__m256i*)lanes);
+}
+
+/// @brief Makes a bitmap with runs of every length, dense or sparse depending on the round.
+static __m256i random_bmp()
+{
+    struct Bits bits;
+    int density = next() % 5;
+    int pos = 0;
+    while (pos < 256)
+    {
+        int len = 1 + next() % (density == 0 ? 4 : density == 4 ? 256 : 32);
+        int value = next() % 5 < density ? 1 : next() & 1;
+        for (int i = pos; i < pos + len && i < 256; i++)
+            bits.bit[i] = value;
+        pos += len;
+    }
+    return pack(&bits);
+}
+
+static int run_at(const struct Bits* bits, int pos)
+{
+    int end = pos;
+    while (end < 256 && bits->bit[end])
+        end++;
+    return end - pos;
+}
+
+/// @brief Checks two bitmaps are the same bit for bit.
+static void same(__m256i got, __m256i want, const char* what, int arg)
+{
+    struct Bits a = unpack(got);
+    struct Bits b = unpack(want);
+    for (int i = 0; i < 256; i++)
+        check(a.bit[i] == b.bit[i], "%s %d: bit %d is %d, expected %d", what, arg, i, a.bit[i], b.bit[i]);
+}
+
+/// @brief Shifts move every bit by exactly n, across lanes, and zero what they vacate.
+static void test_shifts(__m256i bmp)
+{
+    struct Bits bits = unpack(bmp);
+    for (int n = 0; n <= 257; n++)
+    {
+        struct Bits l = { 0 };
+        struct Bits r = { 0 };
+        for (int i = 0; i < 256; i++)
+        {
+            if (i - n >= 0)
+                l.bit[i] = bits.bit[i - n];
+            if (i + n < 256)
+                r.bit[i] = bits.bit[i + n];
+        }
+
+        same(bmp_shl(bmp, n), pack(&l), "shl", n);
+        same(bmp_shr(bmp, n), pack(&r), "shr", n);
+    }
+}
+
+/// @brief Masks and tests at every position and length, including the ones touching either end.
+static void test_expand(__m256i bmp)
+{
+    struct Bits bits = unpack(bmp);
+    for (int pos = 0; pos < 256; pos++)
+    {
+        for (int len = 0; pos + len <= 256; len += 1 + (len >> 3))
+        {
+            struct Bits want = { 0 };
+            int all = 1;
+            for (int i = pos; i < pos + len; i++)
+            {
+                want.bit[i] = 1;
+                all &= bits.bit[i];
+            }
+
+            same(bmp_expand(pos, len), pack(&want), "expand", (pos << 16) | len);
+            check(!!bmp_test(bmp, pos, len) == all, "test %d %d", pos, len);
+
+            __m256i set = bmp;
+            __m256i clear = bmp;
+            bmp_set(&set, pos, len);
+            bmp_clear(&clear, pos, len);
+            same(set, _mm256_or_si256(bmp, pack(&want)), "set", pos);
+            same(clear, _mm256_andnot_si256(pack(&want), bmp), "clear", pos);
+        }
+    }
+}
+
+/// @brief Condensing leaves exactly the starts of len set bits, which the searches all go by.
+static void test_runs(__m256i bmp)
+{
+    struct Bits bits = unpack(bmp);
+
+    int first = -1;
+    int last = -1;
+    int count = 0;
+    int longest = 0;
+    for (int i = 0; i < 256; i++)
+    {
+        if (!bits.bit[i])
+            continue;
+
+        first = first == -1 ? i : first;
+        last = i;
+        count++;
+        longest = run_at(&bits, i) > longest ? run_at(&bits, i) : longest;
+    }
+
+    check(bmp_ffs(bmp) == first, "ffs %d, expected %d", bmp_ffs(bmp), first);
+    check(bmp_fls(bmp) == last, "fls %d, expected %d", bmp_fls(bmp), last);
+    check(bmp_popcount(bmp) == count, "popcount %d, expected %d", bmp_popcount(bmp), count);
+    check(bmp_longest(bmp, 256) == longest, "longest %d, expected %d", bmp_longest(bmp, 256), longest);
+    for (int max = 0; max < 256; max += 1 + (max >> 2))
+    {
+        int want = longest > max ? max : longest;
+        check(bmp_longest(bmp, max) == want, "longest to %d: %d, expected %d", max, bmp_longest(bmp, max), want);
+    }
+
+    for (int len = 1; len <= 257; len += 1 + (len >> 4))
+    {
+        struct Bits starts = { 0 };
+        int decode = -1;
+        int best = -1;
+        int bestLen = 257;
+        for (int i = 0; i < 256; i++)
+        {
+            starts.bit[i] = run_at(&bits, i) >= len;
+            if (starts.bit[i] && decode == -1)
+                decode = i;
+
+            // Best fit goes by whole runs, so only their first bits count.
+            int run = run_at(&bits, i);
+            if ((i == 0 || !bits.bit[i - 1]) && run >= len && run < bestLen)
+            {
+                best = i;
+                bestLen = run;
+            }
+        }
+
+        same(bmp_condense(bmp, len), pack(&starts), "condense", len);
+        check(bmp_decode(bmp, len) == decode, "decode %d: %d, expected %d", len, bmp_decode(bmp, len), decode);
+        check(bmp_best(bmp, len) == best, "best %d: %d, expected %d", len, bmp_best(bmp, len), best);
+    }
+}
+
+/// @brief Summaries follow their clusters, and the bulk searches give what going over every cluster in turn would.
+static void test_bulk()
+{
+    __m256i bmps[NUM_BMPS];
+    __m256i summary[(NUM_BMPS + 255) >> 8];
+    __m256i marked[(NUM_BMPS + 255) >> 8];
+    memset(marked, 0, sizeof(marked));
+
+    // Mostly full clusters, like a busy slab, so summaries have something to skip.
+    for (int i = 0; i < NUM_BMPS; i++)
+    {
+        bmps[i] = next() % 4 == 0 ? random_bmp() : _mm256_setzero_si256();
+        bmps_mark(marked, i, _mm256_set1_epi8(-1));
+        bmps_mark(marked, i, bmps[i]);
+    }
+
+    bmps_summarize(bmps, NUM_BMPS, summary);
+    int count = 0;
+    for (int i = 0; i < NUM_BMPS; i++)
+    {
+        int any = !_mm256_testz_si256(bmps[i], bmps[i]);
+        check(bmp_test(summary[i >> 8], i & 255, 1) == any, "summary of %d", i);
+        check(bmp_test(marked[i >> 8], i & 255, 1) == any, "mark of %d", i);
+        count += bmp_popcount(bmps[i]);
+    }
+    check(bmps_popcount(bmps, NUM_BMPS) == count, "popcount %d, expected %d", bmps_popcount(bmps, NUM_BMPS), count);
+
+    for (int len = 1; len <= 256; len += 1 + (len >> 3))
+    {
+        int first = -1;
+        int best = -1;
+        int bestLen = 257;
+        for (int i = 0; i < NUM_BMPS; i++)
+        {
+            int pos = bmp_decode(bmps[i], len);
+            if (pos != -1 && first == -1)
+                first = (i << 8) + pos;
+
+            pos = bmp_best(bmps[i], len);
+            struct Bits bits = unpack(bmps[i]);
+            if (pos != -1 && run_at(&bits, pos) < bestLen)
+            {
+                best = (i << 8) + pos;
+                bestLen = run_at(&bits, pos);
+            }
+        }
+
+        int got = bmps_first(bmps, summary, NUM_BMPS, len);
+        check(got == first, "first %d: %d, expected %d", len, got, first);
+        got = bmps_best(bmps, summary, NUM_BMPS, len);
+        check(got == best, "best %d: %d, expected %d", len, got, best);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = test_arg(argc, argv, 200);
+
+    // The edges first, nothing set, everything set and a single bit at either end of every lane.
+    __m256i edges[] = { _mm256_setzero_si256(), _mm256_set1_epi8(-1), bmp_expand(0, 1), bmp_expand(63, 2),
+        bmp_expand(127, 2), bmp_expand(191, 2), bmp_expand(255, 1) };
+    for (int i = 0; i < (int)(sizeof(edges) / sizeof(edges[0])); i++)
+    {
+        test_shifts(edges[i]);
+        test_expand(edges[i]);
+        test_runs(edges[i]);
+    }
+
+    for (int i = 0; i < rounds; i++)
+    {
+        __m256i bmp = random_bmp();
+        test_shifts(bmp);
+        test_runs(bmp);
+        if (i % 16 == 0)
+        {
+            test_expand(bmp);
+            test_bulk();
+        }
+    }
+
+    printf("bitmap: %d rounds\n", rounds);
+    printf("ok\n");
+    return 0;
+}
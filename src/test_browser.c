@@ -0,0 +1,217 @@
+// Harness for the file browser, scores have to rank paths the way they're documented to, walks have to find exactly
+// what's on disk, and changes beneath a listing have to reach it through inotify.
+//
+// ./test.sh test_browser
+// ../bin/test_browser
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "browser.h"
+#include "test.h"
+
+static char dir[] = "/tmp/test_browser.XXXXXX";
+
+static int score(const char* path, const char* query)
+{
+    const char* slash = strrchr(path, '/');
+    size_t base = slash != NULL ? slash - path + 1 : 0;
+    return browser_score(path, strlen(path), base, query, strlen(query));
+}
+
+/// @brief Checks the first path outranks the second for a query.
+static void beats(const char* better, const char* worse, const char* query)
+{
+    int a = score(better, query);
+    int b = score(worse, query);
+    check(a > b, "\"%s\" scored %d against \"%s\" with %d for \"%s\"", better, a, worse, b, query);
+}
+
+/// @brief Matches have to be in order, and component starts, the last component, runs and shorter paths rank higher.
+static void test_score()
+{
+    check(score("src/main.c", "main") > 0 && score("src/main.c", "smc") > 0, "in order matches");
+    check(score("src/main.c", "ms") == 0 && score("src/main.c", "x") == 0, "out of order or missing matches");
+    check(score("Src/MAIN.c", "main") == score("src/main.c", "main"), "paths are matched without case");
+
+    // All but the last pair are the same length, so only the bonus for a component start, a camelCase boundary, the
+    // last component or a run tells them apart, the last is told apart by length alone.
+    beats("ab/main.c", "ab/xmain.", "main");
+    beats("ab/x_main", "ab/xxmain", "main");
+    beats("ab/xyMain", "ab/xymain", "m");
+    beats("foo/bar.c", "bar/foo.c", "bar");
+    beats("xy/abc.cx", "xy/axbxc.", "abc");
+    beats("x/main.c", "x/main.c.orig.backup", "main");
+
+    // However long the query, scores stay within a byte and matches never score 0.
+    char path[512];
+    memset(path, 'a', sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    check(score(path, path + 256) == 255, "long match scored %d", score(path, path + 256));
+    check(score(path, "a") >= 1, "weak match scored 0");
+}
+
+/// @brief Makes a path under the scratch directory.
+static void at(char* out, const char* name)
+{
+    snprintf(out, PATH_MAX, "%s/%s", dir, name);
+}
+
+static void touch(const char* name)
+{
+    char path[PATH_MAX];
+    at(path, name);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    check(fd >= 0 && write(fd, "data", 4) == 4, "create %s", path);
+    close(fd);
+}
+
+static void make(const char* name)
+{
+    char path[PATH_MAX];
+    at(path, name);
+    check(mkdir(path, 0755) == 0, "mkdir %s", path);
+}
+
+static void link_to(const char* target, const char* name)
+{
+    char path[PATH_MAX];
+    at(path, name);
+    check(symlink(target, path) == 0, "symlink %s", path);
+}
+
+/// @brief Steps until the walk is done, no walk of a handful of entries takes more than a few steps.
+static void finish(struct Browser* browser)
+{
+    for (int i = 0; browser_step(browser); i++)
+        check(i < 100, "walk never finished");
+}
+
+/// @brief Checks an entry was found with a type, or wasn't found at all with -1.
+static void found(struct Browser* browser, const char* want, int type)
+{
+    struct Listing* listing = browser->current;
+    for (size_t i = 0; i < listing->count; i++)
+    {
+        struct Entry* e = listing->entries + i;
+        if (e->len == strlen(want) && memcmp(listing->names + e->path, want, e->len) == 0)
+        {
+            check(type != -1, "%s was listed", want);
+            check(e->type == type, "%s listed as %d, expected %d", want, e->type, type);
+            const char* slash = strrchr(want, '/');
+            check(e->base == (slash != NULL ? (size_t)(slash - want + 1) : 0), "%s has base %zu", want, (size_t)e->base);
+            return;
+        }
+    }
+
+    check(type == -1, "%s wasn't listed", want);
+}
+
+/// @brief Walks a tree with nested and hidden directories and every kind of symlink.
+static void test_walk(struct Browser* browser)
+{
+    make("src");
+    make("src/deep");
+    make(".git");
+    touch("readme.md");
+    touch("src/main.c");
+    touch("src/deep/nested.h");
+    touch(".git/config");
+    link_to("readme.md", "file-link");
+    link_to("src", "dir-link");
+    link_to("missing", "dangling");
+    char fifo[PATH_MAX];
+    at(fifo, "pipe");
+    check(mkfifo(fifo, 0644) == 0, "mkfifo");
+
+    check(browser_open(browser, dir) == 0, "open");
+    finish(browser);
+    check(browser->current->count == 10, "%zu entries", browser->current->count);
+
+    found(browser, "src", BROWSER_DIR);
+    found(browser, "src/deep", BROWSER_DIR);
+    found(browser, "src/deep/nested.h", BROWSER_FILE);
+    found(browser, "src/main.c", BROWSER_FILE);
+    found(browser, "readme.md", BROWSER_FILE);
+    // Hidden directories are listed but not walked, and only links to regular files can be opened.
+    found(browser, ".git", BROWSER_DIR);
+    found(browser, ".git/config", -1);
+    found(browser, "file-link", BROWSER_FILE);
+    found(browser, "dir-link", BROWSER_OTHER);
+    found(browser, "dir-link/main.c", -1);
+    found(browser, "dangling", BROWSER_OTHER);
+    found(browser, "pipe", BROWSER_OTHER);
+
+    // The best match is selected, and its path is absolute.
+    browser_query(browser, "NESTED", 6);
+    char path[PATH_MAX];
+    char want[PATH_MAX];
+    at(want, "src/deep/nested.h");
+    check(browser_selected(browser, path) == BROWSER_FILE && strcmp(path, want) == 0, "selected %s", path);
+    browser_query(browser, "main", 4);
+    at(want, "src/main.c");
+    check(browser_selected(browser, path) == BROWSER_FILE && strcmp(path, want) == 0, "selected %s", path);
+    browser_query(browser, "zzz", 3);
+    check(browser_selected(browser, path) == -1, "selected %s without a match", path);
+}
+
+/// @brief A change anywhere beneath a listing wakes its descriptor and the next step walks it again, and a cached
+/// listing which changed while something else was shown is walked again when it's reopened.
+static void test_notify(struct Browser* browser)
+{
+    check(browser_open(browser, dir) == 0, "open");
+    finish(browser);
+    struct Listing* listing = browser->current;
+    size_t before = listing->count;
+
+    struct pollfd fd = { browser_fd(browser), POLLIN, 0 };
+    check(fd.fd >= 0, "no watches");
+    check(poll(&fd, 1, 0) == 0, "woken without a change");
+
+    touch("src/deep/added.c");
+    check(poll(&fd, 1, 1000) == 1, "not woken by a new file");
+    finish(browser);
+    check(listing->count == before + 1, "%zu entries after adding one", listing->count);
+    found(browser, "src/deep/added.c", BROWSER_FILE);
+
+    // Reopening without changes keeps the finished walk.
+    char other[PATH_MAX];
+    at(other, "src");
+    check(browser_open(browser, other) == 0, "open other");
+    finish(browser);
+    check(browser->current != listing, "other directory shares a listing");
+    check(browser_open(browser, dir) == 0 && browser->current == listing && listing->complete, "cached listing walked again");
+
+    check(browser_open(browser, other) == 0, "open other");
+    char path[PATH_MAX];
+    at(path, "src/deep/added.c");
+    check(unlink(path) == 0, "unlink");
+    check(browser_open(browser, dir) == 0 && browser->current == listing, "reopen");
+    finish(browser);
+    check(listing->count == before, "%zu entries after removing one", listing->count);
+    found(browser, "src/deep/added.c", -1);
+}
+
+int main()
+{
+    check(mkdtemp(dir) != NULL, "scratch directory");
+    struct Browser browser;
+    check(browser_init(&browser) == 0, "init");
+
+    test_score();
+    test_walk(&browser);
+    test_notify(&browser);
+
+    char command[PATH_MAX];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    check(system(command) == 0, "clean up");
+
+    printf("ok\n");
+    return 0;
+}
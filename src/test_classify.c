@@ -0,0 +1,210 @@
+// Harness for file classification and the hex view, the vector paths are checked against a byte at a time.
+//
+// ./test.sh test_classify
+// ../bin/test_classify [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "classify.h"
+#include "hex.h"
+#include "text.h"
+#include "test.h"
+
+/// @brief Validates UTF-8 a byte at a time.
+static int valid(const unsigned char* s, size_t len)
+{
+    size_t i = 0;
+    while (i < len)
+    {
+        unsigned c = s[i];
+        int n;
+        uint32_t cp;
+        if (c < 0x80)
+        {
+            i++;
+            continue;
+        }
+        else if (c >= 0xc2 && c <= 0xdf)
+            n = 1, cp = c & 0x1f;
+        else if (c >= 0xe0 && c <= 0xef)
+            n = 2, cp = c & 0x0f;
+        else if (c >= 0xf0 && c <= 0xf4)
+            n = 3, cp = c & 0x07;
+        else
+            return 0;
+
+        if (i + n >= len)
+            return 0;
+        for (int k = 1; k <= n; k++)
+        {
+            if ((s[i + k] & 0xc0) != 0x80)
+                return 0;
+            cp = cp << 6 | (s[i + k] & 0x3f);
+        }
+
+        if ((n == 2 && cp < 0x800) || (n == 3 && (cp < 0x10000 || cp > 0x10ffff)) || (cp >= 0xd800 && cp <= 0xdfff))
+            return 0;
+        i += n + 1;
+    }
+
+    return 1;
+}
+
+/// @brief Appends a random code point, now and then a broken one.
+static size_t codepoint(unsigned char* dst)
+{
+    static const uint32_t ranges[][2] = { { 0x20, 0x7e }, { 0x80, 0x7ff }, { 0x800, 0xd7ff }, { 0xe000, 0xffff },
+                                          { 0x10000, 0x10ffff }, { 0, 0x1f } };
+    const uint32_t* range = ranges[next() % 6];
+    uint32_t cp = range[0] + next() % (range[1] - range[0] + 1);
+    size_t n;
+    if (cp < 0x80)
+        dst[0] = cp, n = 1;
+    else if (cp < 0x800)
+        dst[0] = 0xc0 | cp >> 6, dst[1] = 0x80 | (cp & 0x3f), n = 2;
+    else if (cp < 0x10000)
+        dst[0] = 0xe0 | cp >> 12, dst[1] = 0x80 | (cp >> 6 & 0x3f), dst[2] = 0x80 | (cp & 0x3f), n = 3;
+    else
+        dst[0] = 0xf0 | cp >> 18, dst[1] = 0x80 | (cp >> 12 & 0x3f), dst[2] = 0x80 | (cp >> 6 & 0x3f),
+        dst[3] = 0x80 | (cp & 0x3f), n = 4;
+    return n;
+}
+
+/// @brief Random documents of code points, line endings and the odd broken byte, classified in one go or across
+/// the head and its steps, against counts taken a byte at a time.
+static void test_classify(int rounds)
+{
+    size_t invalid = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        // Now and then a document long enough for its steps to be split across the pool.
+        size_t cap = next() % 256 == 0 ? CLASSIFY_STEP * 3 : next() % 8 == 0 ? CLASSIFY_HEAD * 3 : 512;
+        unsigned char* data = malloc(cap + 4);
+        size_t len = 0;
+        size_t target = next() % cap;
+        while (len < target)
+        {
+            uint64_t r = next() % 16;
+            if (r == 0)
+                data[len++] = '\n';
+            else if (r == 1)
+            {
+                data[len++] = '\r';
+                data[len++] = '\n';
+            }
+            else
+                len += codepoint(data + len);
+        }
+
+        // Some rounds break a byte anywhere, or near the end so sequences cut short are caught.
+        int breaks = next() % 4 == 0;
+        if (breaks && len > 0)
+            data[next() % 2 ? next() % len : len - 1 - next() % (len < 8 ? len : 8)] ^= 1 << (next() % 8);
+
+        size_t lines = 0, crlf = 0, nuls = 0, controls = 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            unsigned char c = data[i];
+            lines += c == '\n';
+            crlf += c == '\n' && i > 0 && data[i - 1] == '\r';
+            nuls += c == 0;
+            controls += (c < 0x20 && c != '\n' && c != '\r' && c != '\t' && c != 0) || c == 0x7f;
+        }
+
+        struct Classify kind;
+        classify_open(&kind, (const char*)data, len);
+        while (classify_step(&kind))
+            ;
+
+        int expected = valid(data, len);
+        invalid += !expected;
+        check(kind.complete && kind.pos == len, "incomplete after %zu of %zu", kind.pos, len);
+        check(kind.utf8 == expected, "round %d of %zu bytes utf8 %d, expected %d", round, len, kind.utf8, expected);
+        check(kind.lines == lines && kind.crlf == crlf, "%zu lines %zu crlf, expected %zu %zu", kind.lines, kind.crlf,
+              lines, crlf);
+        check(kind.nuls == nuls && kind.controls == controls, "%zu nuls %zu controls, expected %zu %zu", kind.nuls,
+              kind.controls, nuls, controls);
+        free(data);
+    }
+
+    printf("classify: %d rounds, %zu invalid\n", rounds, invalid);
+}
+
+/// @brief Sanitizing has to agree with a byte at a time, both with and without UTF-8.
+static void test_sanitize()
+{
+    char in[200];
+    char out[200];
+    for (int i = 0; i < 20000; i++)
+    {
+        size_t len = next() % sizeof(in);
+        int utf8 = next() % 2;
+        for (size_t k = 0; k < len; k++)
+            in[k] = next();
+        memcpy(out, in, len);
+        classify_sanitize(out, len, utf8);
+
+        for (size_t k = 0; k < len; k++)
+        {
+            unsigned char c = in[k];
+            char expected = c == '\t' ? ' ' : c < 0x20 || c == 0x7f || (c >= 0x80 && !utf8) ? CLASSIFY_PLACEHOLDER : c;
+            check(out[k] == expected, "byte %02x sanitized to %02x", c, (unsigned char)out[k]);
+        }
+    }
+}
+
+/// @brief Rows of hex against the same row printed with snprintf.
+static void test_hex()
+{
+    unsigned char bytes[HEX_ROW];
+    char row[200];
+    char expected[200];
+    for (int i = 0; i < 20000; i++)
+    {
+        int count = next() % (HEX_ROW + 1);
+        size_t offset = next() >> (next() % 64);
+        int margin = hex_margin(offset);
+        int cols = next() % sizeof(row);
+        for (int k = 0; k < count; k++)
+            bytes[k] = next();
+
+        int n = snprintf(expected, sizeof(expected), "%0*zx  ", margin, offset);
+        for (int k = 0; k < HEX_ROW; k++)
+            n += k < count ? snprintf(expected + n, sizeof(expected) - n, "%02x ", bytes[k])
+                           : snprintf(expected + n, sizeof(expected) - n, "   ");
+        expected[n++] = '|';
+        for (int k = 0; k < count; k++)
+            expected[n++] = bytes[k] >= 0x20 && bytes[k] < 0x7f ? bytes[k] : '.';
+        expected[n++] = '|';
+        while (n < cols)
+            expected[n++] = ' ';
+
+        hex_row(row, cols, offset, margin, bytes, count);
+        check(memcmp(row, expected, cols) == 0, "row of %d bytes at %zx: %.*s", count, offset, cols, row);
+    }
+
+    // Rows of a document past its end are blank, bar the empty row after a document filling its last one.
+    struct Text text;
+    char data[32];
+    memset(data, 'x', sizeof(data));
+    char screen[4 * 80];
+    check(text_init(&text, data, sizeof(data)) == 0, "init");
+    hex_render(&text, 0, screen, 4, 80);
+    check(screen[2 * 80] == '0' && screen[2 * 80 + 6] == '2' && screen[3 * 80] == ' ', "render past the end");
+    check(hex_column(8, 17) == 13, "column");
+    text_free(&text);
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = test_arg(argc, argv, 20000);
+
+    test_classify(rounds);
+    test_sanitize();
+    test_hex();
+
+    printf("ok\n");
+    return 0;
+}
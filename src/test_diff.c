@@ -0,0 +1,214 @@
+// Harness for the diff engine, every diff is replayed onto the old side and has to give back the new one.
+//
+// ./test.sh test_diff
+// ../bin/test_diff [rounds]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "diff.h"
+#include "text.h"
+#include "mzalloc.h"
+#include "test.h"
+
+/// @brief The vector scans have to agree with a byte at a time for every length and mismatch position.
+static void test_scan()
+{
+    char a[300];
+    char b[300];
+    for (int i = 0; i < 20000; i++)
+    {
+        size_t len = next() % sizeof(a);
+        for (size_t k = 0; k < len; k++)
+            a[k] = b[k] = 'a' + next() % 3;
+        if (len > 0 && next() % 4 != 0)
+            b[next() % len] ^= 1;
+
+        size_t prefix = 0;
+        while (prefix < len && a[prefix] == b[prefix])
+            prefix++;
+        size_t suffix = 0;
+        while (suffix < len && a[len - suffix - 1] == b[len - suffix - 1])
+            suffix++;
+
+        check(diff_prefix(a, b, len) == prefix, "prefix of %zu bytes", len);
+        check(diff_suffix(a, b, len) == suffix, "suffix of %zu bytes", len);
+    }
+}
+
+/// @brief Copies a document out flat.
+static char* flatten(const struct Text* text)
+{
+    char* flat = malloc(text->len + 1);
+    text_read(text, 0, flat, text->len);
+    return flat;
+}
+
+/// @brief Rebuilds the new side from the old side and the hunks, checking each hunk against both sides on the way.
+static void replay(struct Diff* diff, const struct Text* old, const struct Text* new)
+{
+    char* a = flatten(old);
+    char* b = flatten(new);
+    char* out = malloc(new->len + 1);
+    size_t from = 0;
+    size_t len = 0;
+    size_t line = 0;
+    size_t count = diff_count(diff);
+    for (size_t i = 0; i < count; i++)
+    {
+        const struct DiffHunk* hunk = diff_hunk(diff, i);
+        check(hunk->count[0] + hunk->count[1] > 0, "hunk %zu is empty", i);
+        check(hunk->pos[0] >= from, "hunk %zu out of order", i);
+
+        // Lines between hunks are in common, so both sides agree on how far apart the hunks are.
+        size_t same = hunk->pos[0] - from;
+        check(len + same == hunk->pos[1], "hunk %zu at %zu on the new side, expected %zu", i, hunk->pos[1], len + same);
+        for (size_t k = from; k < hunk->pos[0]; k++)
+            line += a[k] == '\n';
+        check(hunk->line[0] == line, "hunk %zu at line %zu, expected %zu", i, hunk->line[0], line);
+
+        size_t lines = 0;
+        for (size_t k = 0; k < hunk->len[0]; k++)
+            lines += a[hunk->pos[0] + k] == '\n';
+        check(lines + (hunk->pos[0] + hunk->len[0] == old->len && hunk->len[0] > 0 && a[old->len - 1] != '\n') == hunk->count[0],
+              "hunk %zu has %zu old lines", i, hunk->count[0]);
+
+        memcpy(out + len, a + from, same);
+        len += same;
+        memcpy(out + len, b + hunk->pos[1], hunk->len[1]);
+        len += hunk->len[1];
+        from = hunk->pos[0] + hunk->len[0];
+        line += lines;
+    }
+
+    check(len + old->len - from == new->len, "replayed %zu bytes, expected %zu", len + old->len - from, new->len);
+    memcpy(out + len, a + from, old->len - from);
+    check(memcmp(out, b, new->len) == 0, "replay differs");
+    free(a);
+    free(b);
+    free(out);
+}
+
+/// @brief Random line edits to random documents, some typed as several batches so lines straddle pieces.
+static void test_random(int rounds)
+{
+    size_t hunks = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        size_t len = next() % 4000;
+        char* original = malloc(len + 1);
+        for (size_t i = 0; i < len; i++)
+            original[i] = "ab\n"[next() % 3];
+
+        struct Text old;
+        struct Text new;
+        check(text_init(&old, original, len) == 0, "init");
+        check(text_init(&new, original, len) == 0, "init");
+
+        int batches = next() % 4;
+        for (int b = 0; b < batches; b++)
+        {
+            struct Edit edits[16];
+            int n = 1 + next() % 16;
+            size_t at = 0;
+            int count = 0;
+            for (int e = 0; e < n && at <= new.len; e++)
+            {
+                size_t pos = at + next() % ((new.len - at) / (n - e) + 1);
+                size_t del = new.len - pos > 0 ? next() % ((new.len - pos) < 8 ? (new.len - pos) + 1 : 8) : 0;
+                static const char* inserts[] = { "", "a", "\n", "ab\nb", "\n\n", "b\na\n" };
+                const char* data = inserts[next() % 6];
+                edits[count++] = (struct Edit){ pos, del, data, strlen(data) };
+                at = pos + del + 1;
+            }
+
+            check(text_apply(&new, edits, count) == 0, "apply");
+        }
+
+        // Either way round, and now and then the same document on both sides.
+        struct Diff diff;
+        const char* names[2] = { "old", "new" };
+        const struct Text* sides[2] = { &old, &new };
+        int flip = next() % 3;
+        if (flip == 2)
+            sides[0] = &new;
+        else if (flip == 1)
+        {
+            sides[0] = &new;
+            sides[1] = &old;
+        }
+
+        check(diff_start(&diff, sides[0], sides[1], names) == 0, "start");
+        diff_wait(&diff);
+        check(diff.complete, "complete");
+        replay(&diff, sides[0], sides[1]);
+        check(flip != 2 || diff_count(&diff) == 0, "%zu hunks between a document and itself", diff_count(&diff));
+        hunks += diff_count(&diff);
+
+        diff_free(&diff);
+        text_free(&old);
+        text_free(&new);
+        free(original);
+    }
+
+    printf("random: %d rounds, %zu hunks\n", rounds, hunks);
+}
+
+/// @brief A large document with a few scattered edits, most of it has to be skipped or hashed rather than diffed.
+static void test_large()
+{
+    size_t len = (size_t)200 << 20;
+    char* original = malloc(len);
+    for (size_t i = 0; i < len; i++)
+        original[i] = i % 48 == 47 ? '\n' : 'a' + (i / 48) % 26;
+
+    struct Text old;
+    struct Text new;
+    check(text_init(&old, original, len) == 0, "init");
+    check(text_init(&new, original, len) == 0, "init");
+    struct Edit edits[100];
+    for (int i = 0; i < 100; i++)
+        edits[i] = (struct Edit){ (size_t)i * (len / 100) + next() % 1000, next() % 200, "edited\nline\n", 12 };
+    check(text_apply(&new, edits, 100) == 0, "apply");
+
+    struct Diff diff;
+    const char* names[2] = { "old", "new" };
+    double start = now();
+    check(diff_start(&diff, &old, &new, names) == 0, "start");
+    diff_wait(&diff);
+    double elapsed = now() - start;
+    replay(&diff, &old, &new);
+    printf("large: %zuMB, %zu hunks in %.1fms\n", len >> 20, diff_count(&diff), elapsed * 1e3);
+
+    // An edit near each end leaves nothing to skip but should still be cheap since the lines hash and match quickly.
+    diff_free(&diff);
+    struct Edit ends[2] = { { 10, 0, "x", 1 }, { new.len - 10, 0, "y", 1 } };
+    check(text_apply(&new, ends, 2) == 0, "apply");
+    start = now();
+    check(diff_start(&diff, &old, &new, names) == 0, "start");
+    diff_wait(&diff);
+    elapsed = now() - start;
+    replay(&diff, &old, &new);
+    printf("ends: %zu hunks in %.1fms\n", diff_count(&diff), elapsed * 1e3);
+
+    diff_free(&diff);
+    text_free(&old);
+    text_free(&new);
+    free(original);
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = test_arg(argc, argv, 2000);
+
+    test_scan();
+    test_random(rounds);
+    test_large();
+
+    check(mzvalidate() == 0, "allocator state");
+    printf("ok\n");
+    return 0;
+}
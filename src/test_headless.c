@@ -0,0 +1,290 @@
+// Harness for headless replays, scripts have to parse into the keys they spell, the virtual screen has to keep what a
+// terminal would show, and a replay through the editor has to land on the screen worked out by hand.
+//
+// ./test.sh test_headless
+// ../bin/test_headless
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include "headless.h"
+#include "test.h"
+
+static char dir[] = "/tmp/test_headless.XXXXXX";
+
+/// @brief Writes a file into the scratch directory.
+static void put(const char* name, const char* data)
+{
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE* out = fopen(path, "w");
+    check(out != NULL, "create %s", path);
+    fputs(data, out);
+    fclose(out);
+}
+
+/// @brief Every key form, repeats and comments, and a script with an unknown key is refused as a whole.
+static void test_script()
+{
+    put("keys", "# a comment line\n"
+                "up\n"
+                "  ^x  \n"
+                "alt+w\n"
+                "\"a#b\"\n"
+                "x *3\n"
+                "pgdn *2 # repeated and commented\n"
+                "\n"
+                "Enter *0\n"
+                "#\n");
+
+    static const char* expected[] = { "\x1b[A", "\x18", "\x1bw", "a", "#", "b", "x", "x", "x", "\x1b[6~", "\x1b[6~" };
+    int count = sizeof(expected) / sizeof(expected[0]);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/keys", dir);
+    struct Script script;
+    check(script_load(&script, path) == 0, "load");
+    check(script.count == count, "%d keys, expected %d", script.count, count);
+
+    char seq[KEY_MAX];
+    for (int i = 0; i < count; i++)
+    {
+        int len = script_next(&script, seq);
+        check(len == (int)strlen(expected[i]) && memcmp(seq, expected[i], len) == 0, "key %d", i);
+    }
+    check(script_next(&script, seq) == 0, "keys past the end");
+    free(script.keys);
+
+    put("bad", "up\nbogus\ndown\n");
+    snprintf(path, sizeof(path), "%s/bad", dir);
+    check(script_load(&script, path) == -1 && script.count == 0 && script.keys == NULL, "unknown key loaded");
+    check(script_load(&script, "/nonexistent/keys") == -1, "missing script loaded");
+}
+
+/// @brief Feeds output a byte at a time or all at once, the screen has to come out the same either way.
+static void feed(struct Screen* screen, const char* data, int split)
+{
+    size_t len = strlen(data);
+    for (size_t i = 0; i < len; i += split ? 1 : len)
+        screen_feed(screen, data + i, split ? 1 : len);
+}
+
+static void row(struct Screen* screen, int r, const char* want)
+{
+    char got[256];
+    memcpy(got, screen->cells + r * screen->cols, screen->cols);
+    got[screen->cols] = '\0';
+    check(strncmp(got, want, strlen(want)) == 0, "row %d is \"%s\", expected \"%s\"", r, got, want);
+    for (int i = strlen(want); i < screen->cols; i++)
+        check(got[i] == ' ', "row %d is \"%s\", expected \"%s\"", r, got, want);
+}
+
+/// @brief Clears, positioning, wrapping at the right edge, and sequences which draw nothing.
+static void test_screen()
+{
+    for (int split = 0; split <= 1; split++)
+    {
+        struct Screen screen;
+        check(screen_init(&screen, 4, 8) == 0, "init");
+
+        feed(&screen, "\x1b[2J\x1b[Hfirst\r\n\x1b[1;7mbold\x1b[0m", split);
+        row(&screen, 0, "first");
+        row(&screen, 1, "bold");
+        check(screen.frames == 1, "%llu frames", (unsigned long long)screen.frames);
+
+        // The eighth character stays on the last cell until the ninth comes, which goes to the next row.
+        feed(&screen, "\x1b[3;1H12345678", split);
+        check(screen.row == 2 && screen.col == 7 && screen.wrap, "cursor %d,%d", screen.row, screen.col);
+        feed(&screen, "9", split);
+        row(&screen, 2, "12345678");
+        row(&screen, 3, "9");
+
+        // Clipboard exports and out of range positions draw nothing, and the cursor is kept on screen.
+        feed(&screen, "\x1b]52;c;aGVsbG8=\a\x1b[99;99H!", split);
+        check(screen.row == 3 && screen.col == 7, "cursor %d,%d", screen.row, screen.col);
+        row(&screen, 3, "9      !");
+        feed(&screen, "\x1b[2;3Hx\x1b[H\x1b[2J", split);
+        check(screen.frames == 2, "%llu frames", (unsigned long long)screen.frames);
+        for (int r = 0; r < 4; r++)
+            row(&screen, r, "");
+
+        free(screen.cells);
+    }
+}
+
+/// @brief Replays a script through the editor and compares the screen it prints with the one worked out by hand.
+/// @param args What follows --headless, run from the scratch directory.
+/// @param expected The rows of the screen.
+/// @param count Number of rows.
+/// @param keys Number of keys in the script.
+static void replay(const char* args, const char** expected, int count, int keys)
+{
+    char editor[PATH_MAX];
+    check(realpath("../bin/pipit", editor) != NULL, "../bin/pipit has to be built first, ./test.sh does");
+
+    char command[PATH_MAX * 2];
+    snprintf(command, sizeof(command), "cd %s && %s --headless %s", dir, editor, args);
+    FILE* in = popen(command, "r");
+    check(in != NULL, "run %s", command);
+
+    char line[256];
+    for (int i = 0; i < count; i++)
+    {
+        check(fgets(line, sizeof(line), in) != NULL, "screen cut short at row %d", i);
+        line[strcspn(line, "\n")] = '\0';
+        check(strcmp(line, expected[i]) == 0, "row %d is \"%s\", expected \"%s\"", i, line, expected[i]);
+    }
+
+    char report[32];
+    snprintf(report, sizeof(report), "keys %d/%d ", keys, keys);
+    check(fgets(line, sizeof(line), in) != NULL && strncmp(line, report, strlen(report)) == 0, "report \"%s\"", line);
+    while (fgets(line, sizeof(line), in) != NULL)
+        ;
+    check(pclose(in) == 0, "editor failed");
+}
+
+/// @brief Cuts, pastes and types through a replay, which never writes the file back.
+static void test_replay()
+{
+    // Cut the second line, paste it below the last, then type at the end and into the first line.
+    put("a.txt", "alpha\nbeta\ngamma\n");
+    put("edit.keys", "down\n^K\ndown\n^U\n\"!\"\nup *3\nright *2\n\"-\" *2\n");
+    static const char* expected[] = { "1 a.txt", "alp--ha", "gamma", "beta", "!", "" };
+    replay("edit.keys 6x20 a.txt", expected, 6, 12);
+
+    char path[PATH_MAX];
+    char data[32];
+    snprintf(path, sizeof(path), "%s/a.txt", dir);
+    FILE* file = fopen(path, "r");
+    check(fread(data, 1, sizeof(data), file) == 17 && memcmp(data, "alpha\nbeta\ngamma\n", 17) == 0, "file written");
+    fclose(file);
+}
+
+/// @brief Opens more tabs than are kept warm through the browser, so the first is trimmed, then goes back to it and
+/// edits a few pages down, which lands where its kept line index says.
+static void test_refocus()
+{
+    char name[32];
+    char data[4096];
+    for (int i = 0; i < 10; i++)
+    {
+        size_t len = 0;
+        for (int line = 1; line <= 100; line++)
+            len += snprintf(data + len, sizeof(data) - len, "tab %d line %d\n", i, line);
+        snprintf(name, sizeof(name), "f%d.txt", i);
+        put(name, data);
+    }
+
+    // ^O, the name and enter opens each of the others, Alt+. wraps around to the first.
+    size_t len = 0;
+    for (int i = 1; i < 10; i++)
+        len += snprintf(data + len, sizeof(data) - len, "^O\n\"f%d\"\nenter\n", i);
+    snprintf(data + len, sizeof(data) - len, "alt+.\npgdn *2\ndown *3\n\"X\"\n");
+    put("tabs.keys", data);
+
+    static const char* expected[] = { "1 f0.txt 2 f1.txt 3 f2.txt 4 f3.txt 5 f4.txt 6 f5.txt 7 f6.txt 8 f7.txt 9 f8.txt "
+                                      "10 f9.txt",
+        "tab 0 line 10", "tab 0 line 11", "tab 0 line 12", "tab 0 line 13", "tab 0 line 14", "tab 0 line 15",
+        "Xtab 0 line 16" };
+    replay("tabs.keys 8x100 f0.txt", expected, 8, 43);
+}
+
+/// @brief Feeds everything the editor writes until it goes quiet, each frame goes out in one burst but the first may
+/// take a while to come.
+static void drain(int master, struct Screen* screen)
+{
+    struct pollfd fd = { master, POLLIN, 0 };
+    char buf[4096];
+    for (int wait = 2000; poll(&fd, 1, wait) == 1; wait = 300)
+    {
+        ssize_t len = read(master, buf, sizeof(buf));
+        if (len <= 0)
+            break;
+        screen_feed(screen, buf, len);
+    }
+}
+
+/// @brief Runs the editor on a pseudo terminal and shrinks the window beneath it, the SIGWINCH this sends has to bring
+/// a frame drawn to the new size without a key being pressed.
+static void test_resize()
+{
+    char editor[PATH_MAX];
+    check(realpath("../bin/pipit", editor) != NULL, "../bin/pipit has to be built first, ./test.sh does");
+    put("b.txt", "first line is longer than twenty\nline 2\nline 3\nline 4\nline 5\nline 6\nline 7\nline 8\n");
+
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    check(master >= 0 && grantpt(master) == 0 && unlockpt(master) == 0, "pseudo terminal");
+    struct winsize size = { .ws_row = 10, .ws_col = 40 };
+    check(ioctl(master, TIOCSWINSZ, &size) == 0, "initial size");
+
+    pid_t pid = fork();
+    check(pid >= 0, "fork");
+    if (pid == 0)
+    {
+        // The pseudo terminal becomes the controlling terminal, so resizes are signalled to the editor.
+        int slave = open(ptsname(master), O_RDWR);
+        if (setsid() == -1 || slave < 0 || ioctl(slave, TIOCSCTTY, 0) == -1 || chdir(dir) == -1)
+            _exit(127);
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        close(master);
+        close(slave);
+        execl(editor, editor, "b.txt", (char*)NULL);
+        _exit(127);
+    }
+
+    struct Screen big;
+    check(screen_init(&big, 10, 40) == 0, "init");
+    drain(master, &big);
+    check(big.frames >= 1, "no frame drawn");
+    row(&big, 0, "1 b.txt");
+    row(&big, 1, "first line is longer than twenty");
+    row(&big, 8, "line 8");
+
+    // Only what's written after the resize is fed to the smaller screen, so it has to be a whole frame.
+    size = (struct winsize){ .ws_row = 5, .ws_col = 20 };
+    check(ioctl(master, TIOCSWINSZ, &size) == 0, "resize");
+    struct Screen small;
+    check(screen_init(&small, 5, 20) == 0, "init");
+    drain(master, &small);
+    check(small.frames >= 1, "no frame drawn after the resize");
+    row(&small, 0, "1 b.txt");
+    row(&small, 1, "first line is longer");
+    row(&small, 2, "line 2");
+    row(&small, 3, "line 3");
+
+    check(write(master, "\x18", 1) == 1, "quit");
+    int status;
+    check(waitpid(pid, &status, 0) == pid && WIFEXITED(status), "editor didn't quit");
+    close(master);
+    free(big.cells);
+    free(small.cells);
+}
+
+int main()
+{
+    check(mkdtemp(dir) != NULL, "scratch directory");
+
+    test_script();
+    test_screen();
+    test_replay();
+    test_refocus();
+    test_resize();
+
+    char command[PATH_MAX];
+    snprintf(command, sizeof(command), "rm -rf %s", dir);
+    check(system(command) == 0, "clean up");
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,253 @@
+// Harness for the recovery journal, sessions run in children which either close cleanly or leave their journal
+// behind the way a crash would, and every replay has to land on a state the document actually went through.
+//
+// ./test.sh test_journal
+// ../bin/test_journal [batches]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "journal.h"
+#include "lineindex.h"
+#include "text.h"
+#include "clipboard.h"
+#include "rapidhash.h"
+#include "mzalloc.h"
+#include "test.h"
+
+#define MAX_EDITS 16
+
+static char file[PATH_MAX];
+static const char original[] = "The quick brown fox\njumps over\nthe lazy dog.\n";
+
+/// @brief Hashes a whole document.
+static uint64_t digest(const struct Text* text)
+{
+    char* flat = malloc(text->len + 1);
+    text_read(text, 0, flat, text->len);
+    uint64_t hash = rapidhash(flat, text->len);
+    free(flat);
+    return hash;
+}
+
+/// @brief Maps the file and opens a document over it.
+static void load(struct Text* text, int* handle)
+{
+    *handle = open(file, O_RDONLY);
+    struct stat st;
+    check(*handle >= 0 && fstat(*handle, &st) == 0, "open %s", file);
+    const char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, *handle, 0);
+    check(text_init(text, data, st.st_size) == 0, "init");
+}
+
+/// @brief Applies random batches the way the editor does, typed text at several cursors and pastes of pieces, journaling
+/// each. hashes[i] is the document after i batches.
+static void session(int backend, long batches, uint64_t* hashes, int keep)
+{
+    check(journal_init(backend) == 0, "backend %d", backend);
+    struct Text text;
+    struct Journal journal;
+    struct Clipboard clipboard = { 0 };
+    int handle;
+    load(&text, &handle);
+    check(journal_open(&journal, file, handle, &text) == 0, "journal open");
+    check(journal.recovered == 0, "recovered %zu from a fresh journal", journal.recovered);
+
+    hashes[0] = digest(&text);
+    double spent = 0;
+    for (long b = 0; b < batches; b++)
+    {
+        struct Edit edits[MAX_EDITS];
+        int n = 1 + next() % MAX_EDITS;
+        size_t at = 0;
+        int count = 0;
+        int paste = next() % 4 == 0 && text.len > 0;
+        if (paste)
+        {
+            size_t pos = next() % text.len;
+            check(clipboard_copy(&clipboard, &text, pos, next() % 64 + 1, 0) == 0, "copy");
+        }
+
+        for (int e = 0; e < n && at <= text.len; e++)
+        {
+            size_t pos = at + next() % ((text.len - at) / (n - e) + 1);
+            size_t del = text.len - pos > 0 ? next() % ((text.len - pos) < 4 ? (text.len - pos) + 1 : 4) : 0;
+            static const char* typed[] = { "", "a", "\n", "word ", "\r\n" };
+            const char* data = typed[next() % 5];
+            edits[count++] = paste ? clipboard_edit(clipboard_get(&clipboard, 0), pos, del)
+                                   : (struct Edit){ pos, del, data, strlen(data) };
+            at = pos + del + 1;
+        }
+
+        check(text_apply(&text, edits, count) == 0, "apply");
+        double start = now();
+        journal_append(&journal, &text, edits, count);
+        spent += now() - start;
+        hashes[b + 1] = digest(&text);
+
+        // Written a few keys at a time, as the main loop would between frames.
+        if (next() % 4 == 0)
+            journal_submit();
+    }
+
+    printf("session %s: %ld batches, %.0fns per append\n", backend == JOURNAL_URING ? "uring" : "thread", batches,
+           spent / batches * 1e9);
+    fflush(stdout);
+    journal_close(&journal, keep);
+    clipboard_free(&clipboard);
+    text_free(&text);
+}
+
+/// @brief Runs a session in a child, hashes come back through a shared mapping.
+static void run(int backend, long batches, uint64_t* hashes, int keep)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        session(backend, batches, hashes, keep);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "session failed with status %x", status);
+}
+
+/// @brief Opens the journal again in a child, which has to recover the last state and then removes it.
+static void reopen(size_t expected, uint64_t hash)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        struct Text text;
+        struct Journal journal;
+        int handle;
+        load(&text, &handle);
+        check(journal_open(&journal, file, handle, &text) == 0, "journal open");
+        check(journal.recovered == expected, "recovered %zu edits, expected %zu", journal.recovered, expected);
+        check(digest(&text) == hash, "recovered the wrong document");
+        journal_close(&journal, 0);
+        _exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    check(WIFEXITED(status) && WEXITSTATUS(status) == 0, "reopen failed");
+}
+
+/// @brief Reads the records of the journal left behind.
+static char* records(size_t* len)
+{
+    char path[PATH_MAX];
+    uint64_t hash;
+    check(lineindex_cache(file, ".journal", path, &hash) == 0, "journal path");
+    int fd = open(path, O_RDONLY);
+    check(fd >= 0, "journal was removed");
+    struct stat st;
+    fstat(fd, &st);
+    *len = st.st_size - sizeof(struct JournalHeader);
+    char* data = malloc(*len + 1);
+    check(pread(fd, data, *len, sizeof(struct JournalHeader)) == (ssize_t)*len, "read journal");
+    close(fd);
+    return data;
+}
+
+/// @brief Replays a damaged journal, which has to stop on a state the document went through.
+static void replay(const char* data, size_t len, const uint64_t* hashes, long batches)
+{
+    struct Text text;
+    int handle;
+    size_t applied;
+    load(&text, &handle);
+    size_t replayed = journal_replay(&text, data, len, &applied);
+    check(replayed <= len, "replayed past the end");
+
+    uint64_t hash = digest(&text);
+    int found = 0;
+    for (long b = 0; b <= batches && !found; b++)
+        found = hashes[b] == hash;
+    check(found, "replay of %zu bytes ended on a state never seen", len);
+
+    text_free(&text);
+    close(handle);
+}
+
+static void test_backend(int backend, long batches)
+{
+    uint64_t* hashes = mmap(NULL, (batches + 1) * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+    // A crash after the last fsync leaves everything.
+    run(backend, batches, hashes, 1);
+    size_t len;
+    char* data = records(&len);
+    struct Text text;
+    int handle;
+    size_t applied;
+    load(&text, &handle);
+    check(journal_replay(&text, data, len, &applied) == len, "whole journal didn't replay");
+    check(digest(&text) == hashes[batches], "replay differs");
+    text_free(&text);
+    close(handle);
+
+    // Torn or damaged anywhere, a replay stops at the last whole batch before the damage.
+    for (int i = 0; i < 200; i++)
+    {
+        size_t cut = next() % (len + 1);
+        replay(data, cut, hashes, batches);
+
+        char* damaged = malloc(len + 1);
+        memcpy(damaged, data, len);
+        if (len > 0)
+            damaged[next() % len] ^= 1 << (next() % 8);
+        replay(damaged, len, hashes, batches);
+        free(damaged);
+    }
+
+    // The next session recovers all of it, and closing cleanly removes the journal.
+    reopen(applied, hashes[batches]);
+    char path[PATH_MAX];
+    uint64_t hash;
+    lineindex_cache(file, ".journal", path, &hash);
+    check(access(path, F_OK) != 0, "journal left after a clean close");
+
+    // A journal of a file which changed since is thrown away.
+    run(backend, batches, hashes, 1);
+    struct stat st;
+    stat(file, &st);
+    struct timespec times[2] = { { 0, UTIME_OMIT }, { st.st_mtim.tv_sec + 1, 0 } };
+    utimensat(AT_FDCWD, file, times, 0);
+    reopen(0, hashes[0]);
+
+    free(data);
+    munmap(hashes, (batches + 1) * sizeof(uint64_t));
+}
+
+int main(int argc, char** argv)
+{
+    long batches = test_arg(argc, argv, 2000);
+
+    char dir[] = "/tmp/pipit-journal-XXXXXX";
+    check(mkdtemp(dir) != NULL, "temporary directory");
+    setenv("PIPIT_CACHE", dir, 1);
+    snprintf(file, sizeof(file), "%s/document.txt", dir);
+    int fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    check(fd >= 0 && write(fd, original, sizeof(original) - 1) == sizeof(original) - 1, "write document");
+    close(fd);
+
+    test_backend(JOURNAL_URING, batches);
+    test_backend(JOURNAL_THREAD, batches);
+
+    unlink(file);
+    rmdir(dir);
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,219 @@
+// Correctness harness for the line index and its sidecar cache, checked against naive newline walks.
+//
+// ./test.sh test_lineindex
+// ../bin/test_lineindex
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "lineindex.h"
+#include "text.h"
+#include "mzalloc.h"
+#include "test.h"
+
+/// @brief Fills a buffer with lines of random length, some of them long enough to span checkpoints alone.
+static void fill(char* data, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        data[i] = next() % (next() % 64 == 0 ? 4096 : 24) == 0 ? '\n' : 'a' + i % 26;
+}
+
+static size_t naive_line(const char* data, size_t pos)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < pos; i++)
+        n += data[i] == '\n';
+    return n;
+}
+
+static size_t naive_offset(const char* data, size_t len, size_t line)
+{
+    for (size_t i = 0; i < len && line > 0; i++)
+    {
+        if (data[i] == '\n' && --line == 0)
+            return i + 1;
+    }
+
+    return line == 0 ? 0 : len;
+}
+
+static void same_index(struct LineIndex* a, struct LineIndex* b)
+{
+    check(a->lines == b->lines, "lines %zu vs %zu", a->lines, b->lines);
+    check(a->count == b->count, "checkpoints %zu vs %zu", a->count, b->count);
+    check(a->blocks == b->blocks, "blocks %zu vs %zu", a->blocks, b->blocks);
+    check(memcmp(a->checkpoints, b->checkpoints, a->count * sizeof(uint64_t)) == 0, "checkpoints differ");
+    check(memcmp(a->fingerprints, b->fingerprints, a->blocks * sizeof(uint64_t)) == 0, "fingerprints differ");
+}
+
+static void test_original()
+{
+    size_t len = 3 * LINE_BLOCK + 12345;
+    char* data = malloc(len);
+    fill(data, len);
+
+    struct LineIndex index;
+    check(lineindex_build(&index, data, len) == 0, "build");
+    check(index.lines == naive_line(data, len), "line count");
+
+    for (int i = 0; i < 2000; i++)
+    {
+        size_t pos = next() % (len + 1);
+        size_t line = naive_line(data, pos);
+        check(lineindex_line(&index, data, pos) == line, "line at %zu", pos);
+
+        line = next() % (index.lines + 2);
+        check(lineindex_offset(&index, data, len, line) == naive_offset(data, len, line), "offset of line %zu", line);
+    }
+
+    printf("original: %zu lines, %zu checkpoints, %zu blocks\n", index.lines, index.count, index.blocks);
+    lineindex_free(&index);
+    free(data);
+}
+
+/// @brief Line lookups over an edited document must agree with a flat copy of it.
+static void test_document()
+{
+    size_t len = LINE_BLOCK + 999;
+    char* data = malloc(len);
+    fill(data, len);
+
+    struct LineIndex index;
+    struct Text text;
+    check(lineindex_build(&index, data, len) == 0, "build");
+    check(text_init(&text, data, len) == 0, "init");
+
+    for (int b = 0; b < 200; b++)
+    {
+        struct Edit edits[8];
+        size_t at = 0;
+        int n = 0;
+        for (int e = 0; e < 8 && at < text.len; e++)
+        {
+            size_t pos = at + next() % ((text.len - at) / 8 + 1);
+            size_t del = next() % 3 == 0 ? next() % 64 : 0;
+            del = pos + del <= text.len ? del : text.len - pos;
+            edits[n++] = (struct Edit){ pos, del, "x\ny\n", next() % 5 };
+            at = pos + del + 1;
+        }
+
+        check(text_apply(&text, edits, n) == 0, "apply");
+    }
+
+    char* flat = malloc(text.len);
+    check(text_read(&text, 0, flat, text.len) == text.len, "read");
+    size_t lines = naive_line(flat, text.len);
+    for (int i = 0; i < 500; i++)
+    {
+        size_t line = next() % (lines + 2);
+        check(lineindex_seek(&index, &text, line) == naive_offset(flat, text.len, line), "seek to line %zu", line);
+
+        size_t pos = next() % (text.len + 1);
+        check(lineindex_number(&index, &text, pos) == naive_line(flat, pos), "number at %zu", pos);
+    }
+
+    printf("document: %d pieces, %zu lines\n", text.count, lines);
+    text_free(&text);
+    lineindex_free(&index);
+    free(flat);
+    free(data);
+}
+
+/// @brief Maps a file, the caller unmaps it.
+static char* map_file(const char* path, int* fd, size_t* len)
+{
+    *fd = open(path, O_RDONLY);
+    check(*fd >= 0, "open %s", path);
+    *len = lseek(*fd, 0, SEEK_END);
+    char* data = mmap(NULL, *len, PROT_READ, MAP_SHARED, *fd, 0);
+    check(data != MAP_FAILED, "map %s", path);
+    return data;
+}
+
+static void test_cache()
+{
+    char dir[] = "/tmp/pipit_lineindexXXXXXX";
+    check(mkdtemp(dir) != NULL, "mkdtemp");
+    setenv("PIPIT_CACHE", dir, 1);
+
+    char path[256];
+    snprintf(path, sizeof(path), "%s/file.txt", dir);
+
+    size_t len = 2 * LINE_BLOCK + 777;
+    char* data = malloc(len + LINE_BLOCK);
+    fill(data, len + LINE_BLOCK);
+    FILE* out = fopen(path, "w");
+    fwrite(data, 1, len, out);
+    fclose(out);
+
+    // First open builds and writes the cache, the second maps it.
+    int fd;
+    size_t mlen;
+    char* map = map_file(path, &fd, &mlen);
+    struct LineIndex built, cached, fresh;
+    check(lineindex_open(&built, path, fd, map, mlen) == 0, "open");
+    check(built.map == NULL, "first open should build");
+    check(lineindex_open(&cached, path, fd, map, mlen) == 0, "reopen");
+    check(cached.map != NULL, "second open should map the cache");
+    same_index(&built, &cached);
+    lineindex_free(&built);
+    lineindex_free(&cached);
+    munmap(map, mlen);
+    close(fd);
+
+    // Appending keeps the cached prefix and must come out the same as building from scratch.
+    out = fopen(path, "a");
+    fwrite(data + len, 1, LINE_BLOCK, out);
+    fclose(out);
+
+    map = map_file(path, &fd, &mlen);
+    check(lineindex_open(&cached, path, fd, map, mlen) == 0, "open after append");
+    check(cached.map == NULL, "changed file can't map the cache");
+    check(lineindex_build(&fresh, map, mlen) == 0, "build");
+    same_index(&cached, &fresh);
+    lineindex_free(&cached);
+
+    check(lineindex_open(&cached, path, fd, map, mlen) == 0, "reopen after append");
+    check(cached.map != NULL, "resumed index should have been cached");
+    same_index(&cached, &fresh);
+    lineindex_free(&cached);
+    lineindex_free(&fresh);
+    munmap(map, mlen);
+    close(fd);
+
+    // A change in the middle of the file must throw away every checkpoint after its block.
+    fd = open(path, O_WRONLY);
+    check(pwrite(fd, "\n\n\n\n", 4, LINE_BLOCK + 100) == 4, "pwrite");
+    close(fd);
+
+    map = map_file(path, &fd, &mlen);
+    check(lineindex_open(&cached, path, fd, map, mlen) == 0, "open after change");
+    check(lineindex_build(&fresh, map, mlen) == 0, "build");
+    same_index(&cached, &fresh);
+    lineindex_free(&cached);
+    lineindex_free(&fresh);
+    munmap(map, mlen);
+    close(fd);
+
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    system(cmd);
+    free(data);
+    printf("cache: ok\n");
+}
+
+int main()
+{
+    test_original();
+    test_document();
+    test_cache();
+
+    check(mzvalidate() == 0, "allocator state");
+    printf("ok\n");
+    return 0;
+}
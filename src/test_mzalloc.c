@@ -0,0 +1,456 @@
+// Stress, correctness and throughput harness for Myzomela, mirroring test_arbitrage.py against the real allocator.
+//
+// ./test.sh test_mzalloc
+// ../bin/test_mzalloc [ops]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "mzalloc.h"
+
+// Failed checks print the heap they failed on.
+#define TEST_DUMP() mzdump(stdout)
+#include "test.h"
+
+#define SLOTS 4096
+
+/// @brief Live allocation tracked by the reference model.
+struct Ref
+{
+    unsigned char* ptr;
+    size_t size;
+    // NUM_CLASSES for huge blocks.
+    int class;
+    // Shards the allocator should be holding for this allocation.
+    int shards;
+};
+
+static struct Ref refs[SLOTS];
+
+static int size_class(size_t size)
+{
+    if (size > HUGE_SIZE)
+        return NUM_CLASSES;
+
+    int class = 0;
+    while (SHARD_SIZE(class) * CLASS_RUN < size)
+        class++;
+    return class;
+}
+
+static int shards(int class, size_t size)
+{
+    if (class == NUM_CLASSES)
+        return 0;
+
+    return (size + SHARD_SIZE(class) - 1) / SHARD_SIZE(class);
+}
+
+/// @brief Mixed workload sizes, mostly line sized with the occasional buffer and huge block.
+static size_t workload_size()
+{
+    uint64_t r = next();
+    switch (r % 100)
+    {
+        case 0:
+            return 65536 + (r >> 8) % (1024 * 1024);
+        case 1 ... 9:
+            return 1 + (r >> 8) % 65536;
+        default:
+            return 1 + (r >> 8) % 512;
+    }
+}
+
+static void fill(struct Ref* ref, int slot)
+{
+    // Touching the ends catches overlap without paying for the whole block.
+    size_t len = ref->size < 64 ? ref->size : 64;
+    memset(ref->ptr, slot, len);
+    memset(ref->ptr + ref->size - len, slot, len);
+}
+
+static void verify(struct Ref* ref, int slot, size_t size)
+{
+    // A block that shrank only keeps its head, the tail that was filled is gone.
+    size_t len = ref->size < 64 ? ref->size : 64;
+    for (size_t i = 0; i < len && i < size; i++)
+        check(ref->ptr[i] == (unsigned char)slot, "slot %d head corrupted at %zu", slot, i);
+
+    for (size_t i = ref->size - len; size >= ref->size && i < ref->size; i++)
+        check(ref->ptr[i] == (unsigned char)slot, "slot %d tail corrupted at %zu", slot, i);
+}
+
+static int ref_compare(const void* a, const void* b)
+{
+    const struct Ref* x = a;
+    const struct Ref* y = b;
+    return (x->ptr > y->ptr) - (x->ptr < y->ptr);
+}
+
+/// @brief Cross-checks the allocator against the reference model.
+static void cross_check()
+{
+    check(mzvalidate() == 0, "mzvalidate reported violations");
+
+    size_t live[NUM_CLASSES + 1] = {0};
+    size_t used[NUM_CLASSES] = {0};
+    struct Ref sorted[SLOTS];
+    int num = 0;
+
+    for (int i = 0; i < SLOTS; i++)
+    {
+        if (refs[i].ptr == NULL)
+            continue;
+
+        live[refs[i].class]++;
+        if (refs[i].class != NUM_CLASSES)
+            used[refs[i].class] += refs[i].shards;
+        sorted[num++] = refs[i];
+    }
+
+    struct MzStats stats;
+    mzstats(&stats);
+    for (int i = 0; i <= NUM_CLASSES; i++)
+    {
+        check(stats.allocs[i] - stats.frees[i] == live[i], "class %d has %zu live, expected %zu", i, stats.allocs[i] - stats.frees[i], live[i]);
+        if (i != NUM_CLASSES)
+            check(stats.shards[i] == used[i], "class %d has %zu shards used, expected %zu", i, stats.shards[i], used[i]);
+    }
+
+    qsort(sorted, num, sizeof(struct Ref), ref_compare);
+    for (int i = 1; i < num; i++)
+        check(sorted[i - 1].ptr + sorted[i - 1].size <= sorted[i].ptr, "%p overlaps %p", sorted[i - 1].ptr, sorted[i].ptr);
+}
+
+static void ref_alloc(int slot, size_t size)
+{
+    struct Ref* ref = refs + slot;
+    ref->ptr = mzalloc(size);
+    check(ref->ptr != NULL, "mzalloc(%zu) failed", size);
+
+    ref->size = size;
+    ref->class = size_class(size);
+    ref->shards = shards(ref->class, size);
+    fill(ref, slot);
+}
+
+static void ref_realloc(int slot, size_t size)
+{
+    struct Ref* ref = refs + slot;
+    unsigned char* ptr = mzrealloc(ref->ptr, size);
+    check(ptr != NULL, "mzrealloc(%zu) failed", size);
+
+    // The old block is still held while a new one is allocated, so a moved block never lands on the same
+    // address, the same pointer means it was resized in place and kept its class.
+    if (ptr != ref->ptr)
+        ref->class = size_class(size);
+
+    ref->ptr = ptr;
+    ref->shards = shards(ref->class, size);
+    verify(ref, slot, size);
+    ref->size = size;
+    fill(ref, slot);
+}
+
+static void ref_free(int slot)
+{
+    struct Ref* ref = refs + slot;
+    verify(ref, slot, ref->size);
+    mzfree(ref->ptr);
+    ref->ptr = NULL;
+}
+
+void test_basic_alloc_free()
+{
+    printf("=== test_basic_alloc_free ===\n");
+
+    // 16 byte shards, so 3, 2, 1 and 3 shards back to back in a fresh cluster.
+    char* s1 = mzalloc(48);
+    char* s2 = mzalloc(32);
+    char* s3 = mzalloc(16);
+    char* s4 = mzalloc(48);
+
+    check(s2 == s1 + 48, "expected %p, got %p", s1 + 48, s2);
+    check(s3 == s1 + 80, "expected %p, got %p", s1 + 80, s3);
+    check(s4 == s1 + 96, "expected %p, got %p", s1 + 96, s4);
+
+    // Freeing the 2 shard allocation must free exactly 2 shards, or the gap won't fit 2 again.
+    mzfree(s2);
+    char* s5 = mzalloc(32);
+    check(s5 == s2, "expected reallocation at %p, got %p", s2, s5);
+    check(mzvalidate() == 0, "mzvalidate reported violations");
+
+    mzfree(s1);
+    mzfree(s3);
+    mzfree(s4);
+    mzfree(s5);
+
+    struct MzStats stats;
+    mzstats(&stats);
+    check(stats.shards[0] == 0, "leaked %zu shards", stats.shards[0]);
+    printf("PASS\n\n");
+}
+
+void test_color_conflict()
+{
+    printf("=== test_color_conflict ===\n");
+
+    char* a = mzalloc(32);
+    char* b = mzalloc(32);
+    char* c = mzalloc(32);
+
+    // Both neighbours of the gap share a value, so the gap can be refilled with the other one.
+    mzfree(b);
+    char* d = mzalloc(32);
+    check(d == b, "expected reallocation at %p, got %p", b, d);
+
+    mzfree(a);
+    mzfree(c);
+    char* e = mzalloc(32);
+    check(e == a, "expected %p, got %p", a, e);
+    char* f = mzalloc(32);
+    check(f == c, "expected %p, got %p", c, f);
+    check(mzvalidate() == 0, "mzvalidate reported violations");
+
+    mzfree(d);
+    mzfree(e);
+    mzfree(f);
+    printf("PASS\n\n");
+}
+
+void test_color_conflict_impossible()
+{
+    printf("=== test_color_conflict_impossible ===\n");
+
+    // Alternating values 0, 1, 0, 1, freeing the middle two leaves a gap of 4 between a 0 and a 1.
+    char* a = mzalloc(32);
+    char* b = mzalloc(32);
+    char* c = mzalloc(32);
+    char* d = mzalloc(32);
+    mzfree(b);
+    mzfree(c);
+
+    // Filling the gap exactly would merge with one of its neighbours, so it must land elsewhere.
+    char* e = mzalloc(64);
+    check(e != b, "allocation filled a conflicting gap");
+    check(mzvalidate() == 0, "mzvalidate reported violations");
+
+    // Partially filling it is fine.
+    char* f = mzalloc(32);
+    check(f == b, "expected %p, got %p", b, f);
+    char* g = mzalloc(32);
+    check(g == c, "expected %p, got %p", c, g);
+    check(mzvalidate() == 0, "mzvalidate reported violations");
+
+    mzfree(a);
+    mzfree(d);
+    mzfree(e);
+    mzfree(f);
+    mzfree(g);
+    printf("PASS\n\n");
+}
+
+void test_realloc_in_place()
+{
+    printf("=== test_realloc_in_place ===\n");
+
+    // Line buffer sized, 10 4KB shards, which should be able to grow over the free shards after it.
+    char* buf = mzalloc(40 * 1024);
+    memset(buf, 'x', 40 * 1024);
+
+    for (size_t size = 48 * 1024; size <= 512 * 1024; size += 8 * 1024)
+    {
+        char* ptr = mzrealloc(buf, size);
+        check(ptr == buf, "growing to %zu moved the block", size);
+        check(ptr[40 * 1024 - 1] == 'x', "contents lost growing to %zu", size);
+    }
+
+    // Shrinking never moves, and the given back shards are reusable.
+    check(mzrealloc(buf, 4096) == buf, "shrinking moved the block");
+    char* next = mzalloc(40 * 1024);
+    check(next == buf + 4096, "expected %p, got %p", buf + 4096, next);
+    check(mzvalidate() == 0, "mzvalidate reported violations");
+
+    mzfree(next);
+    mzfree(buf);
+    printf("PASS\n\n");
+}
+
+void test_random_stress(long ops)
+{
+    printf("=== test_random_stress ===\n");
+    seed = 42;
+
+    long failures = 0;
+    for (long i = 0; i < ops; i++)
+    {
+        int slot = next() % SLOTS;
+        uint64_t op = next() % 8;
+
+        if (refs[slot].ptr == NULL)
+            ref_alloc(slot, workload_size());
+        else if (op < 2)
+            ref_realloc(slot, workload_size());
+        else
+            ref_free(slot);
+
+        if (i % (ops / 16 + 1) == 0)
+            cross_check();
+    }
+
+    cross_check();
+    for (int i = 0; i < SLOTS; i++)
+    {
+        if (refs[i].ptr != NULL)
+            ref_free(i);
+    }
+    cross_check();
+
+    struct MzStats stats;
+    mzstats(&stats);
+    for (int i = 0; i < NUM_CLASSES; i++)
+        failures += stats.shards[i];
+
+    check(failures == 0, "leaked %ld shards after stress test", failures);
+    printf("Stress test: %ld ops\n", ops);
+    printf("PASS\n\n");
+}
+
+void test_simd_run_length()
+{
+    printf("=== test_simd_run_length ===\n");
+
+    // Every run length a fresh allocation can have, back to back so every neighbour is allocated,
+    // freeing one must give back exactly its run and nothing of its neighbours.
+    char* ptrs[CLASS_RUN];
+    for (int i = 0; i < CLASS_RUN; i++)
+        ptrs[i] = mzalloc((i + 1) * MIN_SHARD_SIZE);
+
+    struct MzStats stats;
+    mzstats(&stats);
+    size_t used = stats.shards[0];
+
+    for (int i = CLASS_RUN - 1; i >= 0; i -= 2)
+    {
+        mzfree(ptrs[i]);
+        mzstats(&stats);
+        check(used - stats.shards[0] == (size_t)i + 1, "freeing %d shards freed %zu", i + 1, used - stats.shards[0]);
+        used = stats.shards[0];
+    }
+
+    for (int i = 0; i < CLASS_RUN; i += 2)
+        mzfree(ptrs[i]);
+
+    check(mzvalidate() == 0, "mzvalidate reported violations");
+    printf("PASS\n\n");
+}
+
+void test_decommit()
+{
+    printf("=== test_decommit ===\n");
+
+    // Enough 4KB shard runs to spill over several slabs, touched so they're actually resident.
+    char* ptrs[64];
+    for (int i = 0; i < 64; i++)
+    {
+        ptrs[i] = mzalloc(64 * 1024);
+        memset(ptrs[i], 1, 64 * 1024);
+    }
+
+    struct MzStats before;
+    mzstats(&before);
+    for (int i = 0; i < 64; i++)
+        mzfree(ptrs[i]);
+
+    // Only one empty slab is retained by default, the others must have been given back.
+    struct MzStats after;
+    mzstats(&after);
+    check(after.decommits > before.decommits, "no slabs were decommitted");
+    check(after.resident + 2 * 1024 * 1024 < before.resident, "resident went from %zu to %zu", before.resident, after.resident);
+
+    mztrim();
+    check(mzvalidate() == 0, "mzvalidate reported violations");
+
+    // Decommitted slabs are reused and faulted back in.
+    char* ptr = mzalloc(64 * 1024);
+    memset(ptr, 1, 64 * 1024);
+    mzfree(ptr);
+    check(mzvalidate() == 0, "mzvalidate reported violations");
+    printf("PASS\n\n");
+}
+
+/// @brief Runs the stress workload without any checking against either allocator in a child,
+/// so peak RSS belongs to that allocator alone.
+void bench(const char* name, long ops, void* (*alloc)(size_t), void* (*resize)(void*, size_t), void (*release)(void*))
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        return;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        void* ptrs[SLOTS] = {0};
+        seed = 1337;
+
+        double start = now();
+        for (long i = 0; i < ops; i++)
+        {
+            int slot = next() % SLOTS;
+            uint64_t op = next() % 8;
+
+            if (ptrs[slot] == NULL)
+            {
+                size_t size = workload_size();
+                ptrs[slot] = alloc(size);
+                // Touch the block so untouched pages don't flatter the RSS.
+                memset(ptrs[slot], 0, size < 64 ? size : 64);
+            }
+            else if (op < 2)
+                ptrs[slot] = resize(ptrs[slot], workload_size());
+            else
+            {
+                release(ptrs[slot]);
+                ptrs[slot] = NULL;
+            }
+        }
+
+        double elapsed = now() - start;
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        double res[2] = { ops / elapsed, usage.ru_maxrss / 1024.0 };
+        write(fds[1], res, sizeof(res));
+        _exit(0);
+    }
+
+    double res[2] = {0, 0};
+    close(fds[1]);
+    read(fds[0], res, sizeof(res));
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+    printf("%-8s %12.0f ops/sec %10.1f MB peak rss\n", name, res[0], res[1]);
+}
+
+int main(int argc, char** argv)
+{
+    long ops = test_arg(argc, argv, 2000000);
+
+    test_basic_alloc_free();
+    test_color_conflict();
+    test_color_conflict_impossible();
+    test_realloc_in_place();
+    test_random_stress(ops);
+    test_simd_run_length();
+    test_decommit();
+    printf("All tests passed.\n\n");
+
+    printf("=== throughput (%ld ops) ===\n", ops);
+    bench("mzalloc", ops, mzalloc, mzrealloc, mzfree);
+    bench("malloc", ops, malloc, realloc, free);
+    return 0;
+}
@@ -0,0 +1,312 @@
+// Harness for the plugin rings and protocol, the harness starts itself as the plugin.
+//
+// ./test.sh test_plugin
+// ../bin/test_plugin
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "plugin.h"
+#include "text.h"
+#include "mzalloc.h"
+#include "rapidhash.h"
+#include "test.h"
+
+/// @brief Records of random sizes pushed and popped out of step must come out whole and in order, wrapping many times.
+static void test_ring()
+{
+    struct PluginRing* ring = mmap(NULL, sizeof(struct PluginRing), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    check(ring != MAP_FAILED, "map");
+    static char bytes[65536];
+    for (size_t i = 0; i < sizeof(bytes); i++)
+        bytes[i] = next();
+
+    uint64_t pushed = 0;
+    uint64_t popped = 0;
+    uint64_t pushSeed = 7;
+    uint64_t popSeed = 7;
+    int full = 0;
+    while (popped < 200000)
+    {
+        int burst = next() % 64;
+        for (int i = 0; i < burst; i++)
+        {
+            uint64_t saved = seed;
+            seed = pushSeed;
+            uint32_t len = next() % 60000;
+            uint32_t off = next() % (sizeof(bytes) - len);
+            if (plugin_push(ring, 1 + pushed % 7, &pushed, sizeof(pushed), bytes + off, len) != 0)
+            {
+                seed = saved;
+                full++;
+                break;
+            }
+
+            pushSeed = seed;
+            seed = saved;
+            pushed++;
+        }
+
+        burst = next() % 64;
+        uint32_t type;
+        uint32_t len;
+        const void* record;
+        for (int i = 0; i < burst && plugin_peek(ring, &type, &record, &len) > 0; i++)
+        {
+            const char* data = record;
+            uint64_t saved = seed;
+            seed = popSeed;
+            uint32_t want = next() % 60000;
+            uint32_t off = next() % (sizeof(bytes) - want);
+            popSeed = seed;
+            seed = saved;
+
+            check(type == 1 + popped % 7, "type of record %llu", (unsigned long long)popped);
+            check(len == sizeof(uint64_t) + want, "length of record %llu", (unsigned long long)popped);
+            check(memcmp(data, &popped, sizeof(popped)) == 0, "order of record %llu", (unsigned long long)popped);
+            check(memcmp(data + sizeof(uint64_t), bytes + off, want) == 0, "bytes of record %llu", (unsigned long long)popped);
+            plugin_pop(ring, len);
+            popped++;
+        }
+    }
+
+    check(full > 0, "ring never filled up");
+    printf("ring: %llu records, full %d times\n", (unsigned long long)popped, full);
+    munmap(ring, sizeof(struct PluginRing));
+}
+
+/// @brief Rings written over by the other side are caught before anything is read out of bounds, padding included.
+static void test_corrupt()
+{
+    struct PluginRing* ring = mmap(NULL, sizeof(struct PluginRing), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    check(ring != MAP_FAILED, "map");
+    uint32_t type;
+    uint32_t len;
+    const void* data;
+    uint64_t payload = 42;
+
+    // A record whose length runs past the end of the ring and past head.
+    check(plugin_push(ring, 1, &payload, sizeof(payload), NULL, 0) == 0, "push");
+    ((struct PluginRecord*)ring->data)->len = 0x40000000;
+    check(plugin_peek(ring, &type, &data, &len) == -1, "length past the ring");
+    ((struct PluginRecord*)ring->data)->len = 64;
+    check(plugin_peek(ring, &type, &data, &len) == -1, "length past head");
+
+    // Padding which would go round forever.
+    *(struct PluginRecord*)ring->data = (struct PluginRecord){ PLUGIN_PAD, 0x40000000 };
+    check(plugin_peek(ring, &type, &data, &len) == -1, "padding past the ring");
+
+    // Indices further apart than the ring, and a tail which isn't aligned.
+    ring->head = ring->tail + PLUGIN_RING_SIZE + 8;
+    check(plugin_peek(ring, &type, &data, &len) == -1, "head past the ring");
+    ring->head = 16;
+    ring->tail = 3;
+    check(plugin_peek(ring, &type, &data, &len) == -1, "unaligned tail");
+
+    // A record which fits is still read.
+    ring->head = 0;
+    ring->tail = 0;
+    check(plugin_push(ring, 1, &payload, sizeof(payload), NULL, 0) == 0, "push");
+    check(plugin_peek(ring, &type, &data, &len) == 1 && type == 1 && len == sizeof(payload), "peek");
+    plugin_pop(ring, len);
+    check(plugin_peek(ring, &type, &data, &len) == 0, "empty");
+
+    munmap(ring, sizeof(struct PluginRing));
+}
+
+/// @brief The plugin half, it answers every complete piece list with a hash of the document read straight from the
+/// shared mappings, and every key with an insertion and a decoration.
+static int plugin_main()
+{
+    struct PluginClient client;
+    if (plugin_connect(&client) != 0)
+        return 1;
+
+    uint32_t type;
+    uint32_t len;
+    const void* data;
+    while (plugin_next(&client, 1, &type, &data, &len) == 1)
+    {
+        if (type == PLUGIN_PIECES)
+        {
+            const struct PluginPieces* pieces = data;
+            struct PluginView* view = client.views + pieces->tab;
+            if (pieces->first + pieces->count != pieces->total || view->version != pieces->version)
+                continue;
+
+            char* flat = mzalloc(view->len + 1);
+            size_t at = 0;
+            for (uint32_t i = 0; i < view->count; i++)
+            {
+                memcpy(flat + at, plugin_bytes(view, view->pieces + i), view->pieces[i].len);
+                at += view->pieces[i].len;
+            }
+
+            char status[64];
+            int n = snprintf(status, sizeof(status), "%llu %llx", (unsigned long long)view->version,
+                             (unsigned long long)rapidhash(flat, at));
+            mzfree(flat);
+            while (plugin_send(&client, PLUGIN_STATUS, status, n, NULL, 0) != 0)
+                usleep(100);
+        }
+        else if (type == PLUGIN_KEY)
+        {
+            const struct PluginKey* key = data;
+            struct PluginView* view = client.views + key->tab;
+            struct PluginReplace replace = { key->tab, 0, view->version, 0, 0 };
+            struct PluginDecorate decorate = { key->tab, 1, view->version, 0, 1 };
+            while (plugin_send(&client, PLUGIN_REPLACE, &replace, sizeof(replace), key->key, 1) != 0)
+                usleep(100);
+            while (plugin_send(&client, PLUGIN_DECORATE, &decorate, sizeof(decorate), NULL, 0) != 0)
+                usleep(100);
+        }
+        else if (type == PLUGIN_CLOSE)
+            return 0;
+    }
+
+    return 0;
+}
+
+struct Host
+{
+    struct Text* text;
+    uint64_t statusVersion;
+    uint64_t statusHash;
+    int replaced;
+};
+
+static void on_command(void* ctx, struct Plugin* plugin, uint32_t type, const void* data, uint32_t len)
+{
+    struct Host* host = ctx;
+    if (type == PLUGIN_STATUS)
+    {
+        char status[64] = {0};
+        memcpy(status, data, len < sizeof(status) - 1 ? len : sizeof(status) - 1);
+        unsigned long long version, hash;
+        check(sscanf(status, "%llu %llx", &version, &hash) == 2, "status %s", status);
+        host->statusVersion = version;
+        host->statusHash = hash;
+    }
+    else if (type == PLUGIN_REPLACE)
+    {
+        const struct PluginReplace* replace = data;
+        check(replace->version == host->text->version, "replace of version %llu", (unsigned long long)replace->version);
+        struct Edit edit = { replace->pos, replace->del, (const char*)(replace + 1), len - sizeof(*replace) };
+        check(text_apply(host->text, &edit, 1) == 0, "apply replace");
+        host->replaced++;
+    }
+}
+
+/// @brief Hashes a document the slow way.
+static uint64_t hash_text(struct Text* text)
+{
+    char* flat = mzalloc(text->len + 1);
+    text_read(text, 0, flat, text->len);
+    uint64_t hash = rapidhash(flat, text->len);
+    mzfree(flat);
+    return hash;
+}
+
+/// @brief Syncs and polls until the plugin reports the hash of the current version, never blocking on it.
+static void wait_for(struct Plugin* plugin, struct Host* host, int handle)
+{
+    for (int spins = 0; host->statusVersion != host->text->version; spins++)
+    {
+        check(spins < 20000, "plugin never caught up with version %llu", (unsigned long long)host->text->version);
+        plugin_sync(plugin, 0, host->text, handle);
+        plugin_flush(plugin);
+        struct pollfd fd = { plugin->socket, POLLIN, 0 };
+        poll(&fd, 1, 1);
+        plugin_poll(plugin, on_command, host);
+        check(!plugin->dead, "plugin died");
+    }
+
+    check(host->statusHash == hash_text(host->text), "plugin read version %llu differently", (unsigned long long)host->text->version);
+}
+
+static void test_plugin()
+{
+    char path[] = "/tmp/pipit_pluginXXXXXX";
+    int handle = mkstemp(path);
+    check(handle >= 0, "mkstemp");
+    size_t len = 1 << 20;
+    char* bytes = malloc(len);
+    for (size_t i = 0; i < len; i++)
+        bytes[i] = 'a' + next() % 26;
+    check(write(handle, bytes, len) == (ssize_t)len, "write");
+    const char* original = mmap(NULL, len, PROT_READ, MAP_SHARED, handle, 0);
+    check(original != MAP_FAILED, "map");
+
+    struct Text text;
+    check(text_init(&text, original, len) == 0, "init");
+    struct Host host = { &text, -1, 0, 0 };
+    struct Plugin plugin;
+    char* argv[] = { "/proc/self/exe", "--plugin", NULL };
+    check(plugin_start(&plugin, argv) == 0, "start");
+
+    wait_for(&plugin, &host, handle);
+
+    // Enough edits that the piece list has to be sent in several records.
+    struct Edit* edits = malloc(5000 * sizeof(struct Edit));
+    for (int i = 0; i < 5000; i++)
+        edits[i] = (struct Edit){ (size_t)i * 200, next() % 3, "xyz", 1 + next() % 3 };
+    check(text_apply(&text, edits, 5000) == 0, "apply");
+    check(text.count > PLUGIN_PIECES_MAX, "only %d pieces", text.count);
+    wait_for(&plugin, &host, handle);
+
+    // Edits already typed into the shared add buffer are read by the plugin without being resent.
+    for (int i = 0; i < 50; i++)
+    {
+        struct Edit edit = { next() % text.len, 0, "typed", 5 };
+        check(text_apply(&text, &edit, 1) == 0, "type");
+        wait_for(&plugin, &host, handle);
+    }
+
+    // A key comes back as an insertion against the version the plugin saw, plus a decoration.
+    struct PluginKey key = { 0, "!" };
+    check(plugin_event(&plugin, PLUGIN_KEY, &key, sizeof(key)) == 0, "key");
+    for (int spins = 0; host.replaced == 0 || plugin.numDecorations == 0; spins++)
+    {
+        check(spins < 20000, "no reply to key");
+        plugin_flush(&plugin);
+        struct pollfd fd = { plugin.socket, POLLIN, 0 };
+        poll(&fd, 1, 1);
+        plugin_poll(&plugin, on_command, &host);
+    }
+
+    check(text_at(&text, 0) == '!', "replace applied");
+    wait_for(&plugin, &host, handle);
+
+    struct PluginClose close_ = { 0 };
+    plugin_event(&plugin, PLUGIN_CLOSE, &close_, sizeof(close_));
+    plugin_flush(&plugin);
+    plugin_stop(&plugin);
+
+    printf("plugin: %d pieces shared, version %llu\n", text.count, (unsigned long long)text.version);
+    text_free(&text);
+    munmap((void*)original, len);
+    close(handle);
+    unlink(path);
+    free(edits);
+    free(bytes);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "--plugin") == 0)
+        return plugin_main();
+
+    test_ring();
+    test_corrupt();
+    test_plugin();
+
+    check(mzvalidate() == 0, "allocator state");
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,179 @@
+// Harness for the render stage, rows written out are read back the way a terminal would and have to give the same
+// cells and attributes a byte at a time.
+//
+// ./test.sh test_render
+// ../bin/test_render [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "render.h"
+#include "classify.h"
+#include "test.h"
+
+/// @brief Reads an SGR sequence's parameters into an attribute.
+static uint16_t parseSgr(const char* params, size_t len)
+{
+    uint16_t attr = 0;
+    int values[16];
+    int n = 0;
+    values[0] = 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        if (params[i] == ';')
+            values[++n] = 0;
+        else
+            values[n] = values[n] * 10 + params[i] - '0';
+    }
+
+    for (int i = 0; i <= n; i++)
+    {
+        if (values[i] == 0)
+            attr = 0;
+        else if (values[i] == 1)
+            attr |= RENDER_BOLD;
+        else if (values[i] == 4)
+            attr |= RENDER_UNDERLINE;
+        else if (values[i] == 7)
+            attr |= RENDER_REVERSE;
+        else if (values[i] == 38 && i + 2 <= n && values[i + 1] == 5)
+        {
+            attr |= RENDER_FOREGROUND | values[i + 2];
+            i += 2;
+        }
+    }
+
+    return attr;
+}
+
+/// @brief Random rows of text, control bytes, UTF-8 and broken sequences under runs of random attributes, written out and
+/// read back.
+static void test_rows(int rounds)
+{
+    static const char* pieces[] = { "a", "word", " ", "   ", "\t", "\x1b", "\x07", "\x7f", "\xc3\xa9", "\xe2\x82\xac",
+                                    "\xf0\x9f\x98\x80", "\x80", "\xff", "\r" };
+    size_t bytes = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        int cols = 1 + next() % 300;
+        int utf8 = next() % 2;
+        char* cells = malloc(cols + RENDER_SLACK);
+        uint16_t* attrs = malloc((cols + RENDER_SLACK) * sizeof(uint16_t));
+        char* out = malloc(render_bound(1, cols));
+        memset(cells, 'x', cols + RENDER_SLACK);
+        memset(attrs, 0xff, (cols + RENDER_SLACK) * sizeof(uint16_t));
+
+        // Some rows end in blanks, as short lines do.
+        int filled = next() % 2 ? cols : next() % (cols + 1);
+        int at = 0;
+        while (at < cols)
+        {
+            const char* piece = at < filled ? pieces[next() % (sizeof(pieces) / sizeof(pieces[0]))] : " ";
+            for (size_t k = 0; piece[k] != '\0' && at < cols; k++)
+                cells[at++] = piece[k];
+        }
+
+        static const uint16_t styles[] = { 0, RENDER_REVERSE, RENDER_UNDERLINE, RENDER_FOREGROUND | 196,
+                                           RENDER_BOLD | RENDER_FOREGROUND | 27, RENDER_REVERSE | RENDER_UNDERLINE };
+        for (int k = 0; k < cols;)
+        {
+            int run = 1 + next() % 12;
+            uint16_t attr = next() % 3 == 0 ? 0 : styles[next() % 6];
+            for (int r = 0; r < run && k < cols; r++)
+                attrs[k++] = attr;
+        }
+
+        size_t len = render_row(out, cells, attrs, cols, utf8);
+        check(len <= render_bound(1, cols) - RENDER_SLACK, "row of %d wrote %zu", cols, len);
+        bytes += len;
+
+        // Read it back like a terminal, every byte a cell in whatever attribute is current.
+        char shown[300];
+        uint16_t shownAttrs[300];
+        int n = 0;
+        uint16_t cur = 0;
+        for (size_t i = 0; i < len; i++)
+        {
+            if (out[i] == '\x1b')
+            {
+                check(i + 1 < len && out[i + 1] == '[', "escape other than SGR at %zu", i);
+                size_t end = i + 2;
+                while (end < len && out[end] != 'm')
+                {
+                    check(out[end] == ';' || (out[end] >= '0' && out[end] <= '9'), "bad SGR byte %02x",
+                          (unsigned char)out[end]);
+                    end++;
+                }
+                check(end < len, "unterminated SGR");
+                cur = parseSgr(out + i + 2, end - i - 2);
+                i = end;
+                continue;
+            }
+
+            unsigned char c = out[i];
+            check(c >= ' ' && c != 0x7f && (utf8 || c < 0x80), "byte %02x written", c);
+            check(n < cols, "more than %d cells", cols);
+            shown[n] = out[i];
+            shownAttrs[n++] = cur;
+        }
+        check(cur == 0, "row ended in attribute %x", cur);
+
+        uint16_t expected = 0;
+        for (int k = 0; k < cols; k++)
+        {
+            unsigned char c = cells[k];
+            char byte = c == '\t' ? ' ' : c < 0x20 || c == 0x7f || (c >= 0x80 && !utf8) ? CLASSIFY_PLACEHOLDER : c;
+            // Continuation bytes take the attribute of the character they're part of.
+            if (!(utf8 && (c & 0xc0) == 0x80))
+                expected = attrs[k];
+
+            if (k >= n)
+            {
+                check(c == ' ' && expected == 0, "cell %d of %d left out, %02x in %x", k, cols, c, expected);
+                continue;
+            }
+
+            check(shown[k] == byte, "cell %d is %02x, expected %02x", k, (unsigned char)shown[k], (unsigned char)byte);
+            check(shownAttrs[k] == expected, "cell %d in %x, expected %x", k, shownAttrs[k], expected);
+        }
+
+        free(out);
+        free(attrs);
+        free(cells);
+    }
+
+    printf("render: %d rounds, %zu bytes\n", rounds, bytes);
+}
+
+/// @brief Every cell in an attribute of its own is the most a row can take.
+static void test_bound()
+{
+    int cols = 200;
+    char* cells = malloc(cols + RENDER_SLACK);
+    uint16_t* attrs = malloc((cols + RENDER_SLACK) * sizeof(uint16_t));
+    char* out = malloc(render_bound(1, cols));
+    memset(cells, 'x', cols + RENDER_SLACK);
+    for (int k = 0; k < cols + RENDER_SLACK; k++)
+        attrs[k] = RENDER_BOLD | RENDER_UNDERLINE | RENDER_REVERSE | RENDER_FOREGROUND | (k % 2 ? 255 : 254);
+
+    size_t len = render_row(out, cells, attrs, cols, 1);
+    check(len == (size_t)cols * (RENDER_SGR_MAX + 1) + 4, "worst row wrote %zu", len);
+    check(render_cursor(out, 2147483647, 2147483647) == RENDER_CURSOR_MAX, "cursor");
+    check(render_cursor(out, 12, 7) == 7 && memcmp(out, "\x1b[12;7H", 7) == 0, "cursor %.*s", 7, out);
+
+    free(out);
+    free(attrs);
+    free(cells);
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = test_arg(argc, argv, 20000);
+
+    test_rows(rounds);
+    test_bound();
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+// Harness for the scheduler, jobs have to take turns, stop when they're done or cancelled and give way to input.
+//
+// ./test.sh test_sched
+// ../bin/test_sched
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "sched.h"
+#include "trace.h"
+#include "test.h"
+
+#define NUM_JOBS 3
+
+/// @brief A job counting down its steps, noting the order steps ran in.
+struct Countdown
+{
+    int left;
+    int steps;
+};
+
+static int order[64];
+static int numOrder = 0;
+static struct Countdown jobs[NUM_JOBS];
+
+static int countdown(void* arg)
+{
+    struct Countdown* job = arg;
+    order[numOrder++] = job - jobs;
+    job->steps++;
+    return --job->left > 0;
+}
+
+/// @brief Same as countdown without noting the order, for more jobs than there's room to note.
+static int tick(void* arg)
+{
+    struct Countdown* job = arg;
+    job->steps++;
+    return --job->left > 0;
+}
+
+/// @brief A job which never ends, each step taking about a millisecond.
+static int forever(void* arg)
+{
+    uint64_t start = trace_now();
+    while (trace_now() - start < 1000000)
+        ;
+    (*(int*)arg)++;
+    return 1;
+}
+
+/// @brief Jobs take turns a step each and drop out once they're done, adding one twice doesn't queue it twice.
+static void test_turns()
+{
+    for (int i = 0; i < NUM_JOBS; i++)
+    {
+        jobs[i] = (struct Countdown){ i + 1, 0 };
+        check(sched_add(countdown, jobs + i) == 0, "add");
+    }
+    check(sched_add(countdown, jobs) == 0, "add again");
+
+    sched_finish();
+    check(!sched_pending(), "pending after finishing");
+    static const int expected[] = { 0, 1, 2, 1, 2, 2 };
+    check(numOrder == 6, "%d steps", numOrder);
+    for (int i = 0; i < numOrder; i++)
+        check(order[i] == expected[i], "step %d ran job %d, expected %d", i, order[i], expected[i]);
+    for (int i = 0; i < NUM_JOBS; i++)
+        check(jobs[i].steps == i + 1, "job %d ran %d steps", i, jobs[i].steps);
+}
+
+/// @brief The queue grows past its first allocation without losing or reordering jobs.
+static void test_many()
+{
+    static struct Countdown many[1000];
+    for (int i = 0; i < 1000; i++)
+    {
+        many[i] = (struct Countdown){ .left = 1 + i % 3 };
+        check(sched_add(tick, many + i) == 0, "add %d", i);
+    }
+
+    check(sched_run(UINT64_MAX, -1) == 0, "work left over");
+    for (int i = 0; i < 1000; i++)
+        check(many[i].left == 0 && many[i].steps == 1 + i % 3, "job %d ran %d steps", i, many[i].steps);
+}
+
+/// @brief Cancelling drops only the jobs of that argument, and the others keep their turns.
+static void test_cancel()
+{
+    numOrder = 0;
+    for (int i = 0; i < NUM_JOBS; i++)
+    {
+        jobs[i] = (struct Countdown){ 3, 0 };
+        sched_add(countdown, jobs + i);
+    }
+
+    check(sched_run(UINT64_MAX, -1) == 0, "work left over");
+    check(numOrder == 9, "%d steps", numOrder);
+
+    numOrder = 0;
+    for (int i = 0; i < NUM_JOBS; i++)
+    {
+        jobs[i] = (struct Countdown){ 3, 0 };
+        sched_add(countdown, jobs + i);
+    }
+    sched_cancel(jobs + 1);
+    sched_finish();
+    check(jobs[0].steps == 3 && jobs[1].steps == 0 && jobs[2].steps == 3, "steps %d %d %d", jobs[0].steps,
+          jobs[1].steps, jobs[2].steps);
+}
+
+/// @brief The budget is kept to within a step, and input waiting stops a run after the step it came in during.
+static void test_budget()
+{
+    int steps = 0;
+    check(sched_add(forever, &steps) == 0, "add");
+
+    uint64_t start = trace_now();
+    check(sched_run(SCHED_BUDGET_NS, -1) == 1, "forever finished");
+    uint64_t spent = trace_now() - start;
+    check(spent >= SCHED_BUDGET_NS && spent < SCHED_BUDGET_NS + 5000000, "ran for %lu ns", (unsigned long)spent);
+    check(steps >= 2, "%d steps", steps);
+
+    int fds[2];
+    check(pipe(fds) == 0, "pipe");
+    check(write(fds[1], "k", 1) == 1, "write");
+    steps = 0;
+    sched_run(SCHED_BUDGET_NS, fds[0]);
+    check(steps == 1, "%d steps with input waiting", steps);
+
+    sched_cancel(&steps);
+    check(!sched_pending(), "pending after cancelling");
+    close(fds[0]);
+    close(fds[1]);
+}
+
+int main()
+{
+    test_turns();
+    test_many();
+    test_cancel();
+    test_budget();
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,147 @@
+// Harness for searching a whole document, every match is checked against text_search a match at a time.
+//
+// ./test.sh test_search
+// ../bin/test_search [rounds]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "search.h"
+#include "text.h"
+#include "mzalloc.h"
+#include "test.h"
+
+/// @brief Fills a document from a small alphabet so needles which overlap themselves match all over, then cuts it into
+/// pieces so matches straddle them.
+static void build(struct Text* text, char* original, size_t len, int edits)
+{
+    for (size_t i = 0; i < len; i++)
+        original[i] = "ab\n"[next() % 16 == 0 ? 2 : next() % 2];
+    check(text_init(text, original, len) == 0, "init");
+
+    for (int i = 0; i < edits && text->len > 0; i++)
+    {
+        static const char* typed[] = { "a", "ab", "ba", "aaa", "" };
+        size_t pos = next() % text->len;
+        size_t del = next() % 3;
+        del = del <= text->len - pos ? del : 0;
+        const char* data = typed[next() % 5];
+        struct Edit edit = { pos, del, data, strlen(data) };
+        check(text_apply(text, &edit, 1) == 0, "apply");
+    }
+}
+
+/// @brief Random documents of every size up to a few MB, against successive text_search calls.
+static void test_all(int rounds)
+{
+    size_t total = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        size_t len = next() % 4 == 0 ? next() % (6 << 20) : next() % 4096;
+        char* original = malloc(len + 1);
+        struct Text text;
+        build(&text, original, len, next() % 2000);
+
+        char needle[8];
+        size_t n = 1 + next() % 6;
+        for (size_t i = 0; i < n; i++)
+            needle[i] = next() % 4 == 0 ? 'b' : 'a';
+
+        size_t* hits;
+        size_t count;
+        check(search_all(&text, needle, n, &hits, &count) == 0, "search");
+
+        size_t k = 0;
+        for (size_t hit = text_search(&text, 0, needle, n); hit < text.len; hit = text_search(&text, hit + n, needle, n))
+        {
+            check(k < count && hits[k] == hit, "round %d: match %zu at %zu, expected %zu", round, k,
+                  k < count ? hits[k] : SIZE_MAX, hit);
+            k++;
+        }
+
+        check(k == count, "round %d: %zu matches, expected %zu", round, count, k);
+        total += count;
+        mzfree(hits);
+        text_free(&text);
+        free(original);
+    }
+
+    printf("search: %d rounds, %zu matches\n", rounds, total);
+}
+
+/// @brief Ranged searches against memmem over the flat document.
+static void test_range()
+{
+    for (int round = 0; round < 2000; round++)
+    {
+        size_t len = next() % 512;
+        char* original = malloc(len + 1);
+        struct Text text;
+        build(&text, original, len, next() % 64);
+        char* flat = malloc(text.len + 1);
+        text_read(&text, 0, flat, text.len);
+
+        char needle[4];
+        size_t n = 1 + next() % 3;
+        for (size_t i = 0; i < n; i++)
+            needle[i] = next() % 4 == 0 ? 'b' : 'a';
+
+        size_t pos = next() % (text.len + 1);
+        size_t limit = pos + next() % (text.len - pos + 1);
+        const char* hit = pos < limit ? memmem(flat + pos, text.len - pos, needle, n) : NULL;
+        size_t expected = hit != NULL && (size_t)(hit - flat) < limit ? (size_t)(hit - flat) : text.len;
+        size_t got = text_search_range(&text, pos, limit, needle, n);
+        check(got == expected, "range %zu to %zu found %zu, expected %zu", pos, limit, got, expected);
+
+        free(flat);
+        text_free(&text);
+        free(original);
+    }
+}
+
+/// @brief A token spread thinly over a large document in a few thousand pieces, as replacing it would search.
+static void bench()
+{
+    size_t len = (size_t)256 << 20;
+    char* original = malloc(len);
+    for (size_t i = 0; i < len; i++)
+        original[i] = 'a' + i % 23;
+    for (size_t i = 0; i + 8 < len; i += 4099)
+        memcpy(original + i, "needle", 6);
+
+    struct Text text;
+    check(text_init(&text, original, len) == 0, "init");
+    for (int i = 0; i < 4000; i++)
+    {
+        struct Edit edit = { next() % text.len, 0, "x", 1 };
+        check(text_apply(&text, &edit, 1) == 0, "apply");
+    }
+
+    double start = now();
+    size_t* hits;
+    size_t count;
+    check(search_all(&text, "needle", 6, &hits, &count) == 0, "search");
+    double spent = now() - start;
+    printf("bench: %zu matches in %zu MB, %.1f ms, %.2f GB/s\n", count, len >> 20, spent * 1e3, len / spent / 1e9);
+    // Each edit splits one needle at most.
+    check(count + 4000 >= len / 4099, "%zu matches", count);
+
+    mzfree(hits);
+    text_free(&text);
+    free(original);
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = test_arg(argc, argv, 400);
+
+    test_range();
+    test_all(rounds);
+    bench();
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,91 @@
+// Harness for mapping columns of a line, the vector scan and binary searches are checked against a character at a time.
+//
+// ./test.sh test_sequence
+// ../bin/test_sequence [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "sequence.h"
+#include "arena.h"
+#include "test.h"
+
+/// @brief Random lines of characters of every length, now and then ending in a carriage return. stops[c] is where
+/// column c starts, the last being where the cursor stops at the end of the line.
+static size_t line(char* dst, size_t max, size_t* stops, size_t* columns, int* crlf)
+{
+    size_t len = 0;
+    size_t n = 0;
+    size_t target = next() % max;
+    while (len + 5 < target)
+    {
+        static const size_t widths[] = { 1, 1, 1, 2, 3, 4 };
+        size_t bytes = widths[next() % 6];
+        static const unsigned char leads[] = { 0, 0, 0xc3, 0xe2, 0xf0 };
+        stops[n++] = len;
+        dst[len] = bytes == 1 ? 'a' + next() % 26 : leads[bytes];
+        for (size_t k = 1; k < bytes; k++)
+            dst[len + k] = 0x80 | next() % 64;
+        len += bytes;
+    }
+
+    stops[n] = len;
+    *crlf = next() % 2;
+    if (*crlf)
+        dst[len++] = '\r';
+    *columns = n;
+    return len;
+}
+
+static void test_map(int rounds)
+{
+    struct Arena arena;
+    check(arena_init(&arena) == 0, "arena");
+    char bytes[4096];
+    size_t stops[4096];
+    for (int round = 0; round < rounds; round++)
+    {
+        size_t columns;
+        int crlf;
+        size_t len = line(bytes, round % 8 == 0 ? sizeof(bytes) : 100, stops, &columns, &crlf);
+        struct Sequences seqs;
+        check(sequence_scan(&seqs, bytes, len, SEQUENCE_UTF8 | SEQUENCE_CRLF | SEQUENCE_END, &arena) == 0, "scan");
+        check(sequence_end(&seqs) == stops[columns], "end %zu, expected %zu", sequence_end(&seqs), stops[columns]);
+
+        for (size_t c = 0; c <= columns; c++)
+        {
+            check(sequence_column(&seqs, stops[c]) == c, "offset %zu at column %zu, expected %zu", stops[c],
+                  sequence_column(&seqs, stops[c]), c);
+            check(sequence_offset(&seqs, c) == stops[c], "column %zu at %zu, expected %zu", c,
+                  sequence_offset(&seqs, c), stops[c]);
+            if (c < columns)
+                check(sequence_step(&seqs, stops[c], 1) == stops[c + 1], "right from %zu", stops[c]);
+            if (c > 0)
+                check(sequence_step(&seqs, stops[c], -1) == stops[c - 1], "left from %zu", stops[c]);
+
+            // Inside a character is the column it starts at.
+            for (size_t k = c < columns ? stops[c] + 1 : len; c < columns && k < stops[c + 1]; k++)
+                check(sequence_column(&seqs, k) == c, "inside %zu", k);
+        }
+
+        check(sequence_offset(&seqs, columns + 1 + next() % 8) == stops[columns], "past the end");
+
+        // Without UTF-8 every byte is a column, the carriage return still hides.
+        check(sequence_scan(&seqs, bytes, len, SEQUENCE_CRLF | SEQUENCE_END, &arena) == 0, "scan");
+        check(sequence_column(&seqs, len) == len - crlf && sequence_end(&seqs) == len - crlf, "bytes");
+        arena_reset(&arena);
+    }
+
+    arena_free(&arena);
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = test_arg(argc, argv, 100000);
+
+    test_map(rounds);
+
+    printf("ok\n");
+    return 0;
+}
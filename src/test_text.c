@@ -0,0 +1,361 @@
+// Correctness harness for the piece table, every batch is mirrored onto a flat copy of the document.
+//
+// ./test.sh test_text
+// ../bin/test_text [batches]
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "text.h"
+#include "clipboard.h"
+#include "mzalloc.h"
+#include "test.h"
+
+#define MAX_EDITS 64
+
+/// @brief Checks every piece invariant and that the document reads back as the flat copy.
+static void cross_check(struct Text* text, const char* flat, size_t len)
+{
+    check(text->len == len, "length %zu, expected %zu", text->len, len);
+
+    size_t pos = 0;
+    for (int i = 0; i < text->count; i++)
+    {
+        struct Piece* piece = text->pieces + i;
+        check(piece->len > 0, "piece %d is empty", i);
+        check(piece->pos == pos, "piece %d at %zu, expected %zu", i, piece->pos, pos);
+        if (i > 0)
+        {
+            struct Piece* prev = piece - 1;
+            check(prev->source != piece->source || prev->start + prev->len != piece->start,
+                "pieces %d and %d should have been merged", i - 1, i);
+        }
+        pos += piece->len;
+    }
+
+    char* copy = malloc(len + 1);
+    check(text_read(text, 0, copy, len + 1) == len, "read length");
+    check(memcmp(copy, flat, len) == 0, "contents differ");
+    free(copy);
+}
+
+/// @brief Random sorted, non-overlapping batches, some sharing their inserted data like multi-cursor typing does.
+static void test_batches(long batches)
+{
+    size_t cap = 1 << 20;
+    char* original = malloc(cap);
+    for (size_t i = 0; i < 4096; i++)
+        original[i] = "abc\n"[next() % 4];
+
+    struct Text text;
+    check(text_init(&text, original, 4096) == 0, "init");
+
+    char* flat = malloc(cap);
+    char* tmp = malloc(cap);
+    memcpy(flat, original, 4096);
+    size_t len = 4096;
+
+    struct Edit edits[MAX_EDITS];
+    char data[MAX_EDITS][8];
+    for (long b = 0; b < batches; b++)
+    {
+        int n = 1 + next() % MAX_EDITS;
+        int shared = next() % 2;
+        size_t at = 0;
+        int count = 0;
+        for (int e = 0; e < n && at <= len; e++)
+        {
+            size_t room = len - at;
+            size_t pos = at + (room > 0 ? next() % (room / (n - e) + 1) : 0);
+            size_t del = len - pos > 0 ? next() % ((len - pos) < 4 ? (len - pos) + 1 : 4) : 0;
+            // Keep the document from running away in either direction.
+            del = len > cap / 4 ? del : (next() % 4 == 0 ? del : 0);
+            size_t ins = next() % 4;
+            ins = shared ? 3 : ins;
+            char* src = shared ? data[0] : data[e];
+            if (!shared || e == 0)
+            {
+                for (size_t i = 0; i < ins; i++)
+                    src[i] = "xyz\n"[next() % 4];
+            }
+
+            edits[count++] = (struct Edit){ pos, del, src, ins };
+            at = pos + del + 1;
+        }
+
+        check(text_apply(&text, edits, count) == 0, "apply");
+
+        // Positions are all in terms of the old document, so the flat copy is rebuilt into tmp.
+        size_t out = 0;
+        size_t from = 0;
+        for (int e = 0; e < count; e++)
+        {
+            memcpy(tmp + out, flat + from, edits[e].pos - from);
+            out += edits[e].pos - from;
+            memcpy(tmp + out, edits[e].data, edits[e].len);
+            out += edits[e].len;
+            from = edits[e].pos + edits[e].del;
+        }
+        memcpy(tmp + out, flat + from, len - from);
+        out += len - from;
+        check(out < cap, "flat copy overflowed");
+
+        char* swap = flat;
+        flat = tmp;
+        tmp = swap;
+        len = out;
+        cross_check(&text, flat, len);
+    }
+
+    // Lookups against the flat copy.
+    for (int i = 0; i < 1000; i++)
+    {
+        size_t pos = next() % (len + 1);
+        char* hit = memchr(flat + pos, '\n', len - pos);
+        check(text_chr(&text, pos, '\n') == (hit ? (size_t)(hit - flat) : len), "text_chr at %zu", pos);
+
+        hit = memrchr(flat, '\n', pos);
+        check(text_rchr(&text, pos, '\n') == (hit ? (size_t)(hit - flat) : SIZE_MAX), "text_rchr at %zu", pos);
+
+        if (pos < len)
+            check(text_at(&text, pos) == flat[pos], "text_at at %zu", pos);
+
+        size_t nlen = 1 + next() % 6;
+        size_t from = next() % (len + 1);
+        if (from + nlen <= len)
+        {
+            char needle[8];
+            memcpy(needle, flat + next() % (len - nlen + 1), nlen);
+            hit = memmem(flat + from, len - from, needle, nlen);
+            check(text_search(&text, from, needle, nlen) == (hit ? (size_t)(hit - flat) : len), "text_search at %zu", from);
+        }
+    }
+
+    printf("batches: %ld batches, %d pieces, %zu bytes, %zu added\n", batches, text.count, text.len, text.added);
+    text_free(&text);
+    free(original);
+    free(flat);
+    free(tmp);
+}
+
+/// @brief Typing the same key at many cursors must keep the piece count flat rather than growing per key.
+static void test_typing()
+{
+    size_t len = 1 << 20;
+    char* original = malloc(len);
+    for (size_t i = 0; i < len; i++)
+        original[i] = i % 64 == 63 ? '\n' : 'a';
+
+    struct Text text;
+    check(text_init(&text, original, len) == 0, "init");
+
+    int n = 10000;
+    struct Edit* edits = malloc(n * sizeof(struct Edit));
+    size_t* cursors = malloc(n * sizeof(size_t));
+    for (int i = 0; i < n; i++)
+        cursors[i] = (size_t)i * 64;
+
+    double start = now();
+    for (int key = 0; key < 200; key++)
+    {
+        char c = 'a' + key % 26;
+        for (int i = 0; i < n; i++)
+            edits[i] = (struct Edit){ cursors[i], 0, &c, 1 };
+
+        check(text_apply(&text, edits, n) == 0, "apply");
+        for (int i = 0; i < n; i++)
+            cursors[i] += i + 1;
+    }
+    double elapsed = now() - start;
+
+    check(text.count <= 2 * n + 1, "%d pieces after typing", text.count);
+    check(text.added == 200, "%zu bytes added, expected 200", text.added);
+    check(text_at(&text, 64 * 1 + 200 + 199) == 'a' + 199 % 26, "typed text");
+
+    printf("typing: 200 keys at %d cursors, %.3fms/key, %d pieces\n", n, elapsed * 1e3 / 200, text.count);
+    text_free(&text);
+    free(original);
+    free(edits);
+    free(cursors);
+}
+
+/// @brief Pasting within a document must reference its pieces without adding a byte, pasting elsewhere copies, and
+/// entries must read the same once their document is gone.
+static void test_paste()
+{
+    size_t cap = 1 << 20;
+    char* original = malloc(cap);
+    for (size_t i = 0; i < 4096; i++)
+        original[i] = 'a' + next() % 26;
+
+    struct Text text;
+    check(text_init(&text, original, 4096) == 0, "init");
+    struct Edit typed = { 100, 0, "typed", 5 };
+    check(text_apply(&text, &typed, 1) == 0, "type");
+
+    char* flat = malloc(cap);
+    char* tmp = malloc(cap);
+    text_read(&text, 0, flat, text.len);
+    size_t len = text.len;
+    size_t added = text.added;
+
+    struct Clipboard clipboard = { 0 };
+    struct Edit edits[MAX_EDITS];
+    for (int round = 0; round < 200; round++)
+    {
+        size_t pos = next() % len;
+        size_t take = 1 + next() % (len - pos < 2000 ? len - pos : 2000);
+        check(clipboard_copy(&clipboard, &text, pos, take, next() % 4 == 0) == 0, "copy");
+        const struct Clip* clip = clipboard_get(&clipboard, 0);
+
+        // Paste at a handful of cursors, keeping the document from running away.
+        int n = len > cap / 4 ? 1 : 1 + next() % 4;
+        size_t at = 0;
+        for (int e = 0; e < n; e++)
+        {
+            size_t where = at + next() % ((len - at) / (n - e) + 1);
+            size_t del = len - where < 64 ? 0 : next() % 64;
+            edits[e] = clipboard_edit(clip, where, del);
+            at = where + del + 1 < len ? where + del + 1 : len;
+        }
+
+        char* entry = malloc(clip->len + 1);
+        check(clipboard_read(clip, 0, entry, clip->len) == clip->len, "read entry");
+        check(text_apply(&text, edits, n) == 0, "paste");
+
+        size_t out = 0;
+        size_t from = 0;
+        for (int e = 0; e < n; e++)
+        {
+            memcpy(tmp + out, flat + from, edits[e].pos - from);
+            out += edits[e].pos - from;
+            memcpy(tmp + out, entry, clip->len);
+            out += clip->len;
+            from = edits[e].pos + edits[e].del;
+        }
+        memcpy(tmp + out, flat + from, len - from);
+        out += len - from;
+        check(out < cap, "flat copy overflowed");
+        free(entry);
+
+        char* swap = flat;
+        flat = tmp;
+        tmp = swap;
+        len = out;
+        cross_check(&text, flat, len);
+        check(text.added == added, "paste within the document added %zu bytes", text.added - added);
+    }
+
+    // Into another document the bytes have to be copied, a batch of the same entry copies them once.
+    const struct Clip* clip = clipboard_get(&clipboard, 0);
+    char* expected = malloc(clip->len + 1);
+    clipboard_read(clip, 0, expected, clip->len);
+    struct Text other;
+    check(text_init(&other, "0123456789", 10) == 0, "init other");
+    edits[0] = clipboard_edit(clip, 2, 0);
+    edits[1] = clipboard_edit(clip, 8, 1);
+    check(text_apply(&other, edits, 2) == 0, "paste into other");
+    check(other.added == clip->len, "%zu bytes added for a %zu byte entry", other.added, clip->len);
+    char* pasted = malloc(other.len + 1);
+    text_read(&other, 0, pasted, other.len);
+    check(memcmp(pasted + 2, expected, clip->len) == 0, "first paste into other");
+    check(memcmp(pasted + 8 + clip->len, expected, clip->len) == 0, "second paste into other");
+    free(pasted);
+
+    // Once detached the entry outlives its document.
+    int pieces = text.count;
+    clipboard_detach(&clipboard, &text);
+    text_free(&text);
+    memset(original, 0, cap);
+    check(clip->source == NULL, "entry still references its document");
+    char* after = malloc(clip->len + 1);
+    check(clipboard_read(clip, 0, after, clip->len) == clip->len, "read detached");
+    check(memcmp(after, expected, clip->len) == 0, "detached entry differs");
+
+    printf("paste: %d pieces, %zu bytes, %zu added\n", pieces, len, added);
+    clipboard_free(&clipboard);
+    text_free(&other);
+    free(after);
+    free(expected);
+    free(original);
+    free(flat);
+    free(tmp);
+}
+
+static char* exported;
+static size_t numExported;
+
+static void sink(const char* data, int len)
+{
+    memcpy(exported + numExported, data, len);
+    numExported += len;
+}
+
+/// @brief Entries go to the terminal as base64 a chunk at a time whatever their pieces, and nothing goes past the cap.
+static void test_export()
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t len = CLIPBOARD_EXPORT_MAX + 4096;
+    char* original = malloc(len);
+    for (size_t i = 0; i < len; i++)
+        original[i] = next();
+
+    struct Text text;
+    check(text_init(&text, original, len) == 0, "init");
+    for (int i = 0; i < 500; i++)
+    {
+        struct Edit edit = { .pos = next() % text.len, .del = next() % 2, .data = "xy", .len = 1 + next() % 2 };
+        check(text_apply(&text, &edit, 1) == 0, "apply");
+    }
+
+    unsigned char* flat = malloc(text.len);
+    exported = malloc(CLIPBOARD_EXPORT_MAX / 3 * 4 + 64);
+    struct Clipboard clipboard = { 0 };
+    for (int round = 0; round < 64; round++)
+    {
+        size_t take = round == 0 ? CLIPBOARD_EXPORT_MAX : next() % 10000;
+        size_t pos = next() % (text.len - take);
+        check(clipboard_copy(&clipboard, &text, pos, take, 0) == 0, "copy");
+        text_read(&text, pos, (char*)flat, take);
+
+        numExported = 0;
+        check(clipboard_export(clipboard_get(&clipboard, 0), sink) == 0, "export %zu bytes", take);
+        check(numExported == 8 + (take + 2) / 3 * 4, "%zu bytes sent for %zu", numExported, take);
+        check(memcmp(exported, "\x1b]52;c;", 7) == 0 && exported[numExported - 1] == '\a', "not an OSC 52 sequence");
+        for (size_t i = 0; i < take; i += 3)
+        {
+            uint32_t v = flat[i] << 16 | (i + 1 < take ? flat[i + 1] << 8 : 0) | (i + 2 < take ? flat[i + 2] : 0);
+            const char* got = exported + 7 + i / 3 * 4;
+            check(got[0] == digits[v >> 18 & 63] && got[1] == digits[v >> 12 & 63]
+                      && got[2] == (i + 1 < take ? digits[v >> 6 & 63] : '=') && got[3] == (i + 2 < take ? digits[v & 63] : '='),
+                  "round %d: bytes %zu encoded wrong", round, i);
+        }
+    }
+
+    numExported = 0;
+    check(clipboard_copy(&clipboard, &text, 0, CLIPBOARD_EXPORT_MAX + 1, 0) == 0, "copy");
+    check(clipboard_export(clipboard_get(&clipboard, 0), sink) == -1 && numExported == 0, "exported past the cap");
+
+    clipboard_free(&clipboard);
+    text_free(&text);
+    free(exported);
+    free(flat);
+    free(original);
+}
+
+int main(int argc, char** argv)
+{
+    long batches = test_arg(argc, argv, 2000);
+
+    test_batches(batches);
+    test_typing();
+    test_paste();
+    test_export();
+
+    check(mzvalidate() == 0, "allocator state");
+    printf("ok\n");
+    return 0;
+}
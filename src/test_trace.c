@@ -0,0 +1,150 @@
+// Harness for keystroke tracing, percentiles have to bound the exact ones from sorting every span within a bucket,
+// and the overlay and dump have to report what was recorded.
+//
+// ./test.sh test_trace
+// ../bin/test_trace [spans]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "trace.h"
+#include "test.h"
+
+static int compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/// @brief Spans from a nanosecond to a few seconds, spread evenly over the powers of 2 like real stages aren't.
+static uint64_t random_span()
+{
+    int bits = next() % 32;
+    return (next() & ((2ull << bits) - 1)) | (1ull << bits);
+}
+
+/// @brief Percentiles are never below the exact one and at most a sixteenth of it above, short spans are exact.
+static void test_percentiles(int spans)
+{
+    uint64_t* durs = malloc(spans * sizeof(uint64_t));
+    uint64_t base = trace_now();
+    for (int i = 0; i < spans; i++)
+    {
+        durs[i] = i < 16 ? i : random_span();
+        trace_record(TRACE_FRAME, base, base + durs[i]);
+    }
+
+    check(trace_count(TRACE_FRAME) == (uint64_t)spans, "%llu spans", (unsigned long long)trace_count(TRACE_FRAME));
+    qsort(durs, spans, sizeof(uint64_t), compare);
+
+    static const double pcts[] = { 0, 1, 10, 50, 90, 99, 99.9, 99.99, 100 };
+    for (int i = 0; i < (int)(sizeof(pcts) / sizeof(pcts[0])); i++)
+    {
+        uint64_t target = (uint64_t)(spans * pcts[i] / 100.0);
+        uint64_t want = durs[target < (uint64_t)spans ? target : spans - 1];
+        uint64_t got = trace_percentile(TRACE_FRAME, pcts[i]);
+        check(got >= want && got <= want + want / 16, "p%g is %llu, exact %llu", pcts[i], (unsigned long long)got,
+              (unsigned long long)want);
+    }
+    check(trace_percentile(TRACE_FRAME, 100) == durs[spans - 1], "p100 isn't the longest span");
+
+    // Stages are kept apart, and one with nothing recorded has no percentiles.
+    check(trace_count(TRACE_KEYS) == 0 && trace_percentile(TRACE_KEYS, 50) == 0, "keys recorded");
+    for (int i = 0; i < 100; i++)
+        trace_record(TRACE_PHOTON, base, base + 5);
+    check(trace_percentile(TRACE_PHOTON, 50) == 5 && trace_percentile(TRACE_PHOTON, 99) == 5, "photon percentiles");
+
+    free(durs);
+}
+
+/// @brief The overlay always fills exactly the row it's given, cut short or padded out.
+static void test_overlay()
+{
+    char row[512];
+    memset(row, 0, sizeof(row));
+    trace_overlay(row, 300);
+    check(strncmp(row, " frame p50 ", 11) == 0, "overlay starts \"%.20s\"", row);
+    check(strstr(row, "key->photon p50 0.000ms") != NULL, "photon p50 of 5ns missing");
+    check(row[299] == ' ' && row[300] == '\0', "overlay not padded to its row");
+
+    char frames[64];
+    snprintf(frames, sizeof(frames), "| %llu frames", (unsigned long long)trace_count(TRACE_FRAME));
+    check(strstr(row, frames) != NULL, "overlay doesn't count frames");
+
+    memset(row, 0, sizeof(row));
+    trace_overlay(row, 10);
+    check(memcmp(row, " frame p50", 10) == 0 && row[10] == '\0', "overlay not cut to its row");
+}
+
+/// @brief The dump lists every stage's count, histograms which add up to it and the spans still in the ring.
+static void test_dump(int spans)
+{
+    char path[] = "/tmp/test_trace.XXXXXX";
+    int fd = mkstemp(path);
+    check(fd >= 0, "temporary");
+    close(fd);
+
+    uint64_t last = trace_now();
+    trace_record(TRACE_WRITE, last, last + 1234);
+    check(trace_dump(path) == 0, "dump");
+    check(trace_dump("/nonexistent/pipit.trace") == -1, "dump into a missing directory");
+
+    FILE* in = fopen(path, "r");
+    char line[256];
+    check(fgets(line, sizeof(line), in) != NULL && strncmp(line, "stage", 5) == 0, "header");
+
+    for (int i = 0; i < NUM_TRACES; i++)
+    {
+        char name[16];
+        unsigned long long count;
+        check(fgets(line, sizeof(line), in) != NULL && sscanf(line, "%15s %llu", name, &count) == 2, "stage %d", i);
+        check(strcmp(name, trace_name(i)) == 0 && count == trace_count(i), "stage %s counted %llu", name, count);
+    }
+
+    // Histograms, each opened by a heading and closed by a blank line.
+    int stage = -1;
+    uint64_t sum = 0;
+    uint64_t recent = 0;
+    char lastLine[256] = "";
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        unsigned long long bound;
+        unsigned count;
+        if (strncmp(line, "histogram ", 10) == 0 || strncmp(line, "recent spans", 12) == 0)
+        {
+            check(stage < 0 || sum == trace_count(stage), "histogram of %s adds up to %llu", trace_name(stage),
+                  (unsigned long long)sum);
+            stage = line[0] == 'h' ? stage + 1 : NUM_TRACES;
+            sum = 0;
+        }
+        else if (stage < NUM_TRACES && sscanf(line, "%llu %u", &bound, &count) == 2)
+            sum += count;
+        else if (stage == NUM_TRACES && line[0] != '\n')
+        {
+            recent++;
+            strcpy(lastLine, line);
+        }
+    }
+    fclose(in);
+    unlink(path);
+
+    check(stage == NUM_TRACES, "%d histograms", stage);
+    check(recent > 0 && recent <= (uint64_t)spans + 101, "%llu recent spans", (unsigned long long)recent);
+    snprintf(line, sizeof(line), "%llu write 1234\n", (unsigned long long)last);
+    check(strcmp(lastLine, line) == 0, "last span \"%s\"", lastLine);
+}
+
+int main(int argc, char** argv)
+{
+    int spans = test_arg(argc, argv, 200000);
+
+    test_percentiles(spans);
+    test_overlay();
+    test_dump(spans);
+
+    printf("ok\n");
+    return 0;
+}
@@ -0,0 +1,221 @@
+// Harness for the word index, counts kept up to date from edits have to match tokenizing the whole document again a
+// byte at a time, and lookups have to match going over every word.
+//
+// ./test.sh test_words
+// ../bin/test_words [rounds]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "words.h"
+#include "text.h"
+#include "test.h"
+
+#define MAX_EDITS 8
+#define MAX_MATCHES 8
+
+struct Token
+{
+    const char* word;
+    size_t len;
+    int64_t count;
+};
+
+static int compareTokens(const void* a, const void* b)
+{
+    const struct Token* x = a;
+    const struct Token* y = b;
+    int order = memcmp(x->word, y->word, x->len < y->len ? x->len : y->len);
+    return order != 0 ? order : (x->len > y->len) - (x->len < y->len);
+}
+
+/// @brief Tokenizes a byte at a time, giving every distinct indexed word once with its count, in byte order.
+static size_t tokenize(const char* data, size_t len, struct Token* tokens)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len;)
+    {
+        size_t end = i;
+        while (end < len && words_byte(data[end]))
+            end++;
+        if (end - i >= WORDS_MIN && end - i <= WORDS_MAX)
+            tokens[n++] = (struct Token){ data + i, end - i, 1 };
+        i = end > i ? end : i + 1;
+    }
+
+    qsort(tokens, n, sizeof(struct Token), compareTokens);
+    size_t unique = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        if (unique > 0 && compareTokens(tokens + unique - 1, tokens + i) == 0)
+            tokens[unique - 1].count++;
+        else
+            tokens[unique++] = tokens[i];
+    }
+
+    return unique;
+}
+
+/// @brief Random bytes from a small alphabet so words repeat, with the odd run too long to be indexed.
+static void fill(char* data, size_t len)
+{
+    static const char alphabet[] = "abcab_01 \n.\t";
+    size_t i = 0;
+    while (i < len)
+    {
+        if (next() % 64 == 0)
+        {
+            size_t run = WORDS_MAX - 2 + next() % 6;
+            for (size_t k = 0; k < run && i < len; k++)
+                data[i++] = 'z';
+        }
+        else
+            data[i++] = alphabet[next() % (sizeof(alphabet) - 1)];
+    }
+}
+
+/// @brief Checks a table against the document tokenized a byte at a time, and a few lookups against going over it.
+static void compare(const struct WordTable* table, const struct Text* text)
+{
+    char* flat = malloc(text->len + 1);
+    struct Token* tokens = malloc((text->len / 2 + 1) * sizeof(struct Token));
+    text_read(text, 0, flat, text->len);
+    size_t unique = tokenize(flat, text->len, tokens);
+
+    size_t positive = 0;
+    for (size_t i = 0; i < table->count; i++)
+        positive += table->entries[i].count > 0;
+    check(positive == unique, "%zu words indexed, expected %zu", positive, unique);
+    for (size_t i = 0; i < unique; i++)
+        check(words_count(table, tokens[i].word, tokens[i].len) == tokens[i].count, "%.*s counted %ld, expected %ld",
+              (int)tokens[i].len, tokens[i].word, (long)words_count(table, tokens[i].word, tokens[i].len),
+              (long)tokens[i].count);
+
+    for (int q = 0; q < 4; q++)
+    {
+        char prefix[4];
+        size_t len = next() % sizeof(prefix);
+        for (size_t k = 0; k < len; k++)
+            prefix[k] = "abc_0"[next() % 5];
+
+        struct WordMatch matches[MAX_MATCHES];
+        size_t n = words_lookup(table, prefix, len, matches, MAX_MATCHES);
+
+        // The tokens are in byte order, so a stable sort by count gives what the lookup should.
+        struct Token expected[MAX_MATCHES];
+        size_t count = 0;
+        for (size_t i = 0; i < unique; i++)
+        {
+            if (tokens[i].len <= len || memcmp(tokens[i].word, prefix, len) != 0)
+                continue;
+            size_t at = count;
+            while (at > 0 && expected[at - 1].count < tokens[i].count)
+                at--;
+            if (at >= MAX_MATCHES)
+                continue;
+            size_t moved = count < MAX_MATCHES ? count : MAX_MATCHES - 1;
+            memmove(expected + at + 1, expected + at, (moved - at) * sizeof(struct Token));
+            expected[at] = tokens[i];
+            count = moved + 1;
+        }
+
+        check(n == count, "%zu matches of %.*s, expected %zu", n, (int)len, prefix, count);
+        for (size_t i = 0; i < n; i++)
+            check(matches[i].len == expected[i].len && memcmp(matches[i].word, expected[i].word, expected[i].len) == 0
+                      && matches[i].count == expected[i].count,
+                  "match %zu of %.*s is %.*s", i, (int)len, prefix, (int)matches[i].len, matches[i].word);
+    }
+
+    free(tokens);
+    free(flat);
+}
+
+/// @brief Random batches edit a document, the index follows them from the edits alone. Some rounds start the index in
+/// the background and edit while it's being built.
+static void test_edits(int rounds)
+{
+    size_t batches = 0;
+    for (int round = 0; round < rounds; round++)
+    {
+        size_t len = next() % 8 == 0 ? 100000 : next() % 2000;
+        char* data = malloc(len + 1);
+        fill(data, len);
+        struct Text text;
+        check(text_init(&text, data, len) == 0, "init");
+
+        struct Words words;
+        check(words_open(&words, &text) == 0, "open");
+        int background = next() % 2;
+        if (!background)
+            words_wait(&words);
+
+        int count = next() % 16;
+        for (int b = 0; b < count; b++)
+        {
+            struct Edit edits[MAX_EDITS];
+            char inserted[MAX_EDITS][8];
+            int n = 1 + next() % MAX_EDITS;
+            size_t at = 0;
+            int k = 0;
+            for (int e = 0; e < n && at <= text.len; e++)
+            {
+                size_t pos = at + next() % ((text.len - at) / (n - e) + 1);
+                size_t del = next() % 4;
+                del = del < text.len - pos ? del : 0;
+                size_t ins = next() % sizeof(inserted[0]);
+                fill(inserted[k], ins);
+                edits[k] = (struct Edit){ pos, del, inserted[k], ins };
+                k++;
+                at = pos + del + 1;
+            }
+
+            words_edit(&words, &text, edits, k, -1);
+            check(text_apply(&text, edits, k) == 0, "apply");
+            words_edit(&words, &text, edits, k, 1);
+            batches++;
+        }
+
+        words_wait(&words);
+        check(words.ready, "not ready after waiting");
+        compare(&words.table, &text);
+        words_close(&words);
+        text_free(&text);
+        free(data);
+    }
+
+    printf("words: %d rounds, %zu batches\n", rounds, batches);
+}
+
+/// @brief Closing while the thread is still going has to stop it.
+static void test_cancel()
+{
+    size_t len = 64 * 1024 * 1024;
+    char* data = malloc(len);
+    fill(data, len);
+    struct Text text;
+    check(text_init(&text, data, len) == 0, "init");
+    struct Words words;
+    check(words_open(&words, &text) == 0, "open");
+    words_close(&words);
+    check(!words.started, "still started after closing");
+    text_free(&text);
+    free(data);
+}
+
+int main(int argc, char** argv)
+{
+    int rounds = test_arg(argc, argv, 2000);
+
+    // A plain run of bytes, words at both ends included.
+    struct WordTable table = { 0 };
+    words_scan(&table, "alpha beta_1 gamma alpha", 24, 1);
+    check(words_count(&table, "alpha", 5) == 2 && words_count(&table, "beta_1", 6) == 1, "scan");
+    words_free(&table);
+
+    test_edits(rounds);
+    test_cancel();
+
+    printf("ok\n");
+    return 0;
+}
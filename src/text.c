@@ -0,0 +1,379 @@
+#define _GNU_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "text.h"
+#include "mzalloc.h"
+
+/// @brief Gets the bytes of a piece.
+static inline const char* text_bytes(const struct Text* text, const struct Piece* piece)
+{
+    return (piece->source == TEXT_ORIGINAL ? text->original : text->add) + piece->start;
+}
+
+int text_init(struct Text* text, const char* original, size_t len)
+{
+    *text = (struct Text){ .original = original, .originalLen = len, .len = len };
+    text->cap = 16;
+    text->pieces = mzalloc(text->cap * sizeof(struct Piece));
+    if (text->pieces == NULL)
+        return -1;
+
+    if (len > 0)
+        text->pieces[text->count++] = (struct Piece){ .pos = 0, .start = 0, .len = len, .source = TEXT_ORIGINAL };
+
+    return 0;
+}
+
+void text_free(struct Text* text)
+{
+    mzfree(text->pieces);
+    mzfree(text->spare);
+    if (text->shared)
+    {
+        munmap(text->add, text->addCap);
+        close(text->addFd);
+    }
+    else
+        mzfree(text->add);
+    *text = (struct Text){ 0 };
+}
+
+void text_trim(struct Text* text)
+{
+    mzfree(text->spare);
+    text->spare = NULL;
+    text->spareCap = 0;
+}
+
+int text_snapshot(struct Text* snapshot, const struct Text* text)
+{
+    *snapshot = (struct Text){ .original = text->original, .originalLen = text->originalLen, .len = text->len,
+                               .version = text->version };
+    snapshot->cap = text->count > 0 ? text->count : 1;
+    snapshot->pieces = mzalloc(snapshot->cap * sizeof(struct Piece));
+    snapshot->add = mzalloc(text->added > 0 ? text->added : 1);
+    if (snapshot->pieces == NULL || snapshot->add == NULL)
+    {
+        text_free(snapshot);
+        return -1;
+    }
+
+    memcpy(snapshot->pieces, text->pieces, text->count * sizeof(struct Piece));
+    if (text->added > 0)
+        memcpy(snapshot->add, text->add, text->added);
+    snapshot->count = text->count;
+    snapshot->added = text->added;
+    snapshot->addCap = text->added;
+    return 0;
+}
+
+/// @brief Appends a piece, merging it into the last one when they're contiguous in the same source.
+static inline void text_emit(struct Piece* out, int* count, size_t* len, int source, size_t start, size_t n)
+{
+    if (n == 0)
+        return;
+
+    struct Piece* last = out + *count - 1;
+    if (*count > 0 && last->source == source && last->start + last->len == start)
+        last->len += n;
+    else
+        out[(*count)++] = (struct Piece){ .pos = *len, .start = start, .len = n, .source = source };
+
+    *len += n;
+}
+
+/// @brief Walks n bytes of the old pieces from piece i, offset skip, copying them to out if it isn't NULL.
+static inline void text_walk(
+    const struct Text* text, struct Piece* out, int* count, size_t* len, int* i, size_t* skip, size_t n)
+{
+    while (n > 0)
+    {
+        const struct Piece* piece = text->pieces + *i;
+        size_t take = piece->len - *skip < n ? piece->len - *skip : n;
+        if (out != NULL)
+            text_emit(out, count, len, piece->source, piece->start + *skip, take);
+
+        *skip += take;
+        n -= take;
+        if (*skip == piece->len)
+        {
+            (*i)++;
+            *skip = 0;
+        }
+    }
+}
+
+/// @brief Whether an edit inserts exactly what the one before it did, in which case they share a copy.
+static inline int text_same(const struct Edit* a, const struct Edit* b)
+{
+    return a->data == b->data && a->pieces == b->pieces && a->len == b->len;
+}
+
+/// @brief Whether an edit's bytes have to be copied into the add buffer, rather than referenced where they are.
+static inline int text_copies(const struct Text* text, const struct Edit* edit)
+{
+    return edit->pieces == NULL || edit->source != text;
+}
+
+int text_apply(struct Text* text, const struct Edit* edits, int n)
+{
+    if (n == 0)
+        return 0;
+
+    // Reserve everything up front so that running out of memory leaves the document as it was.
+    size_t bytes = 0;
+    int referenced = 0;
+    for (int e = 0; e < n; e++)
+    {
+        if (!text_copies(text, edits + e))
+            referenced += edits[e].count;
+        else if (e == 0 || !text_same(edits + e, edits + e - 1))
+            bytes += edits[e].len;
+    }
+
+    if (text->added + bytes > text->addCap)
+    {
+        // Others have the shared buffer mapped where it is.
+        if (text->shared)
+            return -1;
+
+        size_t cap = text->addCap == 0 ? 4096 : text->addCap;
+        while (cap < text->added + bytes)
+            cap *= 2;
+
+        char* add = mzrealloc(text->add, cap);
+        if (add == NULL)
+            return -1;
+
+        text->add = add;
+        text->addCap = cap;
+    }
+
+    // Every edit can split at most one piece and add one more, or as many as it references.
+    int cap = text->count + 2 * n + 1 + referenced;
+    if (cap > text->spareCap)
+    {
+        struct Piece* spare = mzrealloc(text->spare, cap * sizeof(struct Piece));
+        if (spare == NULL)
+            return -1;
+
+        text->spare = spare;
+        text->spareCap = cap;
+    }
+
+    struct Piece* out = text->spare;
+    int count = 0;
+    size_t len = 0;
+    int i = 0;
+    size_t skip = 0;
+    size_t at = 0;
+    size_t shared = 0;
+
+    for (int e = 0; e < n; e++)
+    {
+        const struct Edit* edit = edits + e;
+        text_walk(text, out, &count, &len, &i, &skip, edit->pos - at);
+
+        if (edit->len > 0 && !text_copies(text, edit))
+        {
+            for (int p = 0; p < edit->count; p++)
+                text_emit(out, &count, &len, edit->pieces[p].source, edit->pieces[p].start, edit->pieces[p].len);
+        }
+        else if (edit->len > 0)
+        {
+            if (e == 0 || !text_same(edit, edits + e - 1))
+            {
+                shared = text->added;
+                if (edit->pieces == NULL)
+                    memcpy(text->add + text->added, edit->data, edit->len);
+                else
+                {
+                    size_t copied = 0;
+                    for (int p = 0; p < edit->count; p++)
+                    {
+                        memcpy(text->add + text->added + copied, text_bytes(edit->source, edit->pieces + p), edit->pieces[p].len);
+                        copied += edit->pieces[p].len;
+                    }
+                }
+
+                text->added += edit->len;
+            }
+
+            text_emit(out, &count, &len, TEXT_ADDED, shared, edit->len);
+        }
+
+        text_walk(text, NULL, NULL, NULL, &i, &skip, edit->del);
+        at = edit->pos + edit->del;
+    }
+
+    text_walk(text, out, &count, &len, &i, &skip, text->len - at);
+
+    // The old pieces become the spare for the next batch.
+    text->spare = text->pieces;
+    text->pieces = out;
+    int spareCap = text->spareCap;
+    text->spareCap = text->cap;
+    text->cap = spareCap;
+    text->count = count;
+    text->len = len;
+    text->version++;
+    return 0;
+}
+
+int text_share(struct Text* text)
+{
+    if (text->shared)
+        return text->addFd;
+
+    int fd = memfd_create("pipit-add", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    // The file is sparse, only pages actually written to take up memory.
+    char* add = ftruncate(fd, TEXT_SHARED_MAX) == 0
+        ? mmap(NULL, TEXT_SHARED_MAX, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0)
+        : MAP_FAILED;
+    if (add == MAP_FAILED)
+    {
+        close(fd);
+        return -1;
+    }
+
+    memcpy(add, text->add, text->added);
+    mzfree(text->add);
+    text->add = add;
+    text->addCap = TEXT_SHARED_MAX;
+    text->shared = 1;
+    text->addFd = fd;
+    return fd;
+}
+
+int text_find(const struct Text* text, size_t pos)
+{
+    if (pos >= text->len)
+        return text->count;
+
+    int lo = 0;
+    int hi = text->count - 1;
+    while (lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if (text->pieces[mid].pos <= pos)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    return lo;
+}
+
+const char* text_chunk(const struct Text* text, size_t pos, size_t* len)
+{
+    int i = text_find(text, pos);
+    if (i == text->count)
+    {
+        *len = 0;
+        return NULL;
+    }
+
+    const struct Piece* piece = text->pieces + i;
+    size_t off = pos - piece->pos;
+    *len = piece->len - off;
+    return text_bytes(text, piece) + off;
+}
+
+size_t text_read(const struct Text* text, size_t pos, char* dst, size_t len)
+{
+    // Only the first piece needs a search, the rest follow on from it.
+    size_t copied = 0;
+    for (int i = text_find(text, pos); i < text->count && copied < len; i++)
+    {
+        const struct Piece* piece = text->pieces + i;
+        size_t off = pos + copied - piece->pos;
+        size_t avail = piece->len - off < len - copied ? piece->len - off : len - copied;
+        memcpy(dst + copied, text_bytes(text, piece) + off, avail);
+        copied += avail;
+    }
+
+    return copied;
+}
+
+char text_at(const struct Text* text, size_t pos)
+{
+    size_t len;
+    const char* src = text_chunk(text, pos, &len);
+    return src == NULL ? 0 : *src;
+}
+
+size_t text_chr(const struct Text* text, size_t pos, char c)
+{
+    for (int i = text_find(text, pos); i < text->count; i++)
+    {
+        const struct Piece* piece = text->pieces + i;
+        size_t off = pos > piece->pos ? pos - piece->pos : 0;
+        const char* src = text_bytes(text, piece);
+        const char* hit = memchr(src + off, c, piece->len - off);
+        if (hit != NULL)
+            return piece->pos + (hit - src);
+    }
+
+    return text->len;
+}
+
+size_t text_rchr(const struct Text* text, size_t pos, char c)
+{
+    pos = pos < text->len ? pos : text->len;
+    int i = pos == text->len ? text->count - 1 : text_find(text, pos);
+    for (; i >= 0; i--)
+    {
+        const struct Piece* piece = text->pieces + i;
+        const char* src = text_bytes(text, piece);
+        size_t len = pos - piece->pos < piece->len ? pos - piece->pos : piece->len;
+        const char* hit = memrchr(src, c, len);
+        if (hit != NULL)
+            return piece->pos + (hit - src);
+    }
+
+    return SIZE_MAX;
+}
+
+size_t text_search_range(const struct Text* text, size_t pos, size_t limit, const char* needle, size_t len)
+{
+    if (len == 0 || len > TEXT_NEEDLE_MAX)
+        return text->len;
+
+    char window[2 * TEXT_NEEDLE_MAX];
+    size_t avail;
+    const char* src;
+    while (pos < limit && (src = text_chunk(text, pos, &avail)) != NULL)
+    {
+        // Matches have to start before limit, nothing after its last len - 1 bytes is looked at.
+        int clipped = avail > limit - pos + len - 1;
+        if (clipped)
+            avail = limit - pos + len - 1;
+
+        const char* hit = memmem(src, avail, needle, len);
+        if (hit != NULL)
+            return pos + (hit - src);
+        if (clipped)
+            break;
+
+        // Matches which straddle the end of this chunk start within its last len - 1 bytes.
+        size_t end = pos + avail;
+        size_t from = end - pos >= len ? end - len + 1 : pos;
+        size_t got = text_read(text, from, window, end - from + len - 1);
+        hit = memmem(window, got, needle, len);
+        if (hit != NULL && from + (hit - window) < end && from + (hit - window) < limit)
+            return from + (hit - window);
+
+        pos = end;
+    }
+
+    return text->len;
+}
+
+size_t text_search(const struct Text* text, size_t pos, const char* needle, size_t len)
+{
+    return text_search_range(text, pos, text->len, needle, len);
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Where the bytes of a piece live.
+#define TEXT_ORIGINAL 0
+#define TEXT_ADDED 1
+// Longest needle text_search accepts, straddling matches are found through a window of twice this.
+#define TEXT_NEEDLE_MAX 1024
+// Address space reserved for a shared add buffer, it can't move once others have mapped it so it never grows past this.
+#define TEXT_SHARED_MAX ((size_t)1 << 32)
+
+/// @brief A run of document bytes taken from one of the two sources.
+struct Piece
+{
+    /// @brief Offset of the piece in the document.
+    size_t pos;
+    /// @brief Offset of the piece in its source.
+    size_t start;
+    size_t len;
+    int source;
+};
+
+/// @brief A piece table over an immutable original, usually a file mapping, and an append-only add buffer.
+/// Nothing written to either source is ever moved or overwritten, so offsets into them stay valid forever.
+struct Text
+{
+    const char* original;
+    size_t originalLen;
+    char* add;
+    size_t added;
+    size_t addCap;
+    /// @brief Pieces in document order, never empty and never adjacent and contiguous in the same source.
+    struct Piece* pieces;
+    int count;
+    int cap;
+    /// @brief Pieces of the previous batch, kept around so that applying a batch needn't allocate.
+    struct Piece* spare;
+    int spareCap;
+    /// @brief Length of the document.
+    size_t len;
+    /// @brief Bumped by every batch applied, so observers can tell whether they've seen the latest pieces.
+    uint64_t version;
+    /// @brief Whether the add buffer lives in a memfd which other processes can map, addFd is only valid if so.
+    int shared;
+    int addFd;
+};
+
+/// @brief A single replacement, deleting del bytes at pos and inserting len bytes of data in their place.
+struct Edit
+{
+    size_t pos;
+    size_t del;
+    const char* data;
+    size_t len;
+    /// @brief Inserted in place of data when set, len being their total length. Pieces of the document itself are
+    /// referenced as they are without copying a byte, pieces of another document are copied into the add buffer.
+    const struct Piece* pieces;
+    int count;
+    const struct Text* source;
+};
+
+/// @brief Initializes a document over an original.
+/// @param text The document to be initialized.
+/// @param original The original bytes, these must outlive the document and are never written to.
+/// @param len The length of the original.
+/// @return 0 if successful, otherwise -1.
+int text_init(struct Text* text, const char* original, size_t len);
+
+/// @brief Releases everything owned by a document, the original is left alone.
+/// @param text The document to be released.
+void text_free(struct Text* text);
+
+/// @brief Releases what a document only keeps around for speed, the pieces of the previous batch. The next batch
+/// allocates them again.
+/// @param text The document to be trimmed.
+void text_trim(struct Text* text);
+
+/// @brief Takes a read-only copy of a document which later edits to it can't disturb, for readers on other threads.
+/// Pieces and the add buffer are copied, the original is shared.
+/// @param snapshot The copy to be initialized, released with text_free.
+/// @param text The document.
+/// @return 0 if successful, otherwise -1.
+int text_snapshot(struct Text* snapshot, const struct Text* text);
+
+/// @brief Moves the add buffer into a memfd reserving TEXT_SHARED_MAX, so other processes can map it and read pieces
+/// without copies. Bytes already written keep their offsets and the buffer never moves again.
+/// @param text The document to be shared.
+/// @return The memfd of the add buffer, or -1 if it couldn't be created.
+int text_share(struct Text* text);
+
+/// @brief Applies a batch of edits in a single pass over the pieces.
+/// Edits which insert the same data pointer, or the same pieces of another document, as the previous edit share a single
+/// copy in the add buffer.
+/// @param text The document to be edited.
+/// @param edits The edits, sorted by position and not overlapping, all positions refer to the document before the batch.
+/// @param n Number of edits.
+/// @return 0 if successful, otherwise -1 and the document is left untouched.
+int text_apply(struct Text* text, const struct Edit* edits, int n);
+
+/// @brief Finds the piece containing a position with a binary search.
+/// @param text The document to be searched.
+/// @param pos The position to be found.
+/// @return Index of the piece, or count if pos is at or past the end.
+int text_find(const struct Text* text, size_t pos);
+
+/// @brief Gets the contiguous bytes starting at a position, up to the end of its piece.
+/// @param text The document to be read.
+/// @param pos The position to be read from.
+/// @param len Receives the number of contiguous bytes, 0 at the end of the document.
+/// @return Pointer to the bytes, NULL at the end of the document.
+const char* text_chunk(const struct Text* text, size_t pos, size_t* len);
+
+/// @brief Copies bytes out of a document.
+/// @param text The document to be read.
+/// @param pos The position to be read from.
+/// @param dst The buffer to be written to.
+/// @param len The maximum number of bytes to be copied.
+/// @return The number of bytes copied.
+size_t text_read(const struct Text* text, size_t pos, char* dst, size_t len);
+
+/// @brief Gets a single byte of a document.
+/// @return The byte, or 0 past the end.
+char text_at(const struct Text* text, size_t pos);
+
+/// @brief Finds the first occurrence of a byte at or after a position.
+/// @return Position of the byte, or the document length if there is none.
+size_t text_chr(const struct Text* text, size_t pos, char c);
+
+/// @brief Finds the last occurrence of a byte before a position.
+/// @return Position of the byte, or SIZE_MAX if there is none, so that adding 1 always gives the start of the line.
+size_t text_rchr(const struct Text* text, size_t pos, char c);
+
+/// @brief Finds the first occurrence of a needle at or after a position, matches may straddle pieces.
+/// @param text The document to be searched.
+/// @param pos The position to be searched from.
+/// @param needle The bytes to be found.
+/// @param len The length of the needle, at most TEXT_NEEDLE_MAX.
+/// @return Position of the match, or the document length if there is none.
+size_t text_search(const struct Text* text, size_t pos, const char* needle, size_t len);
+
+/// @brief Finds the first occurrence of a needle starting at or after pos and before limit, as text_search does.
+/// Matches may run on past limit.
+/// @return Position of the match, or the document length if there is none.
+size_t text_search_range(const struct Text* text, size_t pos, size_t limit, const char* needle, size_t len);
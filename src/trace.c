@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <string.h>
+#include "trace.h"
+
+// Power of 2 so the head can just be masked, 16 bytes each so this is 256kB.
+#define TRACE_RING 16384
+// Histograms are log-linear, every power of 2 is split into 16 buckets so percentiles are within ~6%,
+// and everything past 2^40ns (about 18 minutes) lands in the last bucket.
+#define TRACE_SUB 16
+#define TRACE_BUCKETS ((40 - 3) * TRACE_SUB + TRACE_SUB)
+
+struct TraceSpan
+{
+    uint64_t start;
+    uint32_t dur;
+    uint32_t stage;
+};
+
+static const char* names[NUM_TRACES] = { "keys", "lines", "frame", "write", "photon" };
+
+// Written only by the main thread, anyone else may read entries behind head once they've loaded it.
+static struct TraceSpan ring[TRACE_RING];
+static uint64_t head;
+static uint32_t hist[NUM_TRACES][TRACE_BUCKETS];
+static uint64_t counts[NUM_TRACES];
+static uint64_t maxes[NUM_TRACES];
+
+static inline int trace_bucket(uint64_t ns)
+{
+    if (ns < TRACE_SUB)
+        return ns;
+
+    int msb = 63 - __builtin_clzll(ns);
+    int bucket = (msb - 3) * TRACE_SUB + ((ns >> (msb - 4)) & (TRACE_SUB - 1));
+    return bucket < TRACE_BUCKETS ? bucket : TRACE_BUCKETS - 1;
+}
+
+/// @brief Gets the highest value which lands in a bucket.
+static inline uint64_t trace_bound(int bucket)
+{
+    if (bucket < TRACE_SUB)
+        return bucket;
+
+    int msb = bucket / TRACE_SUB + 3;
+    return ((uint64_t)(TRACE_SUB + bucket % TRACE_SUB + 1) << (msb - 4)) - 1;
+}
+
+void trace_record(int stage, uint64_t start, uint64_t end)
+{
+    uint64_t dur = end - start;
+    uint64_t pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    struct TraceSpan* span = ring + (pos & (TRACE_RING - 1));
+    span->start = start;
+    span->dur = dur > UINT32_MAX ? UINT32_MAX : dur;
+    span->stage = stage;
+    __atomic_store_n(&head, pos + 1, __ATOMIC_RELEASE);
+
+    hist[stage][trace_bucket(dur)]++;
+    counts[stage]++;
+    maxes[stage] = dur > maxes[stage] ? dur : maxes[stage];
+}
+
+uint64_t trace_percentile(int stage, double pct)
+{
+    if (counts[stage] == 0)
+        return 0;
+
+    uint64_t target = (uint64_t)(counts[stage] * pct / 100.0);
+    uint64_t seen = 0;
+    for (int i = 0; i < TRACE_BUCKETS; i++)
+    {
+        seen += hist[stage][i];
+        if (seen > target)
+            return trace_bound(i) < maxes[stage] ? trace_bound(i) : maxes[stage];
+    }
+
+    return maxes[stage];
+}
+
+uint64_t trace_count(int stage)
+{
+    return counts[stage];
+}
+
+const char* trace_name(int stage)
+{
+    return names[stage];
+}
+
+void trace_overlay(char* dst, int len)
+{
+    char tmp[256];
+    int n = snprintf(tmp, sizeof(tmp), " frame p50 %.3fms p99 %.3fms | key->photon p50 %.3fms p99 %.3fms | %llu frames",
+        trace_percentile(TRACE_FRAME, 50) / 1e6, trace_percentile(TRACE_FRAME, 99) / 1e6,
+        trace_percentile(TRACE_PHOTON, 50) / 1e6, trace_percentile(TRACE_PHOTON, 99) / 1e6,
+        (unsigned long long)counts[TRACE_FRAME]);
+
+    n = n < len ? n : len;
+    memcpy(dst, tmp, n);
+    memset(dst + n, ' ', len - n);
+}
+
+int trace_dump(const char* path)
+{
+    FILE* out = fopen(path, "w");
+    if (out == NULL)
+        return -1;
+
+    fprintf(out, "%-8s %10s %12s %12s %12s %12s %12s\n", "stage", "count", "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns");
+    for (int i = 0; i < NUM_TRACES; i++)
+    {
+        fprintf(out, "%-8s %10llu %12llu %12llu %12llu %12llu %12llu\n", names[i], (unsigned long long)counts[i],
+            (unsigned long long)trace_percentile(i, 50), (unsigned long long)trace_percentile(i, 90),
+            (unsigned long long)trace_percentile(i, 99), (unsigned long long)trace_percentile(i, 99.9),
+            (unsigned long long)maxes[i]);
+    }
+
+    for (int i = 0; i < NUM_TRACES; i++)
+    {
+        fprintf(out, "\nhistogram %s (bucket upper bound ns, count)\n", names[i]);
+        for (int j = 0; j < TRACE_BUCKETS; j++)
+        {
+            if (hist[i][j] != 0)
+                fprintf(out, "%12llu %10u\n", (unsigned long long)trace_bound(j), hist[i][j]);
+        }
+    }
+
+    uint64_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint64_t start = end > TRACE_RING ? end - TRACE_RING : 0;
+    fprintf(out, "\nrecent spans (start ns, stage, duration ns)\n");
+    for (uint64_t i = start; i < end; i++)
+    {
+        struct TraceSpan* span = ring + (i & (TRACE_RING - 1));
+        fprintf(out, "%llu %s %u\n", (unsigned long long)span->start, names[span->stage], span->dur);
+    }
+
+    fclose(out);
+    return 0;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+// Stages of a keystroke, each is recorded with its own histogram.
+#define TRACE_KEYS 0
+#define TRACE_LINES 1
+#define TRACE_FRAME 2
+#define TRACE_WRITE 3
+// From a key being read to the frame containing it being written.
+#define TRACE_PHOTON 4
+#define NUM_TRACES 5
+
+/// @brief Gets a monotonic timestamp for tracing.
+/// @return The current monotonic time in nanoseconds.
+static inline uint64_t trace_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/// @brief Records a traced span into the ring buffer and its stage histogram.
+/// @param stage The stage which was traced.
+/// @param start Timestamp from trace_now when the stage began.
+/// @param end Timestamp from trace_now when the stage ended.
+void trace_record(int stage, uint64_t start, uint64_t end);
+
+/// @brief Estimates a percentile of a stage from its histogram.
+/// @param stage The stage to be queried.
+/// @param pct The percentile, 0..100.
+/// @return The percentile in nanoseconds, 0 if nothing has been recorded.
+uint64_t trace_percentile(int stage, double pct);
+
+/// @brief Gets the number of spans recorded for a stage.
+/// @param stage The stage to be queried.
+/// @return The number of recorded spans.
+uint64_t trace_count(int stage);
+
+/// @brief Gets the name of a stage.
+/// @param stage The stage to be named.
+/// @return The name of the stage.
+const char* trace_name(int stage);
+
+/// @brief Formats the status overlay, frame and keystroke-to-photon percentiles, into dst.
+/// @param dst The buffer to be written to, it is always padded out with spaces.
+/// @param len The length of dst.
+void trace_overlay(char* dst, int len);
+
+/// @brief Writes the percentiles and histograms of every stage and the most recent spans to a file.
+/// @param path The path of the file to be written.
+/// @return 0 if successful, otherwise -1.
+int trace_dump(const char* path);
@@ -0,0 +1,570 @@
+#define _GNU_SOURCE
+#include <immintrin.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include "words.h"
+#include "rapidhash.h"
+
+// Buckets of a table when its first word is added.
+#define WORDS_BUCKETS_MIN 64
+// Bytes the thread scans between checks for a cancel.
+#define WORDS_SLICE (1024 * 1024)
+
+/// @brief Part of a word carried over from the end of one run of bytes to the start of the next, a length past WORDS_MAX
+/// once it's too long to be indexed.
+struct WordsCarry
+{
+    char word[WORDS_MAX];
+    size_t len;
+};
+
+/// @brief Becomes readable whenever a thread is done, shared by every index.
+static int wake = -1;
+
+/// @brief Grows a mapped array to hold at least need elements, doubling.
+static int words_reserve(void** array, size_t* cap, size_t need, size_t size, size_t min)
+{
+    if (need <= *cap)
+        return 0;
+
+    size_t grown = *cap > 0 ? *cap : min;
+    while (grown < need)
+        grown *= 2;
+    void* mapped = *array != NULL ? mremap(*array, *cap * size, grown * size, MREMAP_MAYMOVE)
+                                  : mmap(NULL, grown * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED)
+        return -1;
+
+    *array = mapped;
+    *cap = grown;
+    return 0;
+}
+
+/// @brief Tag of a hash, never 0 so empty slots stand out.
+static inline uint32_t words_tag(uint64_t hash)
+{
+    return (uint32_t)(hash >> 32) | 1;
+}
+
+/// @brief Finds the entry of a word, UINT32_MAX if it isn't there.
+static uint32_t words_find(const struct WordTable* table, uint64_t hash, const char* word, size_t len)
+{
+    if (table->buckets == 0)
+        return UINT32_MAX;
+
+    __m256i want = _mm256_set1_epi32(words_tag(hash));
+    for (size_t b = hash & (table->buckets - 1);; b = (b + 1) & (table->buckets - 1))
+    {
+        __m256i have = _mm256_loadu_si256((const __m256i*)(table->tags + b * WORDS_BUCKET));
+        uint32_t hits = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(have, want)));
+        for (; hits != 0; hits &= hits - 1)
+        {
+            uint32_t i = table->slots[b * WORDS_BUCKET + __builtin_ctz(hits)];
+            const struct WordEntry* entry = table->entries + i;
+            if (entry->hash == hash && entry->len == len && memcmp(table->strings + entry->offset, word, len) == 0)
+                return i;
+        }
+
+        // Buckets fill up in order, a word would have gone into this one if it had room.
+        if (_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(have, _mm256_setzero_si256()))) != 0)
+            return UINT32_MAX;
+    }
+}
+
+/// @brief Puts an entry in the first free slot from its bucket on.
+static void words_place(uint32_t* tags, uint32_t* slots, size_t buckets, uint64_t hash, uint32_t entry)
+{
+    for (size_t b = hash & (buckets - 1);; b = (b + 1) & (buckets - 1))
+    {
+        __m256i have = _mm256_loadu_si256((const __m256i*)(tags + b * WORDS_BUCKET));
+        uint32_t empty = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(have, _mm256_setzero_si256())));
+        if (empty != 0)
+        {
+            size_t slot = b * WORDS_BUCKET + __builtin_ctz(empty);
+            tags[slot] = words_tag(hash);
+            slots[slot] = entry;
+            return;
+        }
+    }
+}
+
+/// @brief Moves every entry into a table of more buckets.
+static int words_rehash(struct WordTable* table, size_t buckets)
+{
+    size_t size = buckets * WORDS_BUCKET * sizeof(uint32_t);
+    uint32_t* tags = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    uint32_t* slots = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (tags == MAP_FAILED || slots == MAP_FAILED)
+    {
+        if (tags != MAP_FAILED)
+            munmap(tags, size);
+        if (slots != MAP_FAILED)
+            munmap(slots, size);
+        return -1;
+    }
+
+    for (size_t i = 0; i < table->count; i++)
+        words_place(tags, slots, buckets, table->entries[i].hash, i);
+
+    if (table->buckets > 0)
+    {
+        munmap(table->tags, table->buckets * WORDS_BUCKET * sizeof(uint32_t));
+        munmap(table->slots, table->buckets * WORDS_BUCKET * sizeof(uint32_t));
+    }
+    table->tags = tags;
+    table->slots = slots;
+    table->buckets = buckets;
+    return 0;
+}
+
+int words_add(struct WordTable* table, const char* word, size_t len, int64_t delta)
+{
+    if (table->failed)
+        return -1;
+
+    uint64_t hash = rapidhash(word, len);
+    uint32_t found = words_find(table, hash, word, len);
+    if (found != UINT32_MAX)
+    {
+        table->entries[found].count += delta;
+        return 0;
+    }
+
+    // Kept at most three quarters full, so probes end within a bucket or two.
+    size_t need = table->count + 1;
+    if ((need * 4 > table->buckets * WORDS_BUCKET * 3
+         && words_rehash(table, table->buckets > 0 ? table->buckets * 2 : WORDS_BUCKETS_MIN) != 0)
+        || table->stringsLen + len > UINT32_MAX
+        || words_reserve((void**)&table->entries, &table->capEntries, need, sizeof(struct WordEntry), 1024) != 0
+        || words_reserve((void**)&table->sorted, &table->capSorted, need, sizeof(uint32_t), 1024) != 0
+        || words_reserve((void**)&table->strings, &table->capStrings, table->stringsLen + len, 1, 64 * 1024) != 0)
+    {
+        table->failed = 1;
+        return -1;
+    }
+
+    memcpy(table->strings + table->stringsLen, word, len);
+    table->entries[table->count] = (struct WordEntry){ hash, table->stringsLen, len, delta };
+    words_place(table->tags, table->slots, table->buckets, hash, table->count);
+    table->stringsLen += len;
+    table->count++;
+
+    if (table->count - table->numSorted > WORDS_RECENT_MAX)
+        words_sort(table);
+    return 0;
+}
+
+int64_t words_count(const struct WordTable* table, const char* word, size_t len)
+{
+    uint32_t found = words_find(table, rapidhash(word, len), word, len);
+    return found != UINT32_MAX ? table->entries[found].count : 0;
+}
+
+/// @brief Gets a mask of the bytes of 32 which are part of a word.
+static inline uint32_t words_mask(const char* data)
+{
+    __m256i bytes = _mm256_loadu_si256((const __m256i*)data);
+    // Letters fold to lower case, anything else moved by it lands outside both ranges.
+    __m256i letter = _mm256_sub_epi8(_mm256_or_si256(bytes, _mm256_set1_epi8(0x20)), _mm256_set1_epi8('a'));
+    __m256i digit = _mm256_sub_epi8(bytes, _mm256_set1_epi8('0'));
+    __m256i word = _mm256_or_si256(
+        _mm256_cmpeq_epi8(_mm256_min_epu8(letter, _mm256_set1_epi8(25)), letter),
+        _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(digit, _mm256_set1_epi8(9)), digit),
+                        _mm256_cmpeq_epi8(bytes, _mm256_set1_epi8('_'))));
+    return _mm256_movemask_epi8(word);
+}
+
+/// @brief Adds a word which ends at end, starting at start or, for a start of -1, with the carry in front of it.
+static void words_emit(struct WordTable* table, struct WordsCarry* carry, const char* data, ptrdiff_t start, size_t end,
+                       int64_t delta)
+{
+    if (start < 0)
+    {
+        size_t len = carry->len + end;
+        if (len <= WORDS_MAX)
+        {
+            memcpy(carry->word + carry->len, data, end);
+            if (len >= WORDS_MIN)
+                words_add(table, carry->word, len, delta);
+        }
+        carry->len = 0;
+    }
+    else if (end - start >= WORDS_MIN && end - start <= WORDS_MAX)
+        words_add(table, data + start, end - start, delta);
+}
+
+/// @brief Adds the words of a run of bytes, the word it ends on is carried over to the next run.
+static void words_feed(struct WordTable* table, struct WordsCarry* carry, const char* data, size_t len, int64_t delta)
+{
+    // Where the word being read starts, -1 while it started in an earlier run and its start is in the carry.
+    ptrdiff_t start = -1;
+    uint32_t inWord = carry->len > 0;
+    for (size_t base = 0; base < len; base += 32)
+    {
+        size_t n = len - base < 32 ? len - base : 32;
+        uint32_t mask = 0;
+        if (n == 32)
+            mask = words_mask(data + base);
+        else
+            for (size_t k = 0; k < n; k++)
+                mask |= (uint32_t)words_byte(data[base + k]) << k;
+
+        // Every change between word and not is a start or an end, in order.
+        uint32_t edges = (mask ^ (mask << 1 | inWord)) & (n == 32 ? UINT32_MAX : (1u << n) - 1);
+        for (; edges != 0; edges &= edges - 1)
+        {
+            int k = __builtin_ctz(edges);
+            if (mask >> k & 1)
+                start = base + k;
+            else
+                words_emit(table, carry, data, start, base + k, delta);
+        }
+
+        inWord = mask >> (n - 1) & 1;
+    }
+
+    if (!inWord)
+        return;
+
+    size_t from = start < 0 ? 0 : start;
+    if (carry->len + len - from > WORDS_MAX)
+        carry->len = WORDS_MAX + 1;
+    else
+    {
+        memcpy(carry->word + carry->len, data + from, len - from);
+        carry->len += len - from;
+    }
+}
+
+/// @brief Adds the word carried over from the last run, if there's one.
+static void words_finish(struct WordTable* table, struct WordsCarry* carry, int64_t delta)
+{
+    if (carry->len >= WORDS_MIN && carry->len <= WORDS_MAX)
+        words_add(table, carry->word, carry->len, delta);
+    carry->len = 0;
+}
+
+void words_scan(struct WordTable* table, const char* data, size_t len, int64_t delta)
+{
+    struct WordsCarry carry = { .len = 0 };
+    words_feed(table, &carry, data, len, delta);
+    words_finish(table, &carry, delta);
+}
+
+void words_range(struct WordTable* table, const struct Text* text, size_t from, size_t to, int64_t delta)
+{
+    struct WordsCarry carry = { .len = 0 };
+    size_t len;
+    for (size_t pos = from; pos < to; pos += len)
+    {
+        const char* chunk = text_chunk(text, pos, &len);
+        if (chunk == NULL)
+            break;
+        if (len > to - pos)
+            len = to - pos;
+        words_feed(table, &carry, chunk, len, delta);
+    }
+
+    words_finish(table, &carry, delta);
+}
+
+/// @brief Orders entries by their bytes, a prefix before the words it starts.
+static int words_compare(const void* a, const void* b, void* arg)
+{
+    const struct WordTable* table = arg;
+    const struct WordEntry* x = table->entries + *(const uint32_t*)a;
+    const struct WordEntry* y = table->entries + *(const uint32_t*)b;
+    int order = memcmp(table->strings + x->offset, table->strings + y->offset, x->len < y->len ? x->len : y->len);
+    return order != 0 ? order : (x->len > y->len) - (x->len < y->len);
+}
+
+void words_sort(struct WordTable* table)
+{
+    size_t recent = table->count - table->numSorted;
+    if (recent == 0 || table->failed)
+        return;
+
+    uint32_t* tail = table->sorted + table->numSorted;
+    for (size_t i = 0; i < recent; i++)
+        tail[i] = table->numSorted + i;
+    qsort_r(tail, recent, sizeof(uint32_t), words_compare, table);
+
+    if (table->numSorted > 0)
+    {
+        // Merged from the back, the sorted ones only move up into room the recent ones were copied out of.
+        size_t size = recent * sizeof(uint32_t);
+        uint32_t* copy = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (copy == MAP_FAILED)
+        {
+            table->failed = 1;
+            return;
+        }
+
+        memcpy(copy, tail, size);
+        size_t i = table->numSorted;
+        size_t j = recent;
+        size_t k = table->count;
+        while (j > 0)
+        {
+            if (i > 0 && words_compare(table->sorted + i - 1, copy + j - 1, table) > 0)
+                table->sorted[--k] = table->sorted[--i];
+            else
+                table->sorted[--k] = copy[--j];
+        }
+        munmap(copy, size);
+    }
+
+    table->numSorted = table->count;
+}
+
+/// @brief Keeps a candidate if it's among the best max so far, most frequent first and in byte order otherwise.
+static size_t words_keep(const struct WordTable* table, const struct WordEntry* entry, struct WordMatch* out, size_t n,
+                         size_t max)
+{
+    const char* word = table->strings + entry->offset;
+    size_t at = n;
+    while (at > 0)
+    {
+        const struct WordMatch* other = out + at - 1;
+        int order = memcmp(other->word, word, other->len < entry->len ? other->len : entry->len);
+        if (other->count > entry->count
+            || (other->count == entry->count && (order < 0 || (order == 0 && other->len < entry->len))))
+            break;
+        at--;
+    }
+
+    if (at >= max)
+        return n;
+
+    size_t moved = n < max ? n : max - 1;
+    memmove(out + at + 1, out + at, (moved - at) * sizeof(struct WordMatch));
+    out[at] = (struct WordMatch){ word, entry->len, entry->count };
+    return moved + 1;
+}
+
+size_t words_lookup(const struct WordTable* table, const char* prefix, size_t len, struct WordMatch* out, size_t max)
+{
+    if (table->failed || max == 0)
+        return 0;
+
+    // The first sorted word not before the prefix, everything it starts follows on from there.
+    size_t lo = 0;
+    size_t hi = table->numSorted;
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct WordEntry* entry = table->entries + table->sorted[mid];
+        int order = memcmp(table->strings + entry->offset, prefix, entry->len < len ? entry->len : len);
+        if (order < 0 || (order == 0 && entry->len < len))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    size_t n = 0;
+    for (size_t i = lo; i < table->numSorted && i - lo < WORDS_WALK_MAX; i++)
+    {
+        const struct WordEntry* entry = table->entries + table->sorted[i];
+        if (entry->len < len || memcmp(table->strings + entry->offset, prefix, len) != 0)
+            break;
+        if (entry->len > len && entry->count > 0)
+            n = words_keep(table, entry, out, n, max);
+    }
+
+    for (size_t i = table->numSorted; i < table->count; i++)
+    {
+        const struct WordEntry* entry = table->entries + i;
+        if (entry->len > len && entry->count > 0 && memcmp(table->strings + entry->offset, prefix, len) == 0)
+            n = words_keep(table, entry, out, n, max);
+    }
+
+    return n;
+}
+
+void words_free(struct WordTable* table)
+{
+    if (table->buckets > 0)
+    {
+        munmap(table->tags, table->buckets * WORDS_BUCKET * sizeof(uint32_t));
+        munmap(table->slots, table->buckets * WORDS_BUCKET * sizeof(uint32_t));
+    }
+    if (table->capEntries > 0)
+        munmap(table->entries, table->capEntries * sizeof(struct WordEntry));
+    if (table->capSorted > 0)
+        munmap(table->sorted, table->capSorted * sizeof(uint32_t));
+    if (table->capStrings > 0)
+        munmap(table->strings, table->capStrings);
+    *table = (struct WordTable){ 0 };
+}
+
+/// @brief Indexes the snapshot, a slice at a time so a cancel doesn't wait for a whole piece.
+static void* words_build(void* arg)
+{
+    struct Words* words = arg;
+    const struct Text* text = &words->snapshot;
+    struct WordsCarry carry = { .len = 0 };
+    size_t len;
+    for (size_t pos = 0; pos < text->len && !__atomic_load_n(&words->cancel, __ATOMIC_RELAXED); pos += len)
+    {
+        const char* chunk = text_chunk(text, pos, &len);
+        if (len > WORDS_SLICE)
+            len = WORDS_SLICE;
+        words_feed(&words->table, &carry, chunk, len, 1);
+    }
+
+    words_finish(&words->table, &carry, 1);
+    words_sort(&words->table);
+
+    __atomic_store_n(&words->complete, 1, __ATOMIC_RELEASE);
+    uint64_t one = 1;
+    write(wake, &one, sizeof(one));
+    return NULL;
+}
+
+int words_open(struct Words* words, const struct Text* text)
+{
+    *words = (struct Words){ 0 };
+    if (wake < 0)
+        wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake < 0 || text_snapshot(&words->snapshot, text) != 0)
+        return -1;
+
+    if (pthread_create(&words->thread, NULL, words_build, words) != 0)
+    {
+        text_free(&words->snapshot);
+        return -1;
+    }
+
+    words->started = 1;
+    return 0;
+}
+
+int words_fd()
+{
+    return wake;
+}
+
+/// @brief Folds what edits changed while the thread built into the index, once it has been joined.
+static void words_merge(struct Words* words)
+{
+    text_free(&words->snapshot);
+    const struct WordTable* delta = &words->delta;
+    for (size_t i = 0; i < delta->count; i++)
+    {
+        const struct WordEntry* entry = delta->entries + i;
+        if (entry->count != 0)
+            words_add(&words->table, delta->strings + entry->offset, entry->len, entry->count);
+    }
+
+    words_free(&words->delta);
+    words_sort(&words->table);
+    words->ready = 1;
+}
+
+int words_poll(struct Words* words)
+{
+    if (!words->started || words->ready || !__atomic_load_n(&words->complete, __ATOMIC_ACQUIRE))
+        return 0;
+
+    pthread_join(words->thread, NULL);
+    words_merge(words);
+    return 1;
+}
+
+void words_wait(struct Words* words)
+{
+    if (!words->started || words->ready)
+        return;
+
+    pthread_join(words->thread, NULL);
+    words_merge(words);
+}
+
+/// @brief Gets where the word which ends at pos starts, looking back at most WORDS_EXPAND_MAX bytes.
+static size_t words_left(const struct Text* text, size_t pos)
+{
+    char window[64];
+    size_t floor = pos > WORDS_EXPAND_MAX ? pos - WORDS_EXPAND_MAX : 0;
+    while (pos > floor)
+    {
+        size_t n = pos - floor < sizeof(window) ? pos - floor : sizeof(window);
+        text_read(text, pos - n, window, n);
+        size_t k = n;
+        while (k > 0 && words_byte(window[k - 1]))
+            k--;
+        if (k > 0)
+            return pos - n + k;
+        pos -= n;
+    }
+
+    return floor;
+}
+
+/// @brief Gets where the word which starts at pos ends, looking ahead at most WORDS_EXPAND_MAX bytes.
+static size_t words_right(const struct Text* text, size_t pos)
+{
+    char window[64];
+    size_t ceiling = text->len - pos > WORDS_EXPAND_MAX ? pos + WORDS_EXPAND_MAX : text->len;
+    while (pos < ceiling)
+    {
+        size_t n = text_read(text, pos, window, ceiling - pos < sizeof(window) ? ceiling - pos : sizeof(window));
+        size_t k = 0;
+        while (k < n && words_byte(window[k]))
+            k++;
+        if (k < n)
+            return pos + k;
+        pos += n;
+    }
+
+    return ceiling;
+}
+
+void words_edit(struct Words* words, const struct Text* text, const struct Edit* edits, int n, int sign)
+{
+    if (!words->started || n == 0)
+        return;
+
+    struct WordTable* table = words->ready ? &words->table : &words->delta;
+    ptrdiff_t shift = 0;
+    size_t from = 0;
+    size_t to = 0;
+    for (int i = 0; i < n; i++)
+    {
+        // After the batch every edit has moved by the ones before it and covers what it inserted.
+        size_t pos = edits[i].pos + (sign > 0 ? shift : 0);
+        size_t end = pos + (sign > 0 ? edits[i].len : edits[i].del);
+        shift += edits[i].len - edits[i].del;
+
+        size_t start = words_left(text, pos);
+        if (i > 0 && start <= to)
+        {
+            if (end > to)
+                to = words_right(text, end);
+            continue;
+        }
+
+        if (i > 0)
+            words_range(table, text, from, to, sign);
+        from = start;
+        to = words_right(text, end);
+    }
+
+    words_range(table, text, from, to, sign);
+}
+
+void words_close(struct Words* words)
+{
+    if (words->started && !words->ready)
+    {
+        __atomic_store_n(&words->cancel, 1, __ATOMIC_RELAXED);
+        pthread_join(words->thread, NULL);
+        text_free(&words->snapshot);
+    }
+
+    words_free(&words->table);
+    words_free(&words->delta);
+    *words = (struct Words){ 0 };
+}
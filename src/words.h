@@ -0,0 +1,136 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "text.h"
+
+// Words shorter or longer than this aren't indexed, nothing is gained completing them.
+#define WORDS_MIN 2
+#define WORDS_MAX 64
+// Tags of a bucket, compared in one go.
+#define WORDS_BUCKET 8
+// Words added since the last sort before they're merged into the sorted ones, until then lookups go over them all.
+#define WORDS_RECENT_MAX 4096
+// Sorted words a lookup goes over at most, a short prefix of a huge index stops early rather than taking a frame.
+#define WORDS_WALK_MAX 65536
+// How far an edit is widened looking for the ends of the words it touches. Anything longer isn't a word that's indexed,
+// and neither is any part of it cut off here.
+#define WORDS_EXPAND_MAX 4096
+
+/// @brief A word and how many times it occurs, counts go down to 0 and below but words are never removed.
+struct WordEntry
+{
+    uint64_t hash;
+    uint32_t offset;
+    uint32_t len;
+    int64_t count;
+};
+
+/// @brief Open addressing over buckets of rapidhash tags, with the words in insertion order and sorted alongside for
+/// prefix lookups. Everything is mapped rather than allocated so the table can be built on another thread.
+struct WordTable
+{
+    /// @brief Upper half of each word's hash with the low bit set, 0 for an empty slot.
+    uint32_t* tags;
+    /// @brief Entry of each tagged slot.
+    uint32_t* slots;
+    size_t buckets;
+    struct WordEntry* entries;
+    size_t count;
+    size_t capEntries;
+    /// @brief Bytes of every word, back to back.
+    char* strings;
+    size_t stringsLen;
+    size_t capStrings;
+    /// @brief The first numSorted entries in byte order, the rest are recent and unsorted.
+    uint32_t* sorted;
+    size_t numSorted;
+    size_t capSorted;
+    /// @brief Set once memory ran out, the table stops taking words and its counts can't be trusted.
+    int failed;
+};
+
+/// @brief Word index of a document, built from a snapshot in the background and kept up to date from every edit.
+struct Words
+{
+    /// @brief The index, only touched by the thread until it's complete.
+    struct WordTable table;
+    /// @brief Changes made by edits while the thread builds, merged into the index once it's done.
+    struct WordTable delta;
+    struct Text snapshot;
+    pthread_t thread;
+    int started;
+    int complete;
+    int cancel;
+    /// @brief Whether the index has been merged and can be looked up.
+    int ready;
+};
+
+/// @brief A completion, pointing into the table it came from.
+struct WordMatch
+{
+    const char* word;
+    size_t len;
+    int64_t count;
+};
+
+/// @brief Whether a byte is part of a word.
+static inline int words_byte(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+/// @brief Adds to the count of a word, adding the word if it's new.
+/// @return 0 if successful, otherwise -1 and the table has failed.
+int words_add(struct WordTable* table, const char* word, size_t len, int64_t delta);
+
+/// @brief Gets the count of a word, 0 if it was never added.
+int64_t words_count(const struct WordTable* table, const char* word, size_t len);
+
+/// @brief Adds every word of contiguous bytes, a vector of bytes at a time. Bytes are taken to be whole words at both
+/// ends.
+void words_scan(struct WordTable* table, const char* data, size_t len, int64_t delta);
+
+/// @brief Adds every word in a range of a document, words straddling pieces included.
+void words_range(struct WordTable* table, const struct Text* text, size_t from, size_t to, int64_t delta);
+
+/// @brief Merges the recent words into the sorted ones.
+void words_sort(struct WordTable* table);
+
+/// @brief Finds the most frequent words starting with a prefix, longer than it and with a positive count.
+/// @param out Receives the matches, most frequent first and in byte order otherwise.
+/// @param max Most matches wanted.
+/// @return Number of matches.
+size_t words_lookup(const struct WordTable* table, const char* prefix, size_t len, struct WordMatch* out, size_t max);
+
+/// @brief Releases a table, which is left empty.
+void words_free(struct WordTable* table);
+
+/// @brief Starts building the index of a document on a thread of its own.
+/// @param words The index, which must stay at the same address until closed.
+/// @param text The document, copied so it can be edited meanwhile.
+/// @return 0 if successful, otherwise -1 and the document has no index.
+int words_open(struct Words* words, const struct Text* text);
+
+/// @brief Gets the descriptor which becomes readable whenever an index is done building, -1 before any was started.
+int words_fd();
+
+/// @brief Merges the index once its thread is done.
+/// @return 1 if the index just became ready, otherwise 0.
+int words_poll(struct Words* words);
+
+/// @brief Waits for the thread and merges the index.
+void words_wait(struct Words* words);
+
+/// @brief Takes the words an edit batch touches out of the index, before it's applied, or puts them back in after.
+/// Every edit is widened to the ends of the words around it, widened edits which meet are taken together so no word is
+/// counted twice.
+/// @param text The document, before the batch for a sign of -1 and after it for 1.
+/// @param edits The batch, positions from before it was applied.
+/// @param n Number of edits.
+/// @param sign -1 or 1.
+void words_edit(struct Words* words, const struct Text* text, const struct Edit* edits, int n, int sign);
+
+/// @brief Stops the thread if it's still building and releases the index.
+void words_close(struct Words* words);
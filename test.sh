@@ -0,0 +1,27 @@
+# Builds and runs the test harnesses, every one or only those named, e.g. ./test.sh test_text test_diff
+
+name="pipit"
+flags="-march=native -O2 -g -pthread"
+cc=${CC:-clang}
+
+src=$([[ $(echo $(basename $(pwd))) == $name ]] && echo "src" || echo "src/$name")
+
+cd $src
+mkdir -p ../bin/tests
+
+# Harnesses link against every module but main, so none of them has to list what it needs.
+for file in *.c; do
+    [[ $file == test_* || $file == main.c ]] && continue
+    $cc $flags -c -o ../bin/tests/${file%.c}.o $file || exit 1
+done
+rm -f ../bin/tests/lib$name.a
+ar rcs ../bin/tests/lib$name.a ../bin/tests/*.o
+# Replays run the editor itself.
+$cc $flags -o ../bin/$name main.c ../bin/tests/lib$name.a || exit 1
+
+tests=${@:-$(ls test_*.c | sed "s/\.c$//")}
+for test in $tests; do
+    echo "$test"
+    $cc $flags -o ../bin/$test $test.c ../bin/tests/lib$name.a || exit 1
+    ../bin/$test || exit 1
+done